@@ -0,0 +1,648 @@
+/* Affinity task pool : placing streaming threads by element class
+ *
+ * Goal
+ *
+ * Every queue of basic-tutorial-7.c, and every multiqueue pad feeding a decoder inside playbin, starts a GstTask, which
+ * runs on a thread of the default task pool with default scheduling. The kernel moves these threads around freely and
+ * treats the audio thread like any other, so audio glitches as soon as the box is loaded. This program installs its
+ * own GstTaskPool on the pipeline and places every streaming thread according to what it feeds:
+ *
+ *   - the pool is set on every task from the sync bus handler, when the task posts STREAM_STATUS CREATE. It caps the
+ *     number of streaming threads of the pipeline: a task beyond --max-threads is refused rather than left waiting
+ *     for a thread forever. GStreamer only logs a warning for a task that cannot start, and the pipeline would sit
+ *     in PAUSED, so the pool posts an error for the element owning the task, which stops the run.
+ *   - when a thread starts running for an element it posts STREAM_STATUS ENTER, from that very thread. The sync
+ *     handler follows the pads downstream from where the thread starts: a thread that reaches a decoder is a decoder
+ *     thread, one that reaches an audio sink (or the ring buffer thread of an audio sink) is an audio thread, and
+ *     everything else is "other". The thread is then pinned to the CPUs of its class, and audio threads can get
+ *     SCHED_FIFO. On STREAM_STATUS LEAVE the thread goes back to the process defaults, because pool threads are
+ *     reused for other tasks.
+ *   - the CPU time of every thread is read from its own clock (pthread_getcpuclockid) and reported per element.
+ *
+ * CPU lists are comma separated CPU numbers and ranges ("0-3,6"), "node:N" for the CPUs of a NUMA node, and "big"
+ * or "little" for the cores with the highest or lowest capacity (cpu_capacity, or else the maximum frequency).
+ * Placement and per-thread CPU time need Linux; elsewhere the pool only limits the thread count.
+ *
+ * Usage
+ *   affinity-task-pool [--playbin [--uri=URI]] [--audio-cpus=LIST] [--decoder-cpus=LIST] [--other-cpus=LIST]
+ *                      [--audio-rt-priority=N] [--max-threads=32] [--duration=10]
+ *
+ * Without --playbin the tutorial 7 graph runs. SCHED_FIFO needs CAP_SYS_NICE (or an RLIMIT_RTPRIO); without it the
+ * priority is not applied and a warning is printed once.
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* Classes of streaming threads, by what they feed */
+typedef enum {
+	THREAD_AUDIO,
+	THREAD_DECODER,
+	THREAD_OTHER,
+	N_THREAD_CLASSES
+} ThreadClass;
+
+static const gchar *class_names[] = { "audio", "decoder", "other" };
+
+/* Where the threads of one class go */
+typedef struct _Placement {
+	gboolean has_cpus;
+#ifdef __linux__
+	cpu_set_t cpus;
+#endif
+	gint rt_priority;               /* SCHED_FIFO priority, 0 to keep the default policy */
+} Placement;
+
+/* One element served by a streaming thread, from ENTER to LEAVE */
+typedef struct _ThreadRecord {
+	gchar *name;                    /* Element (and pad) the thread runs for */
+	ThreadClass thread_class;
+#ifdef __linux__
+	pthread_t thread;
+	clockid_t clock;                /* CPU time clock of the thread */
+#endif
+	gdouble cpu_start;              /* CPU time of the thread at ENTER, in seconds */
+	gdouble cpu_used;               /* CPU time spent for this element, final once done */
+	gboolean done;                  /* LEAVE was received */
+} ThreadRecord;
+
+/* A GstTaskPool running the tasks on its own threads, with a cap on their number */
+typedef struct _LimitedTaskPool {
+	GstTaskPool parent;
+	GThreadPool *threads;
+	guint max_threads;
+	gint active;                    /* Tasks running right now */
+	gint peak;                      /* Most tasks that ran at once */
+} LimitedTaskPool;
+
+typedef struct _LimitedTaskPoolClass {
+	GstTaskPoolClass parent_class;
+} LimitedTaskPoolClass;
+
+/* One task handed to the pool */
+typedef struct _PoolJob {
+	GstTaskPoolFunction func;
+	gpointer user_data;
+} PoolJob;
+
+G_DEFINE_TYPE (LimitedTaskPool, limited_task_pool, GST_TYPE_TASK_POOL);
+
+/* Structure to contain all our information, so we can pass it around */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GstTaskPool *pool;
+	Placement placements[N_THREAD_CLASSES];
+#ifdef __linux__
+	cpu_set_t default_cpus;         /* Affinity of the process, restored on LEAVE */
+#endif
+	GMutex lock;                    /* Protects records and rt_warned */
+	GPtrArray *records;
+	gboolean rt_warned;
+} CustomData;
+
+static gboolean use_playbin = FALSE;
+static gchar *uri = NULL;
+static gchar *audio_cpus = NULL;
+static gchar *decoder_cpus = NULL;
+static gchar *other_cpus = NULL;
+static gint audio_rt_priority = 0;
+static gint max_threads = 32;
+static gint duration = 10;
+
+static GOptionEntry entries[] = {
+	{ "playbin", 'p', 0, G_OPTION_ARG_NONE, &use_playbin, "Play a URI with playbin instead of running the tutorial 7 graph", NULL },
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI played with --playbin (default: the sintel trailer)", "URI" },
+	{ "audio-cpus", 'a', 0, G_OPTION_ARG_STRING, &audio_cpus, "CPUs of the threads feeding audio sinks", "LIST" },
+	{ "decoder-cpus", 'd', 0, G_OPTION_ARG_STRING, &decoder_cpus, "CPUs of the threads feeding decoders", "LIST" },
+	{ "other-cpus", 'o', 0, G_OPTION_ARG_STRING, &other_cpus, "CPUs of the other streaming threads", "LIST" },
+	{ "audio-rt-priority", 'r', 0, G_OPTION_ARG_INT, &audio_rt_priority, "SCHED_FIFO priority of the audio threads, 0 for none (default 0)", "N" },
+	{ "max-threads", 'm', 0, G_OPTION_ARG_INT, &max_threads, "Most streaming threads the pipeline may use (default 32)", "N" },
+	{ "duration", 't', 0, G_OPTION_ARG_INT, &duration, "Seconds to run (default 10)", "S" },
+	{ NULL }
+};
+
+static void pool_thread_func (PoolJob *job, LimitedTaskPool *self) {
+	job->func (job->user_data);
+	g_free (job);
+	g_atomic_int_add (&self->active, -1);
+}
+
+static void limited_task_pool_prepare (GstTaskPool *pool, GError **error) {
+	LimitedTaskPool *self = (LimitedTaskPool *) pool;
+
+	/* Not exclusive: threads are only created when tasks start */
+	self->threads = g_thread_pool_new ((GFunc) pool_thread_func, self, self->max_threads, FALSE, error);
+}
+
+static void limited_task_pool_cleanup (GstTaskPool *pool) {
+	LimitedTaskPool *self = (LimitedTaskPool *) pool;
+
+	if (self->threads) {
+		g_thread_pool_free (self->threads, FALSE, TRUE);
+		self->threads = NULL;
+	}
+}
+
+static void task_owner_free (GWeakRef *ref) {
+	g_weak_ref_clear (ref);
+	g_free (ref);
+}
+
+/* Remembers the element a task runs for, so a refused task can be reported on it */
+static void task_set_owner (GstTask *task, GstElement *owner) {
+	GWeakRef *ref = g_new0 (GWeakRef, 1);
+
+	g_weak_ref_init (ref, owner);
+	g_object_set_data_full (G_OBJECT (task), "task-owner", ref, (GDestroyNotify) task_owner_free);
+}
+
+/* A streaming task runs until its element stops, so a task that has to wait for a free thread may wait forever.
+ * Refuse it instead. GstTask only turns the error into a warning, and basesrc ignores a task that did not start,
+ * so post the error for the element owning the task ourselves. GstTask pushes itself as the user data */
+static gpointer limited_task_pool_push (GstTaskPool *pool, GstTaskPoolFunction func, gpointer user_data, GError **error) {
+	LimitedTaskPool *self = (LimitedTaskPool *) pool;
+	PoolJob *job;
+	gint active = g_atomic_int_add (&self->active, 1) + 1;
+	gint peak;
+
+	if ((guint) active > self->max_threads) {
+		GWeakRef *ref = g_object_get_data (G_OBJECT (user_data), "task-owner");
+		GstElement *owner = ref ? g_weak_ref_get (ref) : NULL;
+
+		g_atomic_int_add (&self->active, -1);
+		g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_THREAD, "All %u streaming threads are in use", self->max_threads);
+		if (owner) {
+			GST_ELEMENT_ERROR (owner, CORE, THREAD, ("All %u streaming threads are in use", self->max_threads),
+					("The task pool refused a streaming thread, raise --max-threads"));
+			gst_object_unref (owner);
+		}
+		return NULL;
+	}
+	do {
+		peak = g_atomic_int_get (&self->peak);
+	} while (active > peak && !g_atomic_int_compare_and_exchange (&self->peak, peak, active));
+
+	job = g_new (PoolJob, 1);
+	job->func = func;
+	job->user_data = user_data;
+	if (!g_thread_pool_push (self->threads, job, error)) {
+		g_free (job);
+		g_atomic_int_add (&self->active, -1);
+	}
+	/* Threads are reused, there is nothing to join */
+	return NULL;
+}
+
+static void limited_task_pool_class_init (LimitedTaskPoolClass *klass) {
+	GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS (klass);
+
+	pool_class->prepare = limited_task_pool_prepare;
+	pool_class->cleanup = limited_task_pool_cleanup;
+	pool_class->push = limited_task_pool_push;
+}
+
+static void limited_task_pool_init (LimitedTaskPool *self) {
+}
+
+static GstTaskPool *limited_task_pool_new (guint n) {
+	LimitedTaskPool *self = g_object_new (limited_task_pool_get_type (), NULL);
+
+	self->max_threads = n;
+	return GST_TASK_POOL (self);
+}
+
+#ifdef __linux__
+/* Adds the CPUs of "ranges" ("0-3,6", as in sysfs) to "set" */
+static gboolean add_cpu_ranges (const gchar *ranges, cpu_set_t *set) {
+	gchar **tokens = g_strsplit (ranges, ",", -1);
+	gboolean ok = TRUE;
+	guint i;
+
+	for (i = 0; tokens[i] && ok; i++) {
+		gchar *end;
+		glong first, last;
+
+		g_strstrip (tokens[i]);
+		if (!*tokens[i])
+			continue;
+		first = last = strtol (tokens[i], &end, 10);
+		if (*end == '-')
+			last = strtol (end + 1, &end, 10);
+		ok = *end == '\0' && first >= 0 && last >= first && last < CPU_SETSIZE;
+		for (; ok && first <= last; first++)
+			CPU_SET (first, set);
+	}
+	g_strfreev (tokens);
+	return ok;
+}
+
+/* Relative performance of a CPU: its capacity on asymmetric systems, or else its maximum frequency */
+static guint64 cpu_capacity (gint cpu) {
+	static const gchar *files[] = { "cpu_capacity", "cpufreq/cpuinfo_max_freq" };
+	guint64 value = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (files) && !value; i++) {
+		gchar *path = g_strdup_printf ("/sys/devices/system/cpu/cpu%d/%s", cpu, files[i]);
+		gchar *contents;
+
+		if (g_file_get_contents (path, &contents, NULL, NULL)) {
+			value = g_ascii_strtoull (contents, NULL, 10);
+			g_free (contents);
+		}
+		g_free (path);
+	}
+	return value;
+}
+
+/* Adds the cores with the highest (big) or lowest (little) capacity among the ones we may run on */
+static void add_cores_by_capacity (gboolean big, const cpu_set_t *allowed, cpu_set_t *set) {
+	guint64 best = big ? 0 : G_MAXUINT64;
+	gint cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET (cpu, allowed))
+			best = big ? MAX (best, cpu_capacity (cpu)) : MIN (best, cpu_capacity (cpu));
+	}
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET (cpu, allowed) && cpu_capacity (cpu) == best)
+			CPU_SET (cpu, set);
+	}
+}
+
+/* Parses a CPU list: CPU numbers and ranges, node:N, big and little */
+static gboolean parse_cpus (const gchar *spec, const cpu_set_t *allowed, cpu_set_t *set) {
+	gchar **tokens = g_strsplit (spec, ",", -1);
+	gboolean ok = TRUE;
+	guint i;
+
+	CPU_ZERO (set);
+	for (i = 0; tokens[i] && ok; i++) {
+		const gchar *token = g_strstrip (tokens[i]);
+
+		if (g_str_has_prefix (token, "node:")) {
+			gchar *path = g_strdup_printf ("/sys/devices/system/node/node%s/cpulist", token + 5);
+			gchar *contents;
+
+			ok = g_file_get_contents (path, &contents, NULL, NULL) && add_cpu_ranges (g_strstrip (contents), set);
+			if (ok)
+				g_free (contents);
+			g_free (path);
+		} else if (g_str_equal (token, "big") || g_str_equal (token, "little")) {
+			add_cores_by_capacity (g_str_equal (token, "big"), allowed, set);
+		} else {
+			ok = add_cpu_ranges (token, set);
+		}
+	}
+	g_strfreev (tokens);
+	return ok && CPU_COUNT (set) > 0;
+}
+
+static gdouble thread_cpu_seconds (clockid_t clock) {
+	struct timespec ts;
+
+	if (clock_gettime (clock, &ts) != 0)
+		return 0;
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+/* The element behind a pad, looking through ghost pads */
+static GstElement *pad_element (GstPad *pad) {
+	GstElement *element = gst_pad_get_parent_element (pad);
+
+	while (element && GST_IS_BIN (element) && GST_IS_GHOST_PAD (pad)) {
+		GstPad *target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+
+		gst_object_unref (element);
+		element = NULL;
+		if (!target)
+			break;
+		element = gst_pad_get_parent_element (target);
+		gst_object_unref (target);
+		pad = target;
+	}
+	return element;
+}
+
+static ThreadClass element_class (GstElement *element) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	const gchar *klass;
+
+	if (!factory)
+		return THREAD_OTHER;
+	klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+	if (strstr (klass, "Decoder"))
+		return THREAD_DECODER;
+	if (strstr (klass, "Sink") && strstr (klass, "Audio"))
+		return THREAD_AUDIO;
+	return THREAD_OTHER;
+}
+
+/* Follows the data downstream from "pad" (a source pad driven by a task) until a decoder or a sink */
+static ThreadClass classify_from_pad (GstPad *pad) {
+	ThreadClass thread_class = THREAD_OTHER;
+	GstPad *peer = gst_pad_get_peer (pad);
+	guint depth;
+
+	for (depth = 0; peer && depth < 32; depth++) {
+		GstElement *element = pad_element (peer);
+		GstIterator *it;
+		GValue item = G_VALUE_INIT;
+		GstPad *next = NULL;
+
+		gst_object_unref (peer);
+		peer = NULL;
+		if (!element)
+			break;
+		thread_class = element_class (element);
+		if (thread_class != THREAD_OTHER || GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK)) {
+			gst_object_unref (element);
+			break;
+		}
+
+		/* Only a single path downstream can be followed; a tee or a demuxer ends the walk */
+		if (element->numsrcpads == 1) {
+			it = gst_element_iterate_src_pads (element);
+			if (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+				next = gst_object_ref (g_value_get_object (&item));
+				g_value_reset (&item);
+			}
+			gst_iterator_free (it);
+		}
+		gst_object_unref (element);
+		if (!next)
+			break;
+		peer = gst_pad_get_peer (next);
+		gst_object_unref (next);
+	}
+	if (peer)
+		gst_object_unref (peer);
+	return thread_class;
+}
+
+/* Called from the thread that starts running for an element */
+static void thread_enter (CustomData *data, GstMessage *msg, GstElement *owner) {
+	GstObject *src = GST_MESSAGE_SRC (msg);
+	ThreadRecord *record = g_new0 (ThreadRecord, 1);
+	Placement *placement;
+
+	/* Pad tasks post from their pad; an audio sink's ring buffer posts from the ring buffer */
+	if (GST_IS_PAD (src) && GST_PAD_IS_SRC (src))
+		record->thread_class = classify_from_pad (GST_PAD (src));
+	else
+		record->thread_class = element_class (owner);
+	if (GST_IS_PAD (src))
+		record->name = g_strdup_printf ("%s:%s", GST_OBJECT_NAME (owner), GST_OBJECT_NAME (src));
+	else
+		record->name = g_strdup (GST_OBJECT_NAME (owner));
+	placement = &data->placements[record->thread_class];
+
+#ifdef __linux__
+	record->thread = pthread_self ();
+	if (pthread_getcpuclockid (record->thread, &record->clock) == 0)
+		record->cpu_start = thread_cpu_seconds (record->clock);
+	if (placement->has_cpus)
+		pthread_setaffinity_np (record->thread, sizeof (cpu_set_t), &placement->cpus);
+	if (placement->rt_priority > 0) {
+		struct sched_param param = { .sched_priority = placement->rt_priority };
+
+		if (pthread_setschedparam (record->thread, SCHED_FIFO, &param) != 0) {
+			g_mutex_lock (&data->lock);
+			if (!data->rt_warned)
+				g_printerr ("Could not set SCHED_FIFO priority %d (needs CAP_SYS_NICE or RLIMIT_RTPRIO).\n",
+						placement->rt_priority);
+			data->rt_warned = TRUE;
+			g_mutex_unlock (&data->lock);
+		}
+	}
+#endif
+
+	g_mutex_lock (&data->lock);
+	g_ptr_array_add (data->records, record);
+	g_mutex_unlock (&data->lock);
+}
+
+/* Called from the thread that stops running for an element: settle its CPU time and reset its placement */
+static void thread_leave (CustomData *data) {
+#ifdef __linux__
+	pthread_t self = pthread_self ();
+	struct sched_param param = { .sched_priority = 0 };
+	guint i;
+
+	g_mutex_lock (&data->lock);
+	for (i = 0; i < data->records->len; i++) {
+		ThreadRecord *record = g_ptr_array_index (data->records, i);
+
+		if (!record->done && pthread_equal (record->thread, self)) {
+			record->cpu_used = thread_cpu_seconds (record->clock) - record->cpu_start;
+			record->done = TRUE;
+		}
+	}
+	g_mutex_unlock (&data->lock);
+
+	pthread_setaffinity_np (self, sizeof (cpu_set_t), &data->default_cpus);
+	pthread_setschedparam (self, SCHED_OTHER, &param);
+#endif
+}
+
+/* Sees every STREAM_STATUS message on the thread that posts it */
+static GstBusSyncReply bus_sync_handler (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GstStreamStatusType type;
+	GstElement *owner;
+	const GValue *value;
+
+	if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_STREAM_STATUS)
+		return GST_BUS_PASS;
+
+	gst_message_parse_stream_status (msg, &type, &owner);
+	switch (type) {
+		case GST_STREAM_STATUS_TYPE_CREATE:
+			/* The task is not started yet: it will run on our pool */
+			value = gst_message_get_stream_status_object (msg);
+			if (value && G_VALUE_HOLDS_OBJECT (value) && GST_IS_TASK (g_value_get_object (value))) {
+				task_set_owner (GST_TASK (g_value_get_object (value)), owner);
+				gst_task_set_pool (GST_TASK (g_value_get_object (value)), data->pool);
+			}
+			break;
+		case GST_STREAM_STATUS_TYPE_ENTER:
+			thread_enter (data, msg, owner);
+			break;
+		case GST_STREAM_STATUS_TYPE_LEAVE:
+			thread_leave (data);
+			break;
+		default:
+			break;
+	}
+	return GST_BUS_DROP;
+}
+
+/* Prints the CPU time spent by every streaming thread, per element */
+static void print_threads (CustomData *data) {
+	gdouble totals[N_THREAD_CLASSES] = { 0 };
+	guint i;
+
+	g_mutex_lock (&data->lock);
+	g_print ("%-40s %-8s %-8s %10s\n", "element", "class", "state", "CPU s");
+	for (i = 0; i < data->records->len; i++) {
+		ThreadRecord *record = g_ptr_array_index (data->records, i);
+		gdouble used = record->cpu_used;
+
+#ifdef __linux__
+		if (!record->done)
+			used = thread_cpu_seconds (record->clock) - record->cpu_start;
+#endif
+		totals[record->thread_class] += used;
+		g_print ("%-40s %-8s %-8s %10.3f\n", record->name, class_names[record->thread_class],
+				record->done ? "done" : "running", used);
+	}
+	g_mutex_unlock (&data->lock);
+	for (i = 0; i < N_THREAD_CLASSES; i++)
+		g_print ("%s threads: %.3f s  ", class_names[i], totals[i]);
+	g_print ("\npool: %d threads busy, %d at most, limit %d\n\n", g_atomic_int_get (&((LimitedTaskPool *) data->pool)->active),
+			g_atomic_int_get (&((LimitedTaskPool *) data->pool)->peak), max_threads);
+}
+
+static void record_free (ThreadRecord *record) {
+	g_free (record->name);
+	g_free (record);
+}
+
+/* Reads the CPU lists of the command line into the placement of every class */
+static gboolean setup_placements (CustomData *data) {
+	const gchar *specs[] = { audio_cpus, decoder_cpus, other_cpus };
+	guint i;
+
+	data->placements[THREAD_AUDIO].rt_priority = audio_rt_priority;
+#ifdef __linux__
+	sched_getaffinity (0, sizeof (cpu_set_t), &data->default_cpus);
+	for (i = 0; i < N_THREAD_CLASSES; i++) {
+		if (!specs[i])
+			continue;
+		if (!parse_cpus (specs[i], &data->default_cpus, &data->placements[i].cpus)) {
+			g_printerr ("Invalid CPU list '%s' for the %s threads.\n", specs[i], class_names[i]);
+			return FALSE;
+		}
+		data->placements[i].has_cpus = TRUE;
+	}
+#else
+	for (i = 0; i < N_THREAD_CLASSES; i++) {
+		if (specs[i])
+			g_printerr ("CPU placement needs Linux, ignoring the CPUs of the %s threads.\n", class_names[i]);
+	}
+#endif
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstBus *bus;
+	GstMessage *msg;
+	gint64 end_time;
+	gboolean terminate = FALSE;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- streaming threads placed by element class");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (max_threads <= 0 || duration <= 0 || audio_rt_priority < 0) {
+		g_printerr ("The thread limit and the duration must be positive.\n");
+		return -1;
+	}
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.lock);
+	data.records = g_ptr_array_new_with_free_func ((GDestroyNotify) record_free);
+	if (!setup_placements (&data))
+		return -1;
+
+	data.pool = limited_task_pool_new (max_threads);
+	gst_task_pool_prepare (data.pool, &error);
+	if (error) {
+		g_printerr ("Unable to prepare the task pool: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+
+	/* Build the pipeline */
+	if (use_playbin)
+		data.pipeline = gst_parse_launch ("playbin name=playbin", &error);
+	else
+		data.pipeline = gst_parse_launch ("audiotestsrc freq=215 ! tee name=tee "
+				"tee. ! queue name=audio_queue ! audioconvert ! audioresample ! autoaudiosink "
+				"tee. ! queue name=video_queue ! wavescope shader=0 style=1 ! videoconvert ! autovideosink", &error);
+	if (!data.pipeline) {
+		g_printerr ("Unable to build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	if (use_playbin)
+		g_object_set (data.pipeline, "uri", uri ? uri : DEFAULT_URI, NULL);
+
+	/* The pool must be set before the tasks start, so this cannot wait for the main thread */
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_set_sync_handler (bus, (GstBusSyncHandler) bus_sync_handler, &data, NULL);
+
+	/* Start playing */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Report every 2 seconds until error, EOS or the end of the run */
+	end_time = g_get_monotonic_time () + (gint64) duration * G_TIME_SPAN_SECOND;
+	while (!terminate) {
+		msg = gst_bus_timed_pop_filtered (bus, 2 * GST_SECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+		if (msg) {
+			if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+				gchar *debug_info;
+
+				gst_message_parse_error (msg, &error, &debug_info);
+				g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), error->message);
+				g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+				g_clear_error (&error);
+				g_free (debug_info);
+			} else {
+				g_print ("End-Of-Stream reached.\n");
+			}
+			gst_message_unref (msg);
+			terminate = TRUE;
+		}
+		print_threads (&data);
+		if (g_get_monotonic_time () >= end_time)
+			terminate = TRUE;
+	}
+
+	/* Free resources. The tasks are joined when the pipeline goes to NULL, before the pool is cleaned up */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	print_threads (&data);
+	gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	gst_task_pool_cleanup (data.pool);
+	gst_object_unref (data.pool);
+	g_ptr_array_unref (data.records);
+	g_mutex_clear (&data.lock);
+	return 0;
+}
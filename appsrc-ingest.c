@@ -0,0 +1,335 @@
+/* Appsrc ingest : pooled, preallocated buffers pushed from our own code
+ *
+ * Goal
+ *
+ * basic-tutorial-6.c and basic-tutorial-7.c generate their data with audiotestsrc. In production the samples come
+ * from our capture code, so this program replaces the source of the basic-tutorial-7.c graph with an appsrc:
+ *
+ *   appsrc -> tee -> audio_queue -> audioconvert -> audioresample -> audio_sink
+ *                 -> video_queue -> wavescope -> videoconvert -> video_sink
+ *
+ * The "capture" thread fills buffers taken from a GstBufferPool instead of allocating them. The pool has a fixed
+ * number of buffers (min = max), all allocated up front with the requested alignment, and a buffer goes back to the
+ * pool when the pipeline releases it. So once the pipeline runs there is no malloc per buffer.
+ *
+ * When every buffer of the pool is still in use downstream, the producer has to do something:
+ *   - block (default): wait until a buffer comes back, which slows the capture down to what the pipeline consumes;
+ *   - drop: acquire with GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT and throw the captured period away.
+ *
+ * Every second it prints the pool hit rate (acquisitions served without waiting), the stalls (acquisitions that had
+ * to wait, and for how long) and the dropped periods.
+ *
+ * Usage
+ *   appsrc-ingest [--pool-size=N] [--align=BYTES] [--backpressure=block|drop] [--duration=SECONDS] [--fakesink]
+ *
+ * It also needs the app library: add gstreamer-app-1.0 to the pkg-config line.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/audio/audio.h>
+
+#define SAMPLE_RATE 44100
+#define SAMPLES_PER_BUFFER 1024
+#define FREQUENCY 215.0
+
+/* Structure to contain all our information, so we can pass it around */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GstElement *app_source;
+	GstBufferPool *pool;
+	GMainLoop *loop;
+	GThread *producer;
+	gint stop;                      /* Atomic, tells the producer to finish */
+
+	guint64 num_samples;            /* Number of samples generated so far (for timestamp generation) */
+	gdouble phase;
+
+	/* Counters, updated by the producer and read by the main loop */
+	GMutex stats_lock;
+	guint64 acquired;
+	guint64 hits;
+	guint64 stalls;
+	GstClockTime stall_time;        /* Time spent waiting for a free buffer */
+	guint64 dropped;
+} CustomData;
+
+static gint pool_size = 8;
+static gint align = 64;
+static gchar *backpressure = NULL;
+static gint duration = 10;
+static gboolean use_fakesink = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "pool-size", 'p', 0, G_OPTION_ARG_INT, &pool_size, "Number of preallocated buffers (default: 8)", "N" },
+	{ "align", 'a', 0, G_OPTION_ARG_INT, &align, "Alignment of the buffer memory, a power of two (default: 64)", "BYTES" },
+	{ "backpressure", 'b', 0, G_OPTION_ARG_STRING, &backpressure, "What to do when the pool is empty: block or drop (default: block)", "POLICY" },
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds of audio to ingest before EOS (default: 10)", "SECONDS" },
+	{ "fakesink", 'f', 0, G_OPTION_ARG_NONE, &use_fakesink, "Use fakesinks instead of the audio and video sinks", NULL },
+	{ NULL }
+};
+
+/* Creates and activates the pool: pool_size buffers of one period of mono S16 audio */
+static GstBufferPool *create_pool (GstCaps *caps, guint size) {
+	GstBufferPool *pool = gst_buffer_pool_new ();
+	GstStructure *config = gst_buffer_pool_get_config (pool);
+	GstAllocationParams params;
+
+	gst_allocation_params_init (&params);
+	params.align = align - 1;
+	gst_buffer_pool_config_set_params (config, caps, size, pool_size, pool_size);
+	gst_buffer_pool_config_set_allocator (config, NULL, &params);
+	if (!gst_buffer_pool_set_config (pool, config) || !gst_buffer_pool_set_active (pool, TRUE)) {
+		gst_object_unref (pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/* Takes a buffer from the pool according to the backpressure policy. Returns NULL when the period must be dropped */
+static GstBuffer *acquire_buffer (CustomData *data, gboolean drop) {
+	GstBufferPoolAcquireParams params = { 0, };
+	GstBuffer *buffer = NULL;
+	GstClockTime wait_start;
+	GstFlowReturn ret;
+
+	/* An empty pool makes a DONTWAIT acquisition return GST_FLOW_EOS */
+	params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+	ret = gst_buffer_pool_acquire_buffer (data->pool, &buffer, &params);
+
+	g_mutex_lock (&data->stats_lock);
+	data->acquired++;
+	if (ret == GST_FLOW_OK)
+		data->hits++;
+	else if (drop)
+		data->dropped++;
+	else
+		data->stalls++;
+	g_mutex_unlock (&data->stats_lock);
+	if (ret == GST_FLOW_OK || drop)
+		return buffer;
+
+	wait_start = gst_util_get_timestamp ();
+	if (gst_buffer_pool_acquire_buffer (data->pool, &buffer, NULL) != GST_FLOW_OK)
+		return NULL;    /* The pool is flushing, we are shutting down */
+	g_mutex_lock (&data->stats_lock);
+	data->stall_time += gst_util_get_timestamp () - wait_start;
+	g_mutex_unlock (&data->stats_lock);
+	return buffer;
+}
+
+/* The capture thread: one period every SAMPLES_PER_BUFFER samples, as a capture card would deliver */
+static gpointer producer_thread (CustomData *data) {
+	gboolean drop = g_strcmp0 (backpressure, "drop") == 0;
+	guint64 total_samples = (guint64) duration * SAMPLE_RATE;
+	GstClockTime start = gst_util_get_timestamp ();
+
+	while (!g_atomic_int_get (&data->stop) && data->num_samples < total_samples) {
+		GstClockTime timestamp = gst_util_uint64_scale (data->num_samples, GST_SECOND, SAMPLE_RATE);
+		GstClockTime now = gst_util_get_timestamp () - start;
+		GstBuffer *buffer;
+		GstMapInfo map;
+		gint16 *raw;
+		guint i;
+
+		/* Capture hardware does not wait for us: pace the periods in real time */
+		if (timestamp > now)
+			g_usleep ((timestamp - now) / GST_USECOND);
+
+		buffer = acquire_buffer (data, drop);
+		if (buffer) {
+			GST_BUFFER_PTS (buffer) = timestamp;
+			GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (SAMPLES_PER_BUFFER, GST_SECOND, SAMPLE_RATE);
+
+			/* The capture: a sine wave at the frequency basic-tutorial-7.c uses */
+			gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+			raw = (gint16 *) map.data;
+			for (i = 0; i < SAMPLES_PER_BUFFER; i++) {
+				raw[i] = (gint16) (sin (data->phase) * 16000);
+				data->phase += 2 * G_PI * FREQUENCY / SAMPLE_RATE;
+			}
+			gst_buffer_unmap (buffer, &map);
+
+			/* appsrc takes ownership of the buffer, which goes back to the pool when the last user drops it */
+			if (gst_app_src_push_buffer (GST_APP_SRC (data->app_source), buffer) != GST_FLOW_OK)
+				break;
+		}
+		data->num_samples += SAMPLES_PER_BUFFER;
+	}
+
+	gst_app_src_end_of_stream (GST_APP_SRC (data->app_source));
+	return NULL;
+}
+
+static gboolean print_stats (CustomData *data) {
+	g_mutex_lock (&data->stats_lock);
+	g_print ("acquired %" G_GUINT64_FORMAT ", pool hit rate %.1f%%, stalls %" G_GUINT64_FORMAT " (%.1f ms waiting), dropped %"
+			G_GUINT64_FORMAT "\n", data->acquired, data->acquired > 0 ? data->hits * 100.0 / data->acquired : 100.0,
+			data->stalls, data->stall_time / 1e6, data->dropped);
+	g_mutex_unlock (&data->stats_lock);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstElement *tee, *audio_queue, *audio_convert, *audio_resample, *audio_sink;
+	GstElement *video_queue, *visual, *video_convert, *video_sink;
+	GstPad *tee_audio_pad, *tee_video_pad, *queue_audio_pad, *queue_video_pad;
+	GstAudioInfo info;
+	GstCaps *audio_caps;
+	GstBus *bus;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- appsrc ingest with a preallocated buffer pool");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (pool_size <= 0 || align <= 0 || (align & (align - 1)) != 0) {
+		g_printerr ("The pool size must be positive and the alignment a power of two.\n");
+		return -1;
+	}
+	if (backpressure && !g_str_equal (backpressure, "block") && !g_str_equal (backpressure, "drop")) {
+		g_printerr ("Unknown backpressure policy '%s'.\n", backpressure);
+		return -1;
+	}
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.stats_lock);
+
+	/* Create the elements */
+	data.app_source = gst_element_factory_make ("appsrc", "audio_source");
+	tee = gst_element_factory_make ("tee", "tee");
+	audio_queue = gst_element_factory_make ("queue", "audio_queue");
+	audio_convert = gst_element_factory_make ("audioconvert", "audio_convert");
+	audio_resample = gst_element_factory_make ("audioresample", "audio_resample");
+	audio_sink = gst_element_factory_make (use_fakesink ? "fakesink" : "autoaudiosink", "audio_sink");
+	video_queue = gst_element_factory_make ("queue", "video_queue");
+	visual = gst_element_factory_make ("wavescope", "visual");
+	video_convert = gst_element_factory_make ("videoconvert", "csp");
+	video_sink = gst_element_factory_make (use_fakesink ? "fakesink" : "autovideosink", "video_sink");
+	data.pipeline = gst_pipeline_new ("test-pipeline");
+
+	if (!data.pipeline || !data.app_source || !tee || !audio_queue || !audio_convert || !audio_resample || !audio_sink ||
+			!video_queue || !visual || !video_convert || !video_sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+
+	/* Configure the appsrc and its pool. The appsrc queue holds at most half of the pool, so some buffers are
+	 * always free for the branches downstream */
+	gst_audio_info_set_format (&info, GST_AUDIO_FORMAT_S16, SAMPLE_RATE, 1, NULL);
+	audio_caps = gst_audio_info_to_caps (&info);
+	data.pool = create_pool (audio_caps, SAMPLES_PER_BUFFER * info.bpf);
+	if (!data.pool) {
+		g_printerr ("Could not configure the buffer pool.\n");
+		gst_caps_unref (audio_caps);
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	g_object_set (data.app_source, "caps", audio_caps, "format", GST_FORMAT_TIME, "block", TRUE,
+			"max-bytes", (guint64) MAX (1, pool_size / 2) * SAMPLES_PER_BUFFER * info.bpf, NULL);
+	gst_caps_unref (audio_caps);
+	g_object_set (visual, "shader", 0, "style", 1, NULL);
+	if (use_fakesink) {
+		g_object_set (audio_sink, "sync", TRUE, NULL);
+		g_object_set (video_sink, "sync", TRUE, NULL);
+	}
+
+	/* Link all elements that can be automatically linked because they have "Always" pads */
+	gst_bin_add_many (GST_BIN (data.pipeline), data.app_source, tee, audio_queue, audio_convert, audio_resample,
+			audio_sink, video_queue, visual, video_convert, video_sink, NULL);
+	if (gst_element_link_many (data.app_source, tee, NULL) != TRUE ||
+			gst_element_link_many (audio_queue, audio_convert, audio_resample, audio_sink, NULL) != TRUE ||
+			gst_element_link_many (video_queue, visual, video_convert, video_sink, NULL) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Manually link the Tee, which has "Request" pads */
+	tee_audio_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_audio_pad = gst_element_get_static_pad (audio_queue, "sink");
+	tee_video_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_video_pad = gst_element_get_static_pad (video_queue, "sink");
+	if (gst_pad_link (tee_audio_pad, queue_audio_pad) != GST_PAD_LINK_OK ||
+			gst_pad_link (tee_video_pad, queue_video_pad) != GST_PAD_LINK_OK) {
+		g_printerr ("Tee could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	gst_object_unref (queue_audio_pad);
+	gst_object_unref (queue_video_pad);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+	g_timeout_add_seconds (1, (GSourceFunc) print_stats, &data);
+
+	/* Start playing the pipeline, then the capture */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	data.producer = g_thread_new ("capture", (GThreadFunc) producer_thread, &data);
+	g_main_loop_run (data.loop);
+
+	/* Stop the producer. Deactivating the pool wakes it up if it is waiting for a buffer */
+	g_atomic_int_set (&data.stop, 1);
+	gst_buffer_pool_set_flushing (data.pool, TRUE);
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	g_thread_join (data.producer);
+	print_stats (&data);
+
+	/* Release the request pads from the Tee, and unref them */
+	gst_element_release_request_pad (tee, tee_audio_pad);
+	gst_element_release_request_pad (tee, tee_video_pad);
+	gst_object_unref (tee_audio_pad);
+	gst_object_unref (tee_video_pad);
+
+	/* Free resources */
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	gst_buffer_pool_set_active (data.pool, FALSE);
+	gst_object_unref (data.pool);
+	g_main_loop_unref (data.loop);
+	g_mutex_clear (&data.stats_lock);
+	g_free (backpressure);
+	return 0;
+}
@@ -0,0 +1,417 @@
+/* Audio mixer scaling : many inputs mixed into the tutorial 7 graph
+ *
+ * Goal
+ *
+ * basic-tutorial-7.c feeds its tee from a single audiotestsrc. A conference mixes tens or hundreds of talkers into
+ * one stream. This program puts an N-input mixing stage in front of the tee, built on audiomixer (a GstAggregator):
+ *
+ *   inputs x (audiotestsrc, live) -> audiomixer -> capsfilter -> tee -> audio branch, video branch (as in tutorial 7)
+ *
+ * The first input is the 215 Hz tone of the tutorial, the others are tones a little higher. Every input and the
+ * output share one format (--format, --rate, mono), so audiomixer never converts a pad and every input goes
+ * straight into its mixing kernels: ORC functions, compiled at runtime to SSE, AVX or NEON code. The sources produce
+ * buffers of the same duration as the mixer's output (--buffer-ms), so every output buffer is the sum of exactly one
+ * buffer per input. Only the video branch converts, because wavescope takes S16 samples only.
+ *
+ * The inputs are live, so the mixer waits for late inputs at most --latency ms past the deadline of each output
+ * buffer before mixing without them. It reports that wait in its LATENCY query, on top of the latency of the
+ * sources: the difference is the latency the mixing stage adds.
+ *
+ * --benchmark runs the stage alone into a fakesink, for every input count of --inputs and every rate of --rates,
+ * --seconds each, and prints the CPU time it took (as a share of one core, per input too) and the added latency.
+ * --compare-backup runs the same benchmark again in a child process with ORC_CODE=backup, the plain C versions of
+ * the kernels, to show what the SIMD code saves.
+ *
+ * Usage
+ *   audio-mixer-scaling [--inputs=N] [--rate=48000] [--format=F32LE] [--latency=MS] [--buffer-ms=10]
+ *   audio-mixer-scaling --benchmark [--inputs=1,10,50,100,200] [--rates=16000,48000] [--seconds=5] [--compare-backup]
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#define BASE_FREQUENCY 215.0
+
+static gchar *inputs_arg = NULL;
+static gint rate = 48000;
+static gchar *rates_arg = NULL;
+static gchar *format = NULL;
+static gint latency_ms = 0;
+static gint buffer_ms = 10;
+static gboolean benchmark = FALSE;
+static gint seconds = 5;
+static gboolean compare_backup = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "inputs", 'n', 0, G_OPTION_ARG_STRING, &inputs_arg, "Inputs to mix, a comma separated list with --benchmark (default: 10, or 1,10,50,100,200)", "N" },
+	{ "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Sample rate (default: 48000)", "HZ" },
+	{ "rates", 0, 0, G_OPTION_ARG_STRING, &rates_arg, "Sample rates for --benchmark, comma separated (default: 16000,48000)", "HZ,..." },
+	{ "format", 'f', 0, G_OPTION_ARG_STRING, &format, "Sample format of the inputs and the mix (default: F32LE)", "FORMAT" },
+	{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency_ms, "How long the mixer waits for late inputs (default: 0)", "MS" },
+	{ "buffer-ms", 'd', 0, G_OPTION_ARG_INT, &buffer_ms, "Duration of the input and output buffers (default: 10)", "MS" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Measure CPU and latency across input counts and rates", NULL },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Seconds per benchmark point (default: 5)", "S" },
+	{ "compare-backup", 0, 0, G_OPTION_ARG_NONE, &compare_backup, "Run the benchmark again with the C versions of the ORC kernels", NULL },
+	{ NULL }
+};
+
+static gdouble cpu_seconds (void) {
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Parses a comma separated list of positive integers. Returns NULL if one of them is not */
+static GArray *parse_list (const gchar *list) {
+	GArray *values = g_array_new (FALSE, FALSE, sizeof (gint));
+	gchar **items = g_strsplit (list, ",", -1);
+	gchar *end;
+	gint value;
+	guint i;
+
+	for (i = 0; items[i]; i++) {
+		value = (gint) g_ascii_strtoll (items[i], &end, 10);
+		if (value <= 0 || *end != '\0' || end == items[i]) {
+			g_array_unref (values);
+			g_strfreev (items);
+			return NULL;
+		}
+		g_array_append_val (values, value);
+	}
+	g_strfreev (items);
+	return values;
+}
+
+/* Adds the mixing stage to the bin. Returns the element to link the mix from, and the first source */
+static GstElement *add_mixing_stage (GstBin *bin, gint inputs, gint sample_rate, GstElement **first_source) {
+	GstCaps *caps = gst_caps_new_simple ("audio/x-raw", "format", G_TYPE_STRING, format ? format : "F32LE",
+			"layout", G_TYPE_STRING, "interleaved", "rate", G_TYPE_INT, sample_rate, "channels", G_TYPE_INT, 1, NULL);
+	GstElement *mixer = gst_element_factory_make ("audiomixer", "mixer");
+	GstElement *mix_filter = gst_element_factory_make ("capsfilter", "mix_caps");
+	gint samples = (gint) gst_util_uint64_scale_int (sample_rate, buffer_ms, 1000);
+	GstElement *source;
+	gint i;
+
+	if (!mixer || !mix_filter) {
+		g_printerr ("Not all elements could be created.\n");
+		gst_caps_unref (caps);
+		return NULL;
+	}
+	g_object_set (mixer, "latency", (guint64) latency_ms * GST_MSECOND,
+			"output-buffer-duration", (guint64) buffer_ms * GST_MSECOND, NULL);
+	g_object_set (mix_filter, "caps", caps, NULL);
+	gst_bin_add_many (bin, mixer, mix_filter, NULL);
+	if (!gst_element_link (mixer, mix_filter)) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_caps_unref (caps);
+		return NULL;
+	}
+
+	for (i = 0; i < inputs; i++) {
+		source = gst_element_factory_make ("audiotestsrc", NULL);
+		if (!source) {
+			g_printerr ("Not all elements could be created.\n");
+			gst_caps_unref (caps);
+			return NULL;
+		}
+		/* Scaled so the sum of all the tones does not clip */
+		g_object_set (source, "freq", BASE_FREQUENCY + 10.0 * i, "volume", 1.0 / inputs, "is-live", TRUE,
+				"samplesperbuffer", samples, NULL);
+		gst_bin_add (bin, source);
+
+		/* Requests a sink pad of the mixer. The caps keep the pad in the format of the mix */
+		if (!gst_element_link_filtered (source, mixer, caps)) {
+			g_printerr ("Input %d could not be linked.\n", i);
+			gst_caps_unref (caps);
+			return NULL;
+		}
+		if (i == 0)
+			*first_source = source;
+	}
+	gst_caps_unref (caps);
+	return mix_filter;
+}
+
+/* The minimum latency a live pad reports, or GST_CLOCK_TIME_NONE */
+static GstClockTime query_latency (GstElement *element) {
+	GstPad *pad = gst_element_get_static_pad (element, "src");
+	GstQuery *query = gst_query_new_latency ();
+	GstClockTime min = GST_CLOCK_TIME_NONE;
+	gboolean live = FALSE;
+
+	if (pad && gst_pad_query (pad, query))
+		gst_query_parse_latency (query, &live, &min, NULL);
+	gst_query_unref (query);
+	if (pad)
+		gst_object_unref (pad);
+	return live ? min : GST_CLOCK_TIME_NONE;
+}
+
+static void print_latency (GstElement *mix, GstElement *first_source) {
+	GstClockTime mix_latency = query_latency (mix);
+	GstClockTime source_latency = query_latency (first_source);
+
+	if (!GST_CLOCK_TIME_IS_VALID (mix_latency) || !GST_CLOCK_TIME_IS_VALID (source_latency)) {
+		g_print ("latency unknown");
+		return;
+	}
+	g_print ("latency %.1f ms (sources %.1f ms, mixer adds %.1f ms)", mix_latency / 1e6, source_latency / 1e6,
+			GST_CLOCK_DIFF (source_latency, mix_latency) / 1e6);
+}
+
+/* Returns FALSE if the pipeline posted an error within the timeout */
+static gboolean wait_for_error (GstElement *pipeline, GstClockTime timeout) {
+	GstBus *bus = gst_element_get_bus (pipeline);
+	GstMessage *msg = gst_bus_timed_pop_filtered (bus, timeout, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	gboolean ok = TRUE;
+
+	if (msg) {
+		if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+			GError *err;
+			gchar *debug_info;
+
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			ok = FALSE;
+		} else {
+			g_print ("End-Of-Stream reached.\n");
+		}
+		gst_message_unref (msg);
+	}
+	gst_object_unref (bus);
+	return ok;
+}
+
+/* One benchmark point: the mixing stage alone, into a clocked fakesink */
+static gboolean bench_point (gint inputs, gint sample_rate) {
+	GstElement *pipeline = gst_pipeline_new ("bench-pipeline");
+	GstElement *sink = gst_element_factory_make ("fakesink", "sink");
+	GstElement *mix, *first_source = NULL;
+	gdouble cpu, wall;
+	gint64 start;
+	gboolean ok;
+
+	if (!pipeline || !sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+	gst_bin_add (GST_BIN (pipeline), sink);
+	mix = add_mixing_stage (GST_BIN (pipeline), inputs, sample_rate, &first_source);
+	if (!mix || !gst_element_link (mix, sink)) {
+		gst_object_unref (pipeline);
+		return FALSE;
+	}
+	g_object_set (sink, "sync", TRUE, NULL);
+
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return FALSE;
+	}
+	gst_element_get_state (pipeline, NULL, NULL, 5 * GST_SECOND);
+
+	/* Measure the steady state: thread startup is over once the pipeline is in PLAYING */
+	cpu = cpu_seconds ();
+	start = g_get_monotonic_time ();
+	ok = wait_for_error (pipeline, (GstClockTime) seconds * GST_SECOND);
+	cpu = cpu_seconds () - cpu;
+	wall = (g_get_monotonic_time () - start) / (gdouble) G_TIME_SPAN_SECOND;
+
+	if (ok) {
+		g_print ("inputs %4d, rate %6d: %6.2f%% of a core, %.4f%% per input, ", inputs, sample_rate,
+				cpu * 100.0 / wall, cpu * 100.0 / wall / inputs);
+		print_latency (mix, first_source);
+		g_print ("\n");
+	}
+
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	return ok;
+}
+
+/* Runs the same benchmark in a child with the C versions of the ORC kernels */
+static gboolean run_backup (const gchar *self) {
+	gchar *child_argv[] = { (gchar *) self, "--benchmark", NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+	gchar **envp = g_environ_setenv (g_get_environ (), "ORC_CODE", "backup", TRUE);
+	GError *error = NULL;
+	gboolean ok = TRUE;
+	gint status, i;
+
+	child_argv[2] = g_strdup_printf ("--inputs=%s", inputs_arg);
+	child_argv[3] = g_strdup_printf ("--rates=%s", rates_arg);
+	child_argv[4] = g_strdup_printf ("--seconds=%d", seconds);
+	child_argv[5] = g_strdup_printf ("--latency=%d", latency_ms);
+	child_argv[6] = g_strdup_printf ("--buffer-ms=%d", buffer_ms);
+	child_argv[7] = g_strdup_printf ("--format=%s", format ? format : "F32LE");
+
+	if (!g_spawn_sync (NULL, child_argv, envp, G_SPAWN_SEARCH_PATH | G_SPAWN_CHILD_INHERITS_STDIN,
+				NULL, NULL, NULL, NULL, &status, &error)) {
+		g_printerr ("Could not start the benchmark: %s\n", error->message);
+		g_clear_error (&error);
+		ok = FALSE;
+	} else if (!g_spawn_check_wait_status (status, &error)) {
+		g_printerr ("The benchmark failed: %s\n", error->message);
+		g_clear_error (&error);
+		ok = FALSE;
+	}
+
+	for (i = 2; i < 8; i++)
+		g_free (child_argv[i]);
+	g_strfreev (envp);
+	return ok;
+}
+
+static gboolean run_benchmark (const gchar *self) {
+	GArray *counts, *rates;
+	gboolean ok = TRUE;
+	guint i, j;
+
+	if (!inputs_arg)
+		inputs_arg = g_strdup ("1,10,50,100,200");
+	if (!rates_arg)
+		rates_arg = g_strdup ("16000,48000");
+	counts = parse_list (inputs_arg);
+	rates = parse_list (rates_arg);
+	if (!counts || !rates) {
+		g_printerr ("The input counts and rates must be lists of positive numbers.\n");
+		g_clear_pointer (&counts, g_array_unref);
+		g_clear_pointer (&rates, g_array_unref);
+		return FALSE;
+	}
+
+	g_print ("== %s, %s mono, %d ms buffers, %d ms latency ==\n", g_strcmp0 (g_getenv ("ORC_CODE"), "backup") == 0 ?
+			"ORC backup (C) kernels" : "ORC (SIMD) kernels", format ? format : "F32LE", buffer_ms, latency_ms);
+	for (j = 0; ok && j < rates->len; j++) {
+		for (i = 0; ok && i < counts->len; i++)
+			ok = bench_point (g_array_index (counts, gint, i), g_array_index (rates, gint, j));
+	}
+	g_array_unref (counts);
+	g_array_unref (rates);
+
+	if (ok && compare_backup)
+		ok = run_backup (self);
+	return ok;
+}
+
+/* The basic-tutorial-7.c graph, fed by the mixing stage instead of one audiotestsrc */
+static gboolean run_graph (gint inputs) {
+	GstElement *pipeline, *tee, *audio_queue, *audio_convert, *audio_resample, *audio_sink;
+	GstElement *video_queue, *visual_convert, *visual, *video_convert, *video_sink;
+	GstElement *mix, *first_source = NULL;
+	GstPad *tee_audio_pad, *tee_video_pad, *queue_audio_pad, *queue_video_pad;
+	gboolean ok;
+
+	tee = gst_element_factory_make ("tee", "tee");
+	audio_queue = gst_element_factory_make ("queue", "audio_queue");
+	audio_convert = gst_element_factory_make ("audioconvert", "audio_convert");
+	audio_resample = gst_element_factory_make ("audioresample", "audio_resample");
+	audio_sink = gst_element_factory_make ("autoaudiosink", "audio_sink");
+	video_queue = gst_element_factory_make ("queue", "video_queue");
+	visual_convert = gst_element_factory_make ("audioconvert", "visual_convert");
+	visual = gst_element_factory_make ("wavescope", "visual");
+	video_convert = gst_element_factory_make ("videoconvert", "csp");
+	video_sink = gst_element_factory_make ("autovideosink", "video_sink");
+	pipeline = gst_pipeline_new ("test-pipeline");
+	if (!pipeline || !tee || !audio_queue || !audio_convert || !audio_resample || !audio_sink || !video_queue ||
+			!visual_convert || !visual || !video_convert || !video_sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+	g_object_set (visual, "shader", 0, "style", 1, NULL);
+
+	gst_bin_add_many (GST_BIN (pipeline), tee, audio_queue, audio_convert, audio_resample, audio_sink, video_queue,
+			visual_convert, visual, video_convert, video_sink, NULL);
+	mix = add_mixing_stage (GST_BIN (pipeline), inputs, rate, &first_source);
+	/* wavescope only takes S16: the video branch converts the mix for it, whatever --format the mixer uses */
+	if (!mix || gst_element_link_many (mix, tee, NULL) != TRUE ||
+			gst_element_link_many (audio_queue, audio_convert, audio_resample, audio_sink, NULL) != TRUE ||
+			gst_element_link_many (video_queue, visual_convert, visual, video_convert, video_sink, NULL) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (pipeline);
+		return FALSE;
+	}
+
+	/* Manually link the Tee, which has "Request" pads */
+	tee_audio_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_audio_pad = gst_element_get_static_pad (audio_queue, "sink");
+	tee_video_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_video_pad = gst_element_get_static_pad (video_queue, "sink");
+	if (gst_pad_link (tee_audio_pad, queue_audio_pad) != GST_PAD_LINK_OK ||
+			gst_pad_link (tee_video_pad, queue_video_pad) != GST_PAD_LINK_OK) {
+		g_printerr ("Tee could not be linked.\n");
+		gst_object_unref (pipeline);
+		return FALSE;
+	}
+	gst_object_unref (queue_audio_pad);
+	gst_object_unref (queue_video_pad);
+
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return FALSE;
+	}
+	gst_element_get_state (pipeline, NULL, NULL, 5 * GST_SECOND);
+	g_print ("Mixing %d inputs at %d Hz, ", inputs, rate);
+	print_latency (mix, first_source);
+	g_print ("\n");
+
+	/* Live sources never end: this runs until an error or an interruption */
+	ok = wait_for_error (pipeline, GST_CLOCK_TIME_NONE);
+
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_element_release_request_pad (tee, tee_audio_pad);
+	gst_element_release_request_pad (tee, tee_video_pad);
+	gst_object_unref (tee_audio_pad);
+	gst_object_unref (tee_video_pad);
+	gst_object_unref (pipeline);
+	return ok;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *self = g_strdup (argv[0]);
+	gboolean ok;
+	gint inputs;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- N-input audio mixing stage and its scaling");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (rate <= 0 || buffer_ms <= 0 || latency_ms < 0 || seconds <= 0) {
+		g_printerr ("The rate, buffer duration and seconds must be positive and the latency not negative.\n");
+		return -1;
+	}
+
+	if (benchmark) {
+		ok = run_benchmark (self);
+	} else {
+		inputs = inputs_arg ? atoi (inputs_arg) : 10;
+		if (inputs <= 0) {
+			g_printerr ("The number of inputs must be positive.\n");
+			return -1;
+		}
+		ok = run_graph (inputs);
+	}
+
+	g_free (self);
+	g_free (inputs_arg);
+	g_free (rates_arg);
+	g_free (format);
+	return ok ? 0 : -1;
+}
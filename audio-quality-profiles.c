@@ -0,0 +1,391 @@
+/* Audio quality profiles : named settings for the audioconvert -> audioresample chain
+ *
+ * Goal
+ *
+ * basic-tutorial-3.c and basic-tutorial-7.c send their audio through audioconvert -> audioresample -> sink with the
+ * default settings. This program gives the chain named profiles:
+ *
+ *   - passthrough : cheapest settings everywhere, for sources that already match the sink. Both elements are base
+ *                   transforms, so with matching caps they forward the buffers untouched and cost nothing. When the
+ *                   rate does have to change, nearest-neighbour resampling would be audibly bad, so the resampler then
+ *                   gets the balanced settings: this is decided from the input caps, before audioresample sees them;
+ *   - low-latency : linear interpolation, no dithering;
+ *   - balanced    : the defaults of audioresample (Kaiser windowed sinc, quality 4) and dithering when the depth drops;
+ *   - high-quality: Kaiser, quality 10 with the full sinc table, dithering with high-frequency TPDF and high noise
+ *                   shaping.
+ *
+ * Without --benchmark it plays the URI through the chain of basic-tutorial-3.c with the chosen profile, and once it
+ * plays it reports which elements are in passthrough.
+ *
+ * --benchmark runs audiotestsrc -> capsfilter -> audioconvert -> audioresample -> capsfilter -> fakesink as fast as
+ * possible with every profile, for three cases: matching formats, a rate change (44.1 -> 48 kHz) and a depth change
+ * (F32 -> S16), and prints the CPU time per channel-second of audio. The time audiotestsrc alone takes to produce the
+ * same audio is measured first and subtracted, so the figures are the cost of the chain.
+ *
+ * Usage
+ *   audio-quality-profiles [--profile=NAME] [--uri=URI]
+ *   audio-quality-profiles --benchmark [--seconds=N] [--channels=N]
+ *
+ * It also needs the base library: add gstreamer-base-1.0 to the pkg-config line.
+ *
+ */
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* One profile. Enum properties are given by their nicks */
+typedef struct _Profile {
+	const gchar *name;
+	const gchar *resample_method;
+	gint quality;
+	const gchar *sinc_filter_mode;
+	const gchar *dithering;
+	const gchar *noise_shaping;
+	const gchar *rate_change_profile;       /* Profile whose resampler settings are used when the rate changes, or NULL */
+} Profile;
+
+static const Profile profiles[] = {
+	{ "passthrough", "nearest", 0, "auto", "none", "none", "balanced" },
+	{ "low-latency", "linear", 0, "auto", "none", "none", NULL },
+	{ "balanced", "kaiser", 4, "auto", "tpdf", "none", NULL },
+	{ "high-quality", "kaiser", 10, "full", "tpdf-hf", "high", NULL },
+};
+
+/* Benchmark cases: what comes out of the source and what the sink wants */
+typedef struct _BenchCase {
+	const gchar *name;
+	const gchar *in_format;
+	gint in_rate;
+	const gchar *out_format;
+	gint out_rate;
+} BenchCase;
+
+static const BenchCase bench_cases[] = {
+	{ "matching", "S16LE", 44100, "S16LE", 44100 },
+	{ "rate", "S16LE", 44100, "S16LE", 48000 },
+	{ "depth", "F32LE", 48000, "S16LE", 48000 },
+};
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GstElement *source;
+	GstElement *convert;
+	GstElement *resample;
+	GstElement *sink;
+} CustomData;
+
+static gchar *profile_name = NULL;
+static gchar *uri = NULL;
+static gboolean benchmark = FALSE;
+static gint seconds = 60;
+static gint channels = 2;
+
+static GOptionEntry entries[] = {
+	{ "profile", 'p', 0, G_OPTION_ARG_STRING, &profile_name, "passthrough, low-latency, balanced or high-quality (default: balanced)", "NAME" },
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play (default: sintel trailer)", "URI" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Measure the CPU cost of every profile", NULL },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Seconds of audio per benchmark run (default: 60)", "N" },
+	{ "channels", 'c', 0, G_OPTION_ARG_INT, &channels, "Channels in the benchmark (default: 2)", "N" },
+	{ NULL }
+};
+
+static const Profile *find_profile (const gchar *name) {
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (profiles); i++)
+		if (g_str_equal (profiles[i].name, name))
+			return &profiles[i];
+	return NULL;
+}
+
+static void apply_resampler (const Profile *profile, GstElement *resample) {
+	gst_util_set_object_arg (G_OBJECT (resample), "resample-method", profile->resample_method);
+	g_object_set (resample, "quality", profile->quality, NULL);
+	gst_util_set_object_arg (G_OBJECT (resample), "sinc-filter-mode", profile->sinc_filter_mode);
+}
+
+/* Sees the caps reaching audioresample before it does. If downstream cannot take the input rate, the rate has to
+ * change, and the resampler gets the settings of the rate change profile instead of the cheap ones */
+static GstPadProbeReturn rate_change_probe (GstPad *pad, GstPadProbeInfo *info, const Profile *profile) {
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+	GstElement *resample;
+	GstPad *src_pad;
+	GstCaps *caps, *allowed, *rate_caps;
+	gint rate;
+	gboolean same_rate = TRUE;
+
+	if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+		return GST_PAD_PROBE_OK;
+	gst_event_parse_caps (event, &caps);
+	if (!gst_structure_get_int (gst_caps_get_structure (caps, 0), "rate", &rate))
+		return GST_PAD_PROBE_OK;
+
+	resample = gst_pad_get_parent_element (pad);
+	src_pad = gst_element_get_static_pad (resample, "src");
+	allowed = gst_pad_peer_query_caps (src_pad, NULL);
+	if (allowed) {
+		rate_caps = gst_caps_new_simple ("audio/x-raw", "rate", G_TYPE_INT, rate, NULL);
+		same_rate = gst_caps_can_intersect (rate_caps, allowed);
+		gst_caps_unref (rate_caps);
+		gst_caps_unref (allowed);
+	}
+	apply_resampler (same_rate ? profile : find_profile (profile->rate_change_profile), resample);
+	gst_object_unref (src_pad);
+	gst_object_unref (resample);
+	return GST_PAD_PROBE_OK;
+}
+
+static void apply_profile (const Profile *profile, GstElement *convert, GstElement *resample) {
+	apply_resampler (profile, resample);
+	gst_util_set_object_arg (G_OBJECT (convert), "dithering", profile->dithering);
+	gst_util_set_object_arg (G_OBJECT (convert), "noise-shaping", profile->noise_shaping);
+
+	if (profile->rate_change_profile) {
+		GstPad *pad = gst_element_get_static_pad (resample, "sink");
+
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) rate_change_probe,
+				(gpointer) profile, NULL);
+		gst_object_unref (pad);
+	}
+}
+
+static void print_passthrough (GstElement *convert, GstElement *resample) {
+	g_print ("audioconvert: %s, audioresample: %s\n",
+			gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (convert)) ? "passthrough" : "converting",
+			gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (resample)) ? "passthrough" : "resampling");
+}
+
+static gdouble cpu_seconds (void) {
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Runs one profile on one case as fast as possible. Without a profile, only the source runs, which gives the
+ * baseline of the case. Returns the CPU seconds, or a negative value */
+static gdouble run_bench (const Profile *profile, const BenchCase *bench, gboolean *passthrough) {
+	gint samples_per_buffer = 1024;
+	gchar *source = g_strdup_printf ("audiotestsrc wave=pink-noise num-buffers=%d samplesperbuffer=%d ! "
+			"audio/x-raw,format=%s,rate=%d,channels=%d", seconds * bench->in_rate / samples_per_buffer, samples_per_buffer,
+			bench->in_format, bench->in_rate, channels);
+	gchar *description = profile ?
+			g_strdup_printf ("%s ! audioconvert name=convert ! audioresample name=resample ! "
+				"audio/x-raw,format=%s,rate=%d,channels=%d ! fakesink sync=false", source,
+				bench->out_format, bench->out_rate, channels) :
+			g_strdup_printf ("%s ! fakesink sync=false", source);
+	GError *error = NULL;
+	GstElement *pipeline = gst_parse_launch (description, &error);
+	GstElement *convert = NULL, *resample = NULL;
+	GstMessage *msg;
+	GstBus *bus;
+	gdouble start, cpu = -1;
+
+	g_free (source);
+	g_free (description);
+	if (!pipeline) {
+		g_printerr ("Could not build the benchmark pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	if (profile) {
+		convert = gst_bin_get_by_name (GST_BIN (pipeline), "convert");
+		resample = gst_bin_get_by_name (GST_BIN (pipeline), "resample");
+		apply_profile (profile, convert, resample);
+	}
+
+	/* Preroll first, so negotiation is done and we can see what each element decided */
+	gst_element_set_state (pipeline, GST_STATE_PAUSED);
+	gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+	if (profile)
+		*passthrough = gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (convert)) &&
+				gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (resample));
+
+	start = cpu_seconds ();
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS)
+		cpu = cpu_seconds () - start;
+	else
+		g_printerr ("Profile %s failed on case %s.\n", profile ? profile->name : "baseline", bench->name);
+
+	gst_message_unref (msg);
+	gst_object_unref (bus);
+	if (convert)
+		gst_object_unref (convert);
+	if (resample)
+		gst_object_unref (resample);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	return cpu;
+}
+
+static int run_benchmark (void) {
+	gdouble baselines[G_N_ELEMENTS (bench_cases)];
+	guint p, c;
+
+	g_print ("CPU microseconds per channel-second, %d s of %d-channel audio, source alone subtracted:\n", seconds, channels);
+	g_print ("%-14s", "profile");
+	for (c = 0; c < G_N_ELEMENTS (bench_cases); c++)
+		g_print (" %16s", bench_cases[c].name);
+	g_print ("\n");
+
+	/* What audiotestsrc costs on its own for every case */
+	g_print ("%-14s", "(source)");
+	for (c = 0; c < G_N_ELEMENTS (bench_cases); c++) {
+		baselines[c] = run_bench (NULL, &bench_cases[c], NULL);
+		if (baselines[c] < 0)
+			return -1;
+		g_print (" %12.1f    ", baselines[c] * 1e6 / ((gdouble) seconds * channels));
+	}
+	g_print ("\n");
+
+	for (p = 0; p < G_N_ELEMENTS (profiles); p++) {
+		g_print ("%-14s", profiles[p].name);
+		for (c = 0; c < G_N_ELEMENTS (bench_cases); c++) {
+			gboolean passthrough = FALSE;
+			gdouble cpu = run_bench (&profiles[p], &bench_cases[c], &passthrough);
+
+			if (cpu < 0)
+				return -1;
+			/* Measurement noise can make a passthrough run cheaper than the source alone */
+			cpu = MAX (cpu - baselines[c], 0);
+			g_print (" %12.1f %s", cpu * 1e6 / ((gdouble) seconds * channels), passthrough ? "(p)" : "   ");
+		}
+		g_print ("\n");
+	}
+	g_print ("(p): both elements were in passthrough\n");
+	return 0;
+}
+
+/* Handler for the pad-added signal, as in basic-tutorial-3.c */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
+	GstPad *sink_pad = gst_element_get_static_pad (data->convert, "sink");
+	GstCaps *new_pad_caps = gst_pad_get_current_caps (new_pad);
+	const gchar *new_pad_type = gst_structure_get_name (gst_caps_get_structure (new_pad_caps, 0));
+
+	if (!gst_pad_is_linked (sink_pad) && g_str_has_prefix (new_pad_type, "audio/x-raw") &&
+			GST_PAD_LINK_FAILED (gst_pad_link (new_pad, sink_pad)))
+		g_print ("Type is '%s' but link failed.\n", new_pad_type);
+	gst_caps_unref (new_pad_caps);
+	gst_object_unref (sink_pad);
+}
+
+static int run_playback (const Profile *profile) {
+	CustomData data;
+	GstBus *bus;
+	GstMessage *msg;
+	gboolean terminate = FALSE;
+
+	data.source = gst_element_factory_make ("uridecodebin", "source");
+	data.convert = gst_element_factory_make ("audioconvert", "convert");
+	data.resample = gst_element_factory_make ("audioresample", "resample");
+	data.sink = gst_element_factory_make ("autoaudiosink", "sink");
+	data.pipeline = gst_pipeline_new ("test-pipeline");
+
+	if (!data.pipeline || !data.source || !data.convert || !data.resample || !data.sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+
+	gst_bin_add_many (GST_BIN (data.pipeline), data.source, data.convert, data.resample, data.sink, NULL);
+	if (!gst_element_link_many (data.convert, data.resample, data.sink, NULL)) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	apply_profile (profile, data.convert, data.resample);
+	g_object_set (data.source, "uri", uri ? uri : DEFAULT_URI, NULL);
+	g_signal_connect (data.source, "pad-added", G_CALLBACK (pad_added_handler), &data);
+
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Listen to the bus */
+	bus = gst_element_get_bus (data.pipeline);
+	do {
+		msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+
+		switch (GST_MESSAGE_TYPE (msg)) {
+			case GST_MESSAGE_ERROR: {
+				GError *err;
+				gchar *debug_info;
+
+				gst_message_parse_error (msg, &err, &debug_info);
+				g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+				g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+				g_clear_error (&err);
+				g_free (debug_info);
+				terminate = TRUE;
+				break;
+			}
+			case GST_MESSAGE_EOS:
+				g_print ("End-Of-Stream reached.\n");
+				terminate = TRUE;
+				break;
+			case GST_MESSAGE_STATE_CHANGED:
+				/* Negotiation is done once the pipeline plays */
+				if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data.pipeline)) {
+					GstState old_state, new_state, pending_state;
+
+					gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+					if (new_state == GST_STATE_PLAYING) {
+						g_print ("Playing with profile %s: ", profile->name);
+						print_passthrough (data.convert, data.resample);
+					}
+				}
+				break;
+			default:
+				break;
+		}
+		gst_message_unref (msg);
+	} while (!terminate);
+
+	gst_object_unref (bus);
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_object_unref (data.pipeline);
+	return 0;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	const Profile *profile;
+	int result;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- audio converter and resampler quality profiles");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	profile = find_profile (profile_name ? profile_name : "balanced");
+	if (!profile) {
+		g_printerr ("Unknown profile '%s'.\n", profile_name);
+		return -1;
+	}
+	if (seconds <= 0 || channels <= 0) {
+		g_printerr ("The duration and the channel count must be positive.\n");
+		return -1;
+	}
+
+	result = benchmark ? run_benchmark () : run_playback (profile);
+	g_free (profile_name);
+	g_free (uri);
+	return result;
+}
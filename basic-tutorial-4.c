@@ -12,8 +12,11 @@
  * If it is allowed, then, once the movie has been running for ten seconds, we skip to a defferent position using a seek.
  *
  * In the previous tutorials, once we had the pipeline setup and running, our main function just sat and waited to receive an ERROR or an EOS through the bus.
- * Here, we modify this function to periodically wake up and query the pipeline for the stream position, so we can print it on the screen.
- * This is similar to what a media player would do, updating the user interface on a periodic basis.
+ * Here, we also want to print the stream position on the screen, similar to what a media player would do, updating the user interface on a periodic basis.
+ * Instead of waking up the main loop periodically to query the pipeline, we ask the pipeline clock to call us back periodically (from its own thread).
+ * The pipeline is only queried when the position jumps, that is when reaching PLAYING and when a seek completes. In between, the position
+ * advances with the clock, so the callback computes it from the last query and the clock time elapsed since, and only posts a message on
+ * the bus when the position actually changed, so the main loop sleeps until there is something to show.
  *
  * Finally, the stream duration is queried and updated whenever it changes.
  *
@@ -28,11 +31,24 @@ typedef struct _CustomData {
 	gboolean seek_enabled; 	/* Is seeking enable for this media? */
 	gboolean seek_done;   	/* Have we performed the seek already? */
 	gint64 duration; 		/* How long does this media last, in nanoseconds */
+
+	GMutex position_lock;		/* Protects position, duration and the anchor, used from the clock thread */
+	gint64 position;		/* Cached stream position, in nanoseconds */
+	gint64 anchor_position;		/* Position returned by the last query */
+	GstClockTime anchor_time;	/* Clock time of that query, GST_CLOCK_TIME_NONE without a clock */
+	GstClockID position_clock_id;	/* Periodic clock notification refreshing the cached position */
 } CustomData;
 
+/* How often the cached position is refreshed */
+#define POSITION_UPDATE_INTERVAL (100 * GST_MSECOND)
+
 /* Forward definition of the message processing function */
 static void handle_message(CustomData* data, GstMessage* msg);
 
+/* Forward definition of the functions that start and stop the clock-driven position updates */
+static void start_position_updates(CustomData* data);
+static void stop_position_updates(CustomData* data);
+
 int main(int argc, char* argv[]) {
 	CustomData data;
 	GstBus* bus;
@@ -44,6 +60,11 @@ int main(int argc, char* argv[]) {
 	data.seek_enabled = FALSE;
 	data.seek_done = FALSE;
 	data.duration = GST_CLOCK_TIME_NONE;
+	data.position = -1;
+	data.anchor_position = -1;
+	data.anchor_time = GST_CLOCK_TIME_NONE;
+	data.position_clock_id = NULL;
+	g_mutex_init(&data.position_lock);
 
 	/* Initialize GStreamer */
 	gst_init(&argc, &argv);
@@ -71,74 +92,152 @@ int main(int argc, char* argv[]) {
 	/* Listen to the bus */
 	bus = gst_element_get_bus(data.playbin);
 	do {
-		/*  Previously, we did not provide a timeout to gst_bus_timed_pop_filtered(), meaming that it didn't return until a message was received.
-		 * Now we use a timeout of 100 milliseconds, so, if no message is received during one tenth of a second, the function will return NULL.
-		 * We are going to use this logic to update our "UI".
-		 *  Note that the desired timeout must be specified as a GstClockTime, hence, in nanoseconds. Numbers expressing different time units then, 
-		 * should be multiplied by macros like GST_SECOND or GST_MSECOND. This also makes your code more readable.  */
-		msg = gst_bus_timed_pop_filtered(bus, 100*GST_MSECOND, 
-			GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_DURATION);
+		/* We do not need a timeout here: position updates arrive as application messages, posted
+		 * from the pipeline clock thread only when the position has changed (see position_clock_cb). */
+		msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+			GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_DURATION | GST_MESSAGE_APPLICATION |
+			GST_MESSAGE_ASYNC_DONE);
 
 		/* Parse message */
 		if(msg != NULL) {
 			handle_message(&data, msg);
-		} else {
-			/* We got no message, this means the timeout expired */
-			if(data.playing) {
-				gint64 current = -1;
-
-
-				/* Query the current position of the stream */
-				if (!gst_element_query_position(data.playbin, GST_FORMAT_TIME, &current)) {
-					g_printerr("Could not query current position.\n");
-				}
-
-				/* If we didn't know it yet, query the stream duration */
-				if(!GST_CLOCK_TIME_IS_VALID(data.duration)) {
-					if(!gst_element_query_duration(data.playbin, GST_FORMAT_TIME, &data.duration)) {
-						g_printerr("Could not query current position.\n");
-					}
-				}
-
-				/* Print current postion and total duration */
-				// Note that usage of the GST_TIME_FORMAT and GST_TIME_ARGS macros to provide a user-friendly representation of GStreamer times.
-				g_print("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r",
-					GST_TIME_ARGS(current), GST_TIME_ARGS(data.duration));
-
-				/* IF seeking is enabled, we have not done it yet, and the time is right, seek */
-				/*
-				 * GST_FORMAT_TIME : This discards all data currently in the pipeline befor doing the seek. Might pause a bit while the pipeline is refilled
-				 *  	and the new data starts to show up, but greatly increases the "responsiveness" of the application.
-				 *  	If this flag is not provided, "stale" data might be shown for a while until the new position apprears at the end of the pipeline.
-				 *
-				 * GST_SEEK_FLAG_KEY_UNIT : With most encoded video data streams, 
-				 * 		seeking to arbitrary positions is not possible but only to certain frames called Key frames. When this flag is used,
-				 * 		the pipeline will actually move to the closest key frame and start producing data straight away. 
-				 * 		If this flag is not used, the pipeline will move internally to the closest key frame (it has no other alternative) but data will not be shown
-				 * 		until it reaches the requested position. This last alternative is more accurate, but might take longer.
-				 *
-				 * GST_SEEK_FLAG_ACCURATE : Some media clips do not provide enough indexing information, 
-				 * 		meaning that seeking to arbitrary position is time-consuming. In these cases, GStreamer usually estimates the position to seek to, and 
-				 * 		usually works just fine. If this precision is not good enough for your case (you see seeks not going to the exact time you asked for ), 
-				 * 		then provide this flag. Be warned that it might take longer to calculate the seeking position (very long, on some files).
-				 */
-				if(data.seek_enabled && !data.seek_done && current > 10 * GST_SECOND) {
-					g_print("\nReached 10s, performing seek...\n");
-					gst_element_seek_simple(data.playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, 30*GST_SECOND);
-					data.seek_done = TRUE;		
-				}
-			}
 		}
 	} while (!data.terminate);
 	
 	/* Free resources */
 	gst_object_unref(bus);
 	gst_element_set_state(data.playbin, GST_STATE_NULL);
+	stop_position_updates(&data);
 	gst_object_unref(data.playbin);
+	g_mutex_clear(&data.position_lock);
 	return 0;
 
 }
 
+/* Queries the pipeline and refreshes the cached position and duration, and the anchor the clock thread
+ * computes the position from. This is only called from the main thread, when reaching PLAYING and when a seek
+ * completes, so the clock thread never has to query the pipeline itself. */
+static void refresh_position_cache(CustomData* data) {
+	gint64 current = -1;
+	GstClock* clock;
+
+	if (!gst_element_query_position(data->playbin, GST_FORMAT_TIME, &current))
+		return;
+
+	g_mutex_lock(&data->position_lock);
+	/* If we didn't know it yet, query the stream duration */
+	if (!GST_CLOCK_TIME_IS_VALID(data->duration)) {
+		if (!gst_element_query_duration(data->playbin, GST_FORMAT_TIME, &data->duration))
+			data->duration = GST_CLOCK_TIME_NONE;
+	}
+	data->position = current;
+
+	/* The pipeline has no clock before its first PLAYING; the clock thread does not run then either */
+	clock = gst_element_get_clock(data->playbin);
+	data->anchor_position = current;
+	data->anchor_time = clock ? gst_clock_get_time(clock) : GST_CLOCK_TIME_NONE;
+	if (clock)
+		gst_object_unref(clock);
+	g_mutex_unlock(&data->position_lock);
+}
+
+/* Called from the clock thread every POSITION_UPDATE_INTERVAL while PLAYING. Within a segment the position
+ * follows the clock, so it is the anchor moved by the clock time elapsed since it was queried. */
+static gboolean position_clock_cb(GstClock* clock, GstClockTime time, GstClockID id, gpointer user_data) {
+	CustomData* data = user_data;
+	gboolean changed = FALSE;
+	gint64 current;
+
+	g_mutex_lock(&data->position_lock);
+	if (GST_CLOCK_TIME_IS_VALID(data->anchor_time)) {
+		current = data->anchor_position + GST_CLOCK_DIFF(data->anchor_time, time);
+		current = MAX(current, 0);
+		if (GST_CLOCK_TIME_IS_VALID(data->duration))
+			current = MIN(current, data->duration);
+		changed = (current != data->position);
+		data->position = current;
+	}
+	g_mutex_unlock(&data->position_lock);
+
+	/* Only wake up the main loop if there is something new to show */
+	if (changed) {
+		gst_element_post_message(data->playbin,
+			gst_message_new_application(GST_OBJECT(data->playbin), gst_structure_new_empty("position-changed")));
+	}
+	return TRUE;
+}
+
+/* Reads the cached position and duration, without querying the pipeline */
+static void get_cached_position(CustomData* data, gint64* position, gint64* duration) {
+	g_mutex_lock(&data->position_lock);
+	*position = data->position;
+	*duration = data->duration;
+	g_mutex_unlock(&data->position_lock);
+}
+
+/* Asks the pipeline clock to call position_clock_cb periodically */
+static void start_position_updates(CustomData* data) {
+	GstClock* clock;
+
+	if (data->position_clock_id)
+		return;
+
+	/* The pipeline selects its clock when going to PLAYING, so it is available now */
+	clock = gst_element_get_clock(data->playbin);
+	if (!clock) {
+		g_printerr("The pipeline has no clock, positions will not be updated.\n");
+		return;
+	}
+	data->position_clock_id = gst_clock_new_periodic_id(clock, gst_clock_get_time(clock), POSITION_UPDATE_INTERVAL);
+	gst_clock_id_wait_async(data->position_clock_id, position_clock_cb, data, NULL);
+	gst_object_unref(clock);
+}
+
+/* Cancels the periodic clock notification, if any */
+static void stop_position_updates(CustomData* data) {
+	if (!data->position_clock_id)
+		return;
+
+	gst_clock_id_unschedule(data->position_clock_id);
+	gst_clock_id_unref(data->position_clock_id);
+	data->position_clock_id = NULL;
+}
+
+/* Called on the main thread when the cached position changed: print it and seek if it is time to */
+static void update_position(CustomData* data) {
+	gint64 current, duration;
+
+	get_cached_position(data, &current, &duration);
+
+	/* Print current postion and total duration */
+	// Note that usage of the GST_TIME_FORMAT and GST_TIME_ARGS macros to provide a user-friendly representation of GStreamer times.
+	g_print("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r",
+		GST_TIME_ARGS(current), GST_TIME_ARGS(duration));
+
+	/* IF seeking is enabled, we have not done it yet, and the time is right, seek */
+	/*
+	 * GST_FORMAT_TIME : This discards all data currently in the pipeline befor doing the seek. Might pause a bit while the pipeline is refilled
+	 *  	and the new data starts to show up, but greatly increases the "responsiveness" of the application.
+	 *  	If this flag is not provided, "stale" data might be shown for a while until the new position apprears at the end of the pipeline.
+	 *
+	 * GST_SEEK_FLAG_KEY_UNIT : With most encoded video data streams, 
+	 * 		seeking to arbitrary positions is not possible but only to certain frames called Key frames. When this flag is used,
+	 * 		the pipeline will actually move to the closest key frame and start producing data straight away. 
+	 * 		If this flag is not used, the pipeline will move internally to the closest key frame (it has no other alternative) but data will not be shown
+	 * 		until it reaches the requested position. This last alternative is more accurate, but might take longer.
+	 *
+	 * GST_SEEK_FLAG_ACCURATE : Some media clips do not provide enough indexing information, 
+	 * 		meaning that seeking to arbitrary position is time-consuming. In these cases, GStreamer usually estimates the position to seek to, and 
+	 * 		usually works just fine. If this precision is not good enough for your case (you see seeks not going to the exact time you asked for ), 
+	 * 		then provide this flag. Be warned that it might take longer to calculate the seeking position (very long, on some files).
+	 */
+	if(data->seek_enabled && !data->seek_done && current > 10 * GST_SECOND) {
+		g_print("\nReached 10s, performing seek...\n");
+		gst_element_seek_simple(data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, 30*GST_SECOND);
+		data->seek_done = TRUE;
+	}
+}
+
 static void handle_message(CustomData* data, GstMessage* msg) {
 	GError* err;
 	gchar* debug_info;
@@ -157,9 +256,23 @@ static void handle_message(CustomData* data, GstMessage* msg) {
 			data->terminate = TRUE;
 			break;
 		case GST_MESSAGE_DURATION:	 // this message is posted on whenever the duration of the stream changes.
-			/* The duration has changed, mark the current on as invalid */
+			/* The duration has changed, query it again */
 			g_print("Get message (GST_MESSAGE_DURATION) ");
-			data->duration = GST_CLOCK_TIME_NONE;
+			g_mutex_lock(&data->position_lock);
+			if (!gst_element_query_duration(data->playbin, GST_FORMAT_TIME, &data->duration))
+				data->duration = GST_CLOCK_TIME_NONE;
+			g_mutex_unlock(&data->position_lock);
+			break;
+		case GST_MESSAGE_ASYNC_DONE:
+			/* A flushing seek completes with an ASYNC_DONE: the position jumped, so anchor it again */
+			if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data->playbin))
+				refresh_position_cache(data);
+			break;
+		case GST_MESSAGE_APPLICATION:
+			/* Posted by position_clock_cb when the cached position changed */
+			if (gst_message_has_name(msg, "position-changed") && data->playing) {
+				update_position(data);
+			}
 			break;
 		case GST_MESSAGE_STATE_CHANGED: {
 			GstState old_state, new_state, pending_state;
@@ -169,6 +282,15 @@ static void handle_message(CustomData* data, GstMessage* msg) {
 				/* Remember whether we are in the PLAYING state or not  */
 				data->playing = (new_state == GST_STATE_PLAYING);
 
+				/* Position updates are only needed while the clock is running. Anchor them
+				 * first, the clock might have been stopped for a while */
+				if(data->playing) {
+					refresh_position_cache(data);
+					start_position_updates(data);
+				}
+				else
+					stop_position_updates(data);
+
 				if(data->playing) {
 					/* We just moved to PLAYING. Check if seeking is possible */
 					GstQuery* query;
@@ -23,6 +23,32 @@
  * This independence comes through the GstVideoOverlay interface, 
  * that allows the application to tell a video sink the handler of the window that should receive the rednering.
  *
+ * Handing a window to whatever sink playbin picks usually means converting colours on the CPU and copying every frame.
+ * When the gtkglsink element is available, this player instead renders through OpenGL: gtkglsink provides its own GTK widget,
+ * which takes the place of the drawing area, and glsinkbin in front of it uploads the frames. Decoders that produce
+ * GL textures or dmabufs are imported without a copy, and the colour conversion runs on the GPU, so playbin is told
+ * to skip its own videoconvert (GST_PLAY_FLAG_NATIVE_VIDEO). Run with --overlay to use the window handle path instead.
+ *
+ * Bus messages do not go through a signal watch either. A sync handler looks at every message on the thread that posts it,
+ * drops the ones the GUI does not use (state changes of elements other than playbin, for instance) and pushes the others
+ * on a lock-free stack. The GTK main thread is woken up once per batch of messages, with g_idle_add(), and only acts on the
+ * newest state change of the batch. Chatty notifications (tags, position) are only posted when the previous one has been
+ * handled, so a burst of tag changes costs the GUI one refresh.
+ *
+ * The position is not queried on every update either. It is queried when the pipeline reaches PAUSED or PLAYING and
+ * after every seek, together with the clock time of the query. Between those, the position only moves with the clock:
+ * each periodic clock notification adds the clock time elapsed since the query, times the playback rate.
+ *
+ * The stream info panel keeps the tags of every stream it shows. When tags change, only the streams whose tag list really
+ * differs are formatted again, only the lines that differ are rewritten in the text buffer, and refreshes are at least
+ * --stream-info-interval milliseconds apart.
+ *
+ * Dragging the slider does not flood the pipeline with flushing seeks. Only one seek is in flight at a time: further
+ * targets replace each other until the pipeline posts ASYNC_DONE, then the newest one is sent. While the slider is held,
+ * the seeks are key-unit trick-mode seeks, so the decoders only decode key frames; releasing it sends a normal seek.
+ * The fast-forward and rewind buttons play at 2x, 4x ... 32x in either direction with the same trick mode, skipping
+ * the non-key frames and the audio. The play button goes back to normal speed.
+ *
  * 
  *
  *
@@ -47,9 +73,34 @@
 #include <gdk/gdkquartz.h>
 #endif
 
+/* playbin flags */
+typedef enum {
+	GST_PLAY_FLAG_NATIVE_VIDEO = (1 << 6) /* Only use native video formats, do not insert videoconvert */
+} GstPlayFlags;
+
+/* Kinds of streams shown in the stream info panel */
+typedef enum {
+	STREAM_VIDEO,
+	STREAM_AUDIO,
+	STREAM_TEXT
+} StreamKind;
+
+/* What the stream info panel shows about one stream */
+typedef struct _StreamInfo {
+	GstTagList *tags;               /* Tags the lines were built from, NULL if the stream has none */
+	GPtrArray *lines;               /* Lines of text describing the stream */
+} StreamInfo;
+
+/* A bus message on its way to the GTK main thread */
+typedef struct _UiEvent {
+	struct _UiEvent *next;
+	GstMessage *msg;
+} UiEvent;
+
 /* Structure to contain all our information, so we can pass it around */
 typedef struct _CustomData {
 	GstElement *playbin;           /* Our one and only pipeline */
+	GtkWidget *video_widget;       /* Widget provided by gtkglsink, NULL when using the window handle (overlay) path */
 
 	GtkWidget *slider;              /* Slider widget to keep track of current position */
 	GtkWidget *streams_list;        /* Text widget to display info about the streams */
@@ -57,8 +108,38 @@ typedef struct _CustomData {
 
 	GstState state;                 /* Current state of the pipeline */
 	gint64 duration;                /* Duration of the clip, in nanoseconds */
+
+	GMutex position_lock;           /* Protects position, duration and the anchor, used from the clock thread */
+	gint64 position;                /* Cached position of the clip, in nanoseconds */
+	gint64 anchor_position;         /* Position returned by the last query */
+	GstClockTime anchor_time;       /* Clock time of that query, GST_CLOCK_TIME_NONE without a clock */
+	gdouble anchor_rate;            /* Playback rate when it was made */
+	gint64 duration_shown;          /* Duration the slider range was last set to, used only by the GTK main thread */
+	GstClockID position_clock_id;   /* Periodic clock notification refreshing the cached position */
+
+	UiEvent *ui_events;             /* Lock-free stack of messages for the GTK main thread, newest first */
+	gint ui_drain_pending;          /* Set while drain_ui_events is scheduled on the GTK main thread */
+	gint tags_pending;              /* Set while a "tags-changed" message is on its way to the GTK main thread */
+	gint position_pending;          /* Same for "position-changed" */
+
+	GPtrArray *stream_infos[3];     /* StreamInfo of every video, audio and text stream */
+	GPtrArray *shown_lines;         /* Lines the stream info text widget shows right now */
+	guint stream_info_interval;     /* Minimum time between two refreshes of the stream info, in milliseconds */
+	gint64 stream_info_updated;     /* When the stream info was last refreshed (monotonic time) */
+	guint stream_info_timeout_id;   /* Pending refresh of the stream info, 0 if none */
+
+	gboolean seek_in_flight;        /* A seek was sent and its ASYNC_DONE has not arrived yet */
+	gint64 pending_seek;            /* Newest target asked for while a seek is in flight, -1 if none */
+	gboolean dragging;              /* The user holds the slider */
+	gdouble rate;                   /* Playback rate; trick modes are used whenever it is not 1.0 */
 } CustomData;
 
+/* How often the cached position is refreshed while playing */
+#define POSITION_UPDATE_INTERVAL GST_SECOND
+
+/* Fastest fast-forward and rewind */
+#define MAX_TRICK_RATE 32.0
+
 /* This function is called when the GUI toolkit creates the physical window that will hold the video.
  *  * At this point we can retrieve its handler (which has a different meaning depending on the windowing system)
  *   * and pass it to GStreamer through the VideoOverlay interface. */
@@ -81,11 +162,74 @@ static void realize_cb (GtkWidget *widget, CustomData *data) {
 	gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->playbin), window_handle);
 }
 
+/* Sends a seek to "position" with the current rate. Held slider and fast rates skip the non-key frames */
+static void send_seek (CustomData *data, gint64 position) {
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+	gboolean ret;
+
+	if (data->rate != 1.0)
+		flags |= GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS | GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+	else if (data->dragging)
+		flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST | GST_SEEK_FLAG_TRICKMODE |
+				GST_SEEK_FLAG_TRICKMODE_KEY_UNITS;
+	else
+		flags |= GST_SEEK_FLAG_KEY_UNIT;
+
+	/* Playing backwards goes from the position down to the start */
+	if (data->rate > 0)
+		ret = gst_element_seek (data->playbin, data->rate, GST_FORMAT_TIME, flags,
+				GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+	else
+		ret = gst_element_seek (data->playbin, data->rate, GST_FORMAT_TIME, flags,
+				GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, position);
+
+	/* A seek that was refused will not be followed by an ASYNC_DONE */
+	data->seek_in_flight = ret;
+}
+
+/* Seeks to "position", or keeps it for later if a seek is still in flight. Only the newest target is kept */
+static void request_seek (CustomData *data, gint64 position) {
+	if (data->seek_in_flight) {
+		data->pending_seek = position;
+		return;
+	}
+	send_seek (data, position);
+}
+
+/* The position to restart from when the rate changes */
+static gint64 current_position (CustomData *data) {
+	gint64 position;
+
+	if (!gst_element_query_position (data->playbin, GST_FORMAT_TIME, &position))
+		position = (gint64)(gtk_range_get_value (GTK_RANGE (data->slider)) * GST_SECOND);
+	return position;
+}
+
+/* Changes the playback rate, restarting from the current position */
+static void set_rate (CustomData *data, gdouble rate) {
+	if (rate == data->rate)
+		return;
+	data->rate = rate;
+	g_print ("Rate set to %gx\n", rate);
+	request_seek (data, current_position (data));
+}
+
 /* This function is called when the PLAY button is clicked */
 static void play_cb (GtkButton *button, CustomData *data) {
+	set_rate (data, 1.0);
 	gst_element_set_state (data->playbin, GST_STATE_PLAYING);
 }
 
+/* This function is called when the FAST FORWARD button is clicked: 2x, then doubles up to MAX_TRICK_RATE */
+static void forward_cb (GtkButton *button, CustomData *data) {
+	set_rate (data, data->rate >= 2.0 ? MIN (data->rate * 2, MAX_TRICK_RATE) : 2.0);
+}
+
+/* Same for REWIND, with negative rates */
+static void rewind_cb (GtkButton *button, CustomData *data) {
+	set_rate (data, data->rate <= -2.0 ? MAX (data->rate * 2, -MAX_TRICK_RATE) : -2.0);
+}
+
 /* This function is called when the PAUSE button is clicked */
 static void pause_cb (GtkButton *button, CustomData *data) {
 	gst_element_set_state (data->playbin, GST_STATE_PAUSED);
@@ -121,11 +265,23 @@ static gboolean draw_cb (GtkWidget *widget, cairo_t *cr, CustomData *data) {
 }
 
 /* This function is called when the slider changes its position. We perform a seek to the
- *  * new position here. */
+ *  * new position here, or queue it behind the one in flight. */
 static void slider_cb (GtkRange *range, CustomData *data) {
 	gdouble value = gtk_range_get_value (GTK_RANGE (data->slider));
-	gst_element_seek_simple (data->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
-			(gint64)(value * GST_SECOND));
+	request_seek (data, (gint64)(value * GST_SECOND));
+}
+
+/* While the slider is held, seeks only decode key frames (see send_seek) */
+static gboolean slider_press_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+	data->dragging = TRUE;
+	return FALSE;
+}
+
+/* When the slider is let go, seek once more to where it ended, without the trick mode */
+static gboolean slider_release_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+	data->dragging = FALSE;
+	request_seek (data, (gint64)(gtk_range_get_value (GTK_RANGE (data->slider)) * GST_SECOND));
+	return FALSE;
 }
 
 /* This creates all the GTK+ widgets that compose our application, and registers the callbacks */
@@ -136,14 +292,20 @@ static void create_ui (CustomData *data) {
 	GtkWidget *main_hbox;    /* HBox to hold the video_window and the stream info text widget */
 	GtkWidget *controls;     /* HBox to hold the buttons and the slider */
 	GtkWidget *play_button, *pause_button, *stop_button; /* Buttons */
+	GtkWidget *rewind_button, *forward_button;
 
 	main_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
 	g_signal_connect (G_OBJECT (main_window), "delete-event", G_CALLBACK (delete_event_cb), data);
 
-	video_window = gtk_drawing_area_new ();
-	gtk_widget_set_double_buffered (video_window, FALSE);
-	g_signal_connect (video_window, "realize", G_CALLBACK (realize_cb), data);
-	g_signal_connect (video_window, "draw", G_CALLBACK (draw_cb), data);
+	if (data->video_widget) {
+		/* gtkglsink draws into its own widget, we just have to place it */
+		video_window = data->video_widget;
+	} else {
+		video_window = gtk_drawing_area_new ();
+		gtk_widget_set_double_buffered (video_window, FALSE);
+		g_signal_connect (video_window, "realize", G_CALLBACK (realize_cb), data);
+		g_signal_connect (video_window, "draw", G_CALLBACK (draw_cb), data);
+	}
 
 	play_button = gtk_button_new_from_icon_name ("media-playback-start", GTK_ICON_SIZE_SMALL_TOOLBAR);
 	g_signal_connect (G_OBJECT (play_button), "clicked", G_CALLBACK (play_cb), data);
@@ -154,9 +316,17 @@ static void create_ui (CustomData *data) {
 	stop_button = gtk_button_new_from_icon_name ("media-playback-stop", GTK_ICON_SIZE_SMALL_TOOLBAR);
 	g_signal_connect (G_OBJECT (stop_button), "clicked", G_CALLBACK (stop_cb), data);
 
+	rewind_button = gtk_button_new_from_icon_name ("media-seek-backward", GTK_ICON_SIZE_SMALL_TOOLBAR);
+	g_signal_connect (G_OBJECT (rewind_button), "clicked", G_CALLBACK (rewind_cb), data);
+
+	forward_button = gtk_button_new_from_icon_name ("media-seek-forward", GTK_ICON_SIZE_SMALL_TOOLBAR);
+	g_signal_connect (G_OBJECT (forward_button), "clicked", G_CALLBACK (forward_cb), data);
+
 	data->slider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL, 0, 100, 1);
 	gtk_scale_set_draw_value (GTK_SCALE (data->slider), 0);
 	data->slider_update_signal_id = g_signal_connect (G_OBJECT (data->slider), "value-changed", G_CALLBACK (slider_cb), data);
+	g_signal_connect (G_OBJECT (data->slider), "button-press-event", G_CALLBACK (slider_press_cb), data);
+	g_signal_connect (G_OBJECT (data->slider), "button-release-event", G_CALLBACK (slider_release_cb), data);
 
 	data->streams_list = gtk_text_view_new ();
 	gtk_text_view_set_editable (GTK_TEXT_VIEW (data->streams_list), FALSE);
@@ -165,6 +335,8 @@ static void create_ui (CustomData *data) {
 	gtk_box_pack_start (GTK_BOX (controls), play_button, FALSE, FALSE, 2);
 	gtk_box_pack_start (GTK_BOX (controls), pause_button, FALSE, FALSE, 2);
 	gtk_box_pack_start (GTK_BOX (controls), stop_button, FALSE, FALSE, 2);
+	gtk_box_pack_start (GTK_BOX (controls), rewind_button, FALSE, FALSE, 2);
+	gtk_box_pack_start (GTK_BOX (controls), forward_button, FALSE, FALSE, 2);
 	gtk_box_pack_start (GTK_BOX (controls), data->slider, TRUE, TRUE, 2);
 
 	main_hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
@@ -180,25 +352,117 @@ static void create_ui (CustomData *data) {
 	gtk_widget_show_all (main_window);
 }
 
-/* This function is called periodically to refresh the GUI */
-static gboolean refresh_ui (CustomData *data) {
+/* Queries the pipeline and refreshes the cached position and duration, and the anchor the clock thread
+ * computes the position from. Returns TRUE if something changed. This is only called from the GTK main
+ * thread, when reaching PAUSED or PLAYING and after a seek, so the GUI never has to query the pipeline itself. */
+static gboolean refresh_position_cache (CustomData *data) {
 	gint64 current = -1;
+	gboolean changed = FALSE;
+	GstClock *clock;
 
-	/* We do not want to update anything unless we are in the PAUSED or PLAYING states */
-	if (data->state < GST_STATE_PAUSED)
-		return TRUE;
+	if (!gst_element_query_position (data->playbin, GST_FORMAT_TIME, &current))
+		return FALSE;
 
+	g_mutex_lock (&data->position_lock);
 	/* If we didn't know it yet, query the stream duration */
 	if (!GST_CLOCK_TIME_IS_VALID (data->duration)) {
-		if (!gst_element_query_duration (data->playbin, GST_FORMAT_TIME, &data->duration)) {
-			g_printerr ("Could not query current duration.\n");
-		} else {
-			/* Set the range of the slider to the clip duration, in SECONDS */
-			gtk_range_set_range (GTK_RANGE (data->slider), 0, (gdouble)data->duration / GST_SECOND);
-		}
+		if (gst_element_query_duration (data->playbin, GST_FORMAT_TIME, &data->duration))
+			changed = TRUE;
+		else
+			data->duration = GST_CLOCK_TIME_NONE;
+	}
+	if (current != data->position) {
+		data->position = current;
+		changed = TRUE;
+	}
+
+	/* The pipeline has no clock before its first PLAYING; the clock thread does not run then either */
+	clock = gst_element_get_clock (data->playbin);
+	data->anchor_position = current;
+	data->anchor_time = clock ? gst_clock_get_time (clock) : GST_CLOCK_TIME_NONE;
+	data->anchor_rate = data->rate;
+	if (clock)
+		gst_object_unref (clock);
+	g_mutex_unlock (&data->position_lock);
+	return changed;
+}
+
+/* Called from the clock thread every POSITION_UPDATE_INTERVAL while PLAYING. Within a segment the running time
+ * follows the clock and the position follows the running time times the rate, so the position is the anchor
+ * moved by the clock time elapsed since it was queried. The GTK main thread is only woken up (through an
+ * application message on the bus) when the position actually changed */
+static gboolean position_clock_cb (GstClock *clock, GstClockTime time, GstClockID id, gpointer user_data) {
+	CustomData *data = user_data;
+	gboolean changed = FALSE;
+	gint64 current;
+
+	g_mutex_lock (&data->position_lock);
+	if (GST_CLOCK_TIME_IS_VALID (data->anchor_time)) {
+		current = data->anchor_position + (gint64)(GST_CLOCK_DIFF (data->anchor_time, time) * data->anchor_rate);
+		current = MAX (current, 0);
+		if (GST_CLOCK_TIME_IS_VALID (data->duration))
+			current = MIN (current, data->duration);
+		changed = current != data->position;
+		data->position = current;
+	}
+	g_mutex_unlock (&data->position_lock);
+
+	/* If the previous notification has not been handled yet, it will show the new position too */
+	if (changed && g_atomic_int_compare_and_exchange (&data->position_pending, 0, 1)) {
+		gst_element_post_message (data->playbin,
+				gst_message_new_application (GST_OBJECT (data->playbin),
+					gst_structure_new_empty ("position-changed")));
+	}
+	return TRUE;
+}
+
+/* Asks the pipeline clock to call position_clock_cb periodically */
+static void start_position_updates (CustomData *data) {
+	GstClock *clock;
+
+	if (data->position_clock_id)
+		return;
+
+	/* The pipeline selects its clock when going to PLAYING, so it is available now */
+	clock = gst_element_get_clock (data->playbin);
+	if (!clock)
+		return;
+	data->position_clock_id = gst_clock_new_periodic_id (clock, gst_clock_get_time (clock), POSITION_UPDATE_INTERVAL);
+	gst_clock_id_wait_async (data->position_clock_id, position_clock_cb, data, NULL);
+	gst_object_unref (clock);
+}
+
+/* Cancels the periodic clock notification, if any */
+static void stop_position_updates (CustomData *data) {
+	if (!data->position_clock_id)
+		return;
+
+	gst_clock_id_unschedule (data->position_clock_id);
+	gst_clock_id_unref (data->position_clock_id);
+	data->position_clock_id = NULL;
+}
+
+/* This function is called to refresh the GUI when the cached position changed */
+static void refresh_ui (CustomData *data) {
+	gint64 current, duration;
+
+	/* We do not want to update anything unless we are in the PAUSED or PLAYING states */
+	if (data->state < GST_STATE_PAUSED)
+		return;
+
+	g_mutex_lock (&data->position_lock);
+	current = data->position;
+	duration = data->duration;
+	g_mutex_unlock (&data->position_lock);
+
+	/* Set the range of the slider to the clip duration, in SECONDS */
+	if (GST_CLOCK_TIME_IS_VALID (duration) && duration != data->duration_shown) {
+		gtk_range_set_range (GTK_RANGE (data->slider), 0, (gdouble)duration / GST_SECOND);
+		data->duration_shown = duration;
 	}
 
-	if (gst_element_query_position (data->playbin, GST_FORMAT_TIME, &current)) {
+	/* Do not move the slider under the user's pointer */
+	if (current >= 0 && !data->dragging) {
 		/* Block the "value-changed" signal, so the slider_cb function is not called
 		 *      * (which would trigger a seek the user has not requested) */
 		g_signal_handler_block (data->slider, data->slider_update_signal_id);
@@ -207,20 +471,22 @@ static gboolean refresh_ui (CustomData *data) {
 		/* Re-enable the signal */
 		g_signal_handler_unblock (data->slider, data->slider_update_signal_id);
 	}
-	return TRUE;
 }
 
 /* This function is called when new metadata is discovered in the stream */
 static void tags_cb (GstElement *playbin, gint stream, CustomData *data) {
 	/* We are possibly in a GStreamer working thread, so we notify the main
-	 *    * thread of this event through a message in the bus */
+	 *    * thread of this event through a message in the bus. One message covers a whole burst of changes:
+	 *    * until the main thread has handled it, there is no need to post another */
+	if (!g_atomic_int_compare_and_exchange (&data->tags_pending, 0, 1))
+		return;
 	gst_element_post_message (playbin,
 			gst_message_new_application (GST_OBJECT (playbin),
 				gst_structure_new_empty ("tags-changed")));
 }
 
 /* This function is called when an error message is posted on the bus */
-static void error_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+static void error_cb (GstMessage *msg, CustomData *data) {
 	GError *err;
 	gchar *debug_info;
 
@@ -237,133 +503,397 @@ static void error_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
 
 /* This function is called when an End-Of-Stream message is posted on the bus.
  *  * We just set the pipeline to READY (which stops playback) */
-static void eos_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+static void eos_cb (GstMessage *msg, CustomData *data) {
 	g_print ("End-Of-Stream reached.\n");
 	gst_element_set_state (data->playbin, GST_STATE_READY);
 }
 
 /* This function is called when the pipeline changes states. We use it to
- *  * keep track of the current state. */
-static void state_changed_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+ *  * keep track of the current state. Only playbin's state changes get here (see bus_sync_handler),
+ *  * and only the newest of a batch, so we compare with the state we knew instead of old_state */
+static void state_changed_cb (GstMessage *msg, CustomData *data) {
 	GstState old_state, new_state, pending_state;
 	gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
 	if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->playbin)) {
+		gboolean reached_paused = data->state < GST_STATE_PAUSED && new_state >= GST_STATE_PAUSED;
+
 		data->state = new_state;
 		g_print ("State set to %s\n", gst_element_state_get_name (new_state));
-		if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED) {
+		if (reached_paused) {
 			/* For extra responsiveness, we refresh the GUI as soon as we reach the PAUSED state */
+			refresh_position_cache (data);
 			refresh_ui (data);
 		}
+
+		/* The position only moves while the clock is running, from where it was when it started again */
+		if (new_state == GST_STATE_PLAYING) {
+			refresh_position_cache (data);
+			start_position_updates (data);
+		} else {
+			stop_position_updates (data);
+		}
+
+		/* Below PAUSED the seeks in flight are gone, and the stream starts again at normal speed */
+		if (new_state < GST_STATE_PAUSED) {
+			data->seek_in_flight = FALSE;
+			data->pending_seek = -1;
+			data->rate = 1.0;
+		}
 	}
 }
 
-/* Extract metadata from all the streams and write it to the text widget in the GUI */
-static void analyze_streams (CustomData *data) {
-	gint i;
-	GstTagList *tags;
-	gchar *str, *total_str;
+/* This function is called when the pipeline has prerolled again, after a state change or a flushing
+ * seek. The seek in flight is done: send the newest target that came in meanwhile, if any */
+static void async_done_cb (GstMessage *msg, CustomData *data) {
+	gint64 target = data->pending_seek;
+
+	data->seek_in_flight = FALSE;
+	data->pending_seek = -1;
+	if (target >= 0)
+		send_seek (data, target);
+
+	/* Show where the seek landed without waiting for the next clock tick. This also moves the anchor to the new segment */
+	if (refresh_position_cache (data))
+		refresh_ui (data);
+}
+
+/* Builds the lines shown for one stream from its tags */
+static void build_stream_lines (StreamKind kind, gint index, GstTagList *tags, GPtrArray *lines) {
+	gchar *str;
 	guint rate;
-	gint n_video, n_audio, n_text;
-	GtkTextBuffer *text;
-
-	/* Clean current contents of the widget */
-	text = gtk_text_view_get_buffer (GTK_TEXT_VIEW (data->streams_list));
-	gtk_text_buffer_set_text (text, "", -1);
-
-	/* Read some properties */
-	g_object_get (data->playbin, "n-video", &n_video, NULL);
-	g_object_get (data->playbin, "n-audio", &n_audio, NULL);
-	g_object_get (data->playbin, "n-text", &n_text, NULL);
-
-	for (i = 0; i < n_video; i++) {
-		tags = NULL;
-		/* Retrieve the stream's video tags */
-		g_signal_emit_by_name (data->playbin, "get-video-tags", i, &tags);
-		if (tags) {
-			total_str = g_strdup_printf ("video stream %d:\n", i);
-			gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-			g_free (total_str);
+
+	switch (kind) {
+		case STREAM_VIDEO:
+			g_ptr_array_add (lines, g_strdup_printf ("video stream %d:", index));
 			gst_tag_list_get_string (tags, GST_TAG_VIDEO_CODEC, &str);
-			total_str = g_strdup_printf ("  codec: %s\n", str ? str : "unknown");
-			gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-			g_free (total_str);
+			g_ptr_array_add (lines, g_strdup_printf ("  codec: %s", str ? str : "unknown"));
 			g_free (str);
-			gst_tag_list_free (tags);
-		}
-	}
-
-	for (i = 0; i < n_audio; i++) {
-		tags = NULL;
-		/* Retrieve the stream's audio tags */
-		g_signal_emit_by_name (data->playbin, "get-audio-tags", i, &tags);
-		if (tags) {
-			total_str = g_strdup_printf ("\naudio stream %d:\n", i);
-			gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-			g_free (total_str);
+			break;
+		case STREAM_AUDIO:
+			g_ptr_array_add (lines, g_strdup (""));
+			g_ptr_array_add (lines, g_strdup_printf ("audio stream %d:", index));
 			if (gst_tag_list_get_string (tags, GST_TAG_AUDIO_CODEC, &str)) {
-				total_str = g_strdup_printf ("  codec: %s\n", str);
-				gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-				g_free (total_str);
+				g_ptr_array_add (lines, g_strdup_printf ("  codec: %s", str));
+				g_free (str);
+			}
+			if (gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &str)) {
+				g_ptr_array_add (lines, g_strdup_printf ("  language: %s", str));
 				g_free (str);
 			}
+			if (gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &rate))
+				g_ptr_array_add (lines, g_strdup_printf ("  bitrate: %d", rate));
+			break;
+		case STREAM_TEXT:
+			g_ptr_array_add (lines, g_strdup (""));
+			g_ptr_array_add (lines, g_strdup_printf ("subtitle stream %d:", index));
 			if (gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &str)) {
-				total_str = g_strdup_printf ("  language: %s\n", str);
-				gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-				g_free (total_str);
+				g_ptr_array_add (lines, g_strdup_printf ("  language: %s", str));
 				g_free (str);
 			}
-			if (gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &rate)) {
-				total_str = g_strdup_printf ("  bitrate: %d\n", rate);
-				gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-				g_free (total_str);
+			break;
+	}
+}
+
+static void stream_info_free (StreamInfo *info) {
+	if (info->tags)
+		gst_tag_list_unref (info->tags);
+	g_ptr_array_unref (info->lines);
+	g_free (info);
+}
+
+/* Brings the model of every stream up to date. Only streams whose tags differ from the ones
+ * the model was built from get their lines formatted again */
+static void update_stream_model (CustomData *data) {
+	static const gchar *count_properties[] = { "n-video", "n-audio", "n-text" };
+	static const gchar *tags_signals[] = { "get-video-tags", "get-audio-tags", "get-text-tags" };
+	StreamKind kind;
+	gint i, n;
+
+	for (kind = STREAM_VIDEO; kind <= STREAM_TEXT; kind++) {
+		GPtrArray *infos = data->stream_infos[kind];
+
+		g_object_get (data->playbin, count_properties[kind], &n, NULL);
+		g_ptr_array_set_size (infos, n);
+
+		for (i = 0; i < n; i++) {
+			StreamInfo *info = g_ptr_array_index (infos, i);
+			GstTagList *tags = NULL;
+
+			/* Retrieve the stream's tags */
+			g_signal_emit_by_name (data->playbin, tags_signals[kind], i, &tags);
+			if (!info) {
+				info = g_new0 (StreamInfo, 1);
+				info->lines = g_ptr_array_new_with_free_func (g_free);
+				g_ptr_array_index (infos, i) = info;
+			} else if ((!tags && !info->tags) || (tags && info->tags && gst_tag_list_is_equal (tags, info->tags))) {
+				/* Nothing changed for this stream */
+				if (tags)
+					gst_tag_list_unref (tags);
+				continue;
 			}
-			gst_tag_list_free (tags);
+
+			if (info->tags)
+				gst_tag_list_unref (info->tags);
+			info->tags = tags;
+			g_ptr_array_set_size (info->lines, 0);
+			if (tags)
+				build_stream_lines (kind, i, tags, info->lines);
 		}
 	}
+}
 
-	for (i = 0; i < n_text; i++) {
-		tags = NULL;
-		/* Retrieve the stream's subtitle tags */
-		g_signal_emit_by_name (data->playbin, "get-text-tags", i, &tags);
-		if (tags) {
-			total_str = g_strdup_printf ("\nsubtitle stream %d:\n", i);
-			gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-			g_free (total_str);
-			if (gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &str)) {
-				total_str = g_strdup_printf ("  language: %s\n", str);
-				gtk_text_buffer_insert_at_cursor (text, total_str, -1);
-				g_free (total_str);
-				g_free (str);
+/* Replaces line "line" of the text buffer, or appends it if the buffer has fewer lines */
+static void set_buffer_line (GtkTextBuffer *text, gint line, const gchar *content) {
+	GtkTextIter start, end;
+	gchar *str = g_strconcat (content, "\n", NULL);
+
+	if (line < gtk_text_buffer_get_line_count (text) - 1) {
+		gtk_text_buffer_get_iter_at_line (text, &start, line);
+		end = start;
+		gtk_text_iter_forward_line (&end);
+		gtk_text_buffer_delete (text, &start, &end);
+	} else {
+		gtk_text_buffer_get_end_iter (text, &start);
+	}
+	gtk_text_buffer_insert (text, &start, str, -1);
+	g_free (str);
+}
+
+/* Extract metadata from all the streams and write it to the text widget in the GUI.
+ * Only the lines that differ from what the widget shows are rewritten */
+static void analyze_streams (CustomData *data) {
+	GtkTextBuffer *text = gtk_text_view_get_buffer (GTK_TEXT_VIEW (data->streams_list));
+	GtkTextIter start, end;
+	StreamKind kind;
+	guint i, j, line = 0;
+
+	data->stream_info_updated = g_get_monotonic_time ();
+	update_stream_model (data);
+
+	for (kind = STREAM_VIDEO; kind <= STREAM_TEXT; kind++) {
+		for (i = 0; i < data->stream_infos[kind]->len; i++) {
+			StreamInfo *info = g_ptr_array_index (data->stream_infos[kind], i);
+
+			for (j = 0; j < info->lines->len; j++, line++) {
+				const gchar *content = g_ptr_array_index (info->lines, j);
+
+				if (line < data->shown_lines->len && g_str_equal (content, g_ptr_array_index (data->shown_lines, line)))
+					continue;
+				set_buffer_line (text, line, content);
+				if (line < data->shown_lines->len) {
+					g_free (g_ptr_array_index (data->shown_lines, line));
+					g_ptr_array_index (data->shown_lines, line) = g_strdup (content);
+				} else {
+					g_ptr_array_add (data->shown_lines, g_strdup (content));
+				}
 			}
-			gst_tag_list_free (tags);
 		}
 	}
+
+	/* Remove the lines of streams that went away */
+	if (line < data->shown_lines->len) {
+		gtk_text_buffer_get_iter_at_line (text, &start, line);
+		gtk_text_buffer_get_end_iter (text, &end);
+		gtk_text_buffer_delete (text, &start, &end);
+		g_ptr_array_set_size (data->shown_lines, line);
+	}
+}
+
+static gboolean stream_info_timeout_cb (CustomData *data) {
+	data->stream_info_timeout_id = 0;
+	analyze_streams (data);
+	return G_SOURCE_REMOVE;
+}
+
+/* Refreshes the stream info at most once per stream_info_interval. A change arriving sooner
+ * is folded into one refresh at the end of the interval */
+static void schedule_analyze_streams (CustomData *data) {
+	gint64 now = g_get_monotonic_time ();
+	gint64 next = data->stream_info_updated + (gint64) data->stream_info_interval * G_TIME_SPAN_MILLISECOND;
+
+	if (data->stream_info_timeout_id)
+		return;
+	if (now >= next)
+		analyze_streams (data);
+	else
+		data->stream_info_timeout_id = g_timeout_add ((guint) ((next - now) / G_TIME_SPAN_MILLISECOND) + 1,
+				(GSourceFunc) stream_info_timeout_cb, data);
 }
 
 /* This function is called when an "application" message is posted on the bus.
  *  * Here we retrieve the message posted by the tags_cb callback */
-static void application_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+static void application_cb (GstMessage *msg, CustomData *data) {
 	if (g_strcmp0 (gst_structure_get_name (gst_message_get_structure (msg)), "tags-changed") == 0) {
-		/* If the message is the "tags-changed" (only one we are currently issuing), update
-		 *      * the stream info GUI */
-		analyze_streams (data);
+		/* If the message is the "tags-changed", update the stream info GUI. Changes
+		 *      * from now on need a new message */
+		g_atomic_int_set (&data->tags_pending, 0);
+		schedule_analyze_streams (data);
+	} else if (gst_message_has_name (msg, "position-changed")) {
+		/* Posted by position_clock_cb when the cached position changed */
+		g_atomic_int_set (&data->position_pending, 0);
+		refresh_ui (data);
+	}
+}
+
+/* Takes all the pending messages at once. Producers only ever push and the only consumer takes the whole
+ * stack, so a compare-and-swap loop is enough and there is no ABA problem */
+static UiEvent *take_ui_events (CustomData *data) {
+	UiEvent *events;
+
+	do {
+		events = g_atomic_pointer_get (&data->ui_events);
+	} while (!g_atomic_pointer_compare_and_exchange (&data->ui_events, events, NULL));
+	return events;
+}
+
+/* Runs on the GTK main thread: dispatches a batch of messages in the order they were posted */
+static gboolean drain_ui_events (CustomData *data) {
+	UiEvent *events, *event, *fifo = NULL, *last_state = NULL;
+
+	/* Clear the flag first: a message pushed from now on schedules a new drain */
+	g_atomic_int_set (&data->ui_drain_pending, 0);
+	events = take_ui_events (data);
+
+	/* The stack is newest first. Reverse it, and note the newest state change on the way */
+	while (events) {
+		event = events;
+		events = event->next;
+		if (!last_state && GST_MESSAGE_TYPE (event->msg) == GST_MESSAGE_STATE_CHANGED)
+			last_state = event;
+		event->next = fifo;
+		fifo = event;
+	}
+
+	while (fifo) {
+		event = fifo;
+		fifo = event->next;
+		switch (GST_MESSAGE_TYPE (event->msg)) {
+			case GST_MESSAGE_ERROR:
+				error_cb (event->msg, data);
+				break;
+			case GST_MESSAGE_EOS:
+				eos_cb (event->msg, data);
+				break;
+			case GST_MESSAGE_STATE_CHANGED:
+				/* Older state changes of the batch are already out of date */
+				if (event == last_state)
+					state_changed_cb (event->msg, data);
+				break;
+			case GST_MESSAGE_APPLICATION:
+				application_cb (event->msg, data);
+				break;
+			case GST_MESSAGE_ASYNC_DONE:
+				async_done_cb (event->msg, data);
+				break;
+			default:
+				break;
+		}
+		gst_message_unref (event->msg);
+		g_free (event);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+/* Called for every message, on the thread that posts it. Forwards the ones the GUI needs to the GTK
+ * main thread and drops everything, so the bus queue never fills up */
+static GstBusSyncReply bus_sync_handler (GstBus *bus, GstMessage *msg, CustomData *data) {
+	UiEvent *event;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+		case GST_MESSAGE_EOS:
+		case GST_MESSAGE_APPLICATION:
+			break;
+		case GST_MESSAGE_STATE_CHANGED:
+		case GST_MESSAGE_ASYNC_DONE:
+			/* The GUI only follows the state of the whole pipeline */
+			if (GST_MESSAGE_SRC (msg) != GST_OBJECT (data->playbin))
+				return GST_BUS_DROP;
+			break;
+		default:
+			return GST_BUS_DROP;
+	}
+
+	/* Push on the stack, then wake up the main thread unless a drain is already scheduled */
+	event = g_new (UiEvent, 1);
+	event->msg = gst_message_ref (msg);
+	do {
+		event->next = g_atomic_pointer_get (&data->ui_events);
+	} while (!g_atomic_pointer_compare_and_exchange (&data->ui_events, event->next, event));
+	if (g_atomic_int_compare_and_exchange (&data->ui_drain_pending, 0, 1))
+		g_idle_add ((GSourceFunc) drain_ui_events, data);
+
+	return GST_BUS_DROP;
+}
+
+/* Tries to render through OpenGL: glsinkbin uploads and converts the frames on the GPU (importing GL textures and dmabufs
+ * without copies) and gtkglsink shows them in its own widget. Returns FALSE if the GL elements are not available */
+static gboolean setup_gl_sink (CustomData *data) {
+	GstElement *gl_sink, *sink_bin;
+	guint flags;
+
+	gl_sink = gst_element_factory_make ("gtkglsink", "gl_sink");
+	sink_bin = gst_element_factory_make ("glsinkbin", "gl_sink_bin");
+	if (!gl_sink || !sink_bin) {
+		if (gl_sink)
+			gst_object_unref (gl_sink);
+		if (sink_bin)
+			gst_object_unref (sink_bin);
+		return FALSE;
 	}
+
+	g_object_set (sink_bin, "sink", gl_sink, NULL);
+	g_object_get (gl_sink, "widget", &data->video_widget, NULL);
+	g_object_set (data->playbin, "video-sink", sink_bin, NULL);
+
+	/* The conversion is done in GL, so playbin must not insert videoconvert in front of the sink */
+	g_object_get (data->playbin, "flags", &flags, NULL);
+	flags |= GST_PLAY_FLAG_NATIVE_VIDEO;
+	g_object_set (data->playbin, "flags", flags, NULL);
+	return TRUE;
 }
 
 int main(int argc, char *argv[]) {
 	CustomData data;
 	GstStateChangeReturn ret;
 	GstBus *bus;
-
-	/* Initialize GTK */
-	gtk_init (&argc, &argv);
-
-	/* Initialize GStreamer */
-	gst_init (&argc, &argv);
+	guint i;
+
+	gboolean use_overlay = FALSE;
+	gint stream_info_interval = 500;
+	GOptionEntry entries[] = {
+		{ "overlay", 0, 0, G_OPTION_ARG_NONE, &use_overlay, "Render through the window handle instead of OpenGL", NULL },
+		{ "stream-info-interval", 0, 0, G_OPTION_ARG_INT, &stream_info_interval, "Minimum time between two stream info refreshes (default: 500)", "MS" },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GError *error = NULL;
+
+	/* Initialize GTK and GStreamer, letting both of them (and us) parse the command line */
+	context = g_option_context_new ("- GStreamer GTK+ player");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gtk_get_option_group (TRUE));
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to initialize: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
 
 	/* Initialize our data structure */
 	memset (&data, 0, sizeof (data));
 	data.duration = GST_CLOCK_TIME_NONE;
+	data.duration_shown = GST_CLOCK_TIME_NONE;
+	data.position = -1;
+	data.anchor_time = GST_CLOCK_TIME_NONE;
+	data.pending_seek = -1;
+	data.rate = 1.0;
+	g_mutex_init (&data.position_lock);
+	data.stream_info_interval = MAX (stream_info_interval, 0);
+	for (i = 0; i < G_N_ELEMENTS (data.stream_infos); i++)
+		data.stream_infos[i] = g_ptr_array_new_with_free_func ((GDestroyNotify) stream_info_free);
+	data.shown_lines = g_ptr_array_new_with_free_func (g_free);
 
 	/* Create the elements */
 	data.playbin = gst_element_factory_make ("playbin", "playbin");
@@ -376,6 +906,10 @@ int main(int argc, char *argv[]) {
 	/* Set the URI to play */
 	g_object_set (data.playbin, "uri", "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm", NULL);
 
+	/* Prefer the OpenGL rendering path, fall back on GstVideoOverlay (see realize_cb) */
+	if (!use_overlay && !setup_gl_sink (&data))
+		g_print ("gtkglsink is not available, rendering through the window handle.\n");
+
 	/* Connect to interesting signals in playbin */
 	g_signal_connect (G_OBJECT (data.playbin), "video-tags-changed", (GCallback) tags_cb, &data);
 	g_signal_connect (G_OBJECT (data.playbin), "audio-tags-changed", (GCallback) tags_cb, &data);
@@ -384,14 +918,9 @@ int main(int argc, char *argv[]) {
 	/* Create the GUI */
 	create_ui (&data);
 
-	/* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
+	/* Sort the messages where they are posted, and pass the interesting ones to the GTK main thread */
 	bus = gst_element_get_bus (data.playbin);
-	gst_bus_add_signal_watch (bus);
-	g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, &data);
-	g_signal_connect (G_OBJECT (bus), "message::eos", (GCallback)eos_cb, &data);
-	g_signal_connect (G_OBJECT (bus), "message::state-changed", (GCallback)state_changed_cb, &data);
-	g_signal_connect (G_OBJECT (bus), "message::application", (GCallback)application_cb, &data);
-	gst_object_unref (bus);
+	gst_bus_set_sync_handler (bus, (GstBusSyncHandler) bus_sync_handler, &data, NULL);
 
 	/* Start playing */
 	ret = gst_element_set_state (data.playbin, GST_STATE_PLAYING);
@@ -401,14 +930,28 @@ int main(int argc, char *argv[]) {
 		return -1;
 	}
 
-	/* Register a function that GLib will call every second */
-	g_timeout_add_seconds (1, (GSourceFunc)refresh_ui, &data);
-
 	/* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
 	gtk_main ();
 
 	/* Free resources */
 	gst_element_set_state (data.playbin, GST_STATE_NULL);
+	stop_position_updates (&data);
+	gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+	gst_object_unref (bus);
+	g_idle_remove_by_data (&data);
+	if (data.stream_info_timeout_id)
+		g_source_remove (data.stream_info_timeout_id);
+	for (i = 0; i < G_N_ELEMENTS (data.stream_infos); i++)
+		g_ptr_array_unref (data.stream_infos[i]);
+	g_ptr_array_unref (data.shown_lines);
+	while (data.ui_events) {
+		UiEvent *event = data.ui_events;
+
+		data.ui_events = event->next;
+		gst_message_unref (event->msg);
+		g_free (event);
+	}
 	gst_object_unref (data.playbin);
+	g_mutex_clear (&data.position_lock);
 	return 0;
 }
@@ -0,0 +1,554 @@
+/* Batch transcode : many uridecodebin pipelines, run side by side
+ *
+ * Goal
+ *
+ * basic-tutorial-3.c decodes one URI with uridecodebin and links the new pads to an audio chain as they appear.
+ * This program transcodes a whole list of media with the same decode side: every job is one pipeline where
+ * uridecodebin's pads are linked, as they appear, to an encoding branch that ends in a shared muxer and a filesink.
+ *
+ *   uridecodebin --> queue ! videoconvert ! VIDEO-ENCODER --> muxer ! filesink
+ *                \-> queue ! audioconvert ! audioresample ! AUDIO-ENCODER -/
+ *
+ * Nothing synchronizes on the clock (sync=false), so every job runs as fast as the CPU allows. Several jobs run at
+ * once, and the scheduler decides how many:
+ *
+ *   - the limit starts at the number of cores divided by the expected CPU use of one job (--job-cpu), and is then
+ *     refined every second from the CPU time the process actually spends per running job
+ *   - no new job starts while the 1 minute load average is above --max-load times the number of cores, so other work
+ *     on the box (or a previous batch) is not oversubscribed
+ *
+ * Every job reports its progress in percent, its speed as a multiple of real time and the bytes it wrote per second.
+ *
+ * Usage
+ *   batch-transcode [--output-dir=DIR] [--jobs=N] [--job-cpu=1.0] [--max-load=1.0] [--list=FILE]
+ *                   [--video-encoder=DESC] [--audio-encoder=DESC] [--muxer=NAME] [--extension=mkv] [URI|FILE|DIR...]
+ *
+ * Directories are expanded to the regular files they contain, and files to file:// URIs. --jobs fixes the number of
+ * concurrent jobs instead of deriving it. Extra audio or video streams beyond the first of each kind are discarded.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+typedef enum {
+	JOB_WAITING,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_FAILED
+} JobState;
+
+static const gchar *state_names[] = { "waiting", "running", "done", "failed" };
+
+typedef struct _Scheduler Scheduler;
+
+/* One input to transcode */
+typedef struct _Job {
+	Scheduler *scheduler;
+	guint index;
+	gchar *uri;
+	gchar *output;
+	JobState state;
+	GstElement *pipeline;
+	GstElement *muxer;
+	gboolean has_audio, has_video;  /* Streams linked to an encoder, only touched from pad-added */
+	guint bus_watch_id;
+	gint64 start_time;              /* Monotonic time the job started */
+	gint64 end_time;
+	gint64 duration;
+	GMutex lock;                    /* Protects position and bytes_written */
+	gint64 position;                /* End of the last buffer that reached the muxer, in nanoseconds */
+	guint64 bytes_written;          /* Bytes that reached the filesink, written from its streaming thread */
+} Job;
+
+/* Structure to contain all our information, so we can pass it around */
+struct _Scheduler {
+	GMainLoop *loop;
+	GPtrArray *jobs;
+	guint next;                     /* Next job to start */
+	guint running;
+	guint limit;                    /* Jobs allowed to run at once */
+	guint n_cores;
+	gdouble job_cpu;                /* CPU cores one job uses, estimated */
+	gdouble last_cpu;               /* Process CPU time at the previous tick */
+	gint64 last_tick;
+	gint64 start_time;
+	gboolean load_blocked;          /* The previous tick held jobs back because of the load */
+};
+
+static gchar *output_dir = NULL;
+static gint jobs_arg = 0;
+static gdouble job_cpu_arg = 1.0;
+static gdouble max_load = 1.0;
+static gchar *list_file = NULL;
+static gchar *video_encoder = NULL;
+static gchar *audio_encoder = NULL;
+static gchar *muxer_name = NULL;
+static gchar *extension = NULL;
+static gchar **inputs = NULL;
+
+static GOptionEntry entries[] = {
+	{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir, "Directory of the transcoded files (default: transcoded)", "DIR" },
+	{ "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs_arg, "Concurrent jobs, 0 to derive it from the cores and the CPU use (default 0)", "N" },
+	{ "job-cpu", 0, 0, G_OPTION_ARG_DOUBLE, &job_cpu_arg, "Expected CPU cores per job, before it is measured (default 1.0)", "CORES" },
+	{ "max-load", 0, 0, G_OPTION_ARG_DOUBLE, &max_load, "Start no job while the load average per core is above this (default 1.0)", "LOAD" },
+	{ "list", 'l', 0, G_OPTION_ARG_FILENAME, &list_file, "File with one URI or path per line", "FILE" },
+	{ "video-encoder", 0, 0, G_OPTION_ARG_STRING, &video_encoder, "Video encoder description (default: x264enc speed-preset=veryfast)", "DESC" },
+	{ "audio-encoder", 0, 0, G_OPTION_ARG_STRING, &audio_encoder, "Audio encoder description (default: opusenc)", "DESC" },
+	{ "muxer", 'm', 0, G_OPTION_ARG_STRING, &muxer_name, "Muxer factory (default: matroskamux)", "NAME" },
+	{ "extension", 'e', 0, G_OPTION_ARG_STRING, &extension, "Extension of the output files (default: mkv)", "EXT" },
+	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs, NULL, "URI|FILE|DIR..." },
+	{ NULL }
+};
+
+static void schedule (Scheduler *scheduler);
+
+static gdouble cpu_seconds (void) {
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Counts what the job writes */
+static GstPadProbeReturn filesink_probe (GstPad *pad, GstPadProbeInfo *info, Job *job) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+	g_mutex_lock (&job->lock);
+	job->bytes_written += gst_buffer_get_size (buffer);
+	g_mutex_unlock (&job->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Records how far the encoded streams have got. A position query would end at the filesink, which only answers
+ * it in bytes. uridecodebin starts the segments of a file at 0, so the timestamps are positions in the input */
+static GstPadProbeReturn muxer_probe (GstPad *pad, GstPadProbeInfo *info, Job *job) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	gint64 end;
+
+	if (!GST_BUFFER_PTS_IS_VALID (buffer))
+		return GST_PAD_PROBE_OK;
+	end = GST_BUFFER_PTS (buffer) + (GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) : 0);
+
+	g_mutex_lock (&job->lock);
+	job->position = MAX (job->position, end);
+	g_mutex_unlock (&job->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Builds "queue ! CHAIN" as a bin with ghost pads, adds it and links it to the muxer */
+static gboolean add_branch (Job *job, GstPad *new_pad, const gchar *chain) {
+	GError *error = NULL;
+	gchar *description = g_strdup_printf ("queue ! %s", chain);
+	GstElement *branch = gst_parse_bin_from_description (description, TRUE, &error);
+	GstPad *sink_pad, *src_pad, *mux_pad;
+	gboolean ok;
+
+	g_free (description);
+	if (!branch) {
+		g_printerr ("[job %u] Branch '%s' could not be built: %s\n", job->index, chain, error->message);
+		g_clear_error (&error);
+		return FALSE;
+	}
+
+	gst_bin_add (GST_BIN (job->pipeline), branch);
+	src_pad = gst_element_get_static_pad (branch, "src");
+	mux_pad = src_pad ? gst_element_get_compatible_pad (job->muxer, src_pad, NULL) : NULL;
+	sink_pad = gst_element_get_static_pad (branch, "sink");
+	ok = mux_pad && gst_pad_link (src_pad, mux_pad) == GST_PAD_LINK_OK;
+	if (ok)
+		gst_pad_add_probe (mux_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) muxer_probe, job, NULL);
+	gst_element_sync_state_with_parent (branch);
+	ok = ok && gst_pad_link (new_pad, sink_pad) == GST_PAD_LINK_OK;
+	if (!ok)
+		g_printerr ("[job %u] Could not link %s to the muxer.\n", job->index, GST_PAD_NAME (new_pad));
+
+	if (mux_pad)
+		gst_object_unref (mux_pad);
+	if (src_pad)
+		gst_object_unref (src_pad);
+	gst_object_unref (sink_pad);
+	return ok;
+}
+
+/* Discards a stream we do not transcode, so uridecodebin does not stop on a not-linked pad */
+static void discard_pad (Job *job, GstPad *new_pad) {
+	GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+	GstPad *sink_pad;
+
+	g_object_set (sink, "sync", FALSE, "async", FALSE, NULL);
+	gst_bin_add (GST_BIN (job->pipeline), sink);
+	gst_element_sync_state_with_parent (sink);
+	sink_pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_link (new_pad, sink_pad);
+	gst_object_unref (sink_pad);
+}
+
+/* This function will be called by the pad-added signal, as in basic-tutorial-3.c */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, Job *job) {
+	GstCaps *caps = gst_pad_get_current_caps (new_pad);
+	const gchar *type;
+	gboolean linked = FALSE;
+	gchar *chain;
+
+	if (!caps)
+		caps = gst_pad_query_caps (new_pad, NULL);
+	type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+	if (g_str_has_prefix (type, "video/x-raw") && !job->has_video) {
+		chain = g_strdup_printf ("videoconvert ! %s", video_encoder ? video_encoder : "x264enc speed-preset=veryfast");
+		linked = job->has_video = add_branch (job, new_pad, chain);
+		g_free (chain);
+	} else if (g_str_has_prefix (type, "audio/x-raw") && !job->has_audio) {
+		chain = g_strdup_printf ("audioconvert ! audioresample ! %s", audio_encoder ? audio_encoder : "opusenc");
+		linked = job->has_audio = add_branch (job, new_pad, chain);
+		g_free (chain);
+	}
+	if (!linked)
+		discard_pad (job, new_pad);
+	gst_caps_unref (caps);
+}
+
+/* The job is over, one way or the other: free its pipeline and let the next one start */
+static void job_finish (Job *job, JobState state) {
+	Scheduler *scheduler = job->scheduler;
+	gdouble seconds;
+
+	job->state = state;
+	job->end_time = g_get_monotonic_time ();
+	gst_element_set_state (job->pipeline, GST_STATE_NULL);
+	gst_object_unref (job->pipeline);
+	job->pipeline = NULL;
+	job->muxer = NULL;
+	scheduler->running--;
+
+	seconds = (job->end_time - job->start_time) / (gdouble) G_TIME_SPAN_SECOND;
+	g_print ("[job %u] %s in %.1f s: %s\n", job->index, state_names[state], seconds, job->output);
+	schedule (scheduler);
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, Job *job) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("[job %u] Error received from element %s: %s\n", job->index, GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("[job %u] Debugging information: %s\n", job->index, debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			/* Returning G_SOURCE_REMOVE removes the watch */
+			job->bus_watch_id = 0;
+			job_finish (job, JOB_FAILED);
+			return G_SOURCE_REMOVE;
+		case GST_MESSAGE_EOS:
+			job->bus_watch_id = 0;
+			job_finish (job, JOB_DONE);
+			return G_SOURCE_REMOVE;
+		default:
+			break;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/* Creates the pipeline of a job and starts it */
+static gboolean job_start (Job *job) {
+	GstElement *source, *sink;
+	GstBus *bus;
+	GstPad *pad;
+
+	job->pipeline = gst_pipeline_new (NULL);
+	source = gst_element_factory_make ("uridecodebin", "source");
+	job->muxer = gst_element_factory_make (muxer_name ? muxer_name : "matroskamux", "muxer");
+	sink = gst_element_factory_make ("filesink", "sink");
+	if (!source || !job->muxer || !sink) {
+		g_printerr ("[job %u] Not all elements could be created.\n", job->index);
+		if (source)
+			gst_object_unref (source);
+		if (job->muxer)
+			gst_object_unref (job->muxer);
+		if (sink)
+			gst_object_unref (sink);
+		gst_object_unref (job->pipeline);
+		job->pipeline = job->muxer = NULL;
+		return FALSE;
+	}
+
+	g_object_set (source, "uri", job->uri, NULL);
+	/* Faster than real time: nothing waits for the clock */
+	g_object_set (sink, "location", job->output, "sync", FALSE, NULL);
+	gst_bin_add_many (GST_BIN (job->pipeline), source, job->muxer, sink, NULL);
+	gst_element_link (job->muxer, sink);
+	g_signal_connect (source, "pad-added", G_CALLBACK (pad_added_handler), job);
+
+	pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) filesink_probe, job, NULL);
+	gst_object_unref (pad);
+
+	bus = gst_element_get_bus (job->pipeline);
+	job->bus_watch_id = gst_bus_add_watch (bus, (GstBusFunc) bus_cb, job);
+	gst_object_unref (bus);
+
+	job->start_time = g_get_monotonic_time ();
+	job->duration = -1;
+	if (gst_element_set_state (job->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("[job %u] Unable to set the pipeline to the playing state.\n", job->index);
+		g_source_remove (job->bus_watch_id);
+		gst_element_set_state (job->pipeline, GST_STATE_NULL);
+		gst_object_unref (job->pipeline);
+		job->pipeline = job->muxer = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Starts jobs while there is room under the limit and the box is not loaded */
+static void schedule (Scheduler *scheduler) {
+	gboolean blocked = FALSE;
+
+	while (scheduler->next < scheduler->jobs->len && scheduler->running < scheduler->limit) {
+		Job *job = g_ptr_array_index (scheduler->jobs, scheduler->next);
+		gdouble load[1];
+
+		/* Other jobs are running, so the loaded box still makes progress; wait for the load to go down */
+		if (scheduler->running > 0 && getloadavg (load, 1) == 1 && load[0] > max_load * scheduler->n_cores) {
+			blocked = TRUE;
+			break;
+		}
+
+		scheduler->next++;
+		if (job_start (job)) {
+			job->state = JOB_RUNNING;
+			scheduler->running++;
+			g_print ("[job %u] started (%u running, limit %u): %s\n", job->index, scheduler->running, scheduler->limit, job->uri);
+		} else {
+			job->state = JOB_FAILED;
+		}
+	}
+	if (blocked && !scheduler->load_blocked)
+		g_print ("Load average above %.1f per core, holding back new jobs.\n", max_load);
+	scheduler->load_blocked = blocked;
+
+	if (scheduler->running == 0 && scheduler->next >= scheduler->jobs->len)
+		g_main_loop_quit (scheduler->loop);
+}
+
+/* Every second: prints the progress of the running jobs and refines the concurrency limit */
+static guint64 job_bytes_written (Job *job) {
+	guint64 bytes;
+
+	g_mutex_lock (&job->lock);
+	bytes = job->bytes_written;
+	g_mutex_unlock (&job->lock);
+	return bytes;
+}
+
+static gint64 job_position (Job *job) {
+	gint64 position;
+
+	g_mutex_lock (&job->lock);
+	position = job->position;
+	g_mutex_unlock (&job->lock);
+	return position;
+}
+
+static gboolean tick_cb (Scheduler *scheduler) {
+	gint64 now = g_get_monotonic_time ();
+	gdouble cpu = cpu_seconds ();
+	gdouble wall = (now - scheduler->last_tick) / (gdouble) G_TIME_SPAN_SECOND;
+	guint i;
+
+	for (i = 0; i < scheduler->jobs->len; i++) {
+		Job *job = g_ptr_array_index (scheduler->jobs, i);
+		gdouble elapsed, speed;
+		gint64 position;
+
+		if (job->state != JOB_RUNNING)
+			continue;
+		if (job->duration <= 0 && !gst_element_query_duration (job->pipeline, GST_FORMAT_TIME, &job->duration))
+			job->duration = -1;
+		position = job_position (job);
+		elapsed = (now - job->start_time) / (gdouble) G_TIME_SPAN_SECOND;
+		speed = elapsed > 0 ? position / 1e9 / elapsed : 0;
+		if (job->duration > 0)
+			g_print ("[job %u] %5.1f%%  %5.1fx  %8.1f KB/s\n", job->index, 100.0 * MIN (position, job->duration) / job->duration,
+					speed, job_bytes_written (job) / 1024.0 / elapsed);
+		else
+			g_print ("[job %u] %8.1f s  %5.1fx  %8.1f KB/s\n", job->index, position / 1e9, speed,
+					job_bytes_written (job) / 1024.0 / elapsed);
+	}
+
+	/* Measured cores per running job, smoothed, gives the number of jobs the cores can take */
+	if (jobs_arg <= 0 && scheduler->running > 0 && wall > 0) {
+		gdouble measured = (cpu - scheduler->last_cpu) / wall / scheduler->running;
+
+		if (measured > 0.01) {
+			scheduler->job_cpu = 0.7 * scheduler->job_cpu + 0.3 * measured;
+			scheduler->limit = CLAMP ((guint) (scheduler->n_cores / scheduler->job_cpu), 1, 4 * scheduler->n_cores);
+		}
+	}
+	scheduler->last_cpu = cpu;
+	scheduler->last_tick = now;
+
+	schedule (scheduler);
+	return G_SOURCE_CONTINUE;
+}
+
+static gint compare_paths (gconstpointer a, gconstpointer b) {
+	return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Adds a job per URI, file, or regular file of a directory */
+static void add_input (Scheduler *scheduler, const gchar *input) {
+	gchar *uri = NULL;
+
+	if (g_file_test (input, G_FILE_TEST_IS_DIR)) {
+		GDir *dir = g_dir_open (input, 0, NULL);
+		GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+		const gchar *name;
+		guint i;
+
+		while (dir && (name = g_dir_read_name (dir)))
+			g_ptr_array_add (names, g_build_filename (input, name, NULL));
+		if (dir)
+			g_dir_close (dir);
+		/* In a predictable order */
+		g_ptr_array_sort (names, compare_paths);
+		for (i = 0; i < names->len; i++) {
+			const gchar *path = g_ptr_array_index (names, i);
+
+			if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+				add_input (scheduler, path);
+		}
+		g_ptr_array_unref (names);
+		return;
+	}
+
+	if (gst_uri_is_valid (input))
+		uri = g_strdup (input);
+	else
+		uri = gst_filename_to_uri (input, NULL);
+	if (uri) {
+		Job *job = g_new0 (Job, 1);
+		gchar *base = g_path_get_basename (input);
+		gchar *dot = strrchr (base, '.');
+		gchar *name;
+
+		if (dot && dot != base)
+			*dot = '\0';
+		job->scheduler = scheduler;
+		g_mutex_init (&job->lock);
+		job->index = scheduler->jobs->len;
+		job->uri = uri;
+		/* The index keeps the outputs of inputs with the same name apart */
+		name = g_strdup_printf ("%03u-%s.%s", job->index, base, extension ? extension : "mkv");
+		job->output = g_build_filename (output_dir ? output_dir : "transcoded", name, NULL);
+		g_free (name);
+		g_free (base);
+		g_ptr_array_add (scheduler->jobs, job);
+	}
+}
+
+static void job_free (Job *job) {
+	g_mutex_clear (&job->lock);
+	g_free (job->uri);
+	g_free (job->output);
+	g_free (job);
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	Scheduler scheduler;
+	guint i, done = 0;
+	gdouble seconds;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- parallel batch transcoding");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (job_cpu_arg <= 0 || max_load <= 0) {
+		g_printerr ("The CPU per job and the maximum load must be positive.\n");
+		return -1;
+	}
+
+	memset (&scheduler, 0, sizeof (scheduler));
+	scheduler.jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) job_free);
+	scheduler.n_cores = g_get_num_processors ();
+	scheduler.job_cpu = job_cpu_arg;
+	scheduler.limit = jobs_arg > 0 ? (guint) jobs_arg : MAX ((guint) (scheduler.n_cores / job_cpu_arg), 1);
+
+	/* Collect the jobs */
+	if (list_file) {
+		gchar *contents;
+		gchar **lines;
+
+		if (!g_file_get_contents (list_file, &contents, NULL, &error)) {
+			g_printerr ("Could not read %s: %s\n", list_file, error->message);
+			g_clear_error (&error);
+			return -1;
+		}
+		lines = g_strsplit (contents, "\n", -1);
+		for (i = 0; lines[i]; i++) {
+			g_strstrip (lines[i]);
+			if (*lines[i] && *lines[i] != '#')
+				add_input (&scheduler, lines[i]);
+		}
+		g_strfreev (lines);
+		g_free (contents);
+	}
+	for (i = 0; inputs && inputs[i]; i++)
+		add_input (&scheduler, inputs[i]);
+	if (!list_file && !inputs)
+		add_input (&scheduler, DEFAULT_URI);
+	if (scheduler.jobs->len == 0) {
+		g_printerr ("Nothing to transcode.\n");
+		return -1;
+	}
+	if (g_mkdir_with_parents (output_dir ? output_dir : "transcoded", 0755) != 0) {
+		g_printerr ("Could not create the output directory.\n");
+		return -1;
+	}
+	g_print ("%u jobs, %u cores, starting with %u concurrent jobs\n", scheduler.jobs->len, scheduler.n_cores, scheduler.limit);
+
+	scheduler.loop = g_main_loop_new (NULL, FALSE);
+	scheduler.start_time = scheduler.last_tick = g_get_monotonic_time ();
+	scheduler.last_cpu = cpu_seconds ();
+	schedule (&scheduler);
+	g_timeout_add_seconds (1, (GSourceFunc) tick_cb, &scheduler);
+	if (scheduler.running > 0)
+		g_main_loop_run (scheduler.loop);
+
+	/* Summary */
+	seconds = (g_get_monotonic_time () - scheduler.start_time) / (gdouble) G_TIME_SPAN_SECOND;
+	g_print ("\n%-5s %-8s %8s %8s %10s  %s\n", "job", "state", "seconds", "speed", "KB", "output");
+	for (i = 0; i < scheduler.jobs->len; i++) {
+		Job *job = g_ptr_array_index (scheduler.jobs, i);
+		gdouble job_seconds = job->end_time > job->start_time ? (job->end_time - job->start_time) / (gdouble) G_TIME_SPAN_SECOND : 0;
+
+		if (job->state == JOB_DONE)
+			done++;
+		g_print ("%-5u %-8s %8.1f %7.1fx %10.1f  %s\n", job->index, state_names[job->state], job_seconds,
+				job_seconds > 0 ? job->position / 1e9 / job_seconds : 0, job->bytes_written / 1024.0, job->output);
+	}
+	g_print ("%u of %u jobs done in %.1f s, %.2f cores per job measured\n", done, scheduler.jobs->len, seconds, scheduler.job_cpu);
+
+	/* Free resources */
+	g_ptr_array_unref (scheduler.jobs);
+	g_main_loop_unref (scheduler.loop);
+	g_strfreev (inputs);
+	return done == scheduler.jobs->len ? 0 : -1;
+}
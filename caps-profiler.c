@@ -0,0 +1,405 @@
+/* Caps profiler : where pipeline startup time goes during caps negotiation
+ *
+ * Goal
+ *
+ * basic-tutorial-6.c prints the Pad Templates of two factories and the current caps of the sink pad at every state change,
+ * so you can watch negotiation happen. This program measures it instead, while building and starting the same pipeline
+ * (audiotestsrc -> autoaudiosink by default) a number of times:
+ *
+ *   - Every pad of every element (including the ones autoaudiosink creates inside itself) gets a query probe.
+ *     The probe fires before (PUSH) and after (PULL) a pad answers a CAPS or ACCEPT_CAPS query, and the time in
+ *     between is charged to the element owning the pad. Queries nest (an element answers a caps query by querying
+ *     its peers), so a per-thread stack separates the time an element spent itself from the time spent downstream.
+ *   - A query answered by a pad while its peer was waiting for it crossed a link: that time is charged to the link,
+ *     and the link with the largest total is reported as the bottleneck.
+ *   - Every CAPS event is counted per pad; any CAPS event after the first one on a pad is a renegotiation.
+ *   - The time from setting PLAYING to ASYNC_DONE is the startup time of the iteration.
+ *
+ * Before the first iteration, the template caps of the two factories are merged per direction to print them and to
+ * reject impossible links before asking any pad. There is no need to cache them across iterations: GstStaticCaps
+ * parses its string the first time it is used and keeps the result, so elements created later do not parse it again.
+ *
+ * Usage
+ *   caps-profiler [--source=audiotestsrc] [--sink=autoaudiosink] [--iterations=10]
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+/* Parsed template caps of one factory, merged per direction */
+typedef struct _FactoryCaps {
+	GstElementFactory *factory;
+	GstCaps *src_caps;
+	GstCaps *sink_caps;
+} FactoryCaps;
+
+/* Time spent answering caps queries, per element or per link */
+typedef struct _QueryStats {
+	gchar *name;
+	guint queries;
+	GstClockTime self_time;         /* Element: time spent in its own pads. Link: time spent answering across it */
+	guint caps_events;              /* Used for pads only */
+} QueryStats;
+
+/* One query being answered on this thread */
+typedef struct _QueryFrame {
+	GstPad *pad;
+	GstClockTime start;
+	GstClockTime child_time;        /* Time spent in nested queries */
+} QueryFrame;
+
+static gchar *source_name = NULL;
+static gchar *sink_name = NULL;
+static gint iterations = 10;
+
+static GOptionEntry entries[] = {
+	{ "source", 0, 0, G_OPTION_ARG_STRING, &source_name, "Source factory (default audiotestsrc)", "FACTORY" },
+	{ "sink", 0, 0, G_OPTION_ARG_STRING, &sink_name, "Sink factory (default autoaudiosink)", "FACTORY" },
+	{ "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of times the pipeline is built and started (default 10)", "N" },
+	{ NULL }
+};
+
+/* The profile, shared by all streaming threads */
+static GMutex stats_lock;
+static GHashTable *element_stats = NULL;        /* Element name -> QueryStats */
+static GHashTable *link_stats = NULL;           /* "src:pad -> sink:pad" -> QueryStats */
+static GHashTable *pad_stats = NULL;            /* "element:pad" -> QueryStats, for caps events */
+static GPrivate query_stack = G_PRIVATE_INIT ((GDestroyNotify) g_array_unref);
+
+/* Functions below print the Capabilities in a human-friendly format, as in basic-tutorial-6.c */
+static gboolean print_field (GQuark field, const GValue *value, gpointer pfx) {
+	gchar *str = gst_value_serialize (value);
+
+	g_print ("%s %15s: %s\n", (gchar *) pfx, g_quark_to_string (field), str);
+	g_free (str);
+	return TRUE;
+}
+
+static void print_caps (const GstCaps *caps, const gchar *pfx) {
+	guint i;
+	g_return_if_fail (caps != NULL);
+
+	if (gst_caps_is_any (caps)) {
+		g_print ("%sANY\n", pfx);
+		return;
+	}
+
+	if (gst_caps_is_empty (caps)) {
+		g_print ("%sEMPTY\n", pfx);
+		return;
+	}
+
+	for (i = 0; i < gst_caps_get_size (caps); i++) {
+		GstStructure *structure = gst_caps_get_structure (caps, i);
+
+		g_print ("%s%s\n", pfx, gst_structure_get_name (structure));
+		gst_structure_foreach (structure, print_field, (gpointer) pfx);
+	}
+}
+
+static void factory_caps_free (FactoryCaps *entry) {
+	gst_object_unref (entry->factory);
+	gst_caps_unref (entry->src_caps);
+	gst_caps_unref (entry->sink_caps);
+	g_free (entry);
+}
+
+/* Returns the template caps of a factory. gst_static_caps_get() only parses each template the first time */
+static FactoryCaps *factory_caps_new (const gchar *name) {
+	FactoryCaps *entry;
+	const GList *templates;
+
+	entry = g_new0 (FactoryCaps, 1);
+	entry->factory = gst_element_factory_find (name);
+	if (!entry->factory) {
+		g_free (entry);
+		return NULL;
+	}
+
+	entry->src_caps = gst_caps_new_empty ();
+	entry->sink_caps = gst_caps_new_empty ();
+	for (templates = gst_element_factory_get_static_pad_templates (entry->factory); templates; templates = templates->next) {
+		GstStaticPadTemplate *padtemplate = templates->data;
+		GstCaps *caps = gst_static_caps_get (&padtemplate->static_caps);
+
+		if (padtemplate->direction == GST_PAD_SRC)
+			entry->src_caps = gst_caps_merge (entry->src_caps, caps);
+		else if (padtemplate->direction == GST_PAD_SINK)
+			entry->sink_caps = gst_caps_merge (entry->sink_caps, caps);
+		else
+			gst_caps_unref (caps);
+	}
+
+	return entry;
+}
+
+static QueryStats *stats_lookup (GHashTable *table, gchar *name) {
+	QueryStats *stats = g_hash_table_lookup (table, name);
+
+	if (!stats) {
+		stats = g_new0 (QueryStats, 1);
+		stats->name = name;
+		g_hash_table_insert (table, stats->name, stats);
+	} else {
+		g_free (name);
+	}
+	return stats;
+}
+
+static void query_stats_free (QueryStats *stats) {
+	g_free (stats->name);
+	g_free (stats);
+}
+
+/* Times CAPS and ACCEPT_CAPS queries, and counts CAPS events */
+static GstPadProbeReturn profile_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+	GArray *stack;
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_CAPS) {
+			g_mutex_lock (&stats_lock);
+			stats_lookup (pad_stats, g_strdup_printf ("%s:%s", GST_DEBUG_PAD_NAME (pad)))->caps_events++;
+			g_mutex_unlock (&stats_lock);
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	switch (GST_QUERY_TYPE (GST_PAD_PROBE_INFO_QUERY (info))) {
+		case GST_QUERY_CAPS:
+		case GST_QUERY_ACCEPT_CAPS:
+			break;
+		default:
+			return GST_PAD_PROBE_OK;
+	}
+
+	stack = g_private_get (&query_stack);
+	if (!stack) {
+		stack = g_array_new (FALSE, FALSE, sizeof (QueryFrame));
+		g_private_set (&query_stack, stack);
+	}
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_PUSH) {
+		/* The pad is about to answer (or forward) the query */
+		QueryFrame frame = { pad, gst_util_get_timestamp (), 0 };
+		g_array_append_val (stack, frame);
+	} else {
+		/* The pad has answered: charge the time to its element, and to the link if the peer was waiting */
+		QueryFrame frame;
+		GstClockTime total;
+		GstObject *parent = GST_OBJECT_PARENT (pad);
+		QueryStats *stats;
+		guint depth = stack->len;
+
+		/* Failed queries get no PULL probe, so frames above ours may be left over: drop them too */
+		while (depth > 0 && g_array_index (stack, QueryFrame, depth - 1).pad != pad)
+			depth--;
+		if (depth == 0)
+			return GST_PAD_PROBE_OK;
+		frame = g_array_index (stack, QueryFrame, depth - 1);
+		total = gst_util_get_timestamp () - frame.start;
+		g_array_set_size (stack, depth - 1);
+		if (stack->len > 0)
+			g_array_index (stack, QueryFrame, stack->len - 1).child_time += total;
+
+		g_mutex_lock (&stats_lock);
+		if (parent && GST_IS_ELEMENT (parent)) {
+			stats = stats_lookup (element_stats, g_strdup (GST_OBJECT_NAME (parent)));
+			stats->queries++;
+			stats->self_time += total - MIN (total, frame.child_time);
+		}
+		if (stack->len > 0 && g_array_index (stack, QueryFrame, stack->len - 1).pad == GST_PAD_PEER (pad)) {
+			GstPad *src = GST_PAD_IS_SRC (pad) ? pad : GST_PAD_PEER (pad);
+			GstPad *sink = GST_PAD_IS_SRC (pad) ? GST_PAD_PEER (pad) : pad;
+
+			stats = stats_lookup (link_stats, g_strdup_printf ("%s:%s -> %s:%s", GST_DEBUG_PAD_NAME (src), GST_DEBUG_PAD_NAME (sink)));
+			stats->queries++;
+			stats->self_time += total;
+		}
+		g_mutex_unlock (&stats_lock);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean add_pad_probe (GstElement *element, GstPad *pad, gpointer user_data) {
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_BOTH | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+			profile_probe, NULL, NULL);
+	return TRUE;
+}
+
+static void pad_added_cb (GstElement *element, GstPad *pad, gpointer user_data) {
+	add_pad_probe (element, pad, NULL);
+}
+
+/* Probes every pad of a new element, now and when it adds pads later */
+static void profile_element (GstElement *element) {
+	gst_element_foreach_pad (element, add_pad_probe, NULL);
+	g_signal_connect (element, "pad-added", G_CALLBACK (pad_added_cb), NULL);
+}
+
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+	profile_element (element);
+}
+
+/* Builds the pipeline from the factories and returns the startup time, or GST_CLOCK_TIME_NONE on failure */
+static GstClockTime run_iteration (FactoryCaps *source_caps, FactoryCaps *sink_caps) {
+	GstElement *pipeline, *source, *sink;
+	GstClockTime start, startup = GST_CLOCK_TIME_NONE;
+	GstBus *bus;
+	GstMessage *msg;
+
+	/* Ask the factories to instantiate actual elements */
+	source = gst_element_factory_create (source_caps->factory, "source");
+	sink = gst_element_factory_create (sink_caps->factory, "sink");
+	pipeline = gst_pipeline_new ("test-pipeline");
+	if (!pipeline || !source || !sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return GST_CLOCK_TIME_NONE;
+	}
+
+	g_signal_connect (pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), NULL);
+	gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+	if (gst_element_link (source, sink) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (pipeline);
+		return GST_CLOCK_TIME_NONE;
+	}
+
+	/* Go to PLAYING and wait until the pipeline has prerolled, which is when negotiation is over */
+	start = gst_util_get_timestamp ();
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND, GST_MESSAGE_ERROR | GST_MESSAGE_ASYNC_DONE);
+	if (msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ASYNC_DONE) {
+		startup = gst_util_get_timestamp () - start;
+	} else if (msg) {
+		GError *err;
+		gchar *debug_info;
+
+		gst_message_parse_error (msg, &err, &debug_info);
+		g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+		g_clear_error (&err);
+		g_free (debug_info);
+	} else {
+		g_printerr ("The pipeline did not preroll within 10 seconds.\n");
+	}
+	if (msg)
+		gst_message_unref (msg);
+
+	/* Free resources */
+	gst_object_unref (bus);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	return startup;
+}
+
+static gint compare_self_time (gconstpointer a, gconstpointer b) {
+	const QueryStats *sa = a, *sb = b;
+
+	return sa->self_time < sb->self_time ? 1 : sa->self_time > sb->self_time ? -1 : 0;
+}
+
+/* Prints the stats of a table, slowest first */
+static void print_stats (GHashTable *table, const gchar *title) {
+	GList *sorted = g_list_sort (g_hash_table_get_values (table), compare_self_time);
+	GList *l;
+
+	g_print ("\n%s:\n", title);
+	for (l = sorted; l; l = l->next) {
+		QueryStats *stats = l->data;
+		g_print ("  %-50s %6u queries %10.3f ms\n", stats->name, stats->queries, stats->self_time / 1e6);
+	}
+	g_list_free (sorted);
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	FactoryCaps *source_caps, *sink_caps;
+	GstClockTime startup, total = 0, fastest = GST_CLOCK_TIME_NONE, slowest = 0;
+	GHashTableIter iter;
+	QueryStats *stats;
+	gint i, done = 0;
+	guint renegotiations = 0;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- caps negotiation profiler");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	element_stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) query_stats_free);
+	link_stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) query_stats_free);
+	pad_stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) query_stats_free);
+
+	source_caps = factory_caps_new (source_name ? source_name : "audiotestsrc");
+	sink_caps = factory_caps_new (sink_name ? sink_name : "autoaudiosink");
+	if (!source_caps || !sink_caps) {
+		g_printerr ("Not all element factories could be found.\n");
+		return -1;
+	}
+
+	g_print ("Template caps of %s (src):\n", GST_OBJECT_NAME (source_caps->factory));
+	print_caps (source_caps->src_caps, "		");
+	g_print ("Template caps of %s (sink):\n", GST_OBJECT_NAME (sink_caps->factory));
+	print_caps (sink_caps->sink_caps, "		");
+
+	/* The templates are the first step of negotiation: if they do not intersect, no pad needs to be asked */
+	if (!gst_caps_can_intersect (source_caps->src_caps, sink_caps->sink_caps)) {
+		g_printerr ("The templates of %s and %s have no common caps, they can not be linked.\n",
+				GST_OBJECT_NAME (source_caps->factory), GST_OBJECT_NAME (sink_caps->factory));
+		return -1;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		startup = run_iteration (source_caps, sink_caps);
+		if (!GST_CLOCK_TIME_IS_VALID (startup))
+			continue;
+		g_print ("Iteration %d: NULL -> PLAYING took %.3f ms\n", i, startup / 1e6);
+		total += startup;
+		fastest = MIN (fastest, startup);
+		slowest = MAX (slowest, startup);
+		done++;
+	}
+
+	print_stats (element_stats, "Time answering caps queries, per element (own time, nested queries excluded)");
+	print_stats (link_stats, "Time answering caps queries across each link");
+
+	g_print ("\nCaps events per pad:\n");
+	g_hash_table_iter_init (&iter, pad_stats);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats)) {
+		/* Every iteration negotiates once; anything more on a pad is a renegotiation */
+		guint extra = stats->caps_events > (guint) done ? stats->caps_events - done : 0;
+		g_print ("  %-50s %4u (%u renegotiations)\n", stats->name, stats->caps_events, extra);
+		renegotiations += extra;
+	}
+
+	g_print ("\nSummary:\n");
+	if (done > 0)
+		g_print ("  startup: min %.3f ms, avg %.3f ms, max %.3f ms over %d iterations\n",
+				fastest / 1e6, total / 1e6 / done, slowest / 1e6, done);
+	g_print ("  renegotiations: %u\n", renegotiations);
+	if (g_hash_table_size (link_stats) > 0) {
+		GList *sorted = g_list_sort (g_hash_table_get_values (link_stats), compare_self_time);
+
+		stats = sorted->data;
+		g_print ("  bottleneck link: %s (%.3f ms)\n", stats->name, stats->self_time / 1e6);
+		g_list_free (sorted);
+	}
+
+	/* Free resources */
+	factory_caps_free (source_caps);
+	factory_caps_free (sink_caps);
+	g_hash_table_unref (element_stats);
+	g_hash_table_unref (link_stats);
+	g_hash_table_unref (pad_stats);
+	g_free (source_name);
+	g_free (sink_name);
+	return 0;
+}
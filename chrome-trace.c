@@ -0,0 +1,534 @@
+/* Chrome trace : pipeline activity as a timeline
+ *
+ * Goal
+ *
+ * tee-latency-trace.c condenses the pipeline into latency histograms, which say how bad things are but not when,
+ * nor on which thread. This program records a timeline instead, and writes it in the Chrome trace event format
+ * (JSON), which chrome://tracing and ui.perfetto.dev both open:
+ *
+ *   - a GstTracer created by the application hooks every buffer push, buffer list push and pull of every pad, and
+ *     every element state change, as begin/end slices on the thread that does them. A push out of a queue shows up as
+ *     a "dequeue", a push into a queue as an "enqueue", and every queue gets a counter track with its level.
+ *   - the application adds instant events of its own on the main thread: the state changes its bus loop sees, as in
+ *     basic-tutorial-3.c, 4.c and 6.c, the pads uridecodebin adds (pad_added_handler of tutorial 3), and the seek of
+ *     tutorial 4, as a slice from the seek until the pipeline prerolled again.
+ *
+ * Events go to a ring buffer owned by the thread that records them, so recording takes no lock and costs a few stores.
+ * The rings keep the last --ring-size events of every thread: a long capture keeps its end, which is usually where the
+ * stall is. They are written out once the pipeline is back to NULL, with the name of every thread.
+ *
+ * Usage
+ *   chrome-trace [--mode=tutorial3|tutorial4|tutorial6] [--duration=20] [--ring-size=65536] [--output=trace.json]
+ *
+ * tutorial3 plays the audio of the sintel trailer with uridecodebin, tutorial4 plays it with playbin and seeks to 30 s
+ * after 10 s, tutorial6 plays a test tone. Perfetto's protobuf format is not written: its UI imports this JSON as is.
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* One recorded event. Names and categories are interned strings, so recording never copies them */
+typedef struct _TraceEvent {
+	gint64 ts;                      /* Nanoseconds since the tracer was created */
+	const gchar *name;
+	const gchar *cat;
+	gchar phase;                    /* 'B', 'E', 'i' or 'C', as in the trace event format */
+	gint64 value;                   /* Value of a counter */
+	gchar *args;                    /* JSON object with the arguments of an instant event, or NULL */
+} TraceEvent;
+
+/* The events of one thread. Only that thread writes to it */
+typedef struct _ThreadRing {
+	gint64 tid;
+	gchar *name;
+	TraceEvent *events;
+	guint64 head;                   /* Events recorded so far; the ring holds the last ring_size of them */
+} ThreadRing;
+
+/* Extra information about a pad, computed on its first push and kept on the pad */
+typedef struct _PadInfo {
+	const gchar *label;             /* "element:pad" */
+	const gchar *cat;               /* "push", "enqueue" or "dequeue" */
+	GstElement *queue;              /* Queue whose level changes with this push, if any (not a reference) */
+	const gchar *counter;           /* Name of its level counter */
+} PadInfo;
+
+/* A GstTracer writing to the rings */
+typedef struct _ChromeTracer {
+	GstTracer parent;
+} ChromeTracer;
+
+typedef struct _ChromeTracerClass {
+	GstTracerClass parent_class;
+} ChromeTracerClass;
+
+G_DEFINE_TYPE (ChromeTracer, chrome_tracer, GST_TYPE_TRACER);
+
+static gchar *mode = NULL;
+static gint duration = 20;
+static gint ring_size = 65536;
+static gchar *output = NULL;
+
+static GOptionEntry entries[] = {
+	{ "mode", 'm', 0, G_OPTION_ARG_STRING, &mode, "Pipeline to trace: tutorial3, tutorial4 or tutorial6 (default tutorial3)", "MODE" },
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to run (default 20)", "S" },
+	{ "ring-size", 'r', 0, G_OPTION_ARG_INT, &ring_size, "Events kept per thread (default 65536)", "N" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Trace file to write (default trace.json)", "FILE" },
+	{ NULL }
+};
+
+static GPrivate ring_key = G_PRIVATE_INIT (NULL);
+static GMutex rings_lock;           /* Protects rings, not their contents */
+static GPtrArray *rings;
+static GstClockTime trace_start;
+static GQuark pad_info_quark;
+
+static gint64 thread_id (void) {
+#ifdef __linux__
+	return syscall (SYS_gettid);
+#else
+	static gint next_id = 1;
+	return g_atomic_int_add (&next_id, 1);
+#endif
+}
+
+/* The ring of the calling thread, created on its first event */
+static ThreadRing *get_ring (void) {
+	ThreadRing *ring = g_private_get (&ring_key);
+#ifdef __linux__
+	gchar name[16];
+#endif
+
+	if (G_LIKELY (ring))
+		return ring;
+
+	ring = g_new0 (ThreadRing, 1);
+	ring->tid = thread_id ();
+	ring->events = g_new0 (TraceEvent, ring_size);
+#ifdef __linux__
+	/* Streaming threads are named after their pad by GStreamer */
+	if (pthread_getname_np (pthread_self (), name, sizeof (name)) == 0)
+		ring->name = g_strdup (name);
+#endif
+	if (!ring->name)
+		ring->name = g_strdup_printf ("thread %" G_GINT64_FORMAT, ring->tid);
+	g_private_set (&ring_key, ring);
+
+	g_mutex_lock (&rings_lock);
+	g_ptr_array_add (rings, ring);
+	g_mutex_unlock (&rings_lock);
+	return ring;
+}
+
+static void record (gchar phase, const gchar *cat, const gchar *name, gint64 value, gchar *args) {
+	ThreadRing *ring = get_ring ();
+	TraceEvent *event = &ring->events[ring->head % ring_size];
+
+	/* The oldest event makes room */
+	g_free (event->args);
+	event->ts = GST_CLOCK_DIFF (trace_start, gst_util_get_timestamp ());
+	event->phase = phase;
+	event->cat = cat;
+	event->name = name;
+	event->value = value;
+	event->args = args;
+	ring->head++;
+}
+
+/* Adds an application event. "args" is a JSON object, or NULL; it is taken over */
+static void trace_instant (const gchar *name, gchar *args) {
+	record ('i', "app", g_intern_string (name), 0, args);
+}
+
+static const gchar *queue_name (GstObject *object) {
+	GstElement *element = GST_IS_ELEMENT (object) ? GST_ELEMENT (object) : NULL;
+	GstElementFactory *factory = element ? gst_element_get_factory (element) : NULL;
+
+	return factory && g_str_equal (GST_OBJECT_NAME (factory), "queue") ? GST_OBJECT_NAME (element) : NULL;
+}
+
+static PadInfo *get_pad_info (GstPad *pad) {
+	PadInfo *info = g_object_get_qdata (G_OBJECT (pad), pad_info_quark);
+	GstPad *peer;
+	gchar *str;
+
+	if (G_LIKELY (info))
+		return info;
+
+	info = g_new0 (PadInfo, 1);
+	str = g_strdup_printf ("%s:%s", GST_DEBUG_PAD_NAME (pad));
+	info->label = g_intern_string (str);
+	g_free (str);
+	info->cat = "push";
+	if (queue_name (GST_OBJECT_PARENT (pad))) {
+		info->cat = "dequeue";
+		info->queue = GST_ELEMENT (GST_OBJECT_PARENT (pad));
+	} else if ((peer = gst_pad_get_peer (pad))) {
+		if (queue_name (GST_OBJECT_PARENT (peer))) {
+			info->cat = "enqueue";
+			info->queue = GST_ELEMENT (GST_OBJECT_PARENT (peer));
+		}
+		gst_object_unref (peer);
+	}
+	if (info->queue) {
+		str = g_strdup_printf ("%s level", GST_OBJECT_NAME (info->queue));
+		info->counter = g_intern_string (str);
+		g_free (str);
+	}
+
+	/* Two threads may get here for the same pad at once: the first one wins */
+	if (!g_object_replace_qdata (G_OBJECT (pad), pad_info_quark, NULL, info, g_free, NULL)) {
+		g_free (info);
+		info = g_object_get_qdata (G_OBJECT (pad), pad_info_quark);
+	}
+	return info;
+}
+
+static void record_queue_level (PadInfo *info) {
+	guint level;
+
+	if (!info->queue)
+		return;
+	g_object_get (info->queue, "current-level-buffers", &level, NULL);
+	record ('C', "queue", info->counter, level, NULL);
+}
+
+static void do_push_pre (GObject *self, GstClockTime ts, GstPad *pad, GstBuffer *buffer) {
+	PadInfo *info = get_pad_info (pad);
+
+	record ('B', info->cat, info->label, 0, NULL);
+}
+
+static void do_push_post (GObject *self, GstClockTime ts, GstPad *pad, GstFlowReturn res) {
+	PadInfo *info = get_pad_info (pad);
+
+	record ('E', info->cat, info->label, 0, NULL);
+	record_queue_level (info);
+}
+
+static void do_push_list_pre (GObject *self, GstClockTime ts, GstPad *pad, GstBufferList *list) {
+	PadInfo *info = get_pad_info (pad);
+
+	record ('B', info->cat, info->label, 0, NULL);
+}
+
+static void do_pull_range_pre (GObject *self, GstClockTime ts, GstPad *pad, guint64 offset, guint size) {
+	record ('B', "pull", get_pad_info (pad)->label, 0, NULL);
+}
+
+static void do_pull_range_post (GObject *self, GstClockTime ts, GstPad *pad, GstBuffer *buffer, GstFlowReturn res) {
+	record ('E', "pull", get_pad_info (pad)->label, 0, NULL);
+}
+
+static const gchar *state_change_name (GstElement *element, GstStateChange transition) {
+	gchar *str = g_strdup_printf ("%s %s", GST_OBJECT_NAME (element), gst_state_change_get_name (transition));
+	const gchar *name = g_intern_string (str);
+
+	g_free (str);
+	return name;
+}
+
+static void do_change_state_pre (GObject *self, GstClockTime ts, GstElement *element, GstStateChange transition) {
+	record ('B', "state", state_change_name (element, transition), 0, NULL);
+}
+
+static void do_change_state_post (GObject *self, GstClockTime ts, GstElement *element, GstStateChange transition,
+		GstStateChangeReturn result) {
+	record ('E', "state", state_change_name (element, transition), 0, NULL);
+}
+
+static void chrome_tracer_class_init (ChromeTracerClass *klass) {
+}
+
+static void chrome_tracer_init (ChromeTracer *self) {
+	GstTracer *tracer = GST_TRACER (self);
+
+	gst_tracing_register_hook (tracer, "pad-push-pre", G_CALLBACK (do_push_pre));
+	gst_tracing_register_hook (tracer, "pad-push-post", G_CALLBACK (do_push_post));
+	gst_tracing_register_hook (tracer, "pad-push-list-pre", G_CALLBACK (do_push_list_pre));
+	gst_tracing_register_hook (tracer, "pad-push-list-post", G_CALLBACK (do_push_post));
+	gst_tracing_register_hook (tracer, "pad-pull-range-pre", G_CALLBACK (do_pull_range_pre));
+	gst_tracing_register_hook (tracer, "pad-pull-range-post", G_CALLBACK (do_pull_range_post));
+	gst_tracing_register_hook (tracer, "element-change-state-pre", G_CALLBACK (do_change_state_pre));
+	gst_tracing_register_hook (tracer, "element-change-state-post", G_CALLBACK (do_change_state_post));
+}
+
+static void append_json_string (GString *json, const gchar *str) {
+	const gchar *p;
+
+	g_string_append_c (json, '"');
+	for (p = str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			g_string_append_printf (json, "\\%c", *p);
+		else if ((guchar) *p < 0x20)
+			g_string_append_printf (json, "\\u%04x", *p);
+		else
+			g_string_append_c (json, *p);
+	}
+	g_string_append_c (json, '"');
+}
+
+/* Builds a JSON object from key/value string pairs, ending with NULL */
+static gchar *json_args (const gchar *key, ...) {
+	GString *json = g_string_new ("{");
+	va_list ap;
+
+	va_start (ap, key);
+	for (; key; key = va_arg (ap, const gchar *)) {
+		if (json->len > 1)
+			g_string_append_c (json, ',');
+		append_json_string (json, key);
+		g_string_append_c (json, ':');
+		append_json_string (json, va_arg (ap, const gchar *));
+	}
+	va_end (ap);
+	g_string_append_c (json, '}');
+	return g_string_free (json, FALSE);
+}
+
+/* Writes the rings of every thread. Nothing may be recording any more */
+static gboolean write_trace (const gchar *path) {
+	gint pid = getpid ();
+	GString *json = g_string_new ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	GError *error = NULL;
+	guint64 total = 0, lost = 0;
+	gboolean first = TRUE, ok;
+	guint i;
+
+	for (i = 0; i < rings->len; i++) {
+		ThreadRing *ring = g_ptr_array_index (rings, i);
+		guint64 n = MIN (ring->head, (guint64) ring_size);
+		guint64 j;
+
+		g_string_append_printf (json, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%" G_GINT64_FORMAT
+				",\"args\":{\"name\":", first ? "" : ",\n", pid, ring->tid);
+		append_json_string (json, ring->name);
+		g_string_append (json, "}}");
+		first = FALSE;
+
+		for (j = ring->head - n; j < ring->head; j++) {
+			TraceEvent *event = &ring->events[j % ring_size];
+
+			g_string_append (json, ",\n{\"name\":");
+			append_json_string (json, event->name);
+			g_string_append_printf (json, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%" G_GINT64_FORMAT,
+					event->cat, event->phase, event->ts / 1000.0, pid, ring->tid);
+			if (event->phase == 'i')
+				g_string_append (json, ",\"s\":\"t\"");
+			if (event->phase == 'C')
+				g_string_append_printf (json, ",\"args\":{\"buffers\":%" G_GINT64_FORMAT "}", event->value);
+			else if (event->args)
+				g_string_append_printf (json, ",\"args\":%s", event->args);
+			g_string_append_c (json, '}');
+		}
+		total += n;
+		lost += ring->head - n;
+	}
+	g_string_append (json, "\n]}\n");
+
+	ok = g_file_set_contents (path, json->str, json->len, &error);
+	if (ok) {
+		g_print ("Wrote %" G_GUINT64_FORMAT " events of %u threads to %s (%" G_GUINT64_FORMAT " older ones overwritten)\n",
+				total, rings->len, path, lost);
+	} else {
+		g_printerr ("Could not write %s: %s\n", path, error->message);
+		g_clear_error (&error);
+	}
+	g_string_free (json, TRUE);
+	return ok;
+}
+
+/* This function will be called by the pad-added signal, as in basic-tutorial-3.c */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, GstElement *convert) {
+	GstPad *sink_pad = gst_element_get_static_pad (convert, "sink");
+	GstCaps *caps = gst_pad_get_current_caps (new_pad);
+	gchar *caps_str;
+	const gchar *type;
+	gboolean linked = FALSE;
+
+	if (!caps)
+		caps = gst_pad_query_caps (new_pad, NULL);
+	type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+	if (g_str_has_prefix (type, "audio/x-raw") && !gst_pad_is_linked (sink_pad))
+		linked = gst_pad_link (new_pad, sink_pad) == GST_PAD_LINK_OK;
+
+	caps_str = gst_caps_to_string (caps);
+	trace_instant ("pad-added", json_args ("element", GST_OBJECT_NAME (src), "pad", GST_PAD_NAME (new_pad),
+				"caps", caps_str, "linked", linked ? "yes" : "no", NULL));
+	g_free (caps_str);
+	gst_caps_unref (caps);
+	gst_object_unref (sink_pad);
+}
+
+/* The pipeline of the chosen tutorial */
+static GstElement *build_pipeline (gboolean *seek) {
+	GstElement *pipeline, *source, *convert, *resample, *sink;
+	GError *error = NULL;
+
+	*seek = FALSE;
+	if (!mode || g_str_equal (mode, "tutorial3")) {
+		source = gst_element_factory_make ("uridecodebin", "source");
+		convert = gst_element_factory_make ("audioconvert", "convert");
+		resample = gst_element_factory_make ("audioresample", "resample");
+		sink = gst_element_factory_make ("autoaudiosink", "sink");
+		pipeline = gst_pipeline_new ("test-pipeline");
+		if (!pipeline || !source || !convert || !resample || !sink) {
+			g_printerr ("Not all elements could be created.\n");
+			return NULL;
+		}
+
+		/* The source is linked from pad-added, as in the tutorial */
+		gst_bin_add_many (GST_BIN (pipeline), source, convert, resample, sink, NULL);
+		if (!gst_element_link_many (convert, resample, sink, NULL)) {
+			g_printerr ("Elements could not be linked.\n");
+			gst_object_unref (pipeline);
+			return NULL;
+		}
+		g_object_set (source, "uri", DEFAULT_URI, NULL);
+		g_signal_connect (source, "pad-added", G_CALLBACK (pad_added_handler), convert);
+		return pipeline;
+	} else if (g_str_equal (mode, "tutorial4")) {
+		pipeline = gst_parse_launch ("playbin uri=\"" DEFAULT_URI "\"", &error);
+		*seek = TRUE;
+	} else if (g_str_equal (mode, "tutorial6")) {
+		pipeline = gst_parse_launch ("audiotestsrc ! autoaudiosink", &error);
+	} else {
+		g_printerr ("Unknown mode '%s'.\n", mode);
+		return NULL;
+	}
+
+	if (!pipeline) {
+		g_printerr ("Unable to build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+	}
+	return pipeline;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	GstElement *pipeline;
+	GstTracer *tracer;
+	GstBus *bus;
+	GstMessage *msg;
+	gboolean terminate = FALSE, seek, seek_done = FALSE, seek_pending = FALSE;
+	gint64 end_time;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- record pipeline activity as a Chrome trace");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (duration <= 0 || ring_size <= 0) {
+		g_printerr ("The duration and the ring size must be positive.\n");
+		return -1;
+	}
+
+	/* Start tracing before the pipeline exists, so its construction is recorded too */
+	rings = g_ptr_array_new ();
+	pad_info_quark = g_quark_from_static_string ("chrome-trace-pad-info");
+	trace_start = gst_util_get_timestamp ();
+	tracer = g_object_new (chrome_tracer_get_type (), NULL);
+
+	pipeline = build_pipeline (&seek);
+	if (!pipeline)
+		return -1;
+
+	/* Start playing */
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+
+	/* Listen to the bus, like the tutorials do, and mark what they react to */
+	bus = gst_element_get_bus (pipeline);
+	end_time = g_get_monotonic_time () + (gint64) duration * G_TIME_SPAN_SECOND;
+	while (!terminate) {
+		msg = gst_bus_timed_pop_filtered (bus, 100 * GST_MSECOND,
+				GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ASYNC_DONE);
+		if (msg) {
+			GError *err;
+			gchar *debug_info;
+			GstState old_state, new_state, pending_state;
+
+			switch (GST_MESSAGE_TYPE (msg)) {
+				case GST_MESSAGE_ERROR:
+					gst_message_parse_error (msg, &err, &debug_info);
+					g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+					g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+					trace_instant ("error", json_args ("element", GST_OBJECT_NAME (msg->src), "message", err->message, NULL));
+					g_clear_error (&err);
+					g_free (debug_info);
+					terminate = TRUE;
+					break;
+				case GST_MESSAGE_EOS:
+					g_print ("End-Of-Stream reached.\n");
+					trace_instant ("eos", NULL);
+					terminate = TRUE;
+					break;
+				case GST_MESSAGE_STATE_CHANGED:
+					gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+					trace_instant ("state-changed", json_args ("element", GST_OBJECT_NAME (msg->src),
+								"old", gst_element_state_get_name (old_state), "new", gst_element_state_get_name (new_state),
+								"pending", gst_element_state_get_name (pending_state), NULL));
+					if (GST_MESSAGE_SRC (msg) == GST_OBJECT (pipeline))
+						g_print ("Pipeline state changed from %s to %s\n", gst_element_state_get_name (old_state),
+								gst_element_state_get_name (new_state));
+					break;
+				case GST_MESSAGE_ASYNC_DONE:
+					/* The seek is complete once the pipeline prerolled again */
+					if (seek_pending) {
+						record ('E', "app", g_intern_static_string ("seek"), 0, NULL);
+						seek_pending = FALSE;
+					}
+					break;
+				default:
+					break;
+			}
+			gst_message_unref (msg);
+		}
+
+		/* Like basic-tutorial-4.c: after 10 s, jump to 30 s */
+		if (seek && !seek_done) {
+			gint64 current;
+
+			if (gst_element_query_position (pipeline, GST_FORMAT_TIME, &current) && current > 10 * GST_SECOND) {
+				g_print ("Reached 10s, performing seek...\n");
+				record ('B', "app", g_intern_static_string ("seek"), 0, json_args ("target", "30 s", NULL));
+				seek_pending = gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+						GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, 30 * GST_SECOND);
+				if (!seek_pending)
+					record ('E', "app", g_intern_static_string ("seek"), 0, NULL);
+				seek_done = TRUE;
+			}
+		}
+		if (g_get_monotonic_time () >= end_time)
+			terminate = TRUE;
+	}
+
+	/* Free resources. The streaming threads are gone once the pipeline is in NULL, so the rings can be read */
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (bus);
+	gst_object_unref (pipeline);
+	write_trace (output ? output : "trace.json");
+	gst_object_unref (tracer);
+	return 0;
+}
@@ -0,0 +1,421 @@
+/* Converter fast path : negotiating first, converting only when needed
+ *
+ * Goal
+ *
+ * basic-tutorial-2.c links videotestsrc straight to autovideosink, while basic-tutorial-7.c always puts audioconvert
+ * and audioresample in the audio branch and videoconvert in the video branch, in case the formats differ. When they
+ * do not, the converters run in passthrough: they still take part in every caps query, allocation query and buffer
+ * push. This program builds the tutorial 7 graph in two ways:
+ *
+ *   - convert: as the tutorial does, with the converters always there. Once prerolled, it reports which of them ended
+ *     up in passthrough, i.e. did nothing.
+ *   - fast: the formats are negotiated before the graph is linked. The producer and the sinks of every branch are
+ *     brought to READY, where the sinks know the formats of their device, and their caps are queried and printed the
+ *     way print_pad_capabilities of basic-tutorial-6.c does. When the producer and the consumers of a branch have
+ *     formats in common, one of them is fixated (near the tutorial's formats) and pinned with a capsfilter in place
+ *     of the converters. Only a branch without a common format keeps its converters. The audio caps must suit the
+ *     wavescope too, because the tee feeds both branches with the same buffers.
+ *
+ * Both graphs run --iterations times with sinks that do not sync, on --buffers buffers of audio. Every run measures
+ * the startup (from building the graph, negotiation included, to the end of the preroll) and the CPU time per buffer
+ * until EOS. The averages of the two modes are printed side by side.
+ *
+ * Usage
+ *   converter-fastpath [--mode=both|convert|fast] [--buffers=2000] [--iterations=5] [--fakesink]
+ *
+ * --fakesink replaces the audio and video sinks with fakesinks, which accept any format: every converter goes.
+ *
+ * It also needs the base library: add gstreamer-base-1.0 to the pkg-config line.
+ *
+ */
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <gst/base/gstbasetransform.h>
+
+#define AUDIO_CONVERTERS "audioconvert ! audioresample"
+#define VIDEO_CONVERTERS "videoconvert"
+/* What we fixate to when the common formats leave a choice: the defaults of basic-tutorial-7.c */
+#define AUDIO_PREFERRED "audio/x-raw,rate=44100,channels=1"
+#define VIDEO_PREFERRED "video/x-raw,width=320,height=200,framerate=25/1"
+
+/* One branch between the tee and a sink */
+typedef struct _Branch {
+	const gchar *name;              /* "audio" or "video" */
+	GstElement *producer;           /* Element whose output the branch carries */
+	GstElement *last;               /* Element the converters or capsfilter follow */
+	GstElement *middle;             /* The converters, or the capsfilter that replaces them */
+	GstElement *sink;
+	gboolean pinned;                /* The converters were replaced */
+	gint buffers;                   /* Atomic, buffers that reached the sink */
+} Branch;
+
+/* One build and run of the graph */
+typedef struct _Run {
+	GstElement *pipeline;
+	GstElement *source;
+	GstElement *visual;
+	Branch audio;
+	Branch video;
+	gdouble startup_ms;
+	gdouble cpu_us_per_buffer;
+	gdouble buffers_per_s;
+} Run;
+
+static gchar *mode = NULL;
+static gint buffers = 2000;
+static gint iterations = 5;
+static gboolean use_fakesink = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "mode", 'm', 0, G_OPTION_ARG_STRING, &mode, "Graphs to run: both, convert or fast (default: both)", "MODE" },
+	{ "buffers", 'b', 0, G_OPTION_ARG_INT, &buffers, "Audio buffers per run (default: 2000)", "N" },
+	{ "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Runs per graph (default: 5)", "N" },
+	{ "fakesink", 'f', 0, G_OPTION_ARG_NONE, &use_fakesink, "Use fakesinks instead of the audio and video sinks", NULL },
+	{ NULL }
+};
+
+static gdouble cpu_seconds (void) {
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* print_field and print_caps display caps in a human-friendly format, as in basic-tutorial-6.c */
+static gboolean print_field (GQuark field, const GValue *value, gpointer pfx) {
+	gchar *str = gst_value_serialize (value);
+
+	g_print ("%s  %15s: %s\n", (gchar *) pfx, g_quark_to_string (field), str);
+	g_free (str);
+	return TRUE;
+}
+
+static void print_caps (const GstCaps *caps, const gchar *pfx) {
+	guint i;
+
+	if (gst_caps_is_any (caps)) {
+		g_print ("%sANY\n", pfx);
+		return;
+	}
+	if (gst_caps_is_empty (caps)) {
+		g_print ("%sEMPTY\n", pfx);
+		return;
+	}
+	for (i = 0; i < gst_caps_get_size (caps); i++) {
+		GstStructure *structure = gst_caps_get_structure (caps, i);
+
+		g_print ("%s%s\n", pfx, gst_structure_get_name (structure));
+		gst_structure_foreach (structure, print_field, (gpointer) pfx);
+	}
+}
+
+/* The caps a pad of an element in READY can handle: what print_pad_capabilities shows before negotiation */
+static GstCaps *query_pad_caps (GstElement *element, const gchar *pad_name) {
+	GstPad *pad = gst_element_get_static_pad (element, pad_name);
+	GstCaps *caps;
+
+	if (!pad)
+		return gst_caps_new_empty ();
+	caps = gst_pad_query_caps (pad, NULL);
+	gst_object_unref (pad);
+	return caps;
+}
+
+/* Negotiates the format of a branch before it is linked. Returns the fixated caps, or NULL when the producer and
+ * the consumers have no format in common */
+static GstCaps *negotiate (Branch *branch, GstElement *other_consumer, gboolean verbose) {
+	const gchar *preferred = g_str_equal (branch->name, "audio") ? AUDIO_PREFERRED : VIDEO_PREFERRED;
+	GstCaps *produced, *consumed, *common, *caps, *tmp;
+
+	/* Sinks open their device in READY and report what it takes */
+	gst_element_set_state (branch->producer, GST_STATE_READY);
+	gst_element_set_state (branch->sink, GST_STATE_READY);
+	if (other_consumer)
+		gst_element_set_state (other_consumer, GST_STATE_READY);
+
+	produced = query_pad_caps (branch->producer, "src");
+	consumed = query_pad_caps (branch->sink, "sink");
+	common = gst_caps_intersect (produced, consumed);
+	if (other_consumer) {
+		tmp = query_pad_caps (other_consumer, "sink");
+		gst_caps_take (&common, gst_caps_intersect (common, tmp));
+		gst_caps_unref (tmp);
+	}
+	if (verbose) {
+		g_print ("%s branch, the producer (%s) can output:\n", branch->name, GST_OBJECT_NAME (branch->producer));
+		print_caps (produced, "    ");
+		g_print ("%s branch, the sink (%s) accepts:\n", branch->name, GST_OBJECT_NAME (branch->sink));
+		print_caps (consumed, "    ");
+	}
+	gst_caps_unref (produced);
+	gst_caps_unref (consumed);
+
+	if (gst_caps_is_empty (common)) {
+		gst_caps_unref (common);
+		return NULL;
+	}
+
+	/* Prefer the formats of the tutorial, and let fixation pick the rest */
+	tmp = gst_caps_from_string (preferred);
+	caps = gst_caps_intersect (common, tmp);
+	gst_caps_unref (tmp);
+	if (gst_caps_is_empty (caps))
+		gst_caps_replace (&caps, common);
+	gst_caps_unref (common);
+	return gst_caps_fixate (caps);
+}
+
+/* The sinks must not sync, whether we made them or autoaudiosink/autovideosink did */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+	if (GST_IS_BASE_SINK (element))
+		g_object_set (element, "sync", FALSE, NULL);
+}
+
+static GstPadProbeReturn count_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch) {
+	g_atomic_int_inc (&branch->buffers);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Puts the converters or, when the branch has a common format, a capsfilter between branch->last and the sink */
+static gboolean build_branch (Run *run, Branch *branch, gboolean fast, GstElement *other_consumer, gboolean verbose) {
+	GstCaps *caps = fast ? negotiate (branch, other_consumer, verbose) : NULL;
+	GError *error = NULL;
+	GstPad *pad;
+
+	if (caps) {
+		branch->middle = gst_element_factory_make ("capsfilter", NULL);
+		g_object_set (branch->middle, "caps", caps, NULL);
+		branch->pinned = TRUE;
+		if (verbose) {
+			g_print ("%s branch pinned to:\n", branch->name);
+			print_caps (caps, "    ");
+		}
+		gst_caps_unref (caps);
+	} else {
+		if (fast)
+			g_print ("%s branch: no format in common, keeping the converters.\n", branch->name);
+		branch->middle = gst_parse_bin_from_description (g_str_equal (branch->name, "audio") ? AUDIO_CONVERTERS :
+				VIDEO_CONVERTERS, TRUE, &error);
+		if (!branch->middle) {
+			g_printerr ("Could not create the converters: %s\n", error->message);
+			g_clear_error (&error);
+			return FALSE;
+		}
+	}
+
+	gst_bin_add (GST_BIN (run->pipeline), branch->middle);
+	if (!gst_element_link_many (branch->last, branch->middle, branch->sink, NULL)) {
+		g_printerr ("Elements could not be linked.\n");
+		return FALSE;
+	}
+	pad = gst_element_get_static_pad (branch->sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_probe, branch, NULL);
+	gst_object_unref (pad);
+	return TRUE;
+}
+
+/* Builds the basic-tutorial-7.c graph, with or without the fast path */
+static gboolean build (Run *run, gboolean fast, gboolean verbose) {
+	GstElement *tee, *audio_queue, *video_queue;
+	GstPad *tee_audio_pad, *tee_video_pad, *queue_audio_pad, *queue_video_pad;
+	gboolean linked;
+
+	run->source = gst_element_factory_make ("audiotestsrc", "audio_source");
+	tee = gst_element_factory_make ("tee", "tee");
+	audio_queue = gst_element_factory_make ("queue", "audio_queue");
+	run->audio.sink = gst_element_factory_make (use_fakesink ? "fakesink" : "autoaudiosink", "audio_sink");
+	video_queue = gst_element_factory_make ("queue", "video_queue");
+	run->visual = gst_element_factory_make ("wavescope", "visual");
+	run->video.sink = gst_element_factory_make (use_fakesink ? "fakesink" : "autovideosink", "video_sink");
+	run->pipeline = gst_pipeline_new ("test-pipeline");
+	if (!run->pipeline || !run->source || !tee || !audio_queue || !run->audio.sink || !video_queue || !run->visual ||
+			!run->video.sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+
+	g_object_set (run->source, "freq", 215.0, "num-buffers", buffers, NULL);
+	g_object_set (run->visual, "shader", 0, "style", 1, NULL);
+	g_signal_connect (run->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), NULL);
+
+	gst_bin_add_many (GST_BIN (run->pipeline), run->source, tee, audio_queue, run->audio.sink, video_queue,
+			run->visual, run->video.sink, NULL);
+	if (gst_element_link_many (run->source, tee, NULL) != TRUE ||
+			gst_element_link_many (video_queue, run->visual, NULL) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		return FALSE;
+	}
+
+	/* The audio branch carries what audiotestsrc makes, which the wavescope must take too */
+	run->audio.name = "audio";
+	run->audio.producer = run->source;
+	run->audio.last = audio_queue;
+	run->video.name = "video";
+	run->video.producer = run->visual;
+	run->video.last = run->visual;
+	if (!build_branch (run, &run->audio, fast, run->visual, verbose) ||
+			!build_branch (run, &run->video, fast, NULL, verbose))
+		return FALSE;
+
+	/* Manually link the Tee, which has "Request" pads. The pipeline owns them until it is freed */
+	tee_audio_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_audio_pad = gst_element_get_static_pad (audio_queue, "sink");
+	tee_video_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_video_pad = gst_element_get_static_pad (video_queue, "sink");
+	linked = gst_pad_link (tee_audio_pad, queue_audio_pad) == GST_PAD_LINK_OK &&
+			gst_pad_link (tee_video_pad, queue_video_pad) == GST_PAD_LINK_OK;
+	gst_object_unref (queue_audio_pad);
+	gst_object_unref (queue_video_pad);
+	gst_object_unref (tee_audio_pad);
+	gst_object_unref (tee_video_pad);
+	if (!linked)
+		g_printerr ("Tee could not be linked.\n");
+	return linked;
+}
+
+/* Which converters do nothing in the graph as negotiated */
+static void print_passthrough (Branch *branch) {
+	GstIterator *it;
+	GValue item = G_VALUE_INIT;
+
+	if (branch->pinned || !GST_IS_BIN (branch->middle))
+		return;
+	it = gst_bin_iterate_elements (GST_BIN (branch->middle));
+	while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+		GstElement *element = g_value_get_object (&item);
+
+		if (GST_IS_BASE_TRANSFORM (element))
+			g_print ("%s branch: %s %s\n", branch->name, GST_OBJECT_NAME (gst_element_get_factory (element)),
+					gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (element)) ? "runs in passthrough" : "converts");
+		g_value_reset (&item);
+	}
+	g_value_unset (&item);
+	gst_iterator_free (it);
+}
+
+/* Builds, prerolls and runs the graph to EOS. Returns FALSE on error */
+static gboolean run_once (Run *run, gboolean fast, gboolean verbose) {
+	GstClockTime start, playing = GST_CLOCK_TIME_NONE;
+	gboolean terminate = FALSE, ok = FALSE;
+	gdouble cpu_start = 0;
+	GError *err;
+	GstMessage *msg;
+	GstBus *bus;
+	gchar *debug_info;
+
+	memset (run, 0, sizeof (*run));
+	start = gst_util_get_timestamp ();
+	if (!build (run, fast, verbose)) {
+		if (run->pipeline)
+			gst_object_unref (run->pipeline);
+		return FALSE;
+	}
+	if (gst_element_set_state (run->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (run->pipeline);
+		return FALSE;
+	}
+
+	bus = gst_element_get_bus (run->pipeline);
+	do {
+		msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+				GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ASYNC_DONE);
+
+		switch (GST_MESSAGE_TYPE (msg)) {
+			case GST_MESSAGE_ERROR:
+				gst_message_parse_error (msg, &err, &debug_info);
+				g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+				g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+				g_clear_error (&err);
+				g_free (debug_info);
+				terminate = TRUE;
+				break;
+			case GST_MESSAGE_ASYNC_DONE:
+				/* The startup ends with the preroll; from here on it is the cost of the buffers */
+				if (!GST_CLOCK_TIME_IS_VALID (playing)) {
+					playing = gst_util_get_timestamp ();
+					cpu_start = cpu_seconds ();
+					run->startup_ms = (playing - start) / 1e6;
+					if (verbose) {
+						print_passthrough (&run->audio);
+						print_passthrough (&run->video);
+					}
+				}
+				break;
+			case GST_MESSAGE_EOS:
+				ok = terminate = TRUE;
+				break;
+			default:
+				break;
+		}
+		gst_message_unref (msg);
+	} while (!terminate);
+
+	if (ok && GST_CLOCK_TIME_IS_VALID (playing) && run->audio.buffers > 0) {
+		run->cpu_us_per_buffer = (cpu_seconds () - cpu_start) * 1e6 / run->audio.buffers;
+		run->buffers_per_s = run->audio.buffers / ((gst_util_get_timestamp () - playing) / 1e9);
+	}
+
+	gst_object_unref (bus);
+	gst_element_set_state (run->pipeline, GST_STATE_NULL);
+	gst_object_unref (run->pipeline);
+	return ok;
+}
+
+/* Runs one graph --iterations times and prints its averages */
+static gboolean bench (gboolean fast) {
+	gdouble startup = 0, cpu = 0, rate = 0;
+	Run run;
+	gint i;
+
+	g_print ("== %s graph ==\n", fast ? "fast" : "convert");
+	for (i = 0; i < iterations; i++) {
+		if (!run_once (&run, fast, i == 0))
+			return FALSE;
+		startup += run.startup_ms;
+		cpu += run.cpu_us_per_buffer;
+		rate += run.buffers_per_s;
+	}
+	g_print ("%-8s startup %.2f ms, %.2f us CPU per buffer, %.0f buffers/s (audio %s, video %s)\n",
+			fast ? "fast" : "convert", startup / iterations, cpu / iterations, rate / iterations,
+			run.audio.pinned ? "pinned" : "converted", run.video.pinned ? "pinned" : "converted");
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	gboolean ok = TRUE;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- tutorial 7 graph with and without its converters");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (mode && !g_str_equal (mode, "both") && !g_str_equal (mode, "convert") && !g_str_equal (mode, "fast")) {
+		g_printerr ("Unknown mode '%s'.\n", mode);
+		return -1;
+	}
+	if (buffers <= 0 || iterations <= 0) {
+		g_printerr ("The number of buffers and iterations must be positive.\n");
+		return -1;
+	}
+
+	if (!mode || !g_str_equal (mode, "fast"))
+		ok = bench (FALSE);
+	if (ok && (!mode || !g_str_equal (mode, "convert")))
+		ok = bench (TRUE);
+
+	g_free (mode);
+	return ok ? 0 : -1;
+}
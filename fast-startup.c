@@ -0,0 +1,335 @@
+/* Fast startup : warmed registry and cached factory lookups
+ *
+ * Goal
+ *
+ * Every tutorial starts with gst_init() and then creates its elements by name with gst_element_factory_make() (or
+ * gst_element_factory_find() in basic-tutorial-6.c). Both can be slow the first time:
+ *
+ *   - gst_init() loads the registry cache, and when the cache is missing or older than the plugins it scans every
+ *     plugin file it can find. In a fresh container that is every run.
+ *   - each lookup by name goes through the registry (a hash lookup plus locking), and the first element of a factory
+ *     also loads its plugin.
+ *
+ * This program shows the startup mode we want:
+ *
+ *   - the registry lives in a file we own (GST_REGISTRY), built once. When it exists, GST_REGISTRY_UPDATE=no tells
+ *     gst_init() to trust it instead of checking every plugin on disk.
+ *   - the factories of the pipeline are resolved once into a lookup table (a GHashTable from name to factory). Every
+ *     later construction of the pipeline creates its elements from that table with gst_element_factory_create().
+ *   - --preload loads only the listed plugins up front, and --whitelist restricts which plugins are considered at all
+ *     (GST_PLUGIN_LOADING_WHITELIST, for example "gstreamer:gst-plugins-base").
+ *
+ * The pipeline is the one of basic-tutorial-2.c with an audio branch, ending in fakesinks.
+ *
+ * --benchmark spawns the program several times, with the registry file removed before each "cold" run and kept for
+ * the "warm" ones, and prints the time from gst_init() to the first buffer for both.
+ *
+ * Usage
+ *   fast-startup [--registry=FILE] [--preload=coreelements,videotestsrc,...] [--whitelist=SPEC] [--constructions=N]
+ *   fast-startup --benchmark [--runs=N]
+ *
+ */
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+/* The factories the pipeline needs */
+static const gchar *pipeline_factories[] = {
+	"videotestsrc", "videoconvert", "audiotestsrc", "audioconvert", "fakesink"
+};
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GHashTable *factories;          /* Factory name -> GstElementFactory, resolved once */
+	GMutex lock;
+	GCond cond;
+	GstClockTime first_buffer;      /* When the first buffer reached a sink */
+} CustomData;
+
+static gchar *registry_path = NULL;
+static gchar *preload = NULL;
+static gchar *whitelist = NULL;
+static gint constructions = 10;
+static gboolean benchmark = FALSE;
+static gint runs = 5;
+
+static GOptionEntry entries[] = {
+	{ "registry", 'r', 0, G_OPTION_ARG_FILENAME, &registry_path, "Registry cache file (default: in the user cache directory)", "FILE" },
+	{ "preload", 'p', 0, G_OPTION_ARG_STRING, &preload, "Comma-separated list of plugins to load up front", "PLUGINS" },
+	{ "whitelist", 'w', 0, G_OPTION_ARG_STRING, &whitelist, "Only consider these plugins, in GST_PLUGIN_LOADING_WHITELIST syntax", "SPEC" },
+	{ "constructions", 'c', 0, G_OPTION_ARG_INT, &constructions, "How many times the pipeline is built from the lookup table (default: 10)", "N" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Compare cold and warm startups in child processes", NULL },
+	{ "runs", 'n', 0, G_OPTION_ARG_INT, &runs, "Runs of each kind in the benchmark (default: 5)", "N" },
+	{ NULL }
+};
+
+/* gst_init() has not run yet when we start timing, so every time is taken from the GLib monotonic clock */
+static GstClockTime now (void) {
+	return g_get_monotonic_time () * GST_USECOND;
+}
+
+/* Resolves every factory once. Later constructions never go through the registry by name again */
+static gboolean resolve_factories (CustomData *data) {
+	guint i;
+
+	data->factories = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, gst_object_unref);
+	for (i = 0; i < G_N_ELEMENTS (pipeline_factories); i++) {
+		GstElementFactory *factory = gst_element_factory_find (pipeline_factories[i]);
+		GstPluginFeature *loaded;
+
+		if (!factory) {
+			g_printerr ("Factory '%s' not found. Check --preload and --whitelist.\n", pipeline_factories[i]);
+			return FALSE;
+		}
+		/* Loading the plugin now keeps it off the path of the first construction */
+		loaded = gst_plugin_feature_load (GST_PLUGIN_FEATURE (factory));
+		gst_object_unref (factory);
+		if (!loaded) {
+			g_printerr ("Plugin of factory '%s' could not be loaded.\n", pipeline_factories[i]);
+			return FALSE;
+		}
+		g_hash_table_insert (data->factories, (gpointer) pipeline_factories[i], loaded);
+	}
+	return TRUE;
+}
+
+static GstElement *make_element (CustomData *data, const gchar *factory_name, const gchar *name) {
+	GstElementFactory *factory = g_hash_table_lookup (data->factories, factory_name);
+
+	return factory ? gst_element_factory_create (factory, name) : NULL;
+}
+
+static GstPadProbeReturn first_buffer_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	g_mutex_lock (&data->lock);
+	if (!GST_CLOCK_TIME_IS_VALID (data->first_buffer)) {
+		data->first_buffer = now ();
+		g_cond_signal (&data->cond);
+	}
+	g_mutex_unlock (&data->lock);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* Builds videotestsrc ! videoconvert ! fakesink and audiotestsrc ! audioconvert ! fakesink from the lookup table */
+static GstElement *build_pipeline (CustomData *data) {
+	GstElement *pipeline = gst_pipeline_new ("test-pipeline");
+	GstElement *video_source = make_element (data, "videotestsrc", "video_source");
+	GstElement *video_convert = make_element (data, "videoconvert", "video_convert");
+	GstElement *video_sink = make_element (data, "fakesink", "video_sink");
+	GstElement *audio_source = make_element (data, "audiotestsrc", "audio_source");
+	GstElement *audio_convert = make_element (data, "audioconvert", "audio_convert");
+	GstElement *audio_sink = make_element (data, "fakesink", "audio_sink");
+
+	if (!pipeline || !video_source || !video_convert || !video_sink || !audio_source || !audio_convert || !audio_sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return NULL;
+	}
+
+	gst_bin_add_many (GST_BIN (pipeline), video_source, video_convert, video_sink, audio_source, audio_convert,
+			audio_sink, NULL);
+	if (!gst_element_link_many (video_source, video_convert, video_sink, NULL) ||
+			!gst_element_link_many (audio_source, audio_convert, audio_sink, NULL)) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (pipeline);
+		return NULL;
+	}
+	g_object_set (video_sink, "sync", FALSE, NULL);
+	g_object_set (audio_sink, "sync", FALSE, NULL);
+	return pipeline;
+}
+
+/* One startup: gst_init(), factory resolution, first pipeline to its first buffer, then the rebuilds */
+static int run_startup (void) {
+	CustomData data;
+	GstClockTime start, init_done, resolved, built;
+	GstClockTime rebuild_total = 0;
+	GstElement *pipeline, *video_sink;
+	GstPad *pad;
+	gint64 deadline;
+	gint i;
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.lock);
+	g_cond_init (&data.cond);
+	data.first_buffer = GST_CLOCK_TIME_NONE;
+
+	/* Reuse our registry file, and trust it if it is already there */
+	g_setenv ("GST_REGISTRY", registry_path, TRUE);
+	if (g_file_test (registry_path, G_FILE_TEST_EXISTS))
+		g_setenv ("GST_REGISTRY_UPDATE", "no", TRUE);
+	if (whitelist)
+		g_setenv ("GST_PLUGIN_LOADING_WHITELIST", whitelist, TRUE);
+
+	start = now ();
+	gst_init (NULL, NULL);
+	init_done = now ();
+
+	if (preload) {
+		gchar **plugins = g_strsplit (preload, ",", -1);
+		gchar **plugin;
+
+		for (plugin = plugins; *plugin; plugin++) {
+			GstPlugin *loaded = gst_plugin_load_by_name (g_strstrip (*plugin));
+
+			if (loaded)
+				gst_object_unref (loaded);
+			else
+				g_printerr ("Could not preload plugin '%s'.\n", *plugin);
+		}
+		g_strfreev (plugins);
+	}
+
+	if (!resolve_factories (&data))
+		return -1;
+	resolved = now ();
+
+	pipeline = build_pipeline (&data);
+	if (!pipeline)
+		return -1;
+	built = now ();
+
+	video_sink = gst_bin_get_by_name (GST_BIN (pipeline), "video_sink");
+	pad = gst_element_get_static_pad (video_sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) first_buffer_probe, &data, NULL);
+	gst_object_unref (pad);
+	gst_object_unref (video_sink);
+
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+
+	/* Wait for the first buffer, at most 10 seconds */
+	deadline = g_get_monotonic_time () + 10 * G_TIME_SPAN_SECOND;
+	g_mutex_lock (&data.lock);
+	while (!GST_CLOCK_TIME_IS_VALID (data.first_buffer))
+		if (!g_cond_wait_until (&data.cond, &data.lock, deadline))
+			break;
+	g_mutex_unlock (&data.lock);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+
+	if (!GST_CLOCK_TIME_IS_VALID (data.first_buffer)) {
+		g_printerr ("No buffer reached the sink.\n");
+		return -1;
+	}
+
+	/* Later constructions reuse the table */
+	for (i = 0; i < constructions; i++) {
+		GstClockTime rebuild_start = now ();
+
+		pipeline = build_pipeline (&data);
+		if (!pipeline)
+			return -1;
+		rebuild_total += now () - rebuild_start;
+		gst_object_unref (pipeline);
+	}
+
+	/* One machine readable line, for the benchmark */
+	g_print ("init_ms=%.3f resolve_ms=%.3f build_ms=%.3f first_buffer_ms=%.3f rebuild_ms=%.3f\n",
+			(init_done - start) / 1e6, (resolved - init_done) / 1e6, (built - resolved) / 1e6,
+			(data.first_buffer - start) / 1e6, constructions > 0 ? rebuild_total / 1e6 / constructions : 0.0);
+
+	g_hash_table_unref (data.factories);
+	g_mutex_clear (&data.lock);
+	g_cond_clear (&data.cond);
+	return 0;
+}
+
+/* Runs one child and returns its time from gst_init() to the first buffer, in milliseconds, or a negative value */
+static gdouble run_child (const gchar *self) {
+	gchar *registry_arg = g_strdup_printf ("--registry=%s", registry_path);
+	gchar *child_argv[8] = { (gchar *) self, registry_arg, NULL };
+	gchar *output = NULL, *field;
+	GError *error = NULL;
+	gdouble first_buffer = -1;
+	gint status, n = 2;
+
+	if (preload)
+		child_argv[n++] = g_strdup_printf ("--preload=%s", preload);
+	if (whitelist)
+		child_argv[n++] = g_strdup_printf ("--whitelist=%s", whitelist);
+
+	if (!g_spawn_sync (NULL, child_argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, &output, NULL, &status, &error)) {
+		g_printerr ("Could not start child: %s\n", error->message);
+		g_clear_error (&error);
+	} else if (!g_spawn_check_wait_status (status, &error)) {
+		g_printerr ("Child failed: %s\n", error->message);
+		g_clear_error (&error);
+	} else if ((field = strstr (output, "first_buffer_ms="))) {
+		first_buffer = g_ascii_strtod (field + strlen ("first_buffer_ms="), NULL);
+	}
+
+	while (n > 1)
+		g_free (child_argv[--n]);
+	g_free (output);
+	return first_buffer;
+}
+
+/* Alternates cold (no registry file) and warm (existing file) runs */
+static int run_benchmark (const gchar *self) {
+	gdouble cold_total = 0, warm_total = 0, cold_min = G_MAXDOUBLE, warm_min = G_MAXDOUBLE;
+	gint i;
+
+	for (i = 0; i < runs; i++) {
+		gdouble cold, warm;
+
+		g_unlink (registry_path);
+		cold = run_child (self);
+		warm = run_child (self);
+		if (cold < 0 || warm < 0)
+			return -1;
+		g_print ("Run %d: cold %.3f ms, warm %.3f ms\n", i + 1, cold, warm);
+		cold_total += cold;
+		warm_total += warm;
+		cold_min = MIN (cold_min, cold);
+		warm_min = MIN (warm_min, warm);
+	}
+
+	g_print ("gst_init() to first buffer over %d runs:\n", runs);
+	g_print ("  cold: mean %.3f ms, best %.3f ms\n", cold_total / runs, cold_min);
+	g_print ("  warm: mean %.3f ms, best %.3f ms\n", warm_total / runs, warm_min);
+	return 0;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *self = g_strdup (argv[0]);
+	int result;
+
+	/* Only our own options: gst_init() is part of what we measure, so it must not run during parsing */
+	context = g_option_context_new ("- warmed registry and cached factory lookups");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (runs <= 0 || constructions < 0) {
+		g_printerr ("The number of runs must be positive and the number of constructions not negative.\n");
+		return -1;
+	}
+	if (!registry_path) {
+		gchar *dir = g_build_filename (g_get_user_cache_dir (), "gstreamer_study", NULL);
+
+		g_mkdir_with_parents (dir, 0755);
+		registry_path = g_build_filename (dir, "fast-startup-registry.bin", NULL);
+		g_free (dir);
+	}
+
+	if (benchmark)
+		result = run_benchmark (self);
+	else
+		result = run_startup ();
+
+	g_free (self);
+	g_free (registry_path);
+	g_free (preload);
+	g_free (whitelist);
+	return result;
+}
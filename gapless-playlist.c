@@ -0,0 +1,483 @@
+/* Gapless playlist : playbin's about-to-finish with next-item preloading
+ *
+ * Goal
+ *
+ * basic-tutorial-4.c and basic-tutorial-5.c play one URI, and their EOS handler sets the pipeline to READY. Playing a
+ * list that way means tearing down and rebuilding the pipeline between items, which leaves seconds of silence. This
+ * program plays a playlist without stopping:
+ *
+ *   - playbin emits "about-to-finish" a little before the current item runs out of data. Setting the "uri" property
+ *     from that callback queues the next item, and playbin switches to it without leaving PLAYING.
+ *   - as soon as an item starts, the next one is preloaded: a second pipeline (the source element for its URI into a
+ *     filesink) downloads it into a temporary file while the current item plays. When about-to-finish comes and the
+ *     download is complete, the file:// URI of that copy is queued instead of the network one, so playbin starts the
+ *     next item from local data. An item that is not fully downloaded by then is played from the network as usual.
+ *     Local files are not preloaded. The copy of an item is deleted once the item after it starts.
+ *   - the next item is also inspected with GstDiscoverer, to learn the caps of its streams and report early an item
+ *     that can not be played. When the caps match the current item, playbin3 (--playbin3) can keep its decoders,
+ *     while playbin builds a new decodebin for every item. The log does not guess: at every transition it says how
+ *     many decoders were created for the new item, none when they were reused.
+ *   - the gap of every transition is measured at the audio sink: the running time between the end of the last buffer
+ *     of an item and the start of the first buffer of the next, and the wall clock time between their arrival.
+ *
+ * Usage
+ *   gapless-playlist [--playbin3] [URI...]
+ *
+ * Without URIs it plays the sintel trailer twice. Preloading keeps a whole item on disk, which suits playlists of songs
+ * or clips rather than long films. It also needs the pbutils library: add gstreamer-pbutils-1.0 to the
+ * pkg-config line.
+ *
+ */
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* Structure to contain all our information, so we can pass it around */
+typedef struct _CustomData {
+	GstElement *playbin;
+	GMainLoop *loop;
+	GstDiscoverer *discoverer;
+	gchar **uris;
+	guint n_uris;
+
+	GMutex lock;                    /* Protects everything below */
+	gboolean started;               /* The first item has started */
+	guint current;                 /* Item being played */
+	guint queued;                   /* Item queued by about-to-finish */
+	GstCaps *caps[2];               /* Caps of the current and of the next item, when discovered */
+	GstSegment segment;             /* Segment of the audio sink */
+	gboolean new_item;              /* A stream-start reached the audio sink, the next buffer starts an item */
+	GstClockTime last_end;          /* Running time where the last audio buffer ended */
+	GstClockTime last_arrival;      /* When the last audio buffer reached the sink */
+	GstElement *audio_sink;
+	guint decoders_added;           /* Decoders created since the last about-to-finish */
+
+	/* The preload of the next item. The pipeline is only used by the main thread */
+	gchar *preload_dir;             /* Temporary directory of the copies */
+	GstElement *preload;            /* Pipeline downloading the next item, NULL if none */
+	guint preload_bus_watch;
+	guint preload_item;             /* Item it downloads */
+	gchar *preload_path;            /* File it downloads to */
+	gboolean preload_done;          /* The download is complete */
+	gchar *queued_path;             /* Copy about-to-finish queued, taken over from preload_path */
+	gchar *played_path;             /* Copy the current item plays from, NULL if it came from its own URI */
+} CustomData;
+
+static gboolean use_playbin3 = FALSE;
+static gchar **uri_args = NULL;
+
+static GOptionEntry entries[] = {
+	{ "playbin3", '3', 0, G_OPTION_ARG_NONE, &use_playbin3, "Use playbin3, which reuses decoders between items", NULL },
+	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &uri_args, NULL, "URI..." },
+	{ NULL }
+};
+
+/* Merges the caps of all the audio and video streams an item has */
+static GstCaps *discovered_caps (GstDiscovererInfo *info) {
+	GstCaps *caps = gst_caps_new_empty ();
+	GList *streams, *l;
+
+	streams = gst_discoverer_info_get_stream_list (info);
+	for (l = streams; l; l = l->next) {
+		GstDiscovererStreamInfo *stream = l->data;
+		GstCaps *stream_caps;
+
+		if (!GST_IS_DISCOVERER_AUDIO_INFO (stream) && !GST_IS_DISCOVERER_VIDEO_INFO (stream))
+			continue;
+		stream_caps = gst_discoverer_stream_info_get_caps (stream);
+		if (stream_caps)
+			caps = gst_caps_merge (caps, stream_caps);
+	}
+	gst_discoverer_stream_info_list_free (streams);
+	return caps;
+}
+
+/* Called in the main thread when GstDiscoverer is done with an item */
+static void discovered_cb (GstDiscoverer *discoverer, GstDiscovererInfo *info, GError *err, CustomData *data) {
+	const gchar *uri = gst_discoverer_info_get_uri (info);
+	GstCaps *caps;
+	gchar *str;
+	guint slot;
+
+	if (gst_discoverer_info_get_result (info) != GST_DISCOVERER_OK) {
+		g_printerr ("Could not inspect %s: %s\n", uri, err ? err->message : "unknown error");
+		return;
+	}
+
+	caps = discovered_caps (info);
+	str = gst_caps_to_string (caps);
+	g_mutex_lock (&data->lock);
+	slot = g_str_equal (uri, data->uris[data->current]) && !data->caps[0] ? 0 : 1;
+	gst_caps_replace (&data->caps[slot], caps);
+	g_print ("%s item %s: %s\n", slot == 0 ? "Current" : "Next", uri, str);
+	if (slot == 1 && data->caps[0]) {
+		/* Whether they really are kept is only known at the transition */
+		if (gst_caps_is_equal (data->caps[0], data->caps[1]))
+			g_print ("  same caps as the current item: %s\n", use_playbin3 ? "playbin3 can keep its decoders" :
+					"decoders could only be kept with --playbin3");
+		else
+			g_print ("  different caps: new decoders are needed\n");
+	}
+	g_mutex_unlock (&data->lock);
+	gst_caps_unref (caps);
+	g_free (str);
+}
+
+/* Stops the preload pipeline, if it is still running */
+static void preload_stop (CustomData *data) {
+	if (!data->preload)
+		return;
+
+	gst_element_set_state (data->preload, GST_STATE_NULL);
+	if (data->preload_bus_watch)
+		g_source_remove (data->preload_bus_watch);
+	data->preload_bus_watch = 0;
+	gst_object_unref (data->preload);
+	data->preload = NULL;
+}
+
+/* Stops the preload and deletes its file, unless about-to-finish took it over */
+static void preload_clear (CustomData *data) {
+	preload_stop (data);
+	g_mutex_lock (&data->lock);
+	if (data->preload_path)
+		g_unlink (data->preload_path);
+	g_clear_pointer (&data->preload_path, g_free);
+	data->preload_done = FALSE;
+	g_mutex_unlock (&data->lock);
+}
+
+/* Watches the bus of the preload pipeline, in the main thread */
+static gboolean preload_bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			/* Not fatal: the item is played from its URI */
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Could not preload item %u: %s\n", data->preload_item, err->message);
+			g_clear_error (&err);
+			g_free (debug_info);
+			data->preload_bus_watch = 0;
+			preload_clear (data);
+			return G_SOURCE_REMOVE;
+		case GST_MESSAGE_EOS:
+			g_mutex_lock (&data->lock);
+			data->preload_done = TRUE;
+			g_print ("Preloaded item %u into %s\n", data->preload_item, data->preload_path);
+			g_mutex_unlock (&data->lock);
+			data->preload_bus_watch = 0;
+			preload_stop (data);
+			return G_SOURCE_REMOVE;
+		default:
+			break;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/* Starts downloading an item into a temporary file */
+static void preload_start (CustomData *data, guint item) {
+	const gchar *uri = data->uris[item];
+	GError *error = NULL;
+	GstElement *source, *sink;
+	GstBus *bus;
+	gchar *name;
+
+	if (!data->preload_dir || gst_uri_has_protocol (uri, "file"))
+		return;
+
+	source = gst_element_make_from_uri (GST_URI_SRC, uri, "preload_source", &error);
+	if (!source) {
+		g_printerr ("Could not preload item %u: %s\n", item, error->message);
+		g_clear_error (&error);
+		return;
+	}
+	sink = gst_element_factory_make ("filesink", "preload_sink");
+	data->preload = gst_pipeline_new ("preload");
+	if (!sink || !data->preload) {
+		g_printerr ("Not all elements could be created.\n");
+		gst_object_unref (source);
+		if (sink)
+			gst_object_unref (sink);
+		g_clear_object (&data->preload);
+		return;
+	}
+
+	name = g_strdup_printf ("item-%u", item);
+	g_mutex_lock (&data->lock);
+	data->preload_item = item;
+	data->preload_path = g_build_filename (data->preload_dir, name, NULL);
+	data->preload_done = FALSE;
+	g_mutex_unlock (&data->lock);
+	g_free (name);
+	g_object_set (sink, "location", data->preload_path, NULL);
+	gst_bin_add_many (GST_BIN (data->preload), source, sink, NULL);
+	gst_element_link (source, sink);
+
+	bus = gst_element_get_bus (data->preload);
+	data->preload_bus_watch = gst_bus_add_watch (bus, (GstBusFunc) preload_bus_cb, data);
+	gst_object_unref (bus);
+	if (gst_element_set_state (data->preload, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Could not preload item %u.\n", item);
+		preload_clear (data);
+	}
+}
+
+/* Inspects the item after the current one, and starts preloading it */
+static void prepare_next (CustomData *data) {
+	guint next;
+
+	g_mutex_lock (&data->lock);
+	next = data->current + 1;
+	g_mutex_unlock (&data->lock);
+	if (next >= data->n_uris)
+		return;
+	gst_discoverer_discover_uri_async (data->discoverer, data->uris[next]);
+	preload_start (data, next);
+}
+
+/* Called from a streaming thread when the current item is about to run out of data */
+static void about_to_finish_cb (GstElement *playbin, CustomData *data) {
+	gchar *uri = NULL;
+	guint next;
+
+	g_mutex_lock (&data->lock);
+	next = data->queued + 1;
+	if (next < data->n_uris) {
+		data->queued = next;
+		data->decoders_added = 0;
+		/* The local copy when its download is complete, the network otherwise */
+		if (data->preload_done && data->preload_item == next) {
+			uri = g_filename_to_uri (data->preload_path, NULL, NULL);
+			data->queued_path = data->preload_path;
+			data->preload_path = NULL;
+			data->preload_done = FALSE;
+		}
+		if (!uri)
+			uri = g_strdup (data->uris[next]);
+	}
+	g_mutex_unlock (&data->lock);
+
+	if (uri) {
+		/* Setting the URI here, and only here, makes the transition gapless */
+		g_object_set (playbin, "uri", uri, NULL);
+		g_print ("Queued item %u: %s\n", next, uri);
+		g_free (uri);
+	}
+}
+
+/* Measures the transitions at the audio sink */
+static GstPadProbeReturn audio_sink_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	GstClockTime now = gst_util_get_timestamp ();
+	GstClockTime start, end;
+	GstBuffer *buffer;
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+		g_mutex_lock (&data->lock);
+		if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+			gst_event_copy_segment (event, &data->segment);
+		else if (GST_EVENT_TYPE (event) == GST_EVENT_STREAM_START)
+			data->new_item = GST_CLOCK_TIME_IS_VALID (data->last_end);
+		g_mutex_unlock (&data->lock);
+		return GST_PAD_PROBE_OK;
+	}
+
+	buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	if (!GST_BUFFER_PTS_IS_VALID (buffer))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock (&data->lock);
+	start = gst_segment_to_running_time (&data->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+	end = GST_BUFFER_DURATION_IS_VALID (buffer) ? gst_segment_to_running_time (&data->segment, GST_FORMAT_TIME,
+			GST_BUFFER_PTS (buffer) + GST_BUFFER_DURATION (buffer)) : start;
+	if (data->new_item && GST_CLOCK_TIME_IS_VALID (start)) {
+		GstClockTimeDiff gap = GST_CLOCK_DIFF (data->last_end, start);
+
+		g_print ("Transition: gap of %.3f ms of running time, %.3f ms between buffers\n", gap / 1e6,
+				(now - data->last_arrival) / 1e6);
+		data->new_item = FALSE;
+	}
+	if (GST_CLOCK_TIME_IS_VALID (end)) {
+		data->last_end = end;
+		data->last_arrival = now;
+	}
+	g_mutex_unlock (&data->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Finds the audio sink playbin creates, to measure the transitions there */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	GstPad *pad;
+
+	/* Count the decoders, to see at the transition whether the new item got its own */
+	if (factory && strstr (gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS), "Decoder")) {
+		g_mutex_lock (&data->lock);
+		data->decoders_added++;
+		g_mutex_unlock (&data->lock);
+	}
+
+	if (!factory || GST_IS_BIN (element) || !GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK) ||
+			!strstr (gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS), "Audio"))
+		return;
+
+	g_mutex_lock (&data->lock);
+	if (!data->audio_sink) {
+		data->audio_sink = gst_object_ref (element);
+		pad = gst_element_get_static_pad (element, "sink");
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+				(GstPadProbeCallback) audio_sink_probe, data, NULL);
+		gst_object_unref (pad);
+	}
+	g_mutex_unlock (&data->lock);
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			/* Only the last item ends the stream */
+			g_print ("End of the playlist.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_STREAM_START:
+			/* The queued item is now playing */
+			g_mutex_lock (&data->lock);
+			if (data->started && data->current == data->queued) {
+				g_mutex_unlock (&data->lock);
+				break;
+			}
+			if (data->started) {
+				data->current = data->queued;
+				gst_caps_replace (&data->caps[0], data->caps[1]);
+				gst_caps_replace (&data->caps[1], NULL);
+				g_print ("Now playing item %u: %s (%s), %u decoders created for it%s\n", data->current,
+						data->uris[data->current], data->queued_path ? "preloaded" : "from the network", data->decoders_added,
+						data->decoders_added == 0 ? ": the previous ones were reused" : "");
+
+				/* The copy of the item before this one is not needed any more */
+				if (data->played_path)
+					g_unlink (data->played_path);
+				g_free (data->played_path);
+				data->played_path = data->queued_path;
+				data->queued_path = NULL;
+			} else {
+				g_print ("Now playing item %u: %s\n", data->current, data->uris[data->current]);
+			}
+			data->started = TRUE;
+			g_mutex_unlock (&data->lock);
+
+			/* A preload that was not ready in time is not needed any more either */
+			preload_clear (data);
+			prepare_next (data);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	gchar *default_uris[] = { DEFAULT_URI, DEFAULT_URI, NULL };
+	GstBus *bus;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- gapless playlist");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.lock);
+	gst_segment_init (&data.segment, GST_FORMAT_UNDEFINED);
+	data.last_end = GST_CLOCK_TIME_NONE;
+	data.uris = uri_args ? uri_args : default_uris;
+	data.n_uris = g_strv_length (data.uris);
+	data.preload_dir = g_dir_make_tmp ("gapless-playlist-XXXXXX", &error);
+	if (!data.preload_dir) {
+		g_printerr ("Items will not be preloaded: %s\n", error->message);
+		g_clear_error (&error);
+	}
+
+	/* Create the elements */
+	data.playbin = gst_element_factory_make (use_playbin3 ? "playbin3" : "playbin", "playbin");
+	data.discoverer = gst_discoverer_new (10 * GST_SECOND, &error);
+	if (!data.playbin || !data.discoverer) {
+		g_printerr ("Not all elements could be created.\n");
+		g_clear_error (&error);
+		return -1;
+	}
+
+	g_object_set (data.playbin, "uri", data.uris[0], NULL);
+	g_signal_connect (data.playbin, "about-to-finish", G_CALLBACK (about_to_finish_cb), &data);
+	g_signal_connect (data.playbin, "deep-element-added", G_CALLBACK (deep_element_added_cb), &data);
+	g_signal_connect (data.discoverer, "discovered", G_CALLBACK (discovered_cb), &data);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.playbin);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+
+	/* The discoverer runs in our main loop. The first item is inspected too, to compare the next ones with it */
+	gst_discoverer_start (data.discoverer);
+	gst_discoverer_discover_uri_async (data.discoverer, data.uris[0]);
+
+	/* Start playing */
+	if (gst_element_set_state (data.playbin, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.playbin);
+		return -1;
+	}
+	g_main_loop_run (data.loop);
+
+	/* Free resources */
+	gst_discoverer_stop (data.discoverer);
+	gst_object_unref (data.discoverer);
+	gst_element_set_state (data.playbin, GST_STATE_NULL);
+	preload_clear (&data);
+	if (data.queued_path)
+		g_unlink (data.queued_path);
+	if (data.played_path)
+		g_unlink (data.played_path);
+	g_free (data.queued_path);
+	g_free (data.played_path);
+	if (data.preload_dir)
+		g_rmdir (data.preload_dir);
+	g_free (data.preload_dir);
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	if (data.audio_sink)
+		gst_object_unref (data.audio_sink);
+	gst_object_unref (data.playbin);
+	gst_caps_replace (&data.caps[0], NULL);
+	gst_caps_replace (&data.caps[1], NULL);
+	g_main_loop_unref (data.loop);
+	g_mutex_clear (&data.lock);
+	g_strfreev (uri_args);
+	return 0;
+}
@@ -0,0 +1,449 @@
+/* Hardware decode : preferring VA-API/NVDEC/V4L2 decoders, with software fallback
+ *
+ * Goal
+ *
+ * uridecodebin (basic-tutorial-3.c) and playbin (basic-tutorial-1/4/5.c) pick decoders by autoplugging, which tries
+ * the factories that can handle the stream in order of rank. Most hardware decoders have a lower rank than the
+ * software ones, so they are never used. This program:
+ *
+ *   - Raises the rank of every hardware video decoder found in the registry above the software ones, so
+ *     autoplugging tries them first. A decoder counts as hardware when its klass contains "Hardware" (va, nvcodec
+ *     and v4l2codecs decoders) or its name says so (vaapi*, nv*, v4l2*).
+ *   - Falls back to software when the hardware path fails: if a hardware decoder posts an error, or the video
+ *     stream fails to negotiate around it, that factory is demoted to GST_RANK_NONE (autoplugging ignores such
+ *     factories) and the pipeline is restarted. Errors from elsewhere, like the audio branch, are not its fault.
+ *   - Logs which decoder won, and the number of decoded frames per second it sustains.
+ *
+ * Usage
+ *   hw-decode [--uri=URI] [--playbin] [--no-hw] [--fakesink]
+ *
+ * Without --playbin, the pipeline of basic-tutorial-3.c is used, with a video branch next to the audio one. Each branch
+ * is only created when uridecodebin exposes a stream of its type, so audio-only and video-only media play too.
+ * --fakesink renders nothing and does not synchronize, to measure how fast the decoder can go.
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GstElement *source;             /* uridecodebin, or the playbin itself */
+	GstElement *audio_branch;       /* uridecodebin only, NULL until the stream shows up */
+	GstElement *video_branch;
+
+	GHashTable *hw_factories;       /* Hardware decoder factory name -> original rank */
+	GMutex lock;                    /* Protects decoder, decoder_name and decoder_is_hw, set from streaming threads */
+	GstElement *decoder;            /* The video decoder in use, if any */
+	gchar *decoder_name;            /* Name of its factory */
+	gboolean decoder_is_hw;
+	gint frames;                    /* Frames decoded since the last report */
+	gboolean restart;               /* Restart the pipeline with the next decoder */
+} CustomData;
+
+static gchar *uri_arg = NULL;
+static gboolean use_playbin = FALSE;
+static gboolean no_hw = FALSE;
+static gboolean use_fakesink = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri_arg, "URI to play (default: the sintel trailer)", "URI" },
+	{ "playbin", 'p', 0, G_OPTION_ARG_NONE, &use_playbin, "Use playbin instead of uridecodebin", NULL },
+	{ "no-hw", 0, 0, G_OPTION_ARG_NONE, &no_hw, "Do not prefer hardware decoders", NULL },
+	{ "fakesink", 'f', 0, G_OPTION_ARG_NONE, &use_fakesink, "Decode as fast as possible into fakesinks", NULL },
+	{ NULL }
+};
+
+static void pad_added_handler (GstElement *src, GstPad *pad, CustomData *data);
+
+/* Is this factory a hardware video decoder? */
+static gboolean is_hw_decoder (GstElementFactory *factory) {
+	const gchar *klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+	const gchar *name = GST_OBJECT_NAME (factory);
+
+	if (!klass || !strstr (klass, "Decoder") || !strstr (klass, "Video"))
+		return FALSE;
+	return strstr (klass, "Hardware") != NULL ||
+		g_str_has_prefix (name, "vaapi") || g_str_has_prefix (name, "nv") || g_str_has_prefix (name, "v4l2");
+}
+
+/* Raises every hardware video decoder above the software ones */
+static void prefer_hw_decoders (CustomData *data) {
+	GList *factories, *l;
+
+	factories = gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_DECODER | GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO,
+			GST_RANK_NONE);
+	for (l = factories; l; l = l->next) {
+		GstElementFactory *factory = l->data;
+		GstPluginFeature *feature = GST_PLUGIN_FEATURE (factory);
+		guint rank = gst_plugin_feature_get_rank (feature);
+
+		if (!is_hw_decoder (factory))
+			continue;
+
+		g_hash_table_insert (data->hw_factories, g_strdup (GST_OBJECT_NAME (factory)), GUINT_TO_POINTER (rank));
+		gst_plugin_feature_set_rank (feature, GST_RANK_PRIMARY + 1 + rank);
+		g_print ("Preferring hardware decoder %s (rank %u -> %u)\n", GST_OBJECT_NAME (factory), rank,
+				gst_plugin_feature_get_rank (feature));
+	}
+	gst_plugin_feature_list_free (factories);
+}
+
+/* Takes the decoder in use out of autoplugging, so the next one is tried. Called with the lock held */
+static void demote_current_decoder (CustomData *data) {
+	GstPluginFeature *feature;
+
+	feature = gst_registry_lookup_feature (gst_registry_get (), data->decoder_name);
+	if (feature) {
+		gst_plugin_feature_set_rank (feature, GST_RANK_NONE);
+		gst_object_unref (feature);
+	}
+	g_print ("Hardware decoder %s failed, falling back\n", data->decoder_name);
+	gst_clear_object (&data->decoder);
+	g_clear_pointer (&data->decoder_name, g_free);
+	data->decoder_is_hw = FALSE;
+}
+
+/* Counts the frames leaving the video decoder */
+static GstPadProbeReturn frame_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	g_atomic_int_inc (&data->frames);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Called for every element created inside the pipeline, at any depth: watch for the video decoder */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	const gchar *klass;
+	GstPad *pad;
+
+	if (!factory)
+		return;
+	klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+	if (!klass || !strstr (klass, "Decoder") || !strstr (klass, "Video"))
+		return;
+
+	/* This runs on a streaming thread, while the main thread reads the decoder on errors and reports */
+	g_mutex_lock (&data->lock);
+	gst_object_replace ((GstObject **) &data->decoder, GST_OBJECT (element));
+	g_free (data->decoder_name);
+	data->decoder_name = g_strdup (GST_OBJECT_NAME (factory));
+	data->decoder_is_hw = g_hash_table_contains (data->hw_factories, data->decoder_name);
+	g_print ("Video decoder: %s (%s)\n", data->decoder_name, data->decoder_is_hw ? "hardware" : "software");
+	g_mutex_unlock (&data->lock);
+
+	pad = gst_element_get_static_pad (element, "src");
+	if (pad) {
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) frame_probe, data, NULL);
+		gst_object_unref (pad);
+	}
+}
+
+/* The element linked to "pad", looking through ghost pads (and their internal pads) */
+static GstElement *linked_element (GstPad *pad) {
+	GstPad *peer = gst_pad_get_peer (pad);
+	GstElement *element;
+
+	while (peer && GST_IS_PROXY_PAD (peer)) {
+		GstPad *other = GST_PAD (gst_proxy_pad_get_internal (GST_PROXY_PAD (peer)));
+
+		gst_object_unref (peer);
+		peer = other ? gst_pad_get_peer (other) : NULL;
+		if (other)
+			gst_object_unref (other);
+	}
+	if (!peer)
+		return NULL;
+	element = gst_pad_get_parent_element (peer);
+	gst_object_unref (peer);
+	return element;
+}
+
+/* Walks the video chain from "element", downstream or upstream, for as long as it does not branch. Returns TRUE if
+ * "src" is one of its elements */
+static gboolean chain_contains (GstElement *element, gboolean downstream, GstObject *src) {
+	gboolean found = FALSE;
+	guint depth;
+
+	gst_object_ref (element);
+	for (depth = 0; depth < 32 && !found; depth++) {
+		GstPad *pad = gst_element_get_static_pad (element, downstream ? "src" : "sink");
+		GstElement *next;
+
+		gst_object_unref (element);
+		if (!pad)
+			return FALSE;
+		next = linked_element (pad);
+		gst_object_unref (pad);
+		if (!next)
+			return FALSE;
+		/* A tee, a mixer, a demuxer or a multiqueue: the chain ends here */
+		if ((downstream ? next->numsinkpads : next->numsrcpads) != 1) {
+			gst_object_unref (next);
+			return FALSE;
+		}
+		found = gst_object_has_as_ancestor (src, GST_OBJECT (next));
+		element = next;
+	}
+	gst_object_unref (element);
+	return found;
+}
+
+/* Did this error come from the hardware decoder, or from the video chain it is part of? A negotiation failure is
+ * posted by the demuxer, which also feeds the other streams, so an error from beyond the chain only counts if the
+ * decoder itself refused the caps. Called with the lock held */
+static gboolean is_hw_failure (CustomData *data, GstMessage *msg, GError *err) {
+	GstObject *src = GST_MESSAGE_SRC (msg);
+	gboolean failed = FALSE;
+	GstPad *pad;
+
+	if (!data->decoder_is_hw || !data->decoder)
+		return FALSE;
+	if (gst_object_has_as_ancestor (src, GST_OBJECT (data->decoder)))
+		return TRUE;
+	if (!g_error_matches (err, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION) &&
+			!g_error_matches (err, GST_STREAM_ERROR, GST_STREAM_ERROR_FORMAT) &&
+			!g_error_matches (err, GST_STREAM_ERROR, GST_STREAM_ERROR_FAILED))
+		return FALSE;
+
+	if (chain_contains (data->decoder, TRUE, src) || chain_contains (data->decoder, FALSE, src))
+		return TRUE;
+	pad = gst_element_get_static_pad (data->decoder, "sink");
+	if (pad) {
+		failed = gst_pad_get_last_flow_return (pad) == GST_FLOW_NOT_NEGOTIATED;
+		gst_object_unref (pad);
+	}
+	return failed;
+}
+
+/* Builds the pipeline, either the one of basic-tutorial-3.c with an added video branch, or a playbin */
+static gboolean build_pipeline (CustomData *data, const gchar *uri) {
+	if (use_playbin) {
+		data->pipeline = data->source = gst_element_factory_make ("playbin", "playbin");
+		if (!data->pipeline) {
+			g_printerr ("Not all elements could be created.\n");
+			return FALSE;
+		}
+		if (use_fakesink) {
+			GstElement *audio_sink = gst_element_factory_make ("fakesink", "audio_sink");
+			GstElement *video_sink = gst_element_factory_make ("fakesink", "video_sink");
+
+			g_object_set (audio_sink, "sync", FALSE, NULL);
+			g_object_set (video_sink, "sync", FALSE, NULL);
+			g_object_set (data->pipeline, "audio-sink", audio_sink, "video-sink", video_sink, NULL);
+		}
+	} else {
+		data->source = gst_element_factory_make ("uridecodebin", "source");
+		data->pipeline = gst_pipeline_new ("test-pipeline");
+
+		if (!data->pipeline || !data->source) {
+			g_printerr ("Not all elements could be created.\n");
+			return FALSE;
+		}
+
+		/* The branches are created by pad_added_handler */
+		gst_bin_add (GST_BIN (data->pipeline), data->source);
+		g_signal_connect (data->source, "pad-added", G_CALLBACK (pad_added_handler), data);
+	}
+
+	g_object_set (data->source, "uri", uri, NULL);
+	g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), data);
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstBus *bus;
+	GstMessage *msg;
+	gboolean terminate = FALSE;
+	gint64 last_report;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- hardware decoding with software fallback");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	memset (&data, 0, sizeof (data));
+	data.hw_factories = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_mutex_init (&data.lock);
+
+	/* Ranks must be changed before autoplugging runs */
+	if (!no_hw)
+		prefer_hw_decoders (&data);
+
+	if (!build_pipeline (&data, uri_arg ? uri_arg : DEFAULT_URI)) {
+		if (data.pipeline)
+			gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Start playing */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Listen to the bus, waking up once per second to report the decoding rate */
+	bus = gst_element_get_bus (data.pipeline);
+	last_report = g_get_monotonic_time ();
+	do {
+		msg = gst_bus_timed_pop_filtered (bus, GST_SECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+
+		if (msg != NULL) {
+			GError *err;
+			gchar *debug_info;
+
+			switch (GST_MESSAGE_TYPE (msg)) {
+				case GST_MESSAGE_ERROR:
+					gst_message_parse_error (msg, &err, &debug_info);
+					g_mutex_lock (&data.lock);
+					if (is_hw_failure (&data, msg, err)) {
+						/* Retry with the next decoder in rank order */
+						g_print ("Error from %s while using %s: %s\n", GST_OBJECT_NAME (msg->src), data.decoder_name, err->message);
+						demote_current_decoder (&data);
+						data.restart = TRUE;
+					}
+					g_mutex_unlock (&data.lock);
+					if (!data.restart) {
+						g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+						g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+						terminate = TRUE;
+					}
+					g_clear_error (&err);
+					g_free (debug_info);
+					break;
+				case GST_MESSAGE_EOS:
+					g_print ("End-Of-Stream reached.\n");
+					terminate = TRUE;
+					break;
+				default:
+					/* We should not reach here because we only asked for ERRORs and EOS */
+					g_printerr ("Unexpected message received.\n");
+					break;
+			}
+			gst_message_unref (msg);
+		}
+
+		if (data.restart) {
+			/* Going to NULL throws away the autoplugged elements; going back to PLAYING plugs them again */
+			gst_element_set_state (data.pipeline, GST_STATE_NULL);
+			gst_bus_set_flushing (bus, TRUE);
+			gst_bus_set_flushing (bus, FALSE);
+			g_atomic_int_set (&data.frames, 0);
+			data.restart = FALSE;
+			gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
+			last_report = g_get_monotonic_time ();
+		} else if (g_get_monotonic_time () - last_report >= G_USEC_PER_SEC) {
+			gint64 now = g_get_monotonic_time ();
+			gint frames = g_atomic_int_get (&data.frames);
+
+			g_atomic_int_add (&data.frames, -frames);
+
+			g_mutex_lock (&data.lock);
+			if (data.decoder_name)
+				g_print ("%s: %.1f frames/s\n", data.decoder_name, frames * 1e6 / (now - last_report));
+			g_mutex_unlock (&data.lock);
+			last_report = now;
+		}
+	} while (!terminate);
+
+	/* Free resources */
+	gst_object_unref (bus);
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_object_unref (data.pipeline);
+	g_hash_table_unref (data.hw_factories);
+	gst_clear_object (&data.decoder);
+	g_free (data.decoder_name);
+	g_mutex_clear (&data.lock);
+	g_free (uri_arg);
+	return 0;
+}
+
+/* Creates a branch from its description and adds it to the running pipeline */
+static GstElement *create_branch (CustomData *data, const gchar *description) {
+	GError *error = NULL;
+	GstElement *branch;
+
+	branch = gst_parse_bin_from_description (description, TRUE, &error);
+	if (!branch) {
+		g_printerr ("Could not create the branch '%s': %s\n", description, error->message);
+		g_clear_error (&error);
+		return NULL;
+	}
+
+	/* It must be running before the first buffer comes in */
+	gst_bin_add (GST_BIN (data->pipeline), branch);
+	gst_element_sync_state_with_parent (branch);
+	return branch;
+}
+
+/* This function will be called by the pad-added signal. It creates the branch for the type of the pad the first
+ * time, and links the pad to it as in basic-tutorial-3.c. After a restart the new pads go to the same branches */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
+	GstElement **branch;
+	GstPad *sink_pad = NULL;
+	GstPadLinkReturn ret;
+	GstCaps *new_pad_caps = NULL;
+	GstStructure *new_pad_struct = NULL;
+	const gchar *new_pad_type = NULL;
+	gchar *description;
+
+	g_print ("Received new pad '%s' from '%s' :\n", GST_PAD_NAME (new_pad), GST_ELEMENT_NAME (src));
+
+	/* Check the new pad's type */
+	new_pad_caps = gst_pad_get_current_caps (new_pad);
+	new_pad_struct = gst_caps_get_structure (new_pad_caps, 0);
+	new_pad_type = gst_structure_get_name (new_pad_struct);
+	if (g_str_has_prefix (new_pad_type, "audio/x-raw")) {
+		branch = &data->audio_branch;
+		description = g_strdup_printf ("audioconvert ! audioresample ! %s", use_fakesink ? "fakesink sync=false" : "autoaudiosink");
+	} else if (g_str_has_prefix (new_pad_type, "video/x-raw")) {
+		branch = &data->video_branch;
+		description = g_strdup_printf ("videoconvert ! %s", use_fakesink ? "fakesink sync=false" : "autovideosink");
+	} else {
+		g_print ("It has type '%s' which is not raw audio or video. Ignoring.\n", new_pad_type);
+		goto exit;
+	}
+
+	if (!*branch)
+		*branch = create_branch (data, description);
+	g_free (description);
+	if (!*branch)
+		goto exit;
+	sink_pad = gst_element_get_static_pad (*branch, "sink");
+
+	/* If this branch is already linked, we have nothing to do here */
+	if (gst_pad_is_linked (sink_pad)) {
+		g_print ("We are already linked. Ignoring. \n");
+		goto exit;
+	}
+
+	/* Attempt the link */
+	ret = gst_pad_link (new_pad, sink_pad);
+	if (GST_PAD_LINK_FAILED (ret)) {
+		g_print ("Type is '%s' but link failed. \n", new_pad_type);
+	} else {
+		g_print ("Link succeeded (type '%s').\n", new_pad_type);
+	}
+
+exit:
+	/* unreference the new pad's caps, if we got them */
+	if (new_pad_caps != NULL)
+		gst_caps_unref (new_pad_caps);
+
+	/* Unreference the sink pad */
+	if (sink_pad != NULL)
+		gst_object_unref (sink_pad);
+}
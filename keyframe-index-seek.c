@@ -0,0 +1,475 @@
+/* Keyframe index seek : remembering where the keyframes are between runs
+ *
+ * Goal
+ *
+ * basic-tutorial-4.c seeks with GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, and basic-tutorial-5.c does the same from its slider.
+ * Every one of those seeks makes the demuxer find the keyframe around the target again, and with files that have poor cues,
+ * served over HTTP, that search is slow. The comments in basic-tutorial-4.c also warn that GST_SEEK_FLAG_ACCURATE
+ * "might take longer to calculate the seeking position (very long, on some files)".
+ *
+ * This program keeps a keyframe index per media:
+ *
+ *   - While playing, a pad probe on the demuxer's video pad records the timestamp of every keyframe
+ *     (every buffer without the DELTA_UNIT flag). Playback seeks, so the index has gaps: the probe also records
+ *     the intervals it saw without interruption, a new one starting after every flush or new segment. Inside an
+ *     interval every keyframe is known.
+ *   - The index is saved in the user cache directory, keyed by the URI and the HTTP ETag of the response
+ *     (taken from the "http-headers" message souphttpsrc posts), so a changed file gets a fresh index.
+ *     Later runs load it and keep extending it.
+ *   - When a seek target falls inside one of those intervals, the index already knows the keyframe at or before it,
+ *     so the program prints where the seek will land before sending it, as a player would to move its slider
+ *     straight away. The seek itself is a GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE seek to that keyframe:
+ *     no ACCURATE flag, so the decoder never decodes forward from the keyframe to the target.
+ *
+ * This does not make the seek itself any faster. GStreamer 1.x demuxers do not accept an external index, and they
+ * do not seek in GST_FORMAT_BYTES either, so matroskademux still searches its own cues whatever we know. The
+ * printed seek times show the same cost with and without an index hit.
+ *
+ * Usage
+ *   keyframe-index-seek [--uri=URI] [--seeks=30,60,15] [--interval=5]
+ *
+ * After PLAYING is reached, one seek from the list is performed every --interval seconds, and the time from
+ * the seek to the pipeline prerolling again (ASYNC_DONE) is printed. The index is saved however playback ends:
+ * EOS, an error, or Ctrl-C.
+ *
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* Structure to contain all our information, so we can pass it around */
+typedef struct _CustomData {
+	GstElement *playbin;            /* Our one and only element */
+	GMainLoop *loop;                /* GLib main loop */
+
+	gchar *uri;                     /* URI being played */
+	gchar *index_path;              /* Cache file of the index, NULL until the key is known */
+	GMutex index_lock;              /* Protects keyframes, which is appended to from the streaming thread */
+	GArray *keyframes;              /* Sorted keyframe timestamps (gint64, in nanoseconds) */
+	GArray *intervals;              /* Sorted, disjoint Interval where every keyframe is in keyframes */
+	guint loaded_keyframes;         /* How many of them came from the cache file */
+
+	gdouble *seeks;                 /* Seek targets, in seconds */
+	guint n_seeks;
+	guint next_seek;
+	gboolean seeks_scheduled;       /* Has the seek timer been started? */
+	gint64 seek_start;              /* Monotonic time of the seek in flight, 0 if none */
+} CustomData;
+
+/* A stretch of the media played without interruption, from its first keyframe to its last */
+typedef struct _Interval {
+	gint64 start;
+	gint64 end;
+} Interval;
+
+/* One of these per demuxer pad, to remember whether the pad carries video */
+typedef struct _PadIndexer {
+	CustomData *data;
+	gboolean is_video;
+	gint64 run_start;               /* First keyframe since the last flush or segment, -1 if none yet */
+} PadIndexer;
+
+static gchar *uri_arg = NULL;
+static gchar *seeks_arg = NULL;
+static gint seek_interval = 5;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri_arg, "URI to play (default: the sintel trailer)", "URI" },
+	{ "seeks", 's', 0, G_OPTION_ARG_STRING, &seeks_arg, "Comma separated seek targets, in seconds (default 30,60,15)", "LIST" },
+	{ "interval", 'i', 0, G_OPTION_ARG_INT, &seek_interval, "Seconds between two seeks (default 5)", "S" },
+	{ NULL }
+};
+
+/* Inserts a keyframe timestamp in the sorted index, ignoring duplicates. Returns TRUE if it was new.
+ * Call with index_lock held */
+static gboolean index_insert (CustomData *data, gint64 ts) {
+	guint lo = 0, hi = data->keyframes->len;
+
+	/* Keyframes usually arrive in order, so check the end first */
+	if (hi == 0 || g_array_index (data->keyframes, gint64, hi - 1) < ts) {
+		g_array_append_val (data->keyframes, ts);
+		return TRUE;
+	}
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		if (g_array_index (data->keyframes, gint64, mid) < ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < data->keyframes->len && g_array_index (data->keyframes, gint64, lo) == ts)
+		return FALSE;
+	g_array_insert_val (data->keyframes, lo, ts);
+	return TRUE;
+}
+
+/* Adds an interval where every keyframe is known, merging it with the ones it overlaps. Call with index_lock held */
+static void interval_add (CustomData *data, gint64 start, gint64 end) {
+	Interval added = { start, end };
+	guint i = 0;
+
+	while (i < data->intervals->len) {
+		Interval *interval = &g_array_index (data->intervals, Interval, i);
+
+		if (interval->end < added.start) {
+			i++;
+		} else if (interval->start > added.end) {
+			break;
+		} else {
+			added.start = MIN (added.start, interval->start);
+			added.end = MAX (added.end, interval->end);
+			g_array_remove_index (data->intervals, i);
+		}
+	}
+	g_array_insert_val (data->intervals, i, added);
+}
+
+/* Finds the keyframe at or before target. Only answers when the keyframe and the target are inside the same
+ * interval: elsewhere a keyframe we never saw may be closer. Call with index_lock held */
+static gboolean index_lookup (CustomData *data, gint64 target, gint64 *keyframe) {
+	guint lo = 0, hi = data->keyframes->len;
+	guint i;
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		if (g_array_index (data->keyframes, gint64, mid) <= target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return FALSE;
+	*keyframe = g_array_index (data->keyframes, gint64, lo - 1);
+
+	for (i = 0; i < data->intervals->len; i++) {
+		Interval *interval = &g_array_index (data->intervals, Interval, i);
+
+		if (interval->start <= *keyframe && target <= interval->end)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Computes the cache file for this URI and ETag, and loads the index stored there, if any */
+static void index_load (CustomData *data, const gchar *etag) {
+	gchar *key_string, *key, *dir, *filename, *contents = NULL;
+	gchar **lines, **line;
+
+	if (data->index_path)
+		return;
+
+	key_string = g_strdup_printf ("%s\n%s", data->uri, etag ? etag : "");
+	key = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key_string, -1);
+	dir = g_build_filename (g_get_user_cache_dir (), "gstreamer_study", "keyframes", NULL);
+	filename = g_strconcat (key, ".idx", NULL);
+	data->index_path = g_build_filename (dir, filename, NULL);
+	g_mkdir_with_parents (dir, 0755);
+	g_free (key_string);
+	g_free (key);
+	g_free (dir);
+	g_free (filename);
+
+	if (!g_file_get_contents (data->index_path, &contents, NULL, NULL)) {
+		g_print ("No keyframe index cached for this media yet, building one.\n");
+		return;
+	}
+
+	/* One keyframe timestamp per line, and "interval START END" lines, after a header line with the URI. The probe
+	 * may already have recorded some keyframes: only the ones the file adds are counted as loaded */
+	g_mutex_lock (&data->index_lock);
+	lines = g_strsplit (contents, "\n", -1);
+	for (line = lines; *line; line++) {
+		if (g_ascii_isdigit ((*line)[0])) {
+			if (index_insert (data, g_ascii_strtoll (*line, NULL, 10)))
+				data->loaded_keyframes++;
+		} else if (g_str_has_prefix (*line, "interval ")) {
+			gchar *end;
+			gint64 start = g_ascii_strtoll (*line + strlen ("interval "), &end, 10);
+
+			interval_add (data, start, g_ascii_strtoll (end, NULL, 10));
+		}
+	}
+	g_mutex_unlock (&data->index_lock);
+	g_strfreev (lines);
+	g_free (contents);
+
+	g_print ("Loaded %u keyframes from %s\n", data->loaded_keyframes, data->index_path);
+}
+
+/* Writes the index back to its cache file */
+static void index_save (CustomData *data) {
+	GString *contents;
+	GError *error = NULL;
+	guint i;
+
+	if (!data->index_path)
+		return;
+
+	contents = g_string_new (NULL);
+	g_string_append_printf (contents, "# %s\n", data->uri);
+	g_mutex_lock (&data->index_lock);
+	for (i = 0; i < data->keyframes->len; i++)
+		g_string_append_printf (contents, "%" G_GINT64_FORMAT "\n", g_array_index (data->keyframes, gint64, i));
+	for (i = 0; i < data->intervals->len; i++) {
+		Interval *interval = &g_array_index (data->intervals, Interval, i);
+
+		g_string_append_printf (contents, "interval %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", interval->start,
+				interval->end);
+	}
+	g_print ("Saving %u keyframes (%u new) to %s\n", data->keyframes->len,
+			data->keyframes->len - data->loaded_keyframes, data->index_path);
+	g_mutex_unlock (&data->index_lock);
+
+	/* g_file_set_contents writes to a temporary file and renames it, so concurrent players never read half an index */
+	if (!g_file_set_contents (data->index_path, contents->str, contents->len, &error)) {
+		g_printerr ("Could not save the keyframe index: %s\n", error->message);
+		g_clear_error (&error);
+	}
+	g_string_free (contents, TRUE);
+}
+
+/* Records the timestamp of every keyframe leaving the demuxer on a video pad, and the interval it belongs to */
+static GstPadProbeReturn keyframe_probe (GstPad *pad, GstPadProbeInfo *info, PadIndexer *indexer) {
+	if (GST_PAD_PROBE_INFO_TYPE (info) & (GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH)) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+		/* A seek: what comes next does not follow what we saw */
+		if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP || GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+			indexer->run_start = -1;
+		if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+
+			gst_event_parse_caps (event, &caps);
+			indexer->is_video = g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "video/");
+		}
+	} else if (indexer->is_video) {
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+		GstClockTime ts = GST_BUFFER_PTS_IS_VALID (buffer) ? GST_BUFFER_PTS (buffer) : GST_BUFFER_DTS (buffer);
+
+		if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) && GST_CLOCK_TIME_IS_VALID (ts)) {
+			if (indexer->run_start < 0)
+				indexer->run_start = (gint64) ts;
+			g_mutex_lock (&indexer->data->index_lock);
+			index_insert (indexer->data, (gint64) ts);
+			interval_add (indexer->data, indexer->run_start, (gint64) ts);
+			g_mutex_unlock (&indexer->data->index_lock);
+		}
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/* Called when the demuxer creates a pad: watch it for keyframes */
+static void demuxer_pad_added_cb (GstElement *demuxer, GstPad *pad, CustomData *data) {
+	PadIndexer *indexer;
+
+	if (GST_PAD_DIRECTION (pad) != GST_PAD_SRC)
+		return;
+
+	indexer = g_new0 (PadIndexer, 1);
+	indexer->data = data;
+	indexer->run_start = -1;
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+			(GstPadProbeCallback) keyframe_probe, indexer, g_free);
+}
+
+/* Called for every element playbin creates, at any depth: find the demuxer */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	const gchar *klass;
+
+	if (!factory)
+		return;
+	klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+	if (klass && strstr (klass, "Demuxer"))
+		g_signal_connect (element, "pad-added", G_CALLBACK (demuxer_pad_added_cb), data);
+}
+
+/* Looks for the ETag field of the HTTP response headers, whatever its case */
+static gboolean find_etag (GQuark field, const GValue *value, gpointer user_data) {
+	const gchar **etag = user_data;
+
+	if (g_ascii_strcasecmp (g_quark_to_string (field), "ETag") == 0 && G_VALUE_HOLDS_STRING (value)) {
+		*etag = g_value_get_string (value);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Sends the next seek of the list. With an index hit we know where it lands before the demuxer does */
+static gboolean perform_seek (CustomData *data) {
+	gint64 target, keyframe;
+	gboolean snapped;
+
+	if (data->next_seek >= data->n_seeks || data->seek_start)
+		return data->next_seek < data->n_seeks;
+
+	target = (gint64) (data->seeks[data->next_seek++] * GST_SECOND);
+
+	g_mutex_lock (&data->index_lock);
+	snapped = index_lookup (data, target, &keyframe);
+	g_mutex_unlock (&data->index_lock);
+
+	data->seek_start = g_get_monotonic_time ();
+	if (snapped) {
+		g_print ("Seek to %" GST_TIME_FORMAT ": index hit, will land on keyframe %" GST_TIME_FORMAT "\n",
+				GST_TIME_ARGS (target), GST_TIME_ARGS (keyframe));
+		target = keyframe;
+	} else {
+		g_print ("Seek to %" GST_TIME_FORMAT ": not indexed yet, the landing keyframe is unknown\n", GST_TIME_ARGS (target));
+	}
+	/* The demuxer searches its own index either way, and KEY_UNIT saves the decoder from decoding up to the target */
+	gst_element_seek_simple (data->playbin, GST_FORMAT_TIME,
+			GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE, target);
+	return data->next_seek < data->n_seeks;
+}
+
+/* Ctrl-C ends playback like EOS does, so the index is still saved */
+static gboolean interrupt_cb (CustomData *data) {
+	g_print ("Interrupted.\n");
+	g_main_loop_quit (data->loop);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR: {
+			GError *err;
+			gchar *debug_info;
+
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		}
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_ELEMENT: {
+			/* souphttpsrc tells us about the HTTP response: use the ETag as part of the cache key */
+			const GstStructure *structure = gst_message_get_structure (msg);
+			GstStructure *response = NULL;
+			const gchar *etag = NULL;
+
+			if (gst_structure_has_name (structure, "http-headers") && !data->index_path) {
+				if (gst_structure_get (structure, "response-headers", GST_TYPE_STRUCTURE, &response, NULL)) {
+					gst_structure_foreach (response, find_etag, &etag);
+					index_load (data, etag);
+					gst_structure_free (response);
+				}
+			}
+			break;
+		}
+		case GST_MESSAGE_ASYNC_DONE:
+			/* The pipeline prerolled again after a flushing seek */
+			if (data->seek_start) {
+				g_print ("  seek took %.1f ms\n", (g_get_monotonic_time () - data->seek_start) / 1000.0);
+				data->seek_start = 0;
+			}
+			break;
+		case GST_MESSAGE_STATE_CHANGED:
+			if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->playbin)) {
+				GstState old_state, new_state, pending_state;
+
+				gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+				if (old_state == GST_STATE_PAUSED && new_state == GST_STATE_PLAYING && !data->seeks_scheduled && data->n_seeks > 0) {
+					/* Media without an ETag (local files, for example) is keyed on its URI only */
+					index_load (data, NULL);
+					g_timeout_add_seconds (seek_interval, (GSourceFunc) perform_seek, data);
+					data->seeks_scheduled = TRUE;
+				}
+			}
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstBus *bus;
+	gchar **targets;
+	guint i;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- seeking with a persistent keyframe index");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	/* Initialize our data structure */
+	memset (&data, 0, sizeof (data));
+	data.uri = g_strdup (uri_arg ? uri_arg : DEFAULT_URI);
+	data.keyframes = g_array_new (FALSE, FALSE, sizeof (gint64));
+	data.intervals = g_array_new (FALSE, FALSE, sizeof (Interval));
+	g_mutex_init (&data.index_lock);
+
+	targets = g_strsplit (seeks_arg ? seeks_arg : "30,60,15", ",", -1);
+	data.n_seeks = g_strv_length (targets);
+	data.seeks = g_new0 (gdouble, data.n_seeks);
+	for (i = 0; i < data.n_seeks; i++)
+		data.seeks[i] = g_ascii_strtod (targets[i], NULL);
+	g_strfreev (targets);
+
+	/* Create the elements */
+	data.playbin = gst_element_factory_make ("playbin", "playbin");
+	if (!data.playbin) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+	g_object_set (data.playbin, "uri", data.uri, NULL);
+	g_signal_connect (data.playbin, "deep-element-added", G_CALLBACK (deep_element_added_cb), &data);
+
+	bus = gst_element_get_bus (data.playbin);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+
+	/* Start playing */
+	if (gst_element_set_state (data.playbin, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (bus);
+		gst_object_unref (data.playbin);
+		return -1;
+	}
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	g_unix_signal_add (SIGINT, (GSourceFunc) interrupt_cb, &data);
+	g_main_loop_run (data.loop);
+
+	/* Persist what we learned for the next run, whatever ended the main loop: EOS, an error or an interrupt */
+	gst_element_set_state (data.playbin, GST_STATE_NULL);
+	index_save (&data);
+
+	/* Free resources */
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.playbin);
+	g_main_loop_unref (data.loop);
+	g_array_unref (data.keyframes);
+	g_array_unref (data.intervals);
+	g_mutex_clear (&data.index_lock);
+	g_free (data.index_path);
+	g_free (data.uri);
+	g_free (data.seeks);
+	g_free (uri_arg);
+	g_free (seeks_arg);
+	return 0;
+}
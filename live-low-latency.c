@@ -0,0 +1,423 @@
+/* Live low latency : one profile for live cameras over RTSP, SRT or WebRTC
+ *
+ * Goal
+ *
+ * The tutorials play a file-like HTTPS URI, where buffering is what we want. For a live camera the same defaults add
+ * hundreds of milliseconds: a 2 s jitter buffer in rtspsrc, queues that hold seconds of data, sinks that render late
+ * frames instead of dropping them. This program plays a live URI with playbin (basic-tutorial-1.c) or with the
+ * uridecodebin pipeline of basic-tutorial-3.c, and applies a latency profile picked once on the command line:
+ *
+ *   - the source (through "source-setup") and every rtpjitterbuffer get the profile latency and drop what arrives later
+ *     than that;
+ *   - queues are short and leaky, multiqueues short;
+ *   - sinks and video decoders have QoS enabled, and sinks drop buffers later than max-lateness;
+ *   - the pipeline latency is fixed to the profile value with gst_pipeline_set_latency(), instead of the sum of what
+ *     every element asks for.
+ *
+ * Every property is set only on elements that have it, so the same profile works whatever source the URI selects.
+ *
+ * Glass-to-glass latency is measured at the video sink. When the buffers carry a capture timestamp
+ * (GstReferenceTimestampMeta with timestamp/x-ntp caps, which rtspsrc and rtpjitterbuffer add from RTCP sender reports
+ * when asked to), it is the difference between the time the frame will be rendered and the capture time. Without it,
+ * live sources timestamp their buffers with the capture running time, so we report how long after that running time
+ * the frame reaches the video sink: everything spent inside the pipeline, without the camera and the network. The sink
+ * then holds it until running time + pipeline latency, so that number is the time it had to spare, not a render time.
+ *
+ * Usage
+ *   live-low-latency --uri=rtsp://camera/stream [--profile=normal|low|ultra] [--uridecodebin]
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+/* Seconds between 1900 (NTP epoch) and 1970 (Unix epoch) */
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT (2208988800)
+
+/* A latency profile. Values of 0 leave the element defaults alone */
+typedef struct _LatencyProfile {
+	const gchar *name;
+	guint latency_ms;               /* Jitter buffer and pipeline latency */
+	guint queue_buffers;            /* max-size-buffers of the queues */
+	gint64 max_lateness_ms;         /* Sinks drop buffers later than this */
+} LatencyProfile;
+
+static const LatencyProfile profiles[] = {
+	{ "normal", 0, 0, 0 },
+	{ "low", 200, 5, 40 },
+	{ "ultra", 50, 1, 10 },
+};
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	gboolean audio_branch;          /* uridecodebin mode only: the branch was created */
+	gboolean video_branch;
+	GMainLoop *loop;
+	const LatencyProfile *profile;
+
+	GMutex lock;                    /* Protects everything below */
+	GstElement *video_sink;         /* The sink we measure at */
+	GstSegment segment;             /* Last segment seen by the video sink */
+	guint64 frames;
+	GstClockTime latency_min, latency_max, latency_sum;
+	gboolean reference_meta;        /* The last measurement used the capture timestamp */
+	guint64 dropped;                /* Reported by QoS messages */
+} CustomData;
+
+static gchar *uri = NULL;
+static gchar *profile_name = NULL;
+static gboolean use_uridecodebin = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "Live URI to play (rtsp://, srt://, ...)", "URI" },
+	{ "profile", 'p', 0, G_OPTION_ARG_STRING, &profile_name, "Latency profile: normal, low or ultra (default: low)", "NAME" },
+	{ "uridecodebin", 'd', 0, G_OPTION_ARG_NONE, &use_uridecodebin, "Use the uridecodebin pipeline of basic-tutorial-3.c instead of playbin", NULL },
+	{ NULL }
+};
+
+/* Sets a property from a string, only if the object has it. Enums and flags take their nicks */
+static void set_if_exists (gpointer object, const gchar *name, const gchar *value) {
+	if (g_object_class_find_property (G_OBJECT_GET_CLASS (object), name))
+		gst_util_set_object_arg (G_OBJECT (object), name, value);
+}
+
+/* The source and the jitter buffers: keep little, drop what is too late, and tag the capture time */
+static void configure_network_element (GObject *element, const LatencyProfile *profile) {
+	gchar *value;
+
+	/* Always useful, and harmless: it only adds the capture time when the sender provides it */
+	set_if_exists (element, "add-reference-timestamp-meta", "true");
+	if (profile->latency_ms == 0)
+		return;
+	value = g_strdup_printf ("%u", profile->latency_ms);
+	set_if_exists (element, "latency", value);
+	set_if_exists (element, "drop-on-latency", "true");
+	g_free (value);
+}
+
+/* Handler for the source-setup signal of playbin and uridecodebin */
+static void source_setup_cb (GstElement *bin, GstElement *source, CustomData *data) {
+	g_print ("Source %s\n", GST_OBJECT_NAME (gst_element_get_factory (source)));
+	configure_network_element (G_OBJECT (source), data->profile);
+}
+
+static GstPadProbeReturn video_sink_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data);
+
+/* Every element the pipeline creates, however deep, goes through here */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	const LatencyProfile *profile = data->profile;
+	GstElementFactory *factory = gst_element_get_factory (element);
+	const gchar *factory_name = factory ? GST_OBJECT_NAME (factory) : "";
+	const gchar *klass = factory ? gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS) : "";
+	gchar *value;
+
+	if (g_str_equal (factory_name, "rtpjitterbuffer")) {
+		configure_network_element (G_OBJECT (element), profile);
+	} else if (profile->queue_buffers > 0 && (g_str_equal (factory_name, "queue") || g_str_equal (factory_name, "multiqueue"))) {
+		value = g_strdup_printf ("%u", profile->queue_buffers);
+		g_object_set (element, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+		set_if_exists (element, "max-size-buffers", value);
+		set_if_exists (element, "leaky", "downstream");
+		g_free (value);
+	} else if (strstr (klass, "Decoder") && strstr (klass, "Video")) {
+		set_if_exists (element, "qos", "true");
+	}
+
+	if (GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK) && !GST_IS_BIN (element)) {
+		set_if_exists (element, "qos", "true");
+		if (profile->max_lateness_ms > 0) {
+			value = g_strdup_printf ("%" G_GINT64_FORMAT, profile->max_lateness_ms * GST_MSECOND);
+			set_if_exists (element, "max-lateness", value);
+			g_free (value);
+		}
+
+		/* Measure at the first video sink */
+		g_mutex_lock (&data->lock);
+		if (!data->video_sink && strstr (klass, "Video")) {
+			GstPad *pad = gst_element_get_static_pad (element, "sink");
+
+			data->video_sink = gst_object_ref (element);
+			gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+					(GstPadProbeCallback) video_sink_probe, data, NULL);
+			gst_object_unref (pad);
+		}
+		g_mutex_unlock (&data->lock);
+	}
+}
+
+/* Measures the latency of every frame that reaches the video sink */
+static GstPadProbeReturn video_sink_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	static GstCaps *ntp_caps = NULL;
+	GstReferenceTimestampMeta *meta;
+	GstClockTime running_time, render_time, latency = GST_CLOCK_TIME_NONE, pipeline_latency;
+	GstClockTime clock_now, base_time, capture_time;
+	GstClock *clock;
+	GstBuffer *buffer;
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+		if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+			g_mutex_lock (&data->lock);
+			gst_event_copy_segment (event, &data->segment);
+			g_mutex_unlock (&data->lock);
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	clock = gst_element_get_clock (data->video_sink);
+	if (!clock || !GST_BUFFER_PTS_IS_VALID (buffer)) {
+		if (clock)
+			gst_object_unref (clock);
+		return GST_PAD_PROBE_OK;
+	}
+	if (g_once_init_enter (&ntp_caps))
+		g_once_init_leave (&ntp_caps, gst_caps_new_empty_simple ("timestamp/x-ntp"));
+
+	g_mutex_lock (&data->lock);
+	running_time = gst_segment_to_running_time (&data->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+	g_mutex_unlock (&data->lock);
+	if (!GST_CLOCK_TIME_IS_VALID (running_time)) {
+		gst_object_unref (clock);
+		return GST_PAD_PROBE_OK;
+	}
+
+	base_time = gst_element_get_base_time (data->video_sink);
+	clock_now = gst_clock_get_time (clock);
+	capture_time = base_time + running_time;
+
+	meta = gst_buffer_get_reference_timestamp_meta (buffer, ntp_caps);
+	if (meta) {
+		/* The sink renders the frame at running time + pipeline latency, or now if it is already late */
+		GstClockTime wall_ntp = g_get_real_time () * GST_USECOND + NTP_UNIX_OFFSET * GST_SECOND;
+		GstClockTime render_ntp;
+
+		pipeline_latency = gst_pipeline_get_latency (GST_PIPELINE (data->pipeline));
+		render_time = MAX (capture_time + (GST_CLOCK_TIME_IS_VALID (pipeline_latency) ? pipeline_latency : 0), clock_now);
+		/* Where the wall clock will be at render time, in the NTP time base of the capture timestamp */
+		render_ntp = wall_ntp + (render_time - clock_now);
+		if (render_ntp > meta->timestamp)
+			latency = render_ntp - meta->timestamp;
+	} else if (clock_now >= capture_time) {
+		/* The buffer running time is its capture running time. Going through the render time instead would only give
+		 * back the pipeline latency we configured */
+		latency = clock_now - capture_time;
+	}
+	gst_object_unref (clock);
+
+	if (GST_CLOCK_TIME_IS_VALID (latency)) {
+		g_mutex_lock (&data->lock);
+		data->frames++;
+		data->latency_sum += latency;
+		data->latency_min = MIN (data->latency_min, latency);
+		data->latency_max = MAX (data->latency_max, latency);
+		data->reference_meta = meta != NULL;
+		g_mutex_unlock (&data->lock);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean print_latency (CustomData *data) {
+	g_mutex_lock (&data->lock);
+	if (data->frames > 0) {
+		g_print ("%s latency: min %.1f ms, avg %.1f ms, max %.1f ms over %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT
+				" dropped\n", data->reference_meta ? "glass-to-glass" : "capture to video sink", data->latency_min / 1e6,
+				data->latency_sum / 1e6 / data->frames, data->latency_max / 1e6, data->frames, data->dropped);
+	}
+	data->frames = 0;
+	data->latency_sum = 0;
+	data->latency_min = GST_CLOCK_TIME_NONE;
+	data->latency_max = 0;
+	g_mutex_unlock (&data->lock);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_QOS: {
+			GstFormat format;
+			guint64 processed, dropped;
+
+			/* Every QoS message carries the running count of its element */
+			gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+			if (format == GST_FORMAT_BUFFERS && GST_MESSAGE_SRC (msg) == GST_OBJECT (data->video_sink)) {
+				g_mutex_lock (&data->lock);
+				data->dropped = dropped;
+				g_mutex_unlock (&data->lock);
+			}
+			break;
+		}
+		case GST_MESSAGE_LATENCY:
+			/* An element changed its latency. With a fixed pipeline latency this only redistributes the profile value */
+			gst_bin_recalculate_latency (GST_BIN (data->pipeline));
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+/* Creates a branch for a new pad of uridecodebin and links it */
+static gboolean add_branch (CustomData *data, GstPad *new_pad, const gchar *description) {
+	GError *error = NULL;
+	GstElement *branch;
+	GstPad *sink_pad;
+
+	branch = gst_parse_bin_from_description (description, TRUE, &error);
+	if (!branch) {
+		g_printerr ("Could not create the branch '%s': %s\n", description, error->message);
+		g_clear_error (&error);
+		return FALSE;
+	}
+
+	/* deep-element-added configures its elements, and it must be running before the first buffer comes in */
+	gst_bin_add (GST_BIN (data->pipeline), branch);
+	gst_element_sync_state_with_parent (branch);
+	sink_pad = gst_element_get_static_pad (branch, "sink");
+	if (GST_PAD_LINK_FAILED (gst_pad_link (new_pad, sink_pad))) {
+		g_print ("Branch '%s' could not be linked.\n", description);
+		gst_object_unref (sink_pad);
+		gst_element_set_state (branch, GST_STATE_NULL);
+		gst_bin_remove (GST_BIN (data->pipeline), branch);
+		return FALSE;
+	}
+	gst_object_unref (sink_pad);
+	return TRUE;
+}
+
+/* Handler for the pad-added signal of uridecodebin, as in basic-tutorial-3.c with a video branch. A branch is only
+ * created for a stream the URI has, so a camera without a microphone does not leave a sink waiting forever */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
+	GstCaps *new_pad_caps = gst_pad_get_current_caps (new_pad);
+	const gchar *new_pad_type = gst_structure_get_name (gst_caps_get_structure (new_pad_caps, 0));
+
+	if (g_str_has_prefix (new_pad_type, "audio/x-raw")) {
+		if (!data->audio_branch)
+			data->audio_branch = add_branch (data, new_pad, "audioconvert ! audioresample ! autoaudiosink");
+	} else if (g_str_has_prefix (new_pad_type, "video/x-raw")) {
+		if (!data->video_branch)
+			data->video_branch = add_branch (data, new_pad, "videoconvert ! autovideosink");
+	}
+	gst_caps_unref (new_pad_caps);
+}
+
+static gboolean build_uridecodebin_pipeline (CustomData *data) {
+	GstElement *source;
+
+	source = gst_element_factory_make ("uridecodebin", "source");
+	data->pipeline = gst_pipeline_new ("test-pipeline");
+
+	if (!data->pipeline || !source) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+
+	/* Connected before anything is added, so it also sees the elements added directly to the pipeline */
+	g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), data);
+	gst_bin_add (GST_BIN (data->pipeline), source);
+
+	g_object_set (source, "uri", uri, NULL);
+	g_signal_connect (source, "pad-added", G_CALLBACK (pad_added_handler), data);
+	g_signal_connect (source, "source-setup", G_CALLBACK (source_setup_cb), data);
+	return TRUE;
+}
+
+static gboolean build_playbin_pipeline (CustomData *data) {
+	data->pipeline = gst_element_factory_make ("playbin", "playbin");
+	if (!data->pipeline) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+	g_object_set (data->pipeline, "uri", uri, NULL);
+	g_signal_connect (data->pipeline, "source-setup", G_CALLBACK (source_setup_cb), data);
+	g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), data);
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstBus *bus;
+	guint i;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- low latency live playback");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (!uri) {
+		g_printerr ("A live URI is required (--uri).\n");
+		return -1;
+	}
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.lock);
+	gst_segment_init (&data.segment, GST_FORMAT_UNDEFINED);
+	data.latency_min = GST_CLOCK_TIME_NONE;
+	for (i = 0; i < G_N_ELEMENTS (profiles); i++)
+		if (g_str_equal (profiles[i].name, profile_name ? profile_name : "low"))
+			data.profile = &profiles[i];
+	if (!data.profile) {
+		g_printerr ("Unknown profile '%s'.\n", profile_name);
+		return -1;
+	}
+
+	if (!(use_uridecodebin ? build_uridecodebin_pipeline (&data) : build_playbin_pipeline (&data))) {
+		if (data.pipeline)
+			gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+	g_timeout_add_seconds (1, (GSourceFunc) print_latency, &data);
+
+	/* Start playing. Live sources do not preroll */
+	if (data.profile->latency_ms > 0)
+		gst_pipeline_set_latency (GST_PIPELINE (data.pipeline), data.profile->latency_ms * GST_MSECOND);
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	g_main_loop_run (data.loop);
+
+	/* Free resources */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	if (data.video_sink)
+		gst_object_unref (data.video_sink);
+	gst_object_unref (data.pipeline);
+	g_main_loop_unref (data.loop);
+	g_mutex_clear (&data.lock);
+	g_free (uri);
+	g_free (profile_name);
+	return 0;
+}
@@ -0,0 +1,509 @@
+/* Memory-mapped media cache : repeated playback from a local store
+ *
+ * Goal
+ *
+ * Every tutorial fetches the sintel trailer over HTTP, every time it runs. A node that replays a few hot assets all
+ * day should fetch each of them once. This program puts a local cache in front of the basic-tutorial-3.c playback:
+ *
+ *   - the store is content-addressed: a fetched file is kept as objects/XX/SHA256, named after the SHA-256 of its
+ *     bytes, and a reference maps the URI to that object. Two URIs serving the same bytes share one object.
+ *   - a miss fetches the URI once into the store, with the source element of the URI and a filesink, hashing the bytes
+ *     on the way. The object is renamed into place only when complete, so an interrupted fetch never leaves a
+ *     truncated object behind.
+ *   - a hit maps the object with GMappedFile and feeds it to decodebin through an appsrc in random-access mode. Every
+ *     buffer wraps a range of the mapping: no read() and no copy, the demuxer reads the page cache in place. Plays in
+ *     the same process share one mapping, and other processes mapping the same object share its pages.
+ *
+ * The cache keeps its index and statistics in index.ini, a GKeyFile: the references, and how many plays, hits and
+ * misses it saw and how many bytes the hits served without fetching them. Every run prints what it did and the
+ * totals, with the time every play took to preroll.
+ *
+ * Usage
+ *   mmap-media-cache [--uri=URI] [--cache-dir=DIR] [--repeat=N] [--headless] [--stats]
+ *
+ * --repeat plays the URI N times in a row (the first play of an uncached URI is a miss). --headless uses fakesinks
+ * that do not sync, so the plays run as fast as they decode. --stats only prints the statistics of the cache.
+ *
+ * It also needs the app library: add gstreamer-app-1.0 to the pkg-config line.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+/* Size of the buffers pushed in push mode. In pull mode the demuxer asks for the sizes it wants */
+#define CHUNK_SIZE (256 * 1024)
+
+/* The on-disk store */
+typedef struct _Cache {
+	gchar *dir;
+	gchar *index_path;
+	GKeyFile *index;                /* References and statistics */
+	GHashTable *mappings;           /* Object hash -> GMappedFile, shared by the plays of this process */
+} Cache;
+
+/* One playback of a cached object */
+typedef struct _Play {
+	GstElement *pipeline;
+	GstElement *source;
+	GMappedFile *file;
+	guint64 offset;                 /* Where the next buffer starts */
+	guint64 served;                 /* Bytes handed to the pipeline */
+	gint buffers;
+	gboolean headless;
+} Play;
+
+static gchar *uri = NULL;
+static gchar *cache_dir = NULL;
+static gint repeat = 1;
+static gboolean headless = FALSE;
+static gboolean stats_only = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play (default: sintel trailer)", "URI" },
+	{ "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir, "Directory of the store (default: the user cache directory)", "DIR" },
+	{ "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat, "Number of plays (default: 1)", "N" },
+	{ "headless", 0, 0, G_OPTION_ARG_NONE, &headless, "Play into fakesinks, without syncing to the clock", NULL },
+	{ "stats", 's', 0, G_OPTION_ARG_NONE, &stats_only, "Print the statistics of the cache and exit", NULL },
+	{ NULL }
+};
+
+static void cache_add_stat (Cache *cache, const gchar *key, guint64 value) {
+	g_key_file_set_uint64 (cache->index, "stats", key, g_key_file_get_uint64 (cache->index, "stats", key, NULL) + value);
+}
+
+static gboolean cache_open (Cache *cache, const gchar *dir) {
+	GError *error = NULL;
+	gchar *objects;
+
+	memset (cache, 0, sizeof (*cache));
+	cache->dir = dir ? g_strdup (dir) : g_build_filename (g_get_user_cache_dir (), "mmap-media-cache", NULL);
+	objects = g_build_filename (cache->dir, "objects", NULL);
+	if (g_mkdir_with_parents (objects, 0755) != 0) {
+		g_printerr ("Could not create the cache directory %s.\n", objects);
+		g_free (objects);
+		return FALSE;
+	}
+	g_free (objects);
+
+	cache->index_path = g_build_filename (cache->dir, "index.ini", NULL);
+	cache->index = g_key_file_new ();
+	if (!g_key_file_load_from_file (cache->index, cache->index_path, G_KEY_FILE_KEEP_COMMENTS, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_printerr ("Could not read the cache index: %s\n", error->message);
+			g_clear_error (&error);
+			return FALSE;
+		}
+		g_clear_error (&error);
+	}
+	cache->mappings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_mapped_file_unref);
+	return TRUE;
+}
+
+static void cache_close (Cache *cache) {
+	GError *error = NULL;
+
+	if (!g_key_file_save_to_file (cache->index, cache->index_path, &error)) {
+		g_printerr ("Could not write the cache index: %s\n", error->message);
+		g_clear_error (&error);
+	}
+	g_hash_table_unref (cache->mappings);
+	g_key_file_unref (cache->index);
+	g_free (cache->index_path);
+	g_free (cache->dir);
+}
+
+static gchar *object_path (Cache *cache, const gchar *hash) {
+	gchar prefix[3] = { hash[0], hash[1], '\0' };
+
+	return g_build_filename (cache->dir, "objects", prefix, hash, NULL);
+}
+
+/* The group of the reference for a URI. URIs may hold characters key files do not accept, their hash does not */
+static gchar *ref_group (const gchar *uri) {
+	gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, -1);
+	gchar *group = g_strdup_printf ("ref %s", hash);
+
+	g_free (hash);
+	return group;
+}
+
+/* Maps the object the URI refers to, or returns NULL when it is not cached. The mapping is shared */
+static GMappedFile *cache_lookup (Cache *cache, const gchar *uri) {
+	gchar *group = ref_group (uri);
+	gchar *hash = g_key_file_get_string (cache->index, group, "object", NULL);
+	GMappedFile *file = NULL;
+	gchar *path;
+
+	g_free (group);
+	if (!hash)
+		return NULL;
+
+	file = g_hash_table_lookup (cache->mappings, hash);
+	if (file) {
+		g_free (hash);
+		return g_mapped_file_ref (file);
+	}
+
+	/* A stale reference (the object was removed by hand) is a miss. The fetch will repair it */
+	path = object_path (cache, hash);
+	file = g_mapped_file_new (path, FALSE, NULL);
+	g_free (path);
+	if (!file || g_mapped_file_get_length (file) == 0) {
+		g_clear_pointer (&file, g_mapped_file_unref);
+		g_free (hash);
+		return NULL;
+	}
+	g_hash_table_insert (cache->mappings, hash, g_mapped_file_ref (file));
+	return file;
+}
+
+/* Hashes the bytes on their way to the filesink */
+static GstPadProbeReturn hash_probe (GstPad *pad, GstPadProbeInfo *info, GChecksum *checksum) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	GstMapInfo map;
+
+	if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+		g_checksum_update (checksum, map.data, map.size);
+		gst_buffer_unmap (buffer, &map);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/* Fetches the URI into the store and references it. Returns the size of the object, or 0 on failure */
+static guint64 cache_fetch (Cache *cache, const gchar *uri) {
+	GstElement *pipeline, *source, *sink;
+	GError *error = NULL;
+	GChecksum *checksum;
+	GstMessage *msg;
+	GstBus *bus;
+	GstPad *pad;
+	GStatBuf st;
+	gchar *tmp_path, *path, *dir, *group;
+	const gchar *hash;
+	gboolean done = FALSE;
+	guint64 size = 0;
+
+	source = gst_element_make_from_uri (GST_URI_SRC, uri, "source", &error);
+	if (!source) {
+		g_printerr ("Could not create a source for %s: %s\n", uri, error->message);
+		g_clear_error (&error);
+		return 0;
+	}
+	sink = gst_element_factory_make ("filesink", "sink");
+	pipeline = gst_pipeline_new ("fetch-pipeline");
+	if (!pipeline || !sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return 0;
+	}
+	tmp_path = g_strdup_printf ("%s/objects/.fetch-%d", cache->dir, (gint) getpid ());
+	g_object_set (sink, "location", tmp_path, "sync", FALSE, NULL);
+	gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+	if (!gst_element_link (source, sink)) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (pipeline);
+		g_free (tmp_path);
+		return 0;
+	}
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+	pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) hash_probe, checksum, NULL);
+	gst_object_unref (pad);
+
+	g_print ("Fetching %s\n", uri);
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+	} else {
+		bus = gst_element_get_bus (pipeline);
+		msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+		if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+			gchar *debug_info;
+
+			gst_message_parse_error (msg, &error, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), error->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&error);
+			g_free (debug_info);
+		} else {
+			done = TRUE;
+		}
+		gst_message_unref (msg);
+		gst_object_unref (bus);
+	}
+	/* Going to NULL closes the file */
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+
+	if (done && g_stat (tmp_path, &st) == 0 && st.st_size > 0) {
+		hash = g_checksum_get_string (checksum);
+		path = object_path (cache, hash);
+		dir = g_path_get_dirname (path);
+		g_mkdir_with_parents (dir, 0755);
+		g_free (dir);
+
+		/* Same bytes, same object: a copy fetched through another URI is dropped */
+		if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+			g_print ("Content already stored as %s\n", hash);
+			g_remove (tmp_path);
+			size = st.st_size;
+		} else if (g_rename (tmp_path, path) == 0) {
+			size = st.st_size;
+		} else {
+			g_printerr ("Could not store %s.\n", path);
+		}
+		g_free (path);
+
+		if (size > 0) {
+			group = ref_group (uri);
+			g_key_file_set_string (cache->index, group, "uri", uri);
+			g_key_file_set_string (cache->index, group, "object", hash);
+			g_key_file_set_uint64 (cache->index, group, "size", size);
+			g_free (group);
+			cache_add_stat (cache, "bytes-fetched", size);
+		}
+	}
+	g_remove (tmp_path);
+	g_free (tmp_path);
+	g_checksum_free (checksum);
+	return size;
+}
+
+/* appsrc wants data: wrap the next range of the mapping, without copying it */
+static void need_data (GstAppSrc *src, guint length, Play *play) {
+	guint64 size = g_mapped_file_get_length (play->file);
+	GstBuffer *buffer;
+
+	if (play->offset >= size) {
+		gst_app_src_end_of_stream (src);
+		return;
+	}
+	if (length == 0 || length == (guint) -1)
+		length = CHUNK_SIZE;
+	length = MIN (length, size - play->offset);
+
+	/* The buffer holds a reference on the mapping, which outlives the play if the pipeline keeps the buffer */
+	buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, g_mapped_file_get_contents (play->file), size,
+			play->offset, length, g_mapped_file_ref (play->file), (GDestroyNotify) g_mapped_file_unref);
+	GST_BUFFER_OFFSET (buffer) = play->offset;
+	GST_BUFFER_OFFSET_END (buffer) = play->offset + length;
+	play->offset += length;
+	play->served += length;
+	play->buffers++;
+	gst_app_src_push_buffer (src, buffer);
+}
+
+/* The demuxer jumps around the file (to its index, on seeks): so does the next buffer */
+static gboolean seek_data (GstAppSrc *src, guint64 offset, Play *play) {
+	play->offset = offset;
+	return TRUE;
+}
+
+/* Handler for the pad-added signal of decodebin: plays the audio and video it exposes */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, Play *play) {
+	GstCaps *new_pad_caps = gst_pad_get_current_caps (new_pad);
+	const gchar *new_pad_type = gst_structure_get_name (gst_caps_get_structure (new_pad_caps, 0));
+	const gchar *description = NULL;
+	GError *error = NULL;
+	GstElement *branch;
+	GstPad *sink_pad;
+
+	if (g_str_has_prefix (new_pad_type, "audio/x-raw"))
+		description = play->headless ? "fakesink sync=false" : "audioconvert ! audioresample ! autoaudiosink";
+	else if (g_str_has_prefix (new_pad_type, "video/x-raw"))
+		description = play->headless ? "fakesink sync=false" : "videoconvert ! autovideosink";
+	if (!description) {
+		g_print ("Pad '%s' has type '%s' which we do not play. Ignoring.\n", GST_PAD_NAME (new_pad), new_pad_type);
+		gst_caps_unref (new_pad_caps);
+		return;
+	}
+
+	branch = gst_parse_bin_from_description (description, TRUE, &error);
+	if (!branch) {
+		g_printerr ("Could not create the branch for '%s': %s\n", new_pad_type, error->message);
+		g_clear_error (&error);
+		gst_caps_unref (new_pad_caps);
+		return;
+	}
+	gst_bin_add (GST_BIN (play->pipeline), branch);
+	gst_element_sync_state_with_parent (branch);
+	sink_pad = gst_element_get_static_pad (branch, "sink");
+	if (GST_PAD_LINK_FAILED (gst_pad_link (new_pad, sink_pad)))
+		g_print ("Type is '%s' but link failed.\n", new_pad_type);
+	gst_object_unref (sink_pad);
+	gst_caps_unref (new_pad_caps);
+}
+
+/* Plays a mapped object to the end. Returns FALSE on error */
+static gboolean play_mapped (Play *play) {
+	GstAppSrcCallbacks callbacks = { 0, };
+	GstElement *decodebin;
+	GstClockTime start, preroll = GST_CLOCK_TIME_NONE;
+	GError *err;
+	GstMessage *msg;
+	GstBus *bus;
+	gchar *debug_info;
+	gboolean terminate = FALSE, ok = FALSE;
+
+	play->source = gst_element_factory_make ("appsrc", "cache_source");
+	decodebin = gst_element_factory_make ("decodebin", "decoder");
+	play->pipeline = gst_pipeline_new ("play-pipeline");
+	if (!play->pipeline || !play->source || !decodebin) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+
+	/* Random access: the demuxer may pull from any offset, as it would from filesrc */
+	g_object_set (play->source, "stream-type", GST_APP_STREAM_TYPE_RANDOM_ACCESS, "format", GST_FORMAT_BYTES,
+			"size", (gint64) g_mapped_file_get_length (play->file), "blocksize", CHUNK_SIZE, NULL);
+	callbacks.need_data = (gpointer) need_data;
+	callbacks.seek_data = (gpointer) seek_data;
+	gst_app_src_set_callbacks (GST_APP_SRC (play->source), &callbacks, play, NULL);
+
+	gst_bin_add_many (GST_BIN (play->pipeline), play->source, decodebin, NULL);
+	if (!gst_element_link (play->source, decodebin)) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (play->pipeline);
+		return FALSE;
+	}
+	g_signal_connect (decodebin, "pad-added", G_CALLBACK (pad_added_handler), play);
+
+	start = gst_util_get_timestamp ();
+	if (gst_element_set_state (play->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (play->pipeline);
+		return FALSE;
+	}
+
+	bus = gst_element_get_bus (play->pipeline);
+	do {
+		msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+				GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ASYNC_DONE);
+
+		switch (GST_MESSAGE_TYPE (msg)) {
+			case GST_MESSAGE_ERROR:
+				gst_message_parse_error (msg, &err, &debug_info);
+				g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+				g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+				g_clear_error (&err);
+				g_free (debug_info);
+				terminate = TRUE;
+				break;
+			case GST_MESSAGE_EOS:
+				ok = terminate = TRUE;
+				break;
+			case GST_MESSAGE_ASYNC_DONE:
+				if (!GST_CLOCK_TIME_IS_VALID (preroll))
+					preroll = gst_util_get_timestamp () - start;
+				break;
+			default:
+				break;
+		}
+		gst_message_unref (msg);
+	} while (!terminate);
+
+	g_print ("  prerolled in %.1f ms, played in %.2f s, %d buffers, %" G_GUINT64_FORMAT " bytes from the mapping\n",
+			GST_CLOCK_TIME_IS_VALID (preroll) ? preroll / 1e6 : -1.0, (gst_util_get_timestamp () - start) / 1e9,
+			play->buffers, play->served);
+
+	gst_object_unref (bus);
+	gst_element_set_state (play->pipeline, GST_STATE_NULL);
+	gst_object_unref (play->pipeline);
+	return ok;
+}
+
+static void print_stats (Cache *cache) {
+	guint64 plays = g_key_file_get_uint64 (cache->index, "stats", "plays", NULL);
+	guint64 hits = g_key_file_get_uint64 (cache->index, "stats", "hits", NULL);
+	guint64 misses = g_key_file_get_uint64 (cache->index, "stats", "misses", NULL);
+	guint64 fetched = g_key_file_get_uint64 (cache->index, "stats", "bytes-fetched", NULL);
+	guint64 saved = g_key_file_get_uint64 (cache->index, "stats", "bytes-saved", NULL);
+
+	g_print ("Cache %s: %" G_GUINT64_FORMAT " plays, %" G_GUINT64_FORMAT " hits (%.1f%%), %" G_GUINT64_FORMAT
+			" misses, %.1f MB fetched, %.1f MB served from the cache\n", cache->dir, plays, hits,
+			plays > 0 ? hits * 100.0 / plays : 0.0, misses, fetched / 1e6, saved / 1e6);
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	GMappedFile *file;
+	Cache cache;
+	Play play;
+	gint i, hits = 0, misses = 0;
+	gboolean hit;
+	guint64 saved = 0;
+	gint ret = 0;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- repeated playback from a memory-mapped local cache");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (repeat <= 0) {
+		g_printerr ("The number of plays must be positive.\n");
+		return -1;
+	}
+	if (!cache_open (&cache, cache_dir))
+		return -1;
+	if (stats_only) {
+		print_stats (&cache);
+		cache_close (&cache);
+		return 0;
+	}
+	if (!uri)
+		uri = g_strdup (DEFAULT_URI);
+
+	for (i = 0; i < repeat; i++) {
+		file = cache_lookup (&cache, uri);
+		hit = file != NULL;
+		if (hit) {
+			hits++;
+			cache_add_stat (&cache, "hits", 1);
+			g_print ("Play %d: hit\n", i + 1);
+		} else {
+			misses++;
+			cache_add_stat (&cache, "misses", 1);
+			g_print ("Play %d: miss\n", i + 1);
+			if (cache_fetch (&cache, uri) == 0 || !(file = cache_lookup (&cache, uri))) {
+				g_printerr ("Could not cache %s.\n", uri);
+				ret = -1;
+				break;
+			}
+		}
+		cache_add_stat (&cache, "plays", 1);
+
+		memset (&play, 0, sizeof (play));
+		play.file = file;
+		play.headless = headless;
+		if (!play_mapped (&play))
+			ret = -1;
+		g_mapped_file_unref (file);
+
+		/* What a hit served is what we did not fetch again */
+		if (hit) {
+			saved += play.served;
+			cache_add_stat (&cache, "bytes-saved", play.served);
+		}
+		if (ret != 0)
+			break;
+	}
+
+	g_print ("This run: %d hits, %d misses, %.1f MB served from the cache\n", hits, misses, saved / 1e6);
+	print_stats (&cache);
+	cache_close (&cache);
+	g_free (uri);
+	g_free (cache_dir);
+	return ret;
+}
@@ -0,0 +1,576 @@
+/* Pipeline host : many pipelines in one process
+ *
+ * Goal
+ *
+ * basic-tutorial-1.c builds one playbin with gst_parse_launch() and blocks on its bus. Running one such process per
+ * stream means every stream pays again for loading the registry and the plugins. This program hosts N pipelines
+ * in one process:
+ *
+ *   - One dispatch thread runs a GMainContext to which the bus watch of every pipeline is attached, so
+ *     hundreds of pipelines share a single thread for their messages.
+ *   - Every streaming thread (GstTask) of every pipeline is taken from one shared, bounded task pool.
+ *     The pool is installed from a bus sync handler when a task announces itself with a STREAM_STATUS
+ *     message of type CREATE, before the task starts.
+ *   - Every pipeline can be started, paused, stopped, restarted or removed on its own, by typing commands
+ *     on stdin: "play ID", "pause ID", "stop ID", "restart ID", "remove ID", "add DESCRIPTION", "list" and "quit".
+ *
+ * Note that a GstTask keeps its thread for as long as it is running, so a task waiting for a free thread could wait
+ * forever, and its pipeline could not even be stopped. The bound of the pool is therefore an admission limit: once
+ * all threads are in use, a new task is refused. GStreamer only logs a warning for a task that cannot start, and the
+ * pipeline would sit in PAUSED, so the pool posts an error for the element owning the task, the way the pool of
+ * affinity-task-pool.c does. "list" shows how many threads are in use and how many tasks were refused.
+ *
+ * With --scale, the program instead measures how memory and CPU grow with the number of pipelines: for every
+ * step (1 to 500 pipelines by default) it starts that many copies of the description, lets them run, and
+ * prints the resident memory and CPU time per pipeline.
+ *
+ * Usage
+ *   pipeline-host [--count=N] [--max-threads=T] "DESCRIPTION" ["DESCRIPTION" ...]
+ *   pipeline-host --scale [--scale-steps=1,10,50,100,250,500] [--measure=5] ["DESCRIPTION"]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_DESCRIPTION \
+	"videotestsrc is-live=true ! video/x-raw,width=320,height=240,framerate=30/1 ! fakesink sync=true"
+
+/*
+ * HostTaskPool : a GstTaskPool backed by a GThreadPool with a maximum number of threads
+ */
+typedef struct _HostTaskPool {
+	GstTaskPool parent;
+	GThreadPool *threads;
+	gint max_threads;
+	gint active;                    /* Tasks running right now */
+	gint refused;                   /* Tasks refused because all threads were in use */
+} HostTaskPool;
+
+typedef struct _HostTaskPoolClass {
+	GstTaskPoolClass parent_class;
+} HostTaskPoolClass;
+
+/* A task function waiting for a thread of the pool */
+typedef struct _HostTask {
+	GstTaskPoolFunction func;
+	gpointer user_data;
+} HostTask;
+
+GType host_task_pool_get_type (void);
+G_DEFINE_TYPE (HostTaskPool, host_task_pool, GST_TYPE_TASK_POOL);
+
+static void host_task_run (HostTask *task, HostTaskPool *pool) {
+	task->func (task->user_data);
+	g_free (task);
+	g_atomic_int_add (&pool->active, -1);
+}
+
+static void host_task_pool_prepare (GstTaskPool *pool, GError **error) {
+	HostTaskPool *self = (HostTaskPool *) pool;
+
+	GST_OBJECT_LOCK (self);
+	if (!self->threads)
+		self->threads = g_thread_pool_new ((GFunc) host_task_run, self, self->max_threads, FALSE, error);
+	GST_OBJECT_UNLOCK (self);
+}
+
+static void host_task_pool_cleanup (GstTaskPool *pool) {
+	HostTaskPool *self = (HostTaskPool *) pool;
+	GThreadPool *threads;
+
+	GST_OBJECT_LOCK (self);
+	threads = self->threads;
+	self->threads = NULL;
+	GST_OBJECT_UNLOCK (self);
+
+	/* Wait for the running tasks to finish */
+	if (threads)
+		g_thread_pool_free (threads, FALSE, TRUE);
+}
+
+static void task_owner_free (GWeakRef *ref) {
+	g_weak_ref_clear (ref);
+	g_free (ref);
+}
+
+/* Remembers the element a task runs for, so a refused task can be reported on it */
+static void task_set_owner (GstTask *task, GstElement *owner) {
+	GWeakRef *ref = g_new0 (GWeakRef, 1);
+
+	g_weak_ref_init (ref, owner);
+	g_object_set_data_full (G_OBJECT (task), "task-owner", ref, (GDestroyNotify) task_owner_free);
+}
+
+/* A streaming task runs until its element stops, so it can not wait in the queue of the GThreadPool for a thread
+ * to be released: refuse it instead. GstTask only turns the error into a warning, so post it for the element owning
+ * the task, or its pipeline would wait in PAUSED without a word. GstTask pushes itself as the user data */
+static gpointer host_task_pool_push (GstTaskPool *pool, GstTaskPoolFunction func, gpointer user_data, GError **error) {
+	HostTaskPool *self = (HostTaskPool *) pool;
+	HostTask *task;
+
+	if (g_atomic_int_add (&self->active, 1) >= self->max_threads) {
+		GWeakRef *ref = g_object_get_data (G_OBJECT (user_data), "task-owner");
+		GstElement *owner = ref ? g_weak_ref_get (ref) : NULL;
+
+		g_atomic_int_add (&self->active, -1);
+		g_atomic_int_inc (&self->refused);
+		g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_THREAD, "All %d streaming threads are in use", self->max_threads);
+		if (owner) {
+			GST_ELEMENT_ERROR (owner, CORE, THREAD, ("All %d streaming threads are in use", self->max_threads),
+					("The shared task pool refused a streaming thread, raise --max-threads"));
+			gst_object_unref (owner);
+		}
+		return NULL;
+	}
+
+	task = g_new (HostTask, 1);
+	task->func = func;
+	task->user_data = user_data;
+	if (!g_thread_pool_push (self->threads, task, error)) {
+		g_free (task);
+		g_atomic_int_add (&self->active, -1);
+	}
+	/* Like the default pool, we can not join pooled threads, so there is no id to return */
+	return NULL;
+}
+
+static void host_task_pool_join (GstTaskPool *pool, gpointer id) {
+}
+
+static void host_task_pool_class_init (HostTaskPoolClass *klass) {
+	GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS (klass);
+
+	pool_class->prepare = host_task_pool_prepare;
+	pool_class->cleanup = host_task_pool_cleanup;
+	pool_class->push = host_task_pool_push;
+	pool_class->join = host_task_pool_join;
+}
+
+static void host_task_pool_init (HostTaskPool *self) {
+}
+
+static GstTaskPool *host_task_pool_new (gint max_threads) {
+	HostTaskPool *pool = g_object_new (host_task_pool_get_type (), NULL);
+
+	/* GstTaskPool is a GstObject: take ownership of the floating reference */
+	gst_object_ref_sink (pool);
+	pool->max_threads = max_threads;
+	return GST_TASK_POOL (pool);
+}
+
+/*
+ * The host
+ */
+
+/* One hosted pipeline */
+typedef struct _HostedPipeline {
+	guint id;
+	gchar *description;
+	GstElement *pipeline;
+	GSource *bus_source;            /* Watch of the pipeline's bus, attached to the dispatch context */
+	gint finished;                  /* Atomic, got EOS or ERROR */
+} HostedPipeline;
+
+/* Structure to contain all our information, so we can pass it around */
+typedef struct _Host {
+	GMainContext *context;          /* Context of the dispatch thread, where all bus watches run */
+	GMainLoop *loop;
+	GThread *dispatch_thread;
+	GstTaskPool *pool;              /* Shared by the streaming threads of every pipeline */
+
+	GMutex lock;                    /* Protects pipelines, shared with the dispatch thread */
+	GPtrArray *pipelines;           /* HostedPipeline, in id order */
+	guint next_id;
+} Host;
+
+static gint count = 1;
+static gint max_threads = 1024;
+static gboolean scale = FALSE;
+static gchar *scale_steps = NULL;
+static gint measure_seconds = 5;
+static gchar **descriptions = NULL;
+
+static GOptionEntry entries[] = {
+	{ "count", 'n', 0, G_OPTION_ARG_INT, &count, "Number of copies of every description to host (default 1)", "N" },
+	{ "max-threads", 't', 0, G_OPTION_ARG_INT, &max_threads, "Maximum number of streaming threads (default 1024)", "T" },
+	{ "scale", 0, 0, G_OPTION_ARG_NONE, &scale, "Run the memory/CPU scaling benchmark", NULL },
+	{ "scale-steps", 0, 0, G_OPTION_ARG_STRING, &scale_steps, "Pipeline counts to measure (default 1,10,50,100,250,500)", "LIST" },
+	{ "measure", 0, 0, G_OPTION_ARG_INT, &measure_seconds, "Seconds to measure CPU use at every step (default 5)", "S" },
+	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &descriptions, NULL, "DESCRIPTION..." },
+	{ NULL }
+};
+
+/* Runs in the streaming threads: give every new task our shared pool */
+static GstBusSyncReply sync_handler (GstBus *bus, GstMessage *msg, Host *host) {
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_STREAM_STATUS) {
+		GstStreamStatusType type;
+		GstElement *owner;
+
+		gst_message_parse_stream_status (msg, &type, &owner);
+		if (type == GST_STREAM_STATUS_TYPE_CREATE) {
+			const GValue *value = gst_message_get_stream_status_object (msg);
+
+			if (value && G_VALUE_HOLDS (value, GST_TYPE_TASK)) {
+				task_set_owner (GST_TASK (g_value_get_object (value)), owner);
+				gst_task_set_pool (GST_TASK (g_value_get_object (value)), host->pool);
+			}
+		}
+	}
+	return GST_BUS_PASS;
+}
+
+/* Runs in the dispatch thread, for the messages of every pipeline */
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, HostedPipeline *hosted) {
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR: {
+			GError *err;
+			gchar *debug_info;
+
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("[%u] Error received from element %s: %s\n", hosted->id, GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("[%u] Debugging information: %s\n", hosted->id, debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_atomic_int_set (&hosted->finished, TRUE);
+			break;
+		}
+		case GST_MESSAGE_EOS:
+			g_print ("[%u] End-Of-Stream reached.\n", hosted->id);
+			g_atomic_int_set (&hosted->finished, TRUE);
+			break;
+		default:
+			break;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static gpointer dispatch_thread_func (Host *host) {
+	g_main_context_push_thread_default (host->context);
+	g_main_loop_run (host->loop);
+	g_main_context_pop_thread_default (host->context);
+	return NULL;
+}
+
+/* Builds a pipeline, hooks its bus to the dispatch thread and the shared pool, and starts it */
+static HostedPipeline *host_add (Host *host, const gchar *description) {
+	HostedPipeline *hosted;
+	GstElement *pipeline;
+	GError *error = NULL;
+	GstBus *bus;
+
+	pipeline = gst_parse_launch (description, &error);
+	if (!pipeline) {
+		g_printerr ("Could not build '%s': %s\n", description, error->message);
+		g_clear_error (&error);
+		return NULL;
+	}
+
+	hosted = g_new0 (HostedPipeline, 1);
+	hosted->description = g_strdup (description);
+	hosted->pipeline = pipeline;
+
+	bus = gst_element_get_bus (pipeline);
+	gst_bus_set_sync_handler (bus, (GstBusSyncHandler) sync_handler, host, NULL);
+	hosted->bus_source = gst_bus_create_watch (bus);
+	g_source_set_callback (hosted->bus_source, (GSourceFunc) bus_cb, hosted, NULL);
+	g_source_attach (hosted->bus_source, host->context);
+	gst_object_unref (bus);
+
+	g_mutex_lock (&host->lock);
+	hosted->id = host->next_id++;
+	g_ptr_array_add (host->pipelines, hosted);
+	g_mutex_unlock (&host->lock);
+
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+		g_printerr ("[%u] Unable to set the pipeline to the playing state.\n", hosted->id);
+	return hosted;
+}
+
+/* Used to wait until the dispatch thread is done with what it was dispatching */
+typedef struct _DispatchSync {
+	GMutex lock;
+	GCond cond;
+	gboolean done;
+} DispatchSync;
+
+static gboolean dispatch_sync_cb (DispatchSync *sync) {
+	g_mutex_lock (&sync->lock);
+	sync->done = TRUE;
+	g_cond_signal (&sync->cond);
+	g_mutex_unlock (&sync->lock);
+	return G_SOURCE_REMOVE;
+}
+
+/* Returns once the dispatch thread has returned from the callback it may be running */
+static void host_sync_dispatch (Host *host) {
+	DispatchSync sync;
+
+	g_mutex_init (&sync.lock);
+	g_cond_init (&sync.cond);
+	sync.done = FALSE;
+	g_main_context_invoke (host->context, (GSourceFunc) dispatch_sync_cb, &sync);
+	g_mutex_lock (&sync.lock);
+	while (!sync.done)
+		g_cond_wait (&sync.cond, &sync.lock);
+	g_mutex_unlock (&sync.lock);
+	g_cond_clear (&sync.cond);
+	g_mutex_clear (&sync.lock);
+}
+
+static void hosted_free (Host *host, HostedPipeline *hosted) {
+	/* Once destroyed the watch is not dispatched again, but bus_cb may be running for it right now */
+	g_source_destroy (hosted->bus_source);
+	host_sync_dispatch (host);
+	g_source_unref (hosted->bus_source);
+	gst_element_set_state (hosted->pipeline, GST_STATE_NULL);
+	gst_object_unref (hosted->pipeline);
+	g_free (hosted->description);
+	g_free (hosted);
+}
+
+static HostedPipeline *host_find (Host *host, guint id) {
+	HostedPipeline *found = NULL;
+	guint i;
+
+	g_mutex_lock (&host->lock);
+	for (i = 0; i < host->pipelines->len; i++) {
+		HostedPipeline *hosted = g_ptr_array_index (host->pipelines, i);
+		if (hosted->id == id)
+			found = hosted;
+	}
+	g_mutex_unlock (&host->lock);
+	return found;
+}
+
+static void host_remove (Host *host, HostedPipeline *hosted) {
+	g_mutex_lock (&host->lock);
+	g_ptr_array_remove (host->pipelines, hosted);
+	g_mutex_unlock (&host->lock);
+	hosted_free (host, hosted);
+}
+
+static void host_list (Host *host) {
+	HostTaskPool *pool = (HostTaskPool *) host->pool;
+	guint i;
+
+	g_mutex_lock (&host->lock);
+	for (i = 0; i < host->pipelines->len; i++) {
+		HostedPipeline *hosted = g_ptr_array_index (host->pipelines, i);
+		GstState state;
+
+		gst_element_get_state (hosted->pipeline, &state, NULL, 0);
+		g_print ("%4u %-8s %s%s\n", hosted->id, gst_element_state_get_name (state),
+				g_atomic_int_get (&hosted->finished) ? "(finished) " : "", hosted->description);
+	}
+	g_mutex_unlock (&host->lock);
+	g_print ("streaming threads: %d of %d in use, %d tasks refused\n", g_atomic_int_get (&pool->active),
+			pool->max_threads, g_atomic_int_get (&pool->refused));
+}
+
+/* Reads commands from stdin until "quit" or end of input */
+static void run_console (Host *host) {
+	gchar line[4096];
+
+	g_print ("Commands: play|pause|stop|restart|remove ID, add DESCRIPTION, list, quit\n");
+	while (fgets (line, sizeof (line), stdin)) {
+		gchar *command = g_strstrip (line);
+		gchar *arg = strchr (command, ' ');
+		HostedPipeline *hosted = NULL;
+
+		if (arg) {
+			*arg++ = '\0';
+			arg = g_strstrip (arg);
+		}
+
+		if (g_str_equal (command, "quit"))
+			break;
+		if (g_str_equal (command, "list")) {
+			host_list (host);
+			continue;
+		}
+		if (g_str_equal (command, "add")) {
+			if (arg && (hosted = host_add (host, arg)))
+				g_print ("[%u] added\n", hosted->id);
+			continue;
+		}
+
+		if (!arg || !(hosted = host_find (host, (guint) atoi (arg)))) {
+			g_printerr ("Unknown command or pipeline: '%s'\n", command);
+			continue;
+		}
+		if (g_str_equal (command, "play")) {
+			gst_element_set_state (hosted->pipeline, GST_STATE_PLAYING);
+		} else if (g_str_equal (command, "pause")) {
+			gst_element_set_state (hosted->pipeline, GST_STATE_PAUSED);
+		} else if (g_str_equal (command, "stop")) {
+			gst_element_set_state (hosted->pipeline, GST_STATE_READY);
+		} else if (g_str_equal (command, "restart")) {
+			g_atomic_int_set (&hosted->finished, FALSE);
+			gst_element_set_state (hosted->pipeline, GST_STATE_NULL);
+			gst_element_set_state (hosted->pipeline, GST_STATE_PLAYING);
+		} else if (g_str_equal (command, "remove")) {
+			host_remove (host, hosted);
+		} else {
+			g_printerr ("Unknown command: '%s'\n", command);
+		}
+	}
+}
+
+/* Current resident set size of the process, in kilobytes */
+static glong current_rss_kb (void) {
+	glong size = 0, resident = 0;
+	FILE *statm = fopen ("/proc/self/statm", "r");
+
+	if (statm) {
+		if (fscanf (statm, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose (statm);
+		return resident * (sysconf (_SC_PAGESIZE) / 1024);
+	} else {
+		/* Not Linux: fall back on the peak, which is the best getrusage() can do */
+		struct rusage usage;
+		getrusage (RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+	}
+}
+
+static gdouble cpu_seconds (void) {
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* For every step, start that many pipelines and measure memory and CPU per pipeline */
+static void run_scaling_benchmark (Host *host, const gchar *description) {
+	gchar **steps = g_strsplit (scale_steps ? scale_steps : "1,10,50,100,250,500", ",", -1);
+	gchar **step;
+
+	g_print ("pipelines,rss_kb,rss_kb_per_pipeline,cpu_percent,cpu_percent_per_pipeline\n");
+	for (step = steps; *step; step++) {
+		gint n = atoi (*step), i;
+		glong rss_before, rss_after;
+		gdouble cpu_start, cpu_end;
+		gint64 wall_start, wall_end;
+
+		if (n <= 0)
+			continue;
+
+		rss_before = current_rss_kb ();
+		for (i = 0; i < n; i++)
+			host_add (host, description);
+
+		/* Let every pipeline reach PLAYING before measuring */
+		g_mutex_lock (&host->lock);
+		for (i = 0; i < (gint) host->pipelines->len; i++)
+			gst_element_get_state (((HostedPipeline *) g_ptr_array_index (host->pipelines, i))->pipeline, NULL, NULL, 5 * GST_SECOND);
+		g_mutex_unlock (&host->lock);
+
+		cpu_start = cpu_seconds ();
+		wall_start = g_get_monotonic_time ();
+		g_usleep (measure_seconds * G_USEC_PER_SEC);
+		cpu_end = cpu_seconds ();
+		wall_end = g_get_monotonic_time ();
+		rss_after = current_rss_kb ();
+
+		{
+			gdouble cpu_percent = 100.0 * (cpu_end - cpu_start) / ((wall_end - wall_start) / 1e6);
+			g_print ("%d,%ld,%.1f,%.1f,%.3f\n", n, rss_after - rss_before, (gdouble) (rss_after - rss_before) / n,
+					cpu_percent, cpu_percent / n);
+		}
+
+		/* Tear everything down before the next step */
+		g_mutex_lock (&host->lock);
+		while (host->pipelines->len > 0) {
+			HostedPipeline *hosted = g_ptr_array_steal_index (host->pipelines, host->pipelines->len - 1);
+			g_mutex_unlock (&host->lock);
+			hosted_free (host, hosted);
+			g_mutex_lock (&host->lock);
+		}
+		g_mutex_unlock (&host->lock);
+	}
+	g_strfreev (steps);
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	Host host;
+	gchar **description;
+	gint i;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- host many pipelines in one process");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (max_threads <= 0) {
+		g_printerr ("The maximum number of streaming threads must be positive.\n");
+		return -1;
+	}
+
+	/* Initialize our data structure */
+	memset (&host, 0, sizeof (host));
+	g_mutex_init (&host.lock);
+	host.pipelines = g_ptr_array_new ();
+	host.pool = host_task_pool_new (max_threads);
+	gst_task_pool_prepare (host.pool, &error);
+	if (error) {
+		g_printerr ("Could not prepare the task pool: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+
+	/* Start the shared dispatch thread */
+	host.context = g_main_context_new ();
+	host.loop = g_main_loop_new (host.context, FALSE);
+	host.dispatch_thread = g_thread_new ("bus-dispatch", (GThreadFunc) dispatch_thread_func, &host);
+
+	if (scale) {
+		run_scaling_benchmark (&host, descriptions ? descriptions[0] : DEFAULT_DESCRIPTION);
+	} else {
+		if (!descriptions) {
+			static gchar *default_descriptions[] = { DEFAULT_DESCRIPTION, NULL };
+			descriptions = g_strdupv (default_descriptions);
+		}
+		for (description = descriptions; *description; description++) {
+			for (i = 0; i < count; i++)
+				host_add (&host, *description);
+		}
+		run_console (&host);
+	}
+
+	/* Free resources */
+	g_mutex_lock (&host.lock);
+	while (host.pipelines->len > 0) {
+		HostedPipeline *hosted = g_ptr_array_steal_index (host.pipelines, host.pipelines->len - 1);
+		g_mutex_unlock (&host.lock);
+		hosted_free (&host, hosted);
+		g_mutex_lock (&host.lock);
+	}
+	g_mutex_unlock (&host.lock);
+
+	g_main_loop_quit (host.loop);
+	g_thread_join (host.dispatch_thread);
+	g_main_loop_unref (host.loop);
+	g_main_context_unref (host.context);
+	gst_task_pool_cleanup (host.pool);
+	gst_object_unref (host.pool);
+	g_ptr_array_unref (host.pipelines);
+	g_mutex_clear (&host.lock);
+	g_strfreev (descriptions);
+	g_free (scale_steps);
+	return 0;
+}
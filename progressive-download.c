@@ -0,0 +1,361 @@
+/* Progressive download : buffering with an on-disk ring buffer
+ *
+ * Goal
+ *
+ * basic-tutorial-3.c plays the network stream as it arrives, so any stall of the connection reaches the sink
+ * straight away. This program builds the same uridecodebin pipeline (with a video branch next to the audio one) but
+ * turns on download buffering:
+ *
+ *   - download=TRUE makes uridecodebin put a queue2 in download mode after the source, which stores the stream in a
+ *     temporary file instead of memory. ring-buffer-max-size bounds that file: it becomes a ring buffer, so a long
+ *     stream does not fill the disk. --cache-dir chooses where the file goes.
+ *   - use-buffering=TRUE makes the queues post BUFFERING messages, and buffer-duration says how far ahead of the play
+ *     position we want to have downloaded.
+ *   - the bus handler pauses the pipeline when the buffer runs low and resumes it when it is full again, as every
+ *     network player should.
+ *
+ * It records the numbers viewers notice:
+ *   - time to first frame: from the request to go to PLAYING to the first frame the video sink renders (the audio
+ *     sink when there is no video). A video sink shows its first frame as soon as it gets it, to preroll; an audio
+ *     sink only plays its first buffer once the pipeline is PLAYING;
+ *   - rebuffers: how many times playback stopped to buffer after it had started, and for how long in total.
+ *
+ * Every second it also prints the downloaded ranges, to show how far ahead of the play position we are.
+ *
+ * Usage
+ *   progressive-download [--uri=URI] [--ring-buffer=MB] [--prefetch=SECONDS] [--cache-dir=DIR]
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GstElement *source;
+	GstElement *audio_sink;         /* Sinks of the branches, NULL until the stream shows up */
+	GstElement *video_sink;
+	GstElement *first_frame_sink;   /* Sink whose first frame we time */
+	GMainLoop *loop;
+	gboolean is_live;               /* Live streams must not be paused to buffer */
+	gboolean buffering;             /* Paused because the buffer ran low */
+	gboolean playing;               /* The state the user wants */
+
+	GstClockTime start_time;        /* When we asked for PLAYING */
+	GstClockTime playing_time;      /* When the pipeline first reached PLAYING */
+	GstClockTime first_buffer_time; /* When the first buffer reached first_frame_sink */
+	GstClockTime first_frame_time;  /* When that sink rendered it */
+	GstClockTime stall_start;
+	GstClockTime stall_total;
+	guint rebuffers;
+} CustomData;
+
+static gchar *uri = NULL;
+static gint ring_buffer_mb = 64;
+static gint prefetch = 10;
+static gchar *cache_dir = NULL;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play (default: sintel trailer)", "URI" },
+	{ "ring-buffer", 'r', 0, G_OPTION_ARG_INT, &ring_buffer_mb, "Size of the on-disk ring buffer (default: 64, 0 keeps the whole file)", "MB" },
+	{ "prefetch", 'p', 0, G_OPTION_ARG_INT, &prefetch, "How far ahead of the play position to download (default: 10)", "SECONDS" },
+	{ "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir, "Directory for the download file (default: the temporary directory)", "DIR" },
+	{ NULL }
+};
+
+/* Runs on the main thread: times the first frame once it is known to be rendered */
+static void report_first_frame (CustomData *data) {
+	GstClockTime rendered = data->first_buffer_time;
+
+	if (GST_CLOCK_TIME_IS_VALID (data->first_frame_time) || !GST_CLOCK_TIME_IS_VALID (rendered))
+		return;
+	if (data->first_frame_sink == data->audio_sink) {
+		if (!GST_CLOCK_TIME_IS_VALID (data->playing_time))
+			return;
+		rendered = MAX (rendered, data->playing_time);
+	}
+	data->first_frame_time = rendered;
+	g_print ("Time to first frame: %.3f s (%s)\n", GST_TIME_AS_MSECONDS (data->first_frame_time - data->start_time) / 1000.0,
+			GST_OBJECT_NAME (data->first_frame_sink));
+}
+
+static gboolean first_buffer_idle (CustomData *data) {
+	report_first_frame (data);
+	return G_SOURCE_REMOVE;
+}
+
+/* Records the first buffer that reaches the sink, then removes itself */
+static GstPadProbeReturn first_frame_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	data->first_buffer_time = gst_util_get_timestamp ();
+	g_idle_add ((GSourceFunc) first_buffer_idle, data);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* Creates a branch for a new pad of the source and links it. Returns the sink of the branch, or NULL */
+static GstElement *add_branch (CustomData *data, GstPad *new_pad, const gchar *description, const gchar *sink_name) {
+	GError *error = NULL;
+	GstElement *branch, *sink;
+	GstPad *sink_pad;
+
+	branch = gst_parse_bin_from_description (description, TRUE, &error);
+	if (!branch) {
+		g_printerr ("Could not create the branch '%s': %s\n", description, error->message);
+		g_clear_error (&error);
+		return NULL;
+	}
+
+	/* It must be running before the first buffer comes in */
+	gst_bin_add (GST_BIN (data->pipeline), branch);
+	gst_element_sync_state_with_parent (branch);
+	sink_pad = gst_element_get_static_pad (branch, "sink");
+	if (GST_PAD_LINK_FAILED (gst_pad_link (new_pad, sink_pad))) {
+		g_print ("Branch '%s' could not be linked.\n", description);
+		gst_object_unref (sink_pad);
+		gst_element_set_state (branch, GST_STATE_NULL);
+		gst_bin_remove (GST_BIN (data->pipeline), branch);
+		return NULL;
+	}
+	gst_object_unref (sink_pad);
+
+	/* The branch keeps the sink alive */
+	sink = gst_bin_get_by_name (GST_BIN (branch), sink_name);
+	gst_object_unref (sink);
+	return sink;
+}
+
+/* Handler for the pad-added signal, as in basic-tutorial-3.c but with a video branch. A branch is only created
+ * for a stream the media has: a sink without a stream would never preroll */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
+	GstCaps *new_pad_caps;
+	const gchar *new_pad_type;
+
+	new_pad_caps = gst_pad_get_current_caps (new_pad);
+	new_pad_type = gst_structure_get_name (gst_caps_get_structure (new_pad_caps, 0));
+	if (g_str_has_prefix (new_pad_type, "audio/x-raw")) {
+		if (!data->audio_sink)
+			data->audio_sink = add_branch (data, new_pad, "audioconvert ! audioresample ! autoaudiosink name=audio_sink",
+					"audio_sink");
+	} else if (g_str_has_prefix (new_pad_type, "video/x-raw")) {
+		if (!data->video_sink)
+			data->video_sink = add_branch (data, new_pad, "videoconvert ! autovideosink name=video_sink", "video_sink");
+	} else {
+		g_print ("Pad '%s' has type '%s' which we do not play. Ignoring.\n", GST_PAD_NAME (new_pad), new_pad_type);
+	}
+	gst_caps_unref (new_pad_caps);
+}
+
+/* Once every stream is exposed we know which sink shows the first frame */
+static void no_more_pads_handler (GstElement *src, CustomData *data) {
+	GstPad *pad;
+
+	data->first_frame_sink = data->video_sink ? data->video_sink : data->audio_sink;
+	if (!data->first_frame_sink)
+		return;
+	pad = gst_element_get_static_pad (data->first_frame_sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) first_frame_probe, data, NULL);
+	gst_object_unref (pad);
+}
+
+/* Points the download file of the queue2 that uridecodebin creates to our cache directory */
+static void deep_element_added_handler (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	gchar *template;
+
+	if (!cache_dir || !factory || !g_str_equal (GST_OBJECT_NAME (factory), "queue2"))
+		return;
+	template = g_build_filename (cache_dir, "progressive-download-XXXXXX", NULL);
+	g_object_set (element, "temp-template", template, NULL);
+	g_free (template);
+}
+
+/* Prints the downloaded ranges next to the play position */
+static gboolean print_progress (CustomData *data) {
+	GstQuery *query;
+	gint64 position = -1, duration = -1;
+	guint i;
+
+	gst_element_query_position (data->pipeline, GST_FORMAT_TIME, &position);
+	gst_element_query_duration (data->pipeline, GST_FORMAT_TIME, &duration);
+	g_print ("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT, GST_TIME_ARGS (position), GST_TIME_ARGS (duration));
+
+	query = gst_query_new_buffering (GST_FORMAT_PERCENT);
+	if (gst_element_query (data->pipeline, query)) {
+		g_print (", downloaded:");
+		for (i = 0; i < gst_query_get_n_buffering_ranges (query); i++) {
+			gint64 start, stop;
+
+			/* Ranges are in GST_FORMAT_PERCENT_MAX units of the whole stream */
+			gst_query_parse_nth_buffering_range (query, i, &start, &stop);
+			g_print (" [%.1f%% - %.1f%%]", start * 100.0 / GST_FORMAT_PERCENT_MAX, stop * 100.0 / GST_FORMAT_PERCENT_MAX);
+		}
+	}
+	gst_query_unref (query);
+	g_print (", rebuffers %u\n", data->rebuffers);
+	return G_SOURCE_CONTINUE;
+}
+
+static void handle_buffering (CustomData *data, GstMessage *msg) {
+	GstBufferingMode mode;
+	gint percent, avg_in, avg_out;
+	gint64 buffering_left;
+	GstClockTime now = gst_util_get_timestamp ();
+
+	/* Live streams cannot be paused, they would just drop the data */
+	if (data->is_live)
+		return;
+
+	gst_message_parse_buffering (msg, &percent);
+	gst_message_parse_buffering_stats (msg, &mode, &avg_in, &avg_out, &buffering_left);
+
+	if (percent < 100) {
+		if (!data->buffering) {
+			data->buffering = TRUE;
+			if (GST_CLOCK_TIME_IS_VALID (data->first_frame_time)) {
+				data->rebuffers++;
+				data->stall_start = now;
+			}
+			if (data->playing)
+				gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
+		}
+		g_print ("Buffering %3d%% (in %d B/s, out %d B/s, %" G_GINT64_FORMAT " ms left)\r", percent, avg_in, avg_out,
+				buffering_left);
+	} else if (data->buffering) {
+		data->buffering = FALSE;
+		if (GST_CLOCK_TIME_IS_VALID (data->stall_start)) {
+			data->stall_total += now - data->stall_start;
+			data->stall_start = GST_CLOCK_TIME_NONE;
+		}
+		g_print ("\nBuffering done.\n");
+		if (data->playing)
+			gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
+	}
+}
+
+static gboolean bus_handler (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_BUFFERING:
+			handle_buffering (data, msg);
+			break;
+		case GST_MESSAGE_STATE_CHANGED:
+			if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->pipeline) && !GST_CLOCK_TIME_IS_VALID (data->playing_time)) {
+				GstState old_state, new_state, pending_state;
+
+				gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+				if (new_state == GST_STATE_PLAYING) {
+					data->playing_time = gst_util_get_timestamp ();
+					report_first_frame (data);
+				}
+			}
+			break;
+		case GST_MESSAGE_CLOCK_LOST:
+			/* Get a new clock */
+			gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
+			gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstStateChangeReturn ret;
+	GstBus *bus;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- progressive download with an on-disk ring buffer");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	memset (&data, 0, sizeof (data));
+	data.first_frame_time = GST_CLOCK_TIME_NONE;
+	data.stall_start = GST_CLOCK_TIME_NONE;
+	data.playing_time = GST_CLOCK_TIME_NONE;
+	data.first_buffer_time = GST_CLOCK_TIME_NONE;
+
+	/* Create the elements */
+	data.source = gst_element_factory_make ("uridecodebin", "source");
+	data.pipeline = gst_pipeline_new ("test-pipeline");
+
+	if (!data.pipeline || !data.source) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+
+	/* Build the pipeline, the branches are created and linked when the pads of the source appear */
+	gst_bin_add (GST_BIN (data.pipeline), data.source);
+
+	/* Download into a bounded file, and buffer prefetch seconds ahead */
+	g_object_set (data.source, "uri", uri ? uri : DEFAULT_URI,
+			"download", TRUE,
+			"use-buffering", TRUE,
+			"ring-buffer-max-size", (guint64) ring_buffer_mb * 1024 * 1024,
+			"buffer-duration", (gint64) prefetch * GST_SECOND, NULL);
+
+	g_signal_connect (data.source, "pad-added", G_CALLBACK (pad_added_handler), &data);
+	g_signal_connect (data.source, "no-more-pads", G_CALLBACK (no_more_pads_handler), &data);
+	g_signal_connect (data.pipeline, "deep-element-added", G_CALLBACK (deep_element_added_handler), &data);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_handler, &data);
+	g_timeout_add_seconds (1, (GSourceFunc) print_progress, &data);
+
+	/* Start playing */
+	data.playing = TRUE;
+	data.start_time = gst_util_get_timestamp ();
+	ret = gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
+	if (ret == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	} else if (ret == GST_STATE_CHANGE_NO_PREROLL) {
+		data.is_live = TRUE;
+	}
+	g_main_loop_run (data.loop);
+
+	/* Report the viewer-facing numbers */
+	if (GST_CLOCK_TIME_IS_VALID (data.first_frame_time))
+		g_print ("Time to first frame: %.3f s\n", GST_TIME_AS_MSECONDS (data.first_frame_time - data.start_time) / 1000.0);
+	else
+		g_print ("No frame was played.\n");
+	g_print ("Rebuffers: %u, %.3f s in total\n", data.rebuffers, GST_TIME_AS_MSECONDS (data.stall_total) / 1000.0);
+
+	/* Free resources */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	g_main_loop_unref (data.loop);
+	g_free (uri);
+	g_free (cache_dir);
+	return 0;
+}
@@ -0,0 +1,333 @@
+/* Queue budget : queue memory accounting, high-water marks and adaptive sizing
+ *
+ * Goal
+ *
+ * The audio_queue and video_queue of basic-tutorial-7.c keep the default limits of the queue element: 200 buffers,
+ * 10 MB or 1 second, whichever comes first. A source that is faster than its consumers fills every queue up to one of
+ * those limits, so each queue holds whatever that limit amounts to for its stream, and a box running many streams
+ * spends its RAM on it. Smaller fixed limits would underrun on streams with a higher rate instead.
+ *
+ * This program runs N copies of the tutorial 7 graph in one pipeline and accounts for every queue in it (including
+ * the ones sinks or bins create on their own, found with deep-element-added):
+ *
+ *   - current and peak level, in bytes, buffers and time
+ *   - overruns (the queue was full and blocked its producer) and underruns (it ran empty and its consumer waited),
+ *     counted from the "overrun" and "underrun" signals
+ *   - the consumer rate, from the bytes leaving the queue
+ *
+ * With --budget, the queues share one memory budget for the whole process. Every second each queue is asked to hold
+ * --target milliseconds of what its consumer actually takes, in bytes; if all of them together do not fit in the
+ * budget, every queue shrinks by the same factor. The new max-size-bytes is applied while PLAYING, and the buffer and
+ * time limits are lifted so bytes are the only limit. A queue never goes below two of its average buffers.
+ *
+ * Usage
+ *   queue-budget [--streams=4] [--budget=MB] [--target=200] [--duration=10] [--display]
+ *
+ * Without --budget the queues keep their default limits and are only reported. Without --display the sinks are
+ * synchronized fakesinks, so many streams can run side by side.
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Everything we account for one queue */
+typedef struct _QueueStats {
+	CustomData *data;
+	GstElement *queue;
+	gchar *name;
+	guint64 out_bytes;              /* Bytes that left the queue */
+	guint64 out_buffers;            /* Buffers that left the queue */
+	guint64 last_out_bytes;         /* out_bytes at the previous report */
+	gdouble rate;                   /* Bytes per second its consumer took over the last period */
+	guint peak_bytes;               /* Peaks are only written by the streaming thread feeding the queue */
+	guint peak_buffers;
+	guint64 peak_time;
+	guint overruns;
+	guint underruns;
+} QueueStats;
+
+/* Structure to contain all our information, so we can pass it around */
+struct _CustomData {
+	GstElement *pipeline;
+	GMainLoop *loop;
+	GMutex lock;                    /* Protects queues and every QueueStats */
+	GPtrArray *queues;
+	gint64 last_report;             /* Monotonic time of the previous report */
+};
+
+static gint n_streams = 4;
+static gint budget_mb = 0;
+static gint target_ms = 200;
+static gint duration = 10;
+static gboolean display = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "streams", 's', 0, G_OPTION_ARG_INT, &n_streams, "Number of tutorial 7 graphs to run (default 4)", "N" },
+	{ "budget", 'b', 0, G_OPTION_ARG_INT, &budget_mb, "Memory budget shared by all the queues, 0 to keep the default limits (default 0)", "MB" },
+	{ "target", 't', 0, G_OPTION_ARG_INT, &target_ms, "Milliseconds of consumption every queue should hold (default 200)", "MS" },
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to run (default 10)", "S" },
+	{ "display", 0, 0, G_OPTION_ARG_NONE, &display, "Play and show every stream instead of using fakesinks", NULL },
+	{ NULL }
+};
+
+static void queue_stats_free (QueueStats *stats) {
+	gst_object_unref (stats->queue);
+	g_free (stats->name);
+	g_free (stats);
+}
+
+/* Records the high-water marks. The level is read before the buffer is queued, so the buffer is added to it */
+static GstPadProbeReturn queue_in_probe (GstPad *pad, GstPadProbeInfo *info, QueueStats *stats) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	guint bytes, buffers;
+	guint64 time;
+
+	g_object_get (stats->queue, "current-level-bytes", &bytes, "current-level-buffers", &buffers,
+			"current-level-time", &time, NULL);
+	bytes += gst_buffer_get_size (buffer);
+	buffers++;
+	if (GST_BUFFER_DURATION_IS_VALID (buffer))
+		time += GST_BUFFER_DURATION (buffer);
+
+	g_atomic_int_set (&stats->peak_bytes, MAX ((guint) g_atomic_int_get (&stats->peak_bytes), bytes));
+	g_atomic_int_set (&stats->peak_buffers, MAX ((guint) g_atomic_int_get (&stats->peak_buffers), buffers));
+	if (time > stats->peak_time)
+		stats->peak_time = time;
+	return GST_PAD_PROBE_OK;
+}
+
+/* Measures what the consumer takes */
+static GstPadProbeReturn queue_out_probe (GstPad *pad, GstPadProbeInfo *info, QueueStats *stats) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	CustomData *data = stats->data;
+
+	g_mutex_lock (&data->lock);
+	stats->out_bytes += gst_buffer_get_size (buffer);
+	stats->out_buffers++;
+	g_mutex_unlock (&data->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/* The queue is full: its producer is blocked until there is room again */
+static void overrun_cb (GstElement *queue, QueueStats *stats) {
+	g_atomic_int_inc (&stats->overruns);
+}
+
+/* The queue is empty: its consumer waits for data */
+static void underrun_cb (GstElement *queue, QueueStats *stats) {
+	g_atomic_int_inc (&stats->underruns);
+}
+
+/* Starts accounting for every queue that appears in the pipeline, at any depth */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	QueueStats *stats;
+	GstPad *pad;
+
+	if (!factory || g_strcmp0 (GST_OBJECT_NAME (factory), "queue") != 0)
+		return;
+
+	stats = g_new0 (QueueStats, 1);
+	stats->data = data;
+	stats->queue = gst_object_ref (element);
+	stats->name = gst_object_get_name (GST_OBJECT (element));
+
+	pad = gst_element_get_static_pad (element, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) queue_in_probe, stats, NULL);
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (element, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) queue_out_probe, stats, NULL);
+	gst_object_unref (pad);
+	g_signal_connect (element, "overrun", G_CALLBACK (overrun_cb), stats);
+	g_signal_connect (element, "underrun", G_CALLBACK (underrun_cb), stats);
+
+	g_mutex_lock (&data->lock);
+	g_ptr_array_add (data->queues, stats);
+	g_mutex_unlock (&data->lock);
+}
+
+/* Gives every queue --target milliseconds of its consumer rate, scaled down to fit the budget */
+static void apply_budget (CustomData *data) {
+	guint64 budget = (guint64) budget_mb * 1024 * 1024;
+	gdouble wanted = 0, scale;
+	guint i;
+
+	for (i = 0; i < data->queues->len; i++) {
+		QueueStats *stats = g_ptr_array_index (data->queues, i);
+
+		wanted += stats->rate * target_ms / 1000.0;
+	}
+	scale = wanted > budget ? budget / wanted : 1.0;
+
+	for (i = 0; i < data->queues->len; i++) {
+		QueueStats *stats = g_ptr_array_index (data->queues, i);
+		guint64 floor_bytes = stats->out_buffers ? 2 * (stats->out_bytes / stats->out_buffers) : 0;
+		guint max_bytes;
+
+		/* Nothing consumed yet: leave the queue alone until there is a rate to go by */
+		if (stats->rate <= 0)
+			continue;
+		max_bytes = (guint) MIN (MAX (stats->rate * target_ms / 1000.0 * scale, floor_bytes), G_MAXUINT);
+		g_object_set (stats->queue, "max-size-bytes", max_bytes, "max-size-buffers", 0, "max-size-time", (guint64) 0, NULL);
+	}
+}
+
+/* Prints the levels of every queue, updates the consumer rates and, with a budget, resizes the queues */
+static gboolean report_cb (CustomData *data) {
+	gint64 now = g_get_monotonic_time ();
+	gdouble seconds = (now - data->last_report) / (gdouble) G_TIME_SPAN_SECOND;
+	guint64 total_bytes = 0, total_peak = 0, total_max = 0;
+	guint i;
+
+	data->last_report = now;
+	g_mutex_lock (&data->lock);
+	g_print ("%-16s %10s %6s %7s %10s %6s %7s %10s %9s %8s %8s\n", "queue", "bytes", "bufs", "ms", "peak bytes",
+			"bufs", "ms", "max bytes", "KB/s", "overrun", "underrun");
+	for (i = 0; i < data->queues->len; i++) {
+		QueueStats *stats = g_ptr_array_index (data->queues, i);
+		guint bytes, buffers, max_bytes;
+		guint64 time;
+
+		g_object_get (stats->queue, "current-level-bytes", &bytes, "current-level-buffers", &buffers,
+				"current-level-time", &time, "max-size-bytes", &max_bytes, NULL);
+		stats->rate = seconds > 0 ? (stats->out_bytes - stats->last_out_bytes) / seconds : 0;
+		stats->last_out_bytes = stats->out_bytes;
+		total_bytes += bytes;
+		total_peak += g_atomic_int_get (&stats->peak_bytes);
+		total_max += max_bytes;
+
+		g_print ("%-16s %10u %6u %7.1f %10u %6u %7.1f %10u %9.1f %8u %8u\n", stats->name, bytes, buffers,
+				time / 1e6, (guint) g_atomic_int_get (&stats->peak_bytes), (guint) g_atomic_int_get (&stats->peak_buffers),
+				stats->peak_time / 1e6, max_bytes, stats->rate / 1024, (guint) g_atomic_int_get (&stats->overruns),
+				(guint) g_atomic_int_get (&stats->underruns));
+	}
+	g_print ("%u queues: %" G_GUINT64_FORMAT " bytes queued, %" G_GUINT64_FORMAT " bytes sum of peaks, %"
+			G_GUINT64_FORMAT " bytes of limits", data->queues->len, total_bytes, total_peak, total_max);
+	if (budget_mb > 0) {
+		g_print (", budget %d MB\n\n", budget_mb);
+		apply_budget (data);
+	} else {
+		g_print ("\n\n");
+	}
+	g_mutex_unlock (&data->lock);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+static gboolean stop_cb (CustomData *data) {
+	g_main_loop_quit (data->loop);
+	return G_SOURCE_REMOVE;
+}
+
+/* One tutorial 7 graph per stream, with the queues named as in the tutorial */
+static gchar *build_description (void) {
+	const gchar *audio_sink = display ? "autoaudiosink" : "fakesink sync=true";
+	const gchar *video_sink = display ? "autovideosink" : "fakesink sync=true";
+	GString *description = g_string_new (NULL);
+	gint i;
+
+	for (i = 0; i < n_streams; i++) {
+		g_string_append_printf (description,
+				"audiotestsrc freq=%d ! tee name=tee_%d "
+				"tee_%d. ! queue name=audio_queue_%d ! audioconvert ! audioresample ! %s "
+				"tee_%d. ! queue name=video_queue_%d ! wavescope shader=0 style=1 ! videoconvert ! %s ",
+				215 + 10 * i, i, i, i, audio_sink, i, i, video_sink);
+	}
+	return g_string_free (description, FALSE);
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	gchar *description;
+	GstElement *bin;
+	GstBus *bus;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- queue memory accounting and adaptive sizing");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (n_streams <= 0 || target_ms <= 0 || duration <= 0 || budget_mb < 0) {
+		g_printerr ("The number of streams, the target and the duration must be positive.\n");
+		return -1;
+	}
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.lock);
+	data.queues = g_ptr_array_new_with_free_func ((GDestroyNotify) queue_stats_free);
+
+	/* The elements are created into a bin first, so deep-element-added sees every one of them */
+	description = build_description ();
+	bin = gst_parse_bin_from_description (description, FALSE, &error);
+	g_free (description);
+	if (!bin) {
+		g_printerr ("Unable to build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	data.pipeline = gst_pipeline_new ("queue-budget-pipeline");
+	g_signal_connect (data.pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), &data);
+	gst_bin_add (GST_BIN (data.pipeline), bin);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+
+	/* Start playing */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	data.last_report = g_get_monotonic_time ();
+	g_timeout_add_seconds (1, (GSourceFunc) report_cb, &data);
+	g_timeout_add_seconds (duration, (GSourceFunc) stop_cb, &data);
+	g_main_loop_run (data.loop);
+
+	/* Final levels and counters */
+	report_cb (&data);
+
+	/* Free resources */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	g_ptr_array_unref (data.queues);
+	g_main_loop_unref (data.loop);
+	g_mutex_clear (&data.lock);
+	return 0;
+}
@@ -0,0 +1,409 @@
+/* Shared memory fan-out : publishing decoded buffers to other processes
+ *
+ * Goal
+ *
+ * basic-tutorial-7.c fans one stream out with a tee, but every consumer lives in the same pipeline. A recorder or an
+ * analytics process next to it would need the buffers re-encoded, or copied through a socket. This program adds
+ * output branches that publish the raw buffers of the tutorial 7 graph (the audio, and the wavescope video) to other
+ * processes, and runs as the consumer too:
+ *
+ *   - with --transport=shm, shmsink copies every buffer once into a shared memory area, and shmsrc in the consumer
+ *     reads it in place. shmsrc does not carry caps, so the publisher writes them to a sidecar file next to the
+ *     socket (SOCKET.caps) whenever they change, for the consumer to apply.
+ *   - with --transport=unixfd (GStreamer 1.24), unixfdsink passes file descriptors: memory that is already backed by a
+ *     memfd or a dmabuf crosses without any copy, other memory is copied once into a memfd. Caps travel with the data.
+ *
+ * Either way a consumer costs one memcpy at most. Every output branch starts with a leaky queue of --slots buffers,
+ * so a slow or stuck reader never blocks the tee: once the slots are full, the oldest buffer is dropped. The shared
+ * memory area is sized for the same number of slots. The publisher reports the buffers every output took in, passed
+ * on and dropped, and the consumer reports what it received.
+ *
+ * Usage
+ *   shm-fanout [--transport=shm|unixfd] [--socket=/tmp/shm-fanout] [--slots=4] [--media=both|video|audio] [--headless]
+ *   shm-fanout --consume [--transport=shm|unixfd] [--socket=/tmp/shm-fanout] [--media=video|audio] [--headless]
+ *
+ * The video output listens on SOCKET-video and the audio output on SOCKET-audio. --headless replaces the local
+ * (or, when consuming, the displayed) sinks with fakesinks.
+ *
+ */
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#define VIDEO_WIDTH 640
+#define VIDEO_HEIGHT 480
+#define VIDEO_CAPS "video/x-raw,format=BGRx,width=640,height=480"
+#define AUDIO_CAPS "audio/x-raw,format=S16LE,layout=interleaved,rate=48000,channels=2"
+/* audiotestsrc sends 1024 samples per buffer; leave room for shmsink's own bookkeeping */
+#define AUDIO_SLOT_SIZE (64 * 1024)
+
+/* One published stream */
+typedef struct _Output {
+	const gchar *media;             /* "video" or "audio" */
+	gchar *socket_path;
+	GstElement *queue;              /* Leaky queue holding the slots */
+	GstElement *sink;
+	gint in;                        /* Buffers that entered the queue */
+	gint out;                       /* Buffers that left it, towards the consumers */
+	gint clients;                   /* Consumers connected (shmsink only) */
+} Output;
+
+static gboolean consume = FALSE;
+static gchar *transport = NULL;
+static gchar *socket_base = NULL;
+static gint slots = 4;
+static gchar *media = NULL;
+static gboolean headless = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "consume", 'c', 0, G_OPTION_ARG_NONE, &consume, "Consume a published stream instead of publishing", NULL },
+	{ "transport", 't', 0, G_OPTION_ARG_STRING, &transport, "shm (shmsink/shmsrc) or unixfd (unixfdsink/unixfdsrc) (default shm)", "NAME" },
+	{ "socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_base, "Base path of the control sockets (default /tmp/shm-fanout)", "PATH" },
+	{ "slots", 'n', 0, G_OPTION_ARG_INT, &slots, "Buffers an output holds for its consumers before dropping (default 4)", "N" },
+	{ "media", 'm', 0, G_OPTION_ARG_STRING, &media, "Streams to publish (both, video, audio) or to consume (video, audio) (default both / video)", "MEDIA" },
+	{ "headless", 0, 0, G_OPTION_ARG_NONE, &headless, "Use fakesinks instead of audio and video sinks", NULL },
+	{ NULL }
+};
+
+static gboolean use_unixfd (void) {
+	return g_strcmp0 (transport, "unixfd") == 0;
+}
+
+static GstPadProbeReturn count_in_probe (GstPad *pad, GstPadProbeInfo *info, Output *output) {
+	g_atomic_int_inc (&output->in);
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn count_out_probe (GstPad *pad, GstPadProbeInfo *info, Output *output) {
+	g_atomic_int_inc (&output->out);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Writes the caps of a shm output next to its socket, so consumers can apply them. The file is replaced
+ * atomically, a consumer starting at that moment reads either the old caps or the new ones */
+static GstPadProbeReturn caps_probe (GstPad *pad, GstPadProbeInfo *info, Output *output) {
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+	GstCaps *caps;
+	gchar *str, *path;
+	GError *error = NULL;
+
+	if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+		return GST_PAD_PROBE_OK;
+
+	gst_event_parse_caps (event, &caps);
+	str = gst_caps_to_string (caps);
+	path = g_strconcat (output->socket_path, ".caps", NULL);
+	if (!g_file_set_contents (path, str, -1, &error)) {
+		g_printerr ("Could not write %s: %s\n", path, error->message);
+		g_clear_error (&error);
+	} else {
+		g_print ("Caps of the %s output: %s\n", output->media, str);
+	}
+	g_free (path);
+	g_free (str);
+	return GST_PAD_PROBE_OK;
+}
+
+static void client_connected_cb (GstElement *sink, gint fd, Output *output) {
+	g_print ("Consumer connected to the %s output (%d connected)\n", output->media, g_atomic_int_add (&output->clients, 1) + 1);
+}
+
+static void client_disconnected_cb (GstElement *sink, gint fd, Output *output) {
+	g_print ("Consumer left the %s output (%d connected)\n", output->media, g_atomic_int_add (&output->clients, -1) - 1);
+}
+
+/* The description of one output branch, hanging from "tee" */
+static void append_output (GString *description, const gchar *tee, Output *output, gsize slot_size) {
+	output->socket_path = g_strdup_printf ("%s-%s", socket_base ? socket_base : "/tmp/shm-fanout", output->media);
+	/* A socket left behind by a previous run would keep the sink from listening */
+	g_remove (output->socket_path);
+
+	g_string_append_printf (description,
+			"%s. ! queue name=%s_slots leaky=downstream max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! ",
+			tee, output->media, slots);
+	if (use_unixfd ())
+		g_string_append_printf (description, "unixfdsink name=%s_out socket-path=\"%s\" sync=false async=false ",
+				output->media, output->socket_path);
+	else
+		g_string_append_printf (description, "shmsink name=%s_out socket-path=\"%s\" shm-size=%" G_GSIZE_FORMAT
+				" wait-for-connection=false sync=false async=false ", output->media, output->socket_path, slots * slot_size);
+}
+
+/* Finds the elements of an output in the pipeline and installs the counters */
+static void setup_output (GstElement *pipeline, Output *output) {
+	gchar *name;
+	GstPad *pad;
+
+	name = g_strdup_printf ("%s_slots", output->media);
+	output->queue = gst_bin_get_by_name (GST_BIN (pipeline), name);
+	g_free (name);
+	name = g_strdup_printf ("%s_out", output->media);
+	output->sink = gst_bin_get_by_name (GST_BIN (pipeline), name);
+	g_free (name);
+
+	pad = gst_element_get_static_pad (output->queue, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_in_probe, output, NULL);
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (output->queue, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_out_probe, output, NULL);
+	gst_object_unref (pad);
+
+	if (!use_unixfd ()) {
+		pad = gst_element_get_static_pad (output->sink, "sink");
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) caps_probe, output, NULL);
+		gst_object_unref (pad);
+		g_signal_connect (output->sink, "client-connected", G_CALLBACK (client_connected_cb), output);
+		g_signal_connect (output->sink, "client-disconnected", G_CALLBACK (client_disconnected_cb), output);
+	}
+}
+
+static void print_outputs (Output *outputs, guint n_outputs) {
+	guint i;
+
+	g_print ("output       in      out  queued  dropped\n");
+	for (i = 0; i < n_outputs; i++) {
+		guint level;
+		gint in = g_atomic_int_get (&outputs[i].in);
+		gint out = g_atomic_int_get (&outputs[i].out);
+
+		g_object_get (outputs[i].queue, "current-level-buffers", &level, NULL);
+		g_print ("%-6s %8d %8d %7u %8d\n", outputs[i].media, in, out, level, MAX (in - out - (gint) level, 0));
+	}
+	g_print ("\n");
+}
+
+/* Waits for an error or EOS, calling "report" every 2 seconds. Returns FALSE after an error */
+static gboolean run_pipeline (GstElement *pipeline, void (*report) (gpointer), gpointer user_data) {
+	GstBus *bus = gst_element_get_bus (pipeline);
+	GstMessage *msg;
+	gboolean ok = TRUE, terminate = FALSE;
+
+	while (!terminate) {
+		msg = gst_bus_timed_pop_filtered (bus, 2 * GST_SECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+		if (!msg) {
+			report (user_data);
+			continue;
+		}
+		if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+			GError *err;
+			gchar *debug_info;
+
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			ok = FALSE;
+		} else {
+			g_print ("End-Of-Stream reached.\n");
+		}
+		gst_message_unref (msg);
+		terminate = TRUE;
+	}
+	gst_object_unref (bus);
+	return ok;
+}
+
+typedef struct _PublisherReport {
+	Output *outputs;
+	guint n_outputs;
+} PublisherReport;
+
+static void publisher_report (PublisherReport *report) {
+	print_outputs (report->outputs, report->n_outputs);
+}
+
+/* The tutorial 7 graph, with its local sinks, plus one output per published stream */
+static int run_publisher (void) {
+	Output outputs[2];
+	PublisherReport report = { outputs, 0 };
+	const gchar *audio_sink = headless ? "fakesink sync=true" : "autoaudiosink";
+	const gchar *video_sink = headless ? "fakesink sync=true" : "autovideosink";
+	gboolean publish_video = !media || g_strcmp0 (media, "both") == 0 || g_strcmp0 (media, "video") == 0;
+	gboolean publish_audio = !media || g_strcmp0 (media, "both") == 0 || g_strcmp0 (media, "audio") == 0;
+	GString *description;
+	GstElement *pipeline;
+	GError *error = NULL;
+	gboolean ok;
+	guint i;
+
+	if (!publish_video && !publish_audio) {
+		g_printerr ("Unknown media '%s'.\n", media);
+		return -1;
+	}
+
+	memset (outputs, 0, sizeof (outputs));
+	description = g_string_new (NULL);
+	g_string_append_printf (description,
+			"audiotestsrc is-live=true freq=215 ! " AUDIO_CAPS " ! tee name=audio_tee "
+			"audio_tee. ! queue ! audioconvert ! audioresample ! %s "
+			"audio_tee. ! queue ! wavescope shader=0 style=1 ! videoconvert ! " VIDEO_CAPS " ! tee name=video_tee "
+			"video_tee. ! queue ! videoconvert ! %s ", audio_sink, video_sink);
+	if (publish_video) {
+		Output *output = &outputs[report.n_outputs++];
+
+		output->media = "video";
+		/* A frame is the whole BGRx picture */
+		append_output (description, "video_tee", output, VIDEO_WIDTH * VIDEO_HEIGHT * 4 + 4096);
+	}
+	if (publish_audio) {
+		Output *output = &outputs[report.n_outputs++];
+
+		output->media = "audio";
+		append_output (description, "audio_tee", output, AUDIO_SLOT_SIZE);
+	}
+	pipeline = gst_parse_launch (description->str, &error);
+	g_string_free (description, TRUE);
+	if (!pipeline) {
+		g_printerr ("Unable to build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	for (i = 0; i < report.n_outputs; i++) {
+		setup_output (pipeline, &outputs[i]);
+		g_print ("Publishing %s on %s (%s, %d slots)\n", outputs[i].media, outputs[i].socket_path,
+				use_unixfd () ? "unixfd" : "shm", slots);
+	}
+
+	/* Start playing */
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+	ok = run_pipeline (pipeline, (void (*) (gpointer)) publisher_report, &report);
+	print_outputs (outputs, report.n_outputs);
+
+	/* Free resources */
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	for (i = 0; i < report.n_outputs; i++) {
+		gchar *caps_path = g_strconcat (outputs[i].socket_path, ".caps", NULL);
+
+		g_remove (caps_path);
+		g_free (caps_path);
+		gst_object_unref (outputs[i].queue);
+		gst_object_unref (outputs[i].sink);
+		g_free (outputs[i].socket_path);
+	}
+	gst_object_unref (pipeline);
+	return ok ? 0 : -1;
+}
+
+typedef struct _ConsumerReport {
+	gint buffers;
+	gint64 last_time;
+	gint last_buffers;
+} ConsumerReport;
+
+static GstPadProbeReturn consumer_probe (GstPad *pad, GstPadProbeInfo *info, ConsumerReport *report) {
+	g_atomic_int_inc (&report->buffers);
+	return GST_PAD_PROBE_OK;
+}
+
+static void consumer_report (ConsumerReport *report) {
+	gint64 now = g_get_monotonic_time ();
+	gint buffers = g_atomic_int_get (&report->buffers);
+
+	g_print ("%d buffers received, %.1f/s\n", buffers,
+			(buffers - report->last_buffers) * (gdouble) G_TIME_SPAN_SECOND / (now - report->last_time));
+	report->last_time = now;
+	report->last_buffers = buffers;
+}
+
+/* Reads one published stream */
+static int run_consumer (void) {
+	gboolean video = !media || g_strcmp0 (media, "video") == 0;
+	gchar *socket_path = g_strdup_printf ("%s-%s", socket_base ? socket_base : "/tmp/shm-fanout", video ? "video" : "audio");
+	const gchar *chain = video ? (headless ? "fakesink sync=false" : "videoconvert ! autovideosink") :
+			(headless ? "fakesink sync=false" : "audioconvert ! audioresample ! autoaudiosink");
+	ConsumerReport report = { 0 };
+	GstElement *pipeline, *sink;
+	GError *error = NULL;
+	gchar *description, *caps = NULL;
+	GstPad *pad;
+	gboolean ok;
+
+	if (!video && g_strcmp0 (media, "audio") != 0) {
+		g_printerr ("Unknown media '%s'.\n", media);
+		g_free (socket_path);
+		return -1;
+	}
+
+	if (use_unixfd ()) {
+		description = g_strdup_printf ("unixfdsrc socket-path=\"%s\" ! queue ! %s name=sink", socket_path, chain);
+	} else {
+		/* shmsrc has no caps of its own: take the ones the publisher wrote */
+		gchar *caps_path = g_strconcat (socket_path, ".caps", NULL);
+
+		if (!g_file_get_contents (caps_path, &caps, NULL, &error)) {
+			g_printerr ("Could not read the caps from %s: %s\n", caps_path, error->message);
+			g_clear_error (&error);
+			g_free (caps_path);
+			g_free (socket_path);
+			return -1;
+		}
+		g_free (caps_path);
+		description = g_strdup_printf ("shmsrc socket-path=\"%s\" is-live=true do-timestamp=true ! %s ! queue ! %s name=sink",
+				socket_path, g_strstrip (caps), chain);
+	}
+
+	pipeline = gst_parse_launch (description, &error);
+	g_free (description);
+	g_free (caps);
+	if (!pipeline) {
+		g_printerr ("Unable to build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		g_free (socket_path);
+		return -1;
+	}
+	sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+	pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) consumer_probe, &report, NULL);
+	gst_object_unref (pad);
+	gst_object_unref (sink);
+
+	g_print ("Consuming %s from %s\n", video ? "video" : "audio", socket_path);
+	report.last_time = g_get_monotonic_time ();
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		g_free (socket_path);
+		return -1;
+	}
+	ok = run_pipeline (pipeline, (void (*) (gpointer)) consumer_report, &report);
+
+	/* Free resources */
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	g_free (socket_path);
+	return ok ? 0 : -1;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- publish raw buffers to other processes");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (transport && !g_str_equal (transport, "shm") && !g_str_equal (transport, "unixfd")) {
+		g_printerr ("Unknown transport '%s'.\n", transport);
+		return -1;
+	}
+	if (slots <= 0) {
+		g_printerr ("The number of slots must be positive.\n");
+		return -1;
+	}
+
+	return consume ? run_consumer () : run_publisher ();
+}
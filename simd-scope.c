@@ -0,0 +1,632 @@
+/* SIMD scope : a vectorized drop-in for wavescope
+ *
+ * Goal
+ *
+ * The video branch of basic-tutorial-7.c draws the audio with wavescope (shader=0, style=1), and at high sample
+ * rates it is the hottest element of the pipeline. This program registers "simdscope", a GstAudioVisualizer
+ * subclass that draws the same kind of scope and can replace wavescope on that branch.
+ *
+ * For every column of the picture it needs the minimum and the maximum sample of each channel over the samples that
+ * fall into that column, and draws a vertical line between them straight into the output video buffer. A column only
+ * holds a few frames (about 2.5 at 48 kHz, 30 fps and 640 pixels), too few to fill a vector, so the min/max is not
+ * computed one column at a time: column_minmax builds a sparse table over the whole audio buffer, each level an
+ * elementwise min/max of the previous one and of itself shifted by a power of two frames, and then reads every column
+ * from two entries of one level. Building the levels is the hot loop, and runs on the interleaved samples with a
+ * shift of whole frames, so every channel count from 1 to 8 (5.1 included) takes the vector path. It comes in
+ * several versions, chosen at runtime from what the CPU supports:
+ *   - AVX2 (16 samples per instruction), SSE2 (8 samples) on x86, NEON (8 samples) on ARM;
+ *   - plain C.
+ * --kernel forces one of them. Like wavescope, the "style" property chooses between dots (only the minimum and the
+ * maximum of each column) and lines (the default here); wavescope's colour styles are not implemented. There is no
+ * spectrum mode either: spectrascope already gets its FFT from gst-fft.
+ *
+ * The element is registered with gst_plugin_register_static(), so it can be used in gst_parse_launch() descriptions
+ * of this program like any other element. Without options the program plays the basic-tutorial-7.c graph with
+ * simdscope instead of wavescope.
+ *
+ * --benchmark times the kernels alone, the way render calls them: once per video frame, in stereo and in 5.1. Then it
+ * runs audiotestsrc -> scope -> fakesink as fast as possible at 48, 96 and 192 kHz with wavescope and with simdscope,
+ * both with style=1 as in basic-tutorial-7.c, and prints the CPU time of each run.
+ *
+ * Usage
+ *   simd-scope [--kernel=auto|c|sse2|avx2|neon] [--benchmark] [--seconds=N]
+ *
+ * It also needs the pbutils and video libraries: add gstreamer-pbutils-1.0 and gstreamer-video-1.0 to the
+ * pkg-config line.
+ *
+ */
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/pbutils/gstaudiovisualizer.h>
+#include <gst/video/video.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#define HAVE_NEON_KERNEL 1
+#include <arm_neon.h>
+#endif
+
+#define MAX_CHANNELS 8
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+#define RGB_ORDER "xRGB"
+#else
+#define RGB_ORDER "BGRx"
+#endif
+
+/* One pass of the min/max tables: out_min[i] = MIN (in_min[i], in_min[i + shift]), and the same for the maximum, for
+ * i < n. The inputs are valid up to n + shift. The samples stay interleaved and shift is a whole number of frames,
+ * so lane i always meets the same channel, whatever the channel count */
+typedef void (*PairFunc) (const gint16 *in_min, const gint16 *in_max, guint n, guint shift, gint16 *out_min,
+		gint16 *out_max);
+
+typedef struct _Kernel {
+	const gchar *name;
+	PairFunc func;
+	gboolean (*supported) (void);
+} Kernel;
+
+/* Colours of the channels, as 0x00RRGGBB */
+static const guint32 channel_colors[MAX_CHANNELS] = {
+	0x00ff6060, 0x0060ff60, 0x006060ff, 0x00ffff60, 0x00ff60ff, 0x0060ffff, 0x00ffffff, 0x00a0a0a0
+};
+
+/* Also finishes what the vector versions leave after their last full vector, from sample "from" */
+static inline void pair_tail (const gint16 *in_min, const gint16 *in_max, guint from, guint n, guint shift,
+		gint16 *out_min, gint16 *out_max) {
+	guint i;
+
+	for (i = from; i < n; i++) {
+		out_min[i] = MIN (in_min[i], in_min[i + shift]);
+		out_max[i] = MAX (in_max[i], in_max[i + shift]);
+	}
+}
+
+static void pair_c (const gint16 *in_min, const gint16 *in_max, guint n, guint shift, gint16 *out_min, gint16 *out_max) {
+	pair_tail (in_min, in_max, 0, n, shift, out_min, out_max);
+}
+
+static gboolean always_supported (void) {
+	return TRUE;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__ ((target ("sse2")))
+static void pair_sse2 (const gint16 *in_min, const gint16 *in_max, guint n, guint shift, gint16 *out_min, gint16 *out_max) {
+	guint i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i a = _mm_loadu_si128 ((const __m128i *) (in_min + i));
+		__m128i b = _mm_loadu_si128 ((const __m128i *) (in_min + i + shift));
+		__m128i c = _mm_loadu_si128 ((const __m128i *) (in_max + i));
+		__m128i d = _mm_loadu_si128 ((const __m128i *) (in_max + i + shift));
+
+		_mm_storeu_si128 ((__m128i *) (out_min + i), _mm_min_epi16 (a, b));
+		_mm_storeu_si128 ((__m128i *) (out_max + i), _mm_max_epi16 (c, d));
+	}
+	pair_tail (in_min, in_max, i, n, shift, out_min, out_max);
+}
+
+__attribute__ ((target ("avx2")))
+static void pair_avx2 (const gint16 *in_min, const gint16 *in_max, guint n, guint shift, gint16 *out_min, gint16 *out_max) {
+	guint i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i a = _mm256_loadu_si256 ((const __m256i *) (in_min + i));
+		__m256i b = _mm256_loadu_si256 ((const __m256i *) (in_min + i + shift));
+		__m256i c = _mm256_loadu_si256 ((const __m256i *) (in_max + i));
+		__m256i d = _mm256_loadu_si256 ((const __m256i *) (in_max + i + shift));
+
+		_mm256_storeu_si256 ((__m256i *) (out_min + i), _mm256_min_epi16 (a, b));
+		_mm256_storeu_si256 ((__m256i *) (out_max + i), _mm256_max_epi16 (c, d));
+	}
+	pair_tail (in_min, in_max, i, n, shift, out_min, out_max);
+}
+
+static gboolean sse2_supported (void) {
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("sse2");
+}
+
+static gboolean avx2_supported (void) {
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("avx2");
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static void pair_neon (const gint16 *in_min, const gint16 *in_max, guint n, guint shift, gint16 *out_min, gint16 *out_max) {
+	guint i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		vst1q_s16 (out_min + i, vminq_s16 (vld1q_s16 (in_min + i), vld1q_s16 (in_min + i + shift)));
+		vst1q_s16 (out_max + i, vmaxq_s16 (vld1q_s16 (in_max + i), vld1q_s16 (in_max + i + shift)));
+	}
+	pair_tail (in_min, in_max, i, n, shift, out_min, out_max);
+}
+#endif
+
+/* From the best to the most portable */
+static const Kernel kernels[] = {
+#ifdef HAVE_X86_KERNELS
+	{ "avx2", pair_avx2, avx2_supported },
+	{ "sse2", pair_sse2, sse2_supported },
+#endif
+#ifdef HAVE_NEON_KERNEL
+	{ "neon", pair_neon, always_supported },
+#endif
+	{ "c", pair_c, always_supported },
+};
+
+/* The kernel every simdscope uses */
+static const Kernel *scope_kernel = &kernels[G_N_ELEMENTS (kernels) - 1];
+
+/* Picks a kernel by name, or the best supported one for "auto" */
+static gboolean select_kernel (const gchar *name) {
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (kernels); i++) {
+		if ((g_strcmp0 (name, "auto") == 0 || g_strcmp0 (name, kernels[i].name) == 0) && kernels[i].supported ()) {
+			scope_kernel = &kernels[i];
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Scratch memory of column_minmax, kept between frames */
+typedef struct _ScopeTables {
+	gint16 *levels;                 /* Levels 1 and up, min then max, num_frames * channels samples each */
+	gsize levels_size;
+	gint16 *columns;                /* Result: min then max of every column, width * channels samples each */
+	gsize columns_size;
+} ScopeTables;
+
+static gint16 *tables_ensure (gint16 **buffer, gsize *size, gsize needed) {
+	if (*size < needed) {
+		g_free (*buffer);
+		*buffer = g_new (gint16, needed);
+		*size = needed;
+	}
+	return *buffer;
+}
+
+static void tables_clear (ScopeTables *tables) {
+	g_clear_pointer (&tables->levels, g_free);
+	g_clear_pointer (&tables->columns, g_free);
+	tables->levels_size = tables->columns_size = 0;
+}
+
+/* Per-channel minimum and maximum of every column of the picture, over a whole audio buffer. Columns only hold a few
+ * frames each (about 2.5 at 48 kHz, 30 fps and 640 pixels), too few to fill a vector, so the kernel never works on
+ * one column: it builds a sparse table over the whole buffer. Level k holds, for every frame, the min and max of the
+ * 2^k frames starting there, and is built from level k - 1 with one vectorized pass. A column of length l is then
+ * covered by two overlapping runs of 2^k frames, k = log2 (l), and costs two lookups per channel.
+ * Returns the number of columns, with their results in tables->columns (all the minimums, then all the maximums) */
+static guint column_minmax (const Kernel *kernel, ScopeTables *tables, const gint16 *samples, guint num_frames,
+		guint channels, guint width) {
+	const gint16 *level_min[32], *level_max[32];
+	guint n = num_frames * channels, longest, levels, k, x, ch;
+	gint16 *levels_data, *mins, *maxs;
+
+	if (num_frames == 0 || width == 0)
+		return 0;
+	longest = (num_frames + width - 1) / width;
+	levels = g_bit_storage (longest);
+	levels_data = tables_ensure (&tables->levels, &tables->levels_size, (gsize) 2 * (levels - 1) * n);
+	mins = tables_ensure (&tables->columns, &tables->columns_size, (gsize) 2 * width * channels);
+	maxs = mins + width * channels;
+
+	level_min[0] = level_max[0] = samples;
+	for (k = 1; k < levels; k++) {
+		guint run = 1 << k;
+		gint16 *out_min = levels_data + (gsize) 2 * (k - 1) * n, *out_max = out_min + n;
+
+		kernel->func (level_min[k - 1], level_max[k - 1], (num_frames - run + 1) * channels, (run / 2) * channels,
+				out_min, out_max);
+		level_min[k] = out_min;
+		level_max[k] = out_max;
+	}
+
+	for (x = 0; x < width; x++) {
+		guint start = (guint) ((guint64) x * num_frames / width);
+		guint end = (guint) ((guint64) (x + 1) * num_frames / width);
+		guint a, b;
+
+		if (start >= num_frames)
+			break;
+		if (end <= start)
+			end = start + 1;
+		k = g_bit_storage (end - start) - 1;
+		a = start * channels;
+		b = (end - (1 << k)) * channels;
+		for (ch = 0; ch < channels; ch++) {
+			mins[x * channels + ch] = MIN (level_min[k][a + ch], level_min[k][b + ch]);
+			maxs[x * channels + ch] = MAX (level_max[k][a + ch], level_max[k][b + ch]);
+		}
+	}
+	return x;
+}
+
+/* Drawing styles, numbered as the matching ones of wavescope */
+typedef enum {
+	GST_SIMD_SCOPE_STYLE_DOTS = 0,
+	GST_SIMD_SCOPE_STYLE_LINES
+} GstSimdScopeStyle;
+
+#define GST_TYPE_SIMD_SCOPE_STYLE (gst_simd_scope_style_get_type ())
+static GType gst_simd_scope_style_get_type (void) {
+	static gsize type = 0;
+	static const GEnumValue values[] = {
+		{ GST_SIMD_SCOPE_STYLE_DOTS, "Draw the minimum and the maximum of each column", "dots" },
+		{ GST_SIMD_SCOPE_STYLE_LINES, "Draw a line from the minimum to the maximum of each column", "lines" },
+		{ 0, NULL, NULL }
+	};
+
+	if (g_once_init_enter (&type))
+		g_once_init_leave (&type, g_enum_register_static ("GstSimdScopeStyle", values));
+	return type;
+}
+
+enum {
+	PROP_0,
+	PROP_STYLE
+};
+
+/* The element */
+typedef struct _GstSimdScope {
+	GstAudioVisualizer parent;
+	GstSimdScopeStyle style;
+	ScopeTables tables;
+} GstSimdScope;
+
+typedef struct _GstSimdScopeClass {
+	GstAudioVisualizerClass parent_class;
+} GstSimdScopeClass;
+
+GType gst_simd_scope_get_type (void);
+#define GST_TYPE_SIMD_SCOPE (gst_simd_scope_get_type ())
+
+G_DEFINE_TYPE (GstSimdScope, gst_simd_scope, GST_TYPE_AUDIO_VISUALIZER);
+
+static GstStaticPadTemplate gst_simd_scope_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+		GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (RGB_ORDER)));
+
+static GstStaticPadTemplate gst_simd_scope_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+		GST_PAD_SINK, GST_PAD_ALWAYS,
+		GST_STATIC_CAPS ("audio/x-raw, format = (string) " GST_AUDIO_NE (S16) ", layout = (string) interleaved, "
+				"rate = (int) [ 1, MAX ], channels = (int) [ 1, 8 ]"));
+
+/* Maps a sample value to a row, the maximum at the top */
+static inline guint sample_to_row (gint16 sample, guint height) {
+	return (guint) (((gint) G_MAXINT16 - sample) * (gint64) (height - 1) / 65535);
+}
+
+static gboolean gst_simd_scope_render (GstAudioVisualizer *base, GstBuffer *audio, GstVideoFrame *video) {
+	GstSimdScope *scope = (GstSimdScope *) base;
+	gboolean lines = scope->style == GST_SIMD_SCOPE_STYLE_LINES;
+	guint channels = GST_AUDIO_INFO_CHANNELS (&base->ainfo);
+	guint width = GST_VIDEO_INFO_WIDTH (&base->vinfo), height = GST_VIDEO_INFO_HEIGHT (&base->vinfo);
+	guint8 *pixels = GST_VIDEO_FRAME_PLANE_DATA (video, 0);
+	gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (video, 0);
+	const gint16 *mins, *maxs;
+	guint num_frames, columns, x, y, ch;
+	GstMapInfo map;
+
+	gst_buffer_map (audio, &map, GST_MAP_READ);
+	num_frames = map.size / (channels * sizeof (gint16));
+	columns = column_minmax (scope_kernel, &scope->tables, (const gint16 *) map.data, num_frames, channels, width);
+	mins = scope->tables.columns;
+	maxs = mins + width * channels;
+
+	/* The base class has already cleared the frame (shader=none) or faded the previous one */
+	for (x = 0; x < columns; x++) {
+		for (ch = 0; ch < channels; ch++) {
+			guint top = sample_to_row (maxs[x * channels + ch], height), bottom = sample_to_row (mins[x * channels + ch], height);
+
+			if (!lines) {
+				((guint32 *) (pixels + top * stride))[x] |= channel_colors[ch];
+				((guint32 *) (pixels + bottom * stride))[x] |= channel_colors[ch];
+				continue;
+			}
+			for (y = top; y <= bottom; y++)
+				((guint32 *) (pixels + y * stride))[x] |= channel_colors[ch];
+		}
+	}
+
+	gst_buffer_unmap (audio, &map);
+	return TRUE;
+}
+
+static void gst_simd_scope_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+	GstSimdScope *scope = (GstSimdScope *) object;
+
+	switch (prop_id) {
+		case PROP_STYLE:
+			scope->style = g_value_get_enum (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void gst_simd_scope_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+	GstSimdScope *scope = (GstSimdScope *) object;
+
+	switch (prop_id) {
+		case PROP_STYLE:
+			g_value_set_enum (value, scope->style);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void gst_simd_scope_finalize (GObject *object) {
+	tables_clear (&((GstSimdScope *) object)->tables);
+	G_OBJECT_CLASS (gst_simd_scope_parent_class)->finalize (object);
+}
+
+static void gst_simd_scope_class_init (GstSimdScopeClass *klass) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+	GstAudioVisualizerClass *scope_class = GST_AUDIO_VISUALIZER_CLASS (klass);
+
+	gobject_class->set_property = gst_simd_scope_set_property;
+	gobject_class->get_property = gst_simd_scope_get_property;
+	gobject_class->finalize = gst_simd_scope_finalize;
+	g_object_class_install_property (gobject_class, PROP_STYLE,
+			g_param_spec_enum ("style", "Drawing style", "Drawing style of the scope", GST_TYPE_SIMD_SCOPE_STYLE,
+				GST_SIMD_SCOPE_STYLE_LINES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	gst_element_class_set_static_metadata (element_class, "SIMD waveform oscilloscope", "Visualization",
+			"Simple waveform oscilloscope with vectorized min/max kernels", "gstreamer_study");
+	gst_element_class_add_static_pad_template (element_class, &gst_simd_scope_src_template);
+	gst_element_class_add_static_pad_template (element_class, &gst_simd_scope_sink_template);
+	scope_class->render = GST_DEBUG_FUNCPTR (gst_simd_scope_render);
+}
+
+static void gst_simd_scope_init (GstSimdScope *scope) {
+	scope->style = GST_SIMD_SCOPE_STYLE_LINES;
+}
+
+static gboolean plugin_init (GstPlugin *plugin) {
+	return gst_element_register (plugin, "simdscope", GST_RANK_NONE, GST_TYPE_SIMD_SCOPE);
+}
+
+static gchar *kernel_name = NULL;
+static gboolean benchmark = FALSE;
+static gint seconds = 20;
+
+static GOptionEntry entries[] = {
+	{ "kernel", 'k', 0, G_OPTION_ARG_STRING, &kernel_name, "Min/max kernel: auto, c, sse2, avx2 or neon (default: auto)", "NAME" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Compare the kernels, then simdscope with wavescope", NULL },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Seconds of audio per benchmark run (default: 20)", "N" },
+	{ NULL }
+};
+
+/* What column_minmax must give, one column at a time */
+static void column_minmax_reference (const gint16 *samples, guint num_frames, guint channels, guint width, gint16 *mins,
+		gint16 *maxs) {
+	guint x, f, ch;
+
+	for (x = 0; x < width; x++) {
+		guint start = (guint) ((guint64) x * num_frames / width);
+		guint end = (guint) ((guint64) (x + 1) * num_frames / width);
+
+		if (start >= num_frames)
+			break;
+		if (end <= start)
+			end = start + 1;
+		for (ch = 0; ch < channels; ch++) {
+			mins[x * channels + ch] = G_MAXINT16;
+			maxs[x * channels + ch] = G_MININT16;
+			for (f = start; f < end; f++) {
+				mins[x * channels + ch] = MIN (mins[x * channels + ch], samples[f * channels + ch]);
+				maxs[x * channels + ch] = MAX (maxs[x * channels + ch], samples[f * channels + ch]);
+			}
+		}
+	}
+}
+
+/* Times every supported kernel as simdscope calls it: once per video frame, on the audio of that frame (rate / 30
+ * frames) drawn in 640 columns, in stereo and in 5.1 */
+static void benchmark_kernels (void) {
+	static const gint rates[] = { 48000, 96000, 192000 };
+	static const guint channel_counts[] = { 2, 6 };
+	const guint width = 640, iterations = 2000;
+	guint r, c, k, it;
+
+	g_print ("Kernels, per video frame at 30 fps and %u columns:\n", width);
+	for (c = 0; c < G_N_ELEMENTS (channel_counts); c++) {
+		for (r = 0; r < G_N_ELEMENTS (rates); r++) {
+			guint channels = channel_counts[c], num_frames = rates[r] / 30, n = num_frames * channels, i;
+			gint16 *samples = g_new (gint16, n);
+			gint16 *ref_min = g_new (gint16, width * channels), *ref_max = g_new (gint16, width * channels);
+			gdouble c_time = 0;
+
+			for (i = 0; i < n; i++)
+				samples[i] = (gint16) g_random_int_range (G_MININT16, G_MAXINT16 + 1);
+			column_minmax_reference (samples, num_frames, channels, width, ref_min, ref_max);
+
+			g_print ("  %u channels, %d Hz (%.1f frames per column):\n", channels, rates[r], num_frames / (gdouble) width);
+			/* The C kernel is last: time it first, to compare the others with it */
+			for (k = G_N_ELEMENTS (kernels); k-- > 0;) {
+				ScopeTables tables = { NULL, 0, NULL, 0 };
+				GstClockTime start;
+				gdouble elapsed;
+
+				if (!kernels[k].supported ())
+					continue;
+
+				/* Check it against the reference before timing it */
+				column_minmax (&kernels[k], &tables, samples, num_frames, channels, width);
+				if (memcmp (tables.columns, ref_min, width * channels * sizeof (gint16)) != 0 ||
+						memcmp (tables.columns + width * channels, ref_max, width * channels * sizeof (gint16)) != 0) {
+					g_printerr ("Kernel %s gives wrong results.\n", kernels[k].name);
+					tables_clear (&tables);
+					continue;
+				}
+
+				start = gst_util_get_timestamp ();
+				for (it = 0; it < iterations; it++)
+					column_minmax (&kernels[k], &tables, samples, num_frames, channels, width);
+				elapsed = (gst_util_get_timestamp () - start) / (gdouble) iterations;
+				if (c_time == 0)
+					c_time = elapsed;
+				g_print ("    %-5s %8.2f us/frame %6.2fx\n", kernels[k].name, elapsed / 1000, c_time / elapsed);
+				tables_clear (&tables);
+			}
+			g_free (samples);
+			g_free (ref_min);
+			g_free (ref_max);
+		}
+	}
+}
+
+static gdouble cpu_seconds (void) {
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Runs one scope as fast as possible and returns its CPU time, or a negative value. Both scopes draw lines, the
+ * style of basic-tutorial-7.c: wavescope defaults to dots, which is cheaper */
+static gdouble benchmark_scope (const gchar *scope, gint rate) {
+	gint samples_per_buffer = 1024;
+	gchar *description = g_strdup_printf ("audiotestsrc wave=white num-buffers=%d samplesperbuffer=%d ! "
+			"audio/x-raw,format=" GST_AUDIO_NE (S16) ",rate=%d,channels=2 ! %s shader=0 style=1 ! "
+			"video/x-raw,width=640,height=480,framerate=30/1 ! fakesink sync=false",
+			seconds * rate / samples_per_buffer, samples_per_buffer, rate, scope);
+	GError *error = NULL;
+	GstElement *pipeline = gst_parse_launch (description, &error);
+	GstMessage *msg;
+	GstBus *bus;
+	gdouble start, cpu = -1;
+
+	g_free (description);
+	if (!pipeline) {
+		g_printerr ("Could not build the %s pipeline: %s\n", scope, error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+
+	start = cpu_seconds ();
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS)
+		cpu = cpu_seconds () - start;
+	else
+		g_printerr ("The %s pipeline failed.\n", scope);
+	gst_message_unref (msg);
+	gst_object_unref (bus);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	return cpu;
+}
+
+static int run_benchmark (void) {
+	static const gint rates[] = { 48000, 96000, 192000 };
+	guint i;
+
+	benchmark_kernels ();
+
+	g_print ("\nCPU time for %d s of stereo audio drawn at 640x480, 30 fps:\n", seconds);
+	g_print ("%8s %12s %12s %8s\n", "rate", "wavescope", "simdscope", "speedup");
+	for (i = 0; i < G_N_ELEMENTS (rates); i++) {
+		gdouble wave = benchmark_scope ("wavescope", rates[i]);
+		gdouble simd = benchmark_scope ("simdscope", rates[i]);
+
+		if (wave < 0 || simd < 0)
+			return -1;
+		g_print ("%8d %10.3f s %10.3f s %7.2fx\n", rates[i], wave, simd, simd > 0 ? wave / simd : 0.0);
+	}
+	return 0;
+}
+
+/* The basic-tutorial-7.c graph, with simdscope on the video branch */
+static int run_playback (void) {
+	GError *error = NULL;
+	GstElement *pipeline = gst_parse_launch ("audiotestsrc freq=215 ! tee name=tee "
+			"tee. ! queue ! audioconvert ! audioresample ! autoaudiosink "
+			"tee. ! queue ! simdscope shader=0 style=1 ! videoconvert ! autovideosink", &error);
+	GstMessage *msg;
+	GstBus *bus;
+
+	if (!pipeline) {
+		g_printerr ("Could not build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+
+	/* Wait until error or EOS */
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		GError *err;
+		gchar *debug_info;
+
+		gst_message_parse_error (msg, &err, &debug_info);
+		g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+		g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+		g_clear_error (&err);
+		g_free (debug_info);
+	}
+
+	gst_message_unref (msg);
+	gst_object_unref (bus);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	return 0;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	int result;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- vectorized waveform scope");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (!select_kernel (kernel_name ? kernel_name : "auto")) {
+		g_printerr ("Kernel '%s' is not available on this machine.\n", kernel_name);
+		return -1;
+	}
+	g_print ("Using the %s min/max kernel.\n", scope_kernel->name);
+
+	if (!gst_plugin_register_static (GST_VERSION_MAJOR, GST_VERSION_MINOR, "simdscope",
+				"Vectorized audio visualizer", plugin_init, "1.0", "LGPL", "gstreamer_study", "gstreamer_study",
+				"https://gstreamer.freedesktop.org/")) {
+		g_printerr ("Could not register the simdscope element.\n");
+		return -1;
+	}
+
+	result = benchmark ? run_benchmark () : run_playback ();
+	g_free (kernel_name);
+	return result;
+}
@@ -0,0 +1,327 @@
+/* Tee fan-out : one source, many branches, one drop policy per branch
+ *
+ * Goal
+ *
+ * basic-tutorial-7.c splits one audio source into two hardcoded branches, each behind a default queue.
+ * A default queue blocks when it is full, and a blocking queue blocks the tee, so the slowest branch sets
+ * the pace for every other one. This program builds the same tee + request pad graph with N branches and
+ * gives every branch its own bounded queue with one of these policies:
+ *
+ *   - oldest : leaky=downstream, the oldest queued buffer is dropped to make room (live previews)
+ *   - newest : leaky=upstream, the incoming buffer is dropped while the queue is full
+ *   - block  : not leaky, the tee waits for this branch (only for consumers that must not lose data)
+ *
+ * The tee pushes the same GstBuffer to every source pad, only adding a reference, so the data is never
+ * copied as long as no branch needs to write to it (every element here works in place or read-only).
+ *
+ * Each branch counts the buffers entering and leaving its queue with pad probes. Whatever went in, did not
+ * come out and is not queued any more was dropped by the queue:
+ *
+ *		drops = in - out - current-level-buffers
+ *
+ * Usage
+ *   tee-fanout [--branches=8] [--policies=oldest,newest,block] [--max-buffers=10] [--slow=0,3] [--duration=10]
+ *
+ * Policies are assigned to the branches in turn. The branches listed in --slow sleep 50 ms per buffer
+ * to simulate a slow consumer.
+ *
+ */
+
+#include <stdlib.h>
+
+#include <gst/gst.h>
+
+typedef enum {
+	POLICY_DROP_OLDEST,
+	POLICY_DROP_NEWEST,
+	POLICY_BLOCK
+} DropPolicy;
+
+static const gchar *policy_names[] = { "oldest", "newest", "block" };
+
+/* Everything we need to know about one branch of the tee */
+typedef struct _Branch {
+	guint index;
+	DropPolicy policy;
+	gboolean slow;                  /* Does this branch simulate a slow consumer? */
+	GstPad *tee_pad;                /* Request pad obtained from the tee */
+	GstElement *queue;
+	GstElement *consumer;           /* identity, sleeping when the branch is slow */
+	GstElement *sink;
+	gint in;                        /* Buffers that entered the queue */
+	gint out;                       /* Buffers that left the queue */
+} Branch;
+
+static gint n_branches = 8;
+static gchar *policies_arg = NULL;
+static gint max_buffers = 10;
+static gchar *slow_arg = NULL;
+static gint duration = 10;
+
+static GOptionEntry entries[] = {
+	{ "branches", 'b', 0, G_OPTION_ARG_INT, &n_branches, "Number of tee branches (default 8)", "N" },
+	{ "policies", 'p', 0, G_OPTION_ARG_STRING, &policies_arg, "Comma separated drop policies, assigned in turn (default oldest)", "LIST" },
+	{ "max-buffers", 'm', 0, G_OPTION_ARG_INT, &max_buffers, "Queue size of every branch, in buffers (default 10)", "N" },
+	{ "slow", 's', 0, G_OPTION_ARG_STRING, &slow_arg, "Comma separated indices of the branches that consume slowly", "LIST" },
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to run before sending EOS (default 10)", "S" },
+	{ NULL }
+};
+
+static GstPadProbeReturn count_in_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch) {
+	g_atomic_int_inc (&branch->in);
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn count_out_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch) {
+	g_atomic_int_inc (&branch->out);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Configures the queue of a branch according to its drop policy */
+static void apply_policy (Branch *branch) {
+	/* Bound the queue by buffers only, so the policy is easy to reason about */
+	g_object_set (branch->queue, "max-size-buffers", (guint) max_buffers, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+
+	switch (branch->policy) {
+		case POLICY_DROP_OLDEST:
+			g_object_set (branch->queue, "leaky", 2, NULL);
+			break;
+		case POLICY_DROP_NEWEST:
+			g_object_set (branch->queue, "leaky", 1, NULL);
+			break;
+		case POLICY_BLOCK:
+			g_object_set (branch->queue, "leaky", 0, NULL);
+			break;
+	}
+}
+
+/* Creates the elements of one branch, adds them to the pipeline and links them to a new tee pad */
+static gboolean add_branch (GstElement *pipeline, GstElement *tee, Branch *branch) {
+	gchar *name;
+	GstPad *queue_pad, *pad;
+
+	name = g_strdup_printf ("queue_%u", branch->index);
+	branch->queue = gst_element_factory_make ("queue", name);
+	g_free (name);
+	name = g_strdup_printf ("consumer_%u", branch->index);
+	branch->consumer = gst_element_factory_make ("identity", name);
+	g_free (name);
+	name = g_strdup_printf ("sink_%u", branch->index);
+	branch->sink = gst_element_factory_make ("fakesink", name);
+	g_free (name);
+
+	if (!branch->queue || !branch->consumer || !branch->sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return FALSE;
+	}
+
+	apply_policy (branch);
+	if (branch->slow)
+		g_object_set (branch->consumer, "sleep-time", 50000, NULL);
+	/* Synchronize on the clock, like a real audio or video sink would */
+	g_object_set (branch->sink, "sync", TRUE, NULL);
+
+	gst_bin_add_many (GST_BIN (pipeline), branch->queue, branch->consumer, branch->sink, NULL);
+	if (gst_element_link_many (branch->queue, branch->consumer, branch->sink, NULL) != TRUE) {
+		g_printerr ("Elements of branch %u could not be linked.\n", branch->index);
+		return FALSE;
+	}
+
+	/* Manually link the Tee, which has "Request" pads */
+	branch->tee_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_pad = gst_element_get_static_pad (branch->queue, "sink");
+	if (gst_pad_link (branch->tee_pad, queue_pad) != GST_PAD_LINK_OK) {
+		g_printerr ("Tee could not be linked to branch %u.\n", branch->index);
+		gst_object_unref (queue_pad);
+		return FALSE;
+	}
+
+	/* Count what goes in and out of the queue */
+	gst_pad_add_probe (queue_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_in_probe, branch, NULL);
+	gst_object_unref (queue_pad);
+	pad = gst_element_get_static_pad (branch->queue, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_out_probe, branch, NULL);
+	gst_object_unref (pad);
+
+	return TRUE;
+}
+
+/* Prints the counters of every branch */
+static void print_branch_stats (Branch *branches) {
+	gint i;
+
+	g_print ("branch policy  slow       in      out  queued    drops\n");
+	for (i = 0; i < n_branches; i++) {
+		guint level;
+		gint in = g_atomic_int_get (&branches[i].in);
+		gint out = g_atomic_int_get (&branches[i].out);
+
+		g_object_get (branches[i].queue, "current-level-buffers", &level, NULL);
+		g_print ("%6d %-7s %4s %8d %8d %7u %8d\n", i, policy_names[branches[i].policy],
+				branches[i].slow ? "yes" : "no", in, out, level, MAX (in - out - (gint) level, 0));
+	}
+	g_print ("\n");
+}
+
+/* Parses a comma separated list of policy names into one policy per branch */
+static gboolean parse_policies (Branch *branches) {
+	gchar **names;
+	guint n_names, i, j;
+
+	if (!policies_arg) {
+		for (i = 0; i < (guint) n_branches; i++)
+			branches[i].policy = POLICY_DROP_OLDEST;
+		return TRUE;
+	}
+
+	names = g_strsplit (policies_arg, ",", -1);
+	n_names = g_strv_length (names);
+	for (i = 0; i < (guint) n_branches && n_names > 0; i++) {
+		const gchar *name = g_strstrip (names[i % n_names]);
+
+		for (j = 0; j < G_N_ELEMENTS (policy_names); j++) {
+			if (g_strcmp0 (name, policy_names[j]) == 0)
+				break;
+		}
+		if (j == G_N_ELEMENTS (policy_names)) {
+			g_printerr ("Unknown drop policy '%s'.\n", name);
+			g_strfreev (names);
+			return FALSE;
+		}
+		branches[i].policy = (DropPolicy) j;
+	}
+	g_strfreev (names);
+	return n_names > 0;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	GstElement *pipeline, *audio_source, *tee;
+	GstBus *bus;
+	GstMessage *msg;
+	Branch *branches;
+	gboolean terminate = FALSE, eos_sent = FALSE;
+	gint64 end_time;
+	gint i;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- N-branch tee fan-out with per-branch drop policy");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (n_branches <= 0 || max_buffers <= 0) {
+		g_printerr ("The number of branches and the queue size must be positive.\n");
+		return -1;
+	}
+
+	branches = g_new0 (Branch, n_branches);
+	for (i = 0; i < n_branches; i++)
+		branches[i].index = i;
+	if (!parse_policies (branches))
+		return -1;
+	if (slow_arg) {
+		gchar **indices = g_strsplit (slow_arg, ",", -1);
+		gchar **index;
+
+		for (index = indices; *index; index++) {
+			gint n = atoi (*index);
+			if (n >= 0 && n < n_branches)
+				branches[n].slow = TRUE;
+		}
+		g_strfreev (indices);
+	}
+
+	/* Create the source and the tee. The source is live, so it produces data at the clock rate
+	 * no matter how slow some of the consumers are */
+	audio_source = gst_element_factory_make ("audiotestsrc", "audio_source");
+	tee = gst_element_factory_make ("tee", "tee");
+	pipeline = gst_pipeline_new ("fanout-pipeline");
+	if (!pipeline || !audio_source || !tee) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+	g_object_set (audio_source, "freq", 215.0f, "is-live", TRUE, NULL);
+
+	gst_bin_add_many (GST_BIN (pipeline), audio_source, tee, NULL);
+	if (gst_element_link (audio_source, tee) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+
+	for (i = 0; i < n_branches; i++) {
+		if (!add_branch (pipeline, tee, &branches[i])) {
+			gst_object_unref (pipeline);
+			return -1;
+		}
+	}
+
+	/* Start playing the pipeline */
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+
+	/* Print the counters every second, and send EOS once the duration is over */
+	bus = gst_element_get_bus (pipeline);
+	end_time = g_get_monotonic_time () + duration * G_TIME_SPAN_SECOND;
+	do {
+		msg = gst_bus_timed_pop_filtered (bus, GST_SECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+
+		if (msg != NULL) {
+			GError *err;
+			gchar *debug_info;
+
+			switch (GST_MESSAGE_TYPE (msg)) {
+				case GST_MESSAGE_ERROR:
+					gst_message_parse_error (msg, &err, &debug_info);
+					g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+					g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+					g_clear_error (&err);
+					g_free (debug_info);
+					terminate = TRUE;
+					break;
+				case GST_MESSAGE_EOS:
+					g_print ("End-Of-Stream reached.\n");
+					terminate = TRUE;
+					break;
+				default:
+					/* We should not reach here because we only asked for ERRORs and EOS */
+					g_printerr ("Unexpected message received.\n");
+					break;
+			}
+			gst_message_unref (msg);
+		} else {
+			print_branch_stats (branches);
+			if (!eos_sent && g_get_monotonic_time () >= end_time) {
+				gst_element_send_event (pipeline, gst_event_new_eos ());
+				eos_sent = TRUE;
+			}
+		}
+	} while (!terminate);
+
+	print_branch_stats (branches);
+
+	/* Release the request pads from the Tee, and unref them */
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	for (i = 0; i < n_branches; i++) {
+		gst_element_release_request_pad (tee, branches[i].tee_pad);
+		gst_object_unref (branches[i].tee_pad);
+	}
+
+	/* Free resources */
+	gst_object_unref (bus);
+	gst_object_unref (pipeline);
+	g_free (branches);
+	g_free (policies_arg);
+	g_free (slow_arg);
+	return 0;
+}
@@ -0,0 +1,499 @@
+/* Tee hot branches : adding and removing tee branches while PLAYING
+ *
+ * Goal
+ *
+ * basic-tutorial-7.c requests its tee pads before the pipeline starts and releases them after the bus returned EOS, and
+ * its comments leave the PLAYING case ("Pad blocking") out. Recorders and previews come and go at runtime, though, and
+ * stopping the pipeline to attach one interrupts every other consumer. This program keeps one permanent branch running
+ * and adds and removes other branches around it without any state change of the pipeline:
+ *
+ *   - adding: the branch (a bin with a queue first and a sink last) is added to the pipeline and brought to PLAYING
+ *     on its own, with gst_element_sync_state_with_parent(). Only then is a tee pad requested and linked to it, so the
+ *     tee never pushes into something that is not ready.
+ *   - removing: an IDLE probe on the tee pad waits until no buffer is being pushed on it. From the probe the pad is
+ *     unlinked, the branch gets an EOS so its queue drains and a recorder finalizes its file, and the pad is released.
+ *     When the EOS reaches the sink of the branch, the main thread sets the bin to NULL and removes it.
+ *
+ * The permanent branch checks that the sample offsets of the buffers it receives follow each other, so any buffer lost
+ * to a branch change would show up as a gap. The latency of every step is measured:
+ *
+ *   - add   : linked (request + link), first buffer at the branch, first buffer at its sink
+ *   - remove: unlinked (until the IDLE probe ran), drained (EOS reached the sink), torn down (bin removed)
+ *
+ * Usage
+ *   tee-hot-branches [--duration=20] [--interval=1000] [--lifetime=3000] [--kind=preview|recorder|mixed]
+ *                    [--output-dir=DIR]
+ *
+ * A branch is added every --interval milliseconds and removed --lifetime milliseconds later. Preview branches render
+ * to an audio sink; recorder branches write hot-branch-N.wav files to --output-dir (the temporary directory by default).
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+typedef enum {
+	KIND_PREVIEW,
+	KIND_RECORDER,
+	KIND_MIXED
+} BranchKind;
+
+static const gchar *kind_names[] = { "preview", "recorder", "mixed" };
+
+/* Minimum, average and maximum of one latency, in nanoseconds */
+typedef struct _Stat {
+	const gchar *name;
+	guint count;
+	GstClockTime sum;
+	GstClockTime min;
+	GstClockTime max;
+} Stat;
+
+enum {
+	STAT_ADD_LINKED,
+	STAT_ADD_ENTERED,
+	STAT_ADD_RENDERED,
+	STAT_REMOVE_UNLINKED,
+	STAT_REMOVE_DRAINED,
+	STAT_REMOVE_TORN_DOWN,
+	N_STATS
+};
+
+typedef struct _CustomData CustomData;
+
+/* One branch added at runtime */
+typedef struct _Branch {
+	CustomData *data;
+	guint index;
+	GstElement *bin;                /* queue ! ... ! sink, with a ghost "sink" pad */
+	GstPad *tee_pad;                /* Request pad obtained from the tee */
+	GstPad *sink_pad;               /* Sink pad of the last element of the branch */
+	GstClockTime add_time;          /* When the add was asked for */
+	GstClockTime remove_time;       /* When the remove was asked for, GST_CLOCK_TIME_NONE while attached */
+	gboolean entered;               /* The first buffer reached the branch */
+	gboolean rendered;              /* The first buffer reached its sink */
+	gint removing;                  /* The IDLE probe is installed; set once */
+	guint buffers;                  /* Buffers the sink of the branch received */
+	guint remove_source;            /* Timeout that removes the branch, 0 once it ran */
+} Branch;
+
+/* Structure to contain all our information, so we can pass it around */
+struct _CustomData {
+	GstElement *pipeline;
+	GstElement *tee;
+	GMainLoop *loop;
+	GQueue branches;                /* Attached branches, oldest first */
+	guint next_index;
+	guint added, removed;
+	guint add_source;               /* Timeout adding the branches, 0 once stopped */
+	guint stop_source;              /* Timeout ending the run, 0 once it ran */
+
+	GMutex lock;                    /* Protects everything below */
+	Stat stats[N_STATS];
+	guint64 expected_offset;        /* Sample offset the permanent branch expects next, -1 before the first buffer */
+	guint64 permanent_buffers;      /* Buffers the permanent branch received */
+	guint64 gaps;                   /* Discontinuities seen by the permanent branch */
+	guint64 missing_samples;        /* Samples they add up to */
+};
+
+static gint duration = 20;
+static gint interval = 1000;
+static gint lifetime = 3000;
+static gchar *kind_arg = NULL;
+static gchar *output_dir = NULL;
+
+static GOptionEntry entries[] = {
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to run before sending EOS (default 20)", "S" },
+	{ "interval", 'i', 0, G_OPTION_ARG_INT, &interval, "Milliseconds between two added branches (default 1000)", "MS" },
+	{ "lifetime", 'l', 0, G_OPTION_ARG_INT, &lifetime, "Milliseconds a branch stays attached (default 3000)", "MS" },
+	{ "kind", 'k', 0, G_OPTION_ARG_STRING, &kind_arg, "Kind of the added branches: preview, recorder or mixed (default mixed)", "KIND" },
+	{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir, "Directory of the recorder files (default: temporary directory)", "DIR" },
+	{ NULL }
+};
+
+static BranchKind kind = KIND_MIXED;
+
+static void stat_add (CustomData *data, guint which, GstClockTime value) {
+	Stat *stat = &data->stats[which];
+
+	g_mutex_lock (&data->lock);
+	stat->count++;
+	stat->sum += value;
+	stat->min = stat->count == 1 ? value : MIN (stat->min, value);
+	stat->max = MAX (stat->max, value);
+	g_mutex_unlock (&data->lock);
+}
+
+/* Checks that the permanent branch gets every buffer the source produced */
+static GstPadProbeReturn permanent_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+	if (!GST_BUFFER_OFFSET_IS_VALID (buffer) || !GST_BUFFER_OFFSET_END_IS_VALID (buffer))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock (&data->lock);
+	if (data->expected_offset != GST_BUFFER_OFFSET_NONE && GST_BUFFER_OFFSET (buffer) != data->expected_offset) {
+		data->gaps++;
+		if (GST_BUFFER_OFFSET (buffer) > data->expected_offset)
+			data->missing_samples += GST_BUFFER_OFFSET (buffer) - data->expected_offset;
+	}
+	data->expected_offset = GST_BUFFER_OFFSET_END (buffer);
+	data->permanent_buffers++;
+	g_mutex_unlock (&data->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/* First buffer entering a new branch */
+static GstPadProbeReturn branch_entry_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch) {
+	if (!branch->entered) {
+		branch->entered = TRUE;
+		stat_add (branch->data, STAT_ADD_ENTERED, gst_util_get_timestamp () - branch->add_time);
+	}
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* Counts the buffers of a branch at its sink, and notices the EOS sent by branch_remove */
+static GstPadProbeReturn branch_sink_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch);
+
+static gboolean branch_teardown (Branch *branch);
+
+/* Adds a branch built from "description" (which must start with a queue and end with a sink) and links it to the tee */
+static Branch *branch_add (CustomData *data, const gchar *description) {
+	GError *error = NULL;
+	GstIterator *it;
+	GValue item = G_VALUE_INIT;
+	GstPad *bin_pad;
+	Branch *branch;
+
+	branch = g_new0 (Branch, 1);
+	branch->data = data;
+	branch->index = data->next_index++;
+	branch->add_time = gst_util_get_timestamp ();
+	branch->remove_time = GST_CLOCK_TIME_NONE;
+
+	branch->bin = gst_parse_bin_from_description (description, TRUE, &error);
+	if (!branch->bin) {
+		g_printerr ("Branch '%s' could not be built: %s\n", description, error->message);
+		g_clear_error (&error);
+		g_free (branch);
+		return NULL;
+	}
+
+	/* Watch the sink of the branch */
+	it = gst_bin_iterate_sinks (GST_BIN (branch->bin));
+	if (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+		branch->sink_pad = gst_element_get_static_pad (g_value_get_object (&item), "sink");
+		g_value_reset (&item);
+	}
+	gst_iterator_free (it);
+	if (!branch->sink_pad) {
+		g_printerr ("Branch '%s' has no sink.\n", description);
+		gst_object_unref (branch->bin);
+		g_free (branch);
+		return NULL;
+	}
+	gst_pad_add_probe (branch->sink_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+			(GstPadProbeCallback) branch_sink_probe, branch, NULL);
+
+	/* Bring the branch up on its own, before any data arrives */
+	gst_bin_add (GST_BIN (data->pipeline), branch->bin);
+	gst_element_sync_state_with_parent (branch->bin);
+
+	/* Only now give it data */
+	bin_pad = gst_element_get_static_pad (branch->bin, "sink");
+	gst_pad_add_probe (bin_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) branch_entry_probe, branch, NULL);
+	branch->tee_pad = gst_element_request_pad_simple (data->tee, "src_%u");
+	if (gst_pad_link (branch->tee_pad, bin_pad) != GST_PAD_LINK_OK) {
+		g_printerr ("Tee could not be linked to branch %u.\n", branch->index);
+		gst_element_release_request_pad (data->tee, branch->tee_pad);
+		gst_object_unref (branch->tee_pad);
+		gst_object_unref (bin_pad);
+		gst_element_set_state (branch->bin, GST_STATE_NULL);
+		gst_bin_remove (GST_BIN (data->pipeline), branch->bin);
+		gst_object_unref (branch->sink_pad);
+		g_free (branch);
+		return NULL;
+	}
+	gst_object_unref (bin_pad);
+	stat_add (data, STAT_ADD_LINKED, gst_util_get_timestamp () - branch->add_time);
+
+	g_queue_push_tail (&data->branches, branch);
+	data->added++;
+	g_print ("Added branch %u (%s, %s): %s\n", branch->index, GST_PAD_NAME (branch->tee_pad),
+			gst_element_state_get_name (GST_STATE (branch->bin)), description);
+	return branch;
+}
+
+/* Runs once no buffer is being pushed on the tee pad of the branch. Nothing flows from here on, so it can be unlinked */
+static GstPadProbeReturn branch_idle_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch) {
+	CustomData *data = branch->data;
+	GstPad *bin_pad;
+
+	stat_add (data, STAT_REMOVE_UNLINKED, gst_util_get_timestamp () - branch->remove_time);
+
+	bin_pad = gst_element_get_static_pad (branch->bin, "sink");
+	gst_pad_unlink (branch->tee_pad, bin_pad);
+	/* Let the queue push out what it holds, and the sink finish (a muxer writes its headers) */
+	gst_pad_send_event (bin_pad, gst_event_new_eos ());
+	gst_object_unref (bin_pad);
+
+	gst_element_release_request_pad (data->tee, branch->tee_pad);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* Detaches a branch. The branch is freed in branch_teardown, once it is drained */
+static void branch_remove (Branch *branch) {
+	if (!g_atomic_int_compare_and_exchange (&branch->removing, 0, 1))
+		return;
+
+	branch->remove_time = gst_util_get_timestamp ();
+	g_queue_remove (&branch->data->branches, branch);
+	/* The probe runs right away if the pad is idle, otherwise from the streaming thread once the current push is done */
+	gst_pad_add_probe (branch->tee_pad, GST_PAD_PROBE_TYPE_IDLE, (GstPadProbeCallback) branch_idle_probe, branch, NULL);
+}
+
+static GstPadProbeReturn branch_sink_probe (GstPad *pad, GstPadProbeInfo *info, Branch *branch) {
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		branch->buffers++;
+		if (!branch->rendered) {
+			branch->rendered = TRUE;
+			stat_add (branch->data, STAT_ADD_RENDERED, gst_util_get_timestamp () - branch->add_time);
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	/* Only the EOS of a removed branch is ours; the one of the whole pipeline is left to the bus */
+	if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_EOS &&
+			g_atomic_int_get (&branch->removing)) {
+		stat_add (branch->data, STAT_REMOVE_DRAINED, gst_util_get_timestamp () - branch->remove_time);
+		/* The state of the branch cannot be changed from its own streaming thread */
+		g_idle_add ((GSourceFunc) branch_teardown, branch);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/* Runs on the main thread once a removed branch is drained */
+static gboolean branch_teardown (Branch *branch) {
+	CustomData *data = branch->data;
+
+	gst_element_set_state (branch->bin, GST_STATE_NULL);
+	gst_bin_remove (GST_BIN (data->pipeline), branch->bin);
+	stat_add (data, STAT_REMOVE_TORN_DOWN, gst_util_get_timestamp () - branch->remove_time);
+
+	data->removed++;
+	g_print ("Removed branch %u after %u buffers\n", branch->index, branch->buffers);
+	gst_object_unref (branch->tee_pad);
+	gst_object_unref (branch->sink_pad);
+	g_free (branch);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean remove_timeout_cb (Branch *branch) {
+	branch->remove_source = 0;
+	branch_remove (branch);
+	return G_SOURCE_REMOVE;
+}
+
+/* Adds a branch of the configured kind, and schedules its removal */
+static gboolean add_timeout_cb (CustomData *data) {
+	BranchKind branch_kind = kind == KIND_MIXED ? (BranchKind) (data->next_index % 2) : kind;
+	gchar *description;
+	Branch *branch;
+
+	if (branch_kind == KIND_RECORDER) {
+		gchar *name = g_strdup_printf ("hot-branch-%u.wav", data->next_index);
+		gchar *location = g_build_filename (output_dir ? output_dir : g_get_tmp_dir (), name, NULL);
+
+		description = g_strdup_printf ("queue ! audioconvert ! wavenc ! filesink location=\"%s\"", location);
+		g_free (location);
+		g_free (name);
+	} else {
+		description = g_strdup ("queue ! audioconvert ! audioresample ! autoaudiosink");
+	}
+
+	branch = branch_add (data, description);
+	g_free (description);
+	if (branch)
+		branch->remove_source = g_timeout_add (lifetime, (GSourceFunc) remove_timeout_cb, branch);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+/* Stops adding branches and ends the stream. The branches still attached get the EOS through the tee */
+static gboolean stop_cb (CustomData *data) {
+	data->stop_source = 0;
+	g_source_remove (data->add_source);
+	data->add_source = 0;
+	gst_element_send_event (data->pipeline, gst_event_new_eos ());
+	return G_SOURCE_REMOVE;
+}
+
+static void print_stats (CustomData *data) {
+	guint i;
+
+	g_print ("\n%u branches added, %u removed\n", data->added, data->removed);
+	g_print ("%-20s %6s %10s %10s %10s\n", "latency", "count", "min ms", "avg ms", "max ms");
+	for (i = 0; i < N_STATS; i++) {
+		Stat *stat = &data->stats[i];
+
+		if (!stat->count)
+			continue;
+		g_print ("%-20s %6u %10.3f %10.3f %10.3f\n", stat->name, stat->count, stat->min / 1e6,
+				stat->sum / 1e6 / stat->count, stat->max / 1e6);
+	}
+	g_print ("permanent branch: %" G_GUINT64_FORMAT " buffers, %" G_GUINT64_FORMAT " gaps, %" G_GUINT64_FORMAT
+			" samples missing\n", data->permanent_buffers, data->gaps, data->missing_samples);
+}
+
+int main (int argc, char *argv[]) {
+	static const gchar *stat_names[] = { "add: linked", "add: first buffer", "add: first at sink",
+		"remove: unlinked", "remove: drained", "remove: torn down" };
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstElement *audio_source, *caps_filter, *queue, *sink;
+	GstCaps *caps;
+	GstPad *tee_pad, *pad;
+	GstBus *bus;
+	guint i;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- add and remove tee branches while PLAYING");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (kind_arg) {
+		for (i = 0; i < G_N_ELEMENTS (kind_names); i++) {
+			if (g_strcmp0 (kind_arg, kind_names[i]) == 0)
+				break;
+		}
+		if (i == G_N_ELEMENTS (kind_names)) {
+			g_printerr ("Unknown branch kind '%s'.\n", kind_arg);
+			return -1;
+		}
+		kind = (BranchKind) i;
+	}
+	if (duration <= 0 || interval <= 0 || lifetime <= 0) {
+		g_printerr ("The duration, interval and lifetime must be positive.\n");
+		return -1;
+	}
+
+	memset (&data, 0, sizeof (data));
+	g_queue_init (&data.branches);
+	g_mutex_init (&data.lock);
+	data.expected_offset = GST_BUFFER_OFFSET_NONE;
+	for (i = 0; i < N_STATS; i++)
+		data.stats[i].name = stat_names[i];
+
+	/* Create the source, the tee and the permanent branch. The source is live, so branches come and go while
+	 * data keeps flowing at the clock rate */
+	audio_source = gst_element_factory_make ("audiotestsrc", "audio_source");
+	caps_filter = gst_element_factory_make ("capsfilter", "caps_filter");
+	data.tee = gst_element_factory_make ("tee", "tee");
+	queue = gst_element_factory_make ("queue", "permanent_queue");
+	sink = gst_element_factory_make ("fakesink", "permanent_sink");
+	data.pipeline = gst_pipeline_new ("hot-branches-pipeline");
+	if (!data.pipeline || !audio_source || !caps_filter || !data.tee || !queue || !sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+	g_object_set (audio_source, "freq", 215.0f, "is-live", TRUE, NULL);
+	caps = gst_caps_from_string ("audio/x-raw,format=S16LE,rate=48000,channels=2");
+	g_object_set (caps_filter, "caps", caps, NULL);
+	gst_caps_unref (caps);
+	/* A branch between request and link, or between unlink and release, must not stop the tee */
+	g_object_set (data.tee, "allow-not-linked", TRUE, NULL);
+	g_object_set (sink, "sync", TRUE, NULL);
+
+	gst_bin_add_many (GST_BIN (data.pipeline), audio_source, caps_filter, data.tee, queue, sink, NULL);
+	if (gst_element_link_many (audio_source, caps_filter, data.tee, NULL) != TRUE ||
+			gst_element_link (queue, sink) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	tee_pad = gst_element_request_pad_simple (data.tee, "src_%u");
+	pad = gst_element_get_static_pad (queue, "sink");
+	if (gst_pad_link (tee_pad, pad) != GST_PAD_LINK_OK) {
+		g_printerr ("Tee could not be linked.\n");
+		gst_object_unref (pad);
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) permanent_probe, &data, NULL);
+	gst_object_unref (pad);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+
+	/* Start playing */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	data.add_source = g_timeout_add (interval, (GSourceFunc) add_timeout_cb, &data);
+	data.stop_source = g_timeout_add_seconds (duration, (GSourceFunc) stop_cb, &data);
+	g_main_loop_run (data.loop);
+
+	print_stats (&data);
+
+	/* Free resources. Branches still attached, or not yet torn down, go away with the pipeline */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_element_release_request_pad (data.tee, tee_pad);
+	gst_object_unref (tee_pad);
+	/* The timers are removed by id: the bus watch has the same user data */
+	if (data.add_source)
+		g_source_remove (data.add_source);
+	if (data.stop_source)
+		g_source_remove (data.stop_source);
+	while (!g_queue_is_empty (&data.branches)) {
+		Branch *branch = g_queue_pop_head (&data.branches);
+
+		/* Its removal timeout must not run any more */
+		if (branch->remove_source)
+			g_source_remove (branch->remove_source);
+		gst_element_release_request_pad (data.tee, branch->tee_pad);
+		gst_object_unref (branch->tee_pad);
+		gst_object_unref (branch->sink_pad);
+		g_free (branch);
+	}
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	g_main_loop_unref (data.loop);
+	g_mutex_clear (&data.lock);
+	return 0;
+}
@@ -0,0 +1,453 @@
+/* Tee latency trace : where the time goes in the basic-tutorial-7.c graph
+ *
+ * Goal
+ *
+ * This program builds the pipeline of basic-tutorial-7.c:
+ *
+ *   audio_source -> tee -> audio_queue -> audio_convert -> audio_resample -> audio_sink
+ *                       -> video_queue -> visual (wavescope) -> csp (videoconvert) -> video_sink
+ *
+ * and timestamps every buffer as it crosses every pad, with pad probes, to keep one latency histogram per element:
+ *
+ *   - transforms (tee, audioconvert, audioresample, wavescope, videoconvert): processing time, from the moment an input
+ *     buffer enters the sink pad to the moment the output it contributed to leaves a source pad. Outputs are matched to
+ *     inputs by timestamp: an output covering [pts, pts + duration) is produced from the inputs with a pts before its end,
+ *     which also works for wavescope, that turns many audio buffers into one video frame.
+ *   - queues: residency, the time a buffer spent inside the queue (same measurement, the buffer is the same).
+ *   - sinks: lateness, how far behind its running time a buffer reached the sink (0 when it arrived early enough to
+ *     wait for the clock, which is the normal case). Late buffers are what you see as jitter.
+ *
+ * The histograms have logarithmic buckets with 16 linear sub-buckets each, so p50/p99 are accurate to about 6%.
+ * They are printed (p50, p99 and max per element) at EOS, and whenever the process receives SIGUSR1:
+ *
+ *		kill -USR1 $(pidof tee-latency-trace)
+ *
+ * Usage
+ *   tee-latency-trace [--num-buffers=N]
+ *
+ */
+
+#include <signal.h>
+#include <string.h>
+
+#include <glib-unix.h>
+#include <gst/gst.h>
+
+#define HIST_SUB_BUCKETS 16
+#define HIST_BUCKETS (61 * HIST_SUB_BUCKETS)
+#define MAX_PENDING 1024
+
+/* Log-linear histogram of durations, in nanoseconds */
+typedef struct _Histogram {
+	guint64 counts[HIST_BUCKETS];
+	guint64 total;
+	guint64 max;
+} Histogram;
+
+typedef enum {
+	TRACE_TRANSFORM,
+	TRACE_QUEUE,
+	TRACE_SINK
+} TraceKind;
+
+static const gchar *trace_kind_names[] = { "processing", "residency", "lateness" };
+
+/* Everything measured about one element */
+typedef struct _ElementTrace {
+	GstElement *element;
+	TraceKind kind;
+	GMutex lock;                    /* Protects everything below */
+	GPtrArray *outputs;             /* OutputTracker, one per source pad */
+	GstSegment segment;             /* Last segment seen on the sink pad, for sinks */
+	Histogram histogram;
+	guint64 late_buffers;           /* For sinks */
+} ElementTrace;
+
+/* One input buffer waiting for the output it contributes to */
+typedef struct _Pending {
+	GstClockTime pts;
+	GstClockTime arrival;
+} Pending;
+
+/* The inputs pending on one source pad of an element */
+typedef struct _OutputTracker {
+	ElementTrace *trace;
+	GQueue pending;
+} OutputTracker;
+
+/* Structure to contain all our information, so we can pass it around */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GMainLoop *loop;
+	GMutex traces_lock;
+	GPtrArray *traces;              /* ElementTrace, in the order elements were added */
+} CustomData;
+
+static gint num_buffers = -1;
+
+static GOptionEntry entries[] = {
+	{ "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers, "Number of buffers the source produces before EOS (default: no limit)", "N" },
+	{ NULL }
+};
+
+static guint histogram_index (guint64 ns) {
+	guint msb;
+
+	if (ns < HIST_SUB_BUCKETS)
+		return (guint) ns;
+	msb = g_bit_storage (ns) - 1;
+	return MIN ((msb - 3) * HIST_SUB_BUCKETS + ((ns >> (msb - 4)) & (HIST_SUB_BUCKETS - 1)), HIST_BUCKETS - 1);
+}
+
+/* Lowest value that falls into a bucket */
+static guint64 histogram_bucket_value (guint index) {
+	guint group = index / HIST_SUB_BUCKETS, sub = index % HIST_SUB_BUCKETS;
+
+	if (group == 0)
+		return index;
+	return ((guint64) (HIST_SUB_BUCKETS + sub)) << (group - 1);
+}
+
+static void histogram_add (Histogram *histogram, guint64 ns) {
+	histogram->counts[histogram_index (ns)]++;
+	histogram->total++;
+	histogram->max = MAX (histogram->max, ns);
+}
+
+static guint64 histogram_percentile (const Histogram *histogram, gdouble percentile) {
+	guint64 rank = (guint64) (histogram->total * percentile / 100.0), seen = 0;
+	guint i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += histogram->counts[i];
+		if (seen > rank)
+			return histogram_bucket_value (i);
+	}
+	return histogram->max;
+}
+
+/* Sink pad probe: remember when each input arrived, or measure the lateness for sinks */
+static GstPadProbeReturn sink_probe (GstPad *pad, GstPadProbeInfo *info, ElementTrace *trace) {
+	GstClockTime now = gst_util_get_timestamp ();
+	GstBuffer *buffer;
+	guint i;
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+		g_mutex_lock (&trace->lock);
+		if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+			gst_event_copy_segment (event, &trace->segment);
+		} else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+			/* Whatever was pending was flushed away */
+			for (i = 0; i < trace->outputs->len; i++)
+				g_queue_clear_full (&((OutputTracker *) g_ptr_array_index (trace->outputs, i))->pending, g_free);
+		}
+		g_mutex_unlock (&trace->lock);
+		return GST_PAD_PROBE_OK;
+	}
+
+	buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	if (!GST_BUFFER_PTS_IS_VALID (buffer))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock (&trace->lock);
+	if (trace->kind == TRACE_SINK) {
+		GstClock *clock = gst_element_get_clock (trace->element);
+
+		if (clock && trace->segment.format == GST_FORMAT_TIME) {
+			GstClockTime running_time = gst_segment_to_running_time (&trace->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+			GstClockTime clock_time = gst_clock_get_time (clock);
+			GstClockTime base_time = gst_element_get_base_time (trace->element);
+
+			if (GST_CLOCK_TIME_IS_VALID (running_time) && clock_time >= base_time) {
+				GstClockTime now_running = clock_time - base_time;
+
+				if (now_running > running_time) {
+					histogram_add (&trace->histogram, now_running - running_time);
+					trace->late_buffers++;
+				} else {
+					histogram_add (&trace->histogram, 0);
+				}
+			}
+		}
+		if (clock)
+			gst_object_unref (clock);
+	} else {
+		/* Every source pad (the tee has several) produces something from this input */
+		for (i = 0; i < trace->outputs->len; i++) {
+			OutputTracker *tracker = g_ptr_array_index (trace->outputs, i);
+			Pending *pending;
+
+			if (g_queue_get_length (&tracker->pending) >= MAX_PENDING)
+				g_free (g_queue_pop_head (&tracker->pending));
+			pending = g_new (Pending, 1);
+			pending->pts = GST_BUFFER_PTS (buffer);
+			pending->arrival = now;
+			g_queue_push_tail (&tracker->pending, pending);
+		}
+	}
+	g_mutex_unlock (&trace->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Source pad probe: match the output with the inputs it was produced from */
+static GstPadProbeReturn src_probe (GstPad *pad, GstPadProbeInfo *info, OutputTracker *tracker) {
+	GstClockTime now = gst_util_get_timestamp ();
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	GstClockTime end, arrival = GST_CLOCK_TIME_NONE;
+	Pending *pending;
+
+	if (!GST_BUFFER_PTS_IS_VALID (buffer))
+		return GST_PAD_PROBE_OK;
+	end = GST_BUFFER_PTS (buffer) + (GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) : 1);
+
+	g_mutex_lock (&tracker->trace->lock);
+	/* The most recent input that went into this output is the one whose processing we measure */
+	while ((pending = g_queue_peek_head (&tracker->pending)) && pending->pts < end) {
+		arrival = pending->arrival;
+		g_free (g_queue_pop_head (&tracker->pending));
+	}
+	if (GST_CLOCK_TIME_IS_VALID (arrival))
+		histogram_add (&tracker->trace->histogram, now - arrival);
+	g_mutex_unlock (&tracker->trace->lock);
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean trace_pad (GstElement *element, GstPad *pad, ElementTrace *trace) {
+	if (GST_PAD_IS_SINK (pad)) {
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+				(GstPadProbeCallback) sink_probe, trace, NULL);
+	} else {
+		OutputTracker *tracker = g_new0 (OutputTracker, 1);
+
+		tracker->trace = trace;
+		g_queue_init (&tracker->pending);
+		g_mutex_lock (&trace->lock);
+		g_ptr_array_add (trace->outputs, tracker);
+		g_mutex_unlock (&trace->lock);
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) src_probe, tracker, NULL);
+	}
+	return TRUE;
+}
+
+static void pad_added_cb (GstElement *element, GstPad *pad, ElementTrace *trace) {
+	trace_pad (element, pad, trace);
+}
+
+/* Starts tracing an element. Bins are skipped: their ghost pads only forward to the elements inside */
+static void trace_element (CustomData *data, GstElement *element) {
+	GstElementFactory *factory = gst_element_get_factory (element);
+	ElementTrace *trace;
+
+	if (GST_IS_BIN (element))
+		return;
+
+	trace = g_new0 (ElementTrace, 1);
+	trace->element = gst_object_ref (element);
+	g_mutex_init (&trace->lock);
+	trace->outputs = g_ptr_array_new ();
+	gst_segment_init (&trace->segment, GST_FORMAT_UNDEFINED);
+	if (GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK))
+		trace->kind = TRACE_SINK;
+	else if (factory && g_str_equal (GST_OBJECT_NAME (factory), "queue"))
+		trace->kind = TRACE_QUEUE;
+	else
+		trace->kind = TRACE_TRANSFORM;
+
+	g_mutex_lock (&data->traces_lock);
+	g_ptr_array_add (data->traces, trace);
+	g_mutex_unlock (&data->traces_lock);
+
+	gst_element_foreach_pad (element, (GstElementForeachPadFunc) trace_pad, trace);
+	g_signal_connect (element, "pad-added", G_CALLBACK (pad_added_cb), trace);
+}
+
+/* Elements created later, like the real sinks inside autoaudiosink and autovideosink */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	if (sub_bin != GST_BIN (data->pipeline))
+		trace_element (data, element);
+}
+
+/* Prints p50, p99 and max of every element */
+static gboolean dump_histograms (CustomData *data) {
+	guint i;
+
+	g_print ("\n%-24s %-10s %10s %12s %12s %12s\n", "element", "metric", "buffers", "p50 (us)", "p99 (us)", "max (us)");
+	g_mutex_lock (&data->traces_lock);
+	for (i = 0; i < data->traces->len; i++) {
+		ElementTrace *trace = g_ptr_array_index (data->traces, i);
+		Histogram histogram;
+		guint64 late;
+
+		g_mutex_lock (&trace->lock);
+		histogram = trace->histogram;
+		late = trace->late_buffers;
+		g_mutex_unlock (&trace->lock);
+
+		if (histogram.total == 0)
+			continue;
+		g_print ("%-24s %-10s %10" G_GUINT64_FORMAT " %12.1f %12.1f %12.1f", GST_ELEMENT_NAME (trace->element),
+				trace_kind_names[trace->kind], histogram.total, histogram_percentile (&histogram, 50) / 1e3,
+				histogram_percentile (&histogram, 99) / 1e3, histogram.max / 1e3);
+		if (trace->kind == TRACE_SINK)
+			g_print ("  (%" G_GUINT64_FORMAT " late)", late);
+		g_print ("\n");
+	}
+	g_mutex_unlock (&data->traces_lock);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			dump_histograms (data);
+			g_main_loop_quit (data->loop);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+static void element_trace_free (ElementTrace *trace) {
+	guint i;
+
+	for (i = 0; i < trace->outputs->len; i++) {
+		OutputTracker *tracker = g_ptr_array_index (trace->outputs, i);
+		g_queue_clear_full (&tracker->pending, g_free);
+		g_free (tracker);
+	}
+	g_ptr_array_unref (trace->outputs);
+	g_mutex_clear (&trace->lock);
+	gst_object_unref (trace->element);
+	g_free (trace);
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstElement *audio_source, *tee, *audio_queue, *audio_convert, *audio_resample, *audio_sink;
+	GstElement *video_queue, *visual, *video_convert, *video_sink;
+	GstPad *tee_audio_pad, *tee_video_pad;
+	GstPad *queue_audio_pad, *queue_video_pad;
+	GstBus *bus;
+	GstIterator *it;
+	GValue item = G_VALUE_INIT;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- per-element latency histograms on the tee graph");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.traces_lock);
+	data.traces = g_ptr_array_new_with_free_func ((GDestroyNotify) element_trace_free);
+
+	/* Create the elements, as in basic-tutorial-7.c */
+	audio_source = gst_element_factory_make ("audiotestsrc", "audio_source");
+	tee = gst_element_factory_make ("tee", "tee");
+	audio_queue = gst_element_factory_make ("queue", "audio_queue");
+	audio_convert = gst_element_factory_make ("audioconvert", "audio_convert");
+	audio_resample = gst_element_factory_make ("audioresample", "audio_resample");
+	audio_sink = gst_element_factory_make ("autoaudiosink", "audio_sink");
+	video_queue = gst_element_factory_make ("queue", "video_queue");
+	visual = gst_element_factory_make ("wavescope", "visual");
+	video_convert = gst_element_factory_make ("videoconvert", "csp");
+	video_sink = gst_element_factory_make ("autovideosink", "video_sink");
+	data.pipeline = gst_pipeline_new ("test-pipeline");
+
+	if (!data.pipeline || !audio_source || !tee || !audio_queue || !audio_convert || !audio_resample || !audio_sink ||
+			!video_queue || !visual || !video_convert || !video_sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+
+	/* Configure elements */
+	g_object_set (audio_source, "freq", 215.0f, "num-buffers", num_buffers, NULL);
+	g_object_set (visual, "shader", 0, "style", 1, NULL);
+
+	/* Link all elements that can be automatically linked because they have "Always" pads */
+	gst_bin_add_many (GST_BIN (data.pipeline), audio_source, tee, audio_queue, audio_convert, audio_resample, audio_sink,
+			video_queue, visual, video_convert, video_sink, NULL);
+	if (gst_element_link_many (audio_source, tee, NULL) != TRUE ||
+			gst_element_link_many (audio_queue, audio_convert, audio_resample, audio_sink, NULL) != TRUE ||
+			gst_element_link_many (video_queue, visual, video_convert, video_sink, NULL) != TRUE) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Manually link the Tee, which has "Request" pads */
+	tee_audio_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_audio_pad = gst_element_get_static_pad (audio_queue, "sink");
+	tee_video_pad = gst_element_request_pad_simple (tee, "src_%u");
+	queue_video_pad = gst_element_get_static_pad (video_queue, "sink");
+	if (gst_pad_link (tee_audio_pad, queue_audio_pad) != GST_PAD_LINK_OK ||
+			gst_pad_link (tee_video_pad, queue_video_pad) != GST_PAD_LINK_OK) {
+		g_printerr ("Tee could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	gst_object_unref (queue_audio_pad);
+	gst_object_unref (queue_video_pad);
+
+	/* Trace every element we created, and the ones the automatic sinks will create inside themselves */
+	it = gst_bin_iterate_elements (GST_BIN (data.pipeline));
+	while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+		trace_element (&data, g_value_get_object (&item));
+		g_value_reset (&item);
+	}
+	g_value_unset (&item);
+	gst_iterator_free (it);
+	g_signal_connect (data.pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), &data);
+
+	/* Dump on demand */
+	data.loop = g_main_loop_new (NULL, FALSE);
+	g_unix_signal_add (SIGUSR1, (GSourceFunc) dump_histograms, &data);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+
+	/* Start playing the pipeline */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	g_main_loop_run (data.loop);
+
+	/* Release the request pads from the Tee, and unref them */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_element_release_request_pad (tee, tee_audio_pad);
+	gst_element_release_request_pad (tee, tee_video_pad);
+	gst_object_unref (tee_audio_pad);
+	gst_object_unref (tee_video_pad);
+
+	/* Free resources */
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	g_ptr_array_unref (data.traces);
+	g_mutex_clear (&data.traces_lock);
+	g_main_loop_unref (data.loop);
+	return 0;
+}
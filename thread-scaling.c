@@ -0,0 +1,306 @@
+/* Thread scaling : one thread count for every decoder and converter of a pipeline
+ *
+ * Goal
+ *
+ * playbin (basic-tutorial-1.c, 4 and 5) and the videoconvert of basic-tutorial-7.c run with their default threading,
+ * so a 4K stream keeps one core busy while the others wait. Elements that can use more threads expose it through a
+ * property, but not always the same one:
+ *   - "max-threads" on the libav decoders (avdec_*),
+ *   - "n-threads" on videoconvert, videoscale and dav1ddec,
+ *   - "threads" on vp8dec, vp9dec and several encoders.
+ *
+ * This program applies one --threads setting to every element that has one of these properties, clamped to the range
+ * the property allows. It catches the elements playbin and decodebin plug later through playbin's "element-setup"
+ * signal, and through "deep-element-added" for other pipelines.
+ *
+ * --report measures the frames per second at 1, 2, 4, 8 and 16 threads for two cases:
+ *   - decode : playbin with fakesinks (sync=false) on --uri, for at most --seconds;
+ *   - convert: 4K videotestsrc -> videoconvert (BGRx to I420) -> fakesink, the conversion of basic-tutorial-7.c.
+ *
+ * Usage
+ *   thread-scaling [--uri=URI] [--threads=N]
+ *   thread-scaling --report [--uri=URI] [--seconds=N]
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+
+/* The properties that set how many threads an element uses */
+static const gchar *thread_properties[] = { "max-threads", "n-threads", "threads" };
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	gint threads;
+	gboolean verbose;               /* Print every property we set */
+	gint frames;                    /* Atomic, frames that reached the video sink */
+} CustomData;
+
+static gchar *uri = NULL;
+static gint threads = 0;
+static gboolean report = FALSE;
+static gint seconds = 20;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play (default: sintel trailer)", "URI" },
+	{ "threads", 't', 0, G_OPTION_ARG_INT, &threads, "Threads per element (default: number of processors)", "N" },
+	{ "report", 'r', 0, G_OPTION_ARG_NONE, &report, "Measure frames/s at 1, 2, 4, 8 and 16 threads", NULL },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Longest a decode run may take (default: 20)", "N" },
+	{ NULL }
+};
+
+/* Sets every thread count property of the element, clamped to what the property accepts */
+static void apply_threads (GstElement *element, CustomData *data) {
+	GObjectClass *klass = G_OBJECT_GET_CLASS (element);
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (thread_properties); i++) {
+		GParamSpec *pspec = g_object_class_find_property (klass, thread_properties[i]);
+		gint64 value = data->threads;
+
+		if (!pspec || !(pspec->flags & G_PARAM_WRITABLE) || (pspec->flags & G_PARAM_CONSTRUCT_ONLY))
+			continue;
+
+		if (G_IS_PARAM_SPEC_INT (pspec)) {
+			value = CLAMP (value, G_PARAM_SPEC_INT (pspec)->minimum, G_PARAM_SPEC_INT (pspec)->maximum);
+			g_object_set (element, thread_properties[i], (gint) value, NULL);
+		} else if (G_IS_PARAM_SPEC_UINT (pspec)) {
+			value = CLAMP (value, (gint64) G_PARAM_SPEC_UINT (pspec)->minimum, (gint64) G_PARAM_SPEC_UINT (pspec)->maximum);
+			g_object_set (element, thread_properties[i], (guint) value, NULL);
+		} else {
+			continue;
+		}
+		if (data->verbose)
+			g_print ("%s: %s = %" G_GINT64_FORMAT "\n", GST_ELEMENT_NAME (element), thread_properties[i], value);
+	}
+}
+
+/* playbin calls this for every element it creates, before it starts using it */
+static void element_setup_cb (GstElement *playbin, GstElement *element, CustomData *data) {
+	apply_threads (element, data);
+}
+
+/* Other pipelines: every element added anywhere below the pipeline */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, CustomData *data) {
+	apply_threads (element, data);
+}
+
+/* Applies the setting to everything already in the pipeline and to everything added later */
+static void spread_threads (CustomData *data) {
+	GstIterator *it;
+	GValue item = G_VALUE_INIT;
+
+	it = gst_bin_iterate_recurse (GST_BIN (data->pipeline));
+	while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+		apply_threads (g_value_get_object (&item), data);
+		g_value_reset (&item);
+	}
+	g_value_unset (&item);
+	gst_iterator_free (it);
+
+	if (g_signal_lookup ("element-setup", G_OBJECT_TYPE (data->pipeline)))
+		g_signal_connect (data->pipeline, "element-setup", G_CALLBACK (element_setup_cb), data);
+	else
+		g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), data);
+}
+
+static GstPadProbeReturn count_frames_probe (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+	g_atomic_int_inc (&data->frames);
+	return GST_PAD_PROBE_OK;
+}
+
+/* A fakesink, counting its buffers into data unless data is NULL */
+static GstElement *make_counting_sink (CustomData *data, gboolean sync) {
+	GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+	GstPad *pad;
+
+	g_object_set (sink, "sync", sync, NULL);
+	if (data) {
+		pad = gst_element_get_static_pad (sink, "sink");
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_frames_probe, data, NULL);
+		gst_object_unref (pad);
+	}
+	return sink;
+}
+
+/* Runs the pipeline until EOS, an error, or the time limit. Returns the frames per second, or a negative value */
+static gdouble run_pipeline (CustomData *data, GstClockTime limit) {
+	GstBus *bus = gst_element_get_bus (data->pipeline);
+	GstClockTime start, elapsed;
+	GstMessage *msg;
+	gdouble fps = -1;
+
+	g_atomic_int_set (&data->frames, 0);
+	start = gst_util_get_timestamp ();
+	if (gst_element_set_state (data->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (bus);
+		return -1;
+	}
+
+	msg = gst_bus_timed_pop_filtered (bus, limit, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	elapsed = gst_util_get_timestamp () - start;
+	if (msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		GError *err;
+		gchar *debug_info;
+
+		gst_message_parse_error (msg, &err, &debug_info);
+		g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+		g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+		g_clear_error (&err);
+		g_free (debug_info);
+	} else {
+		/* EOS, or the time limit: both give a valid rate */
+		fps = g_atomic_int_get (&data->frames) / ((gdouble) elapsed / GST_SECOND);
+	}
+
+	if (msg)
+		gst_message_unref (msg);
+	gst_object_unref (bus);
+	gst_element_set_state (data->pipeline, GST_STATE_NULL);
+	return fps;
+}
+
+/* playbin decoding as fast as it can */
+static gdouble run_decode (CustomData *data) {
+	gdouble fps;
+
+	data->pipeline = gst_element_factory_make ("playbin", "playbin");
+	if (!data->pipeline) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+	g_object_set (data->pipeline, "uri", uri ? uri : DEFAULT_URI, "video-sink", make_counting_sink (data, FALSE),
+			"audio-sink", make_counting_sink (NULL, FALSE), NULL);
+	spread_threads (data);
+	fps = run_pipeline (data, seconds * GST_SECOND);
+	gst_object_unref (data->pipeline);
+	return fps;
+}
+
+/* The videoconvert of basic-tutorial-7.c on 4K frames */
+static gdouble run_convert (CustomData *data) {
+	GError *error = NULL;
+	GstElement *sink;
+	GstPad *pad;
+	gdouble fps;
+
+	data->pipeline = gst_parse_launch ("videotestsrc num-buffers=300 ! video/x-raw,format=BGRx,width=3840,height=2160 ! "
+			"videoconvert name=csp ! video/x-raw,format=I420 ! fakesink name=sink sync=false", &error);
+	if (!data->pipeline) {
+		g_printerr ("Could not build the pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	sink = gst_bin_get_by_name (GST_BIN (data->pipeline), "sink");
+	pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_frames_probe, data, NULL);
+	gst_object_unref (pad);
+	gst_object_unref (sink);
+	spread_threads (data);
+	fps = run_pipeline (data, GST_CLOCK_TIME_NONE);
+	gst_object_unref (data->pipeline);
+	return fps;
+}
+
+static int run_report (void) {
+	static const gint thread_counts[] = { 1, 2, 4, 8, 16 };
+	gdouble decode_base = 0, convert_base = 0;
+	CustomData data;
+	guint i;
+
+	memset (&data, 0, sizeof (data));
+	g_print ("%8s %14s %8s %14s %8s\n", "threads", "decode fps", "scale", "convert fps", "scale");
+	for (i = 0; i < G_N_ELEMENTS (thread_counts); i++) {
+		gdouble decode, convert;
+
+		data.threads = thread_counts[i];
+		decode = run_decode (&data);
+		convert = run_convert (&data);
+		if (decode < 0 || convert < 0)
+			return -1;
+		if (i == 0) {
+			decode_base = decode;
+			convert_base = convert;
+		}
+		g_print ("%8d %14.1f %7.2fx %14.1f %7.2fx\n", thread_counts[i], decode, decode_base > 0 ? decode / decode_base : 0.0,
+				convert, convert_base > 0 ? convert / convert_base : 0.0);
+	}
+	return 0;
+}
+
+/* Plays the URI with playbin, as basic-tutorial-1.c, with the thread setting applied */
+static int run_playback (void) {
+	CustomData data;
+	GstBus *bus;
+	GstMessage *msg;
+
+	memset (&data, 0, sizeof (data));
+	data.threads = threads;
+	data.verbose = TRUE;
+	data.pipeline = gst_element_factory_make ("playbin", "playbin");
+	if (!data.pipeline) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+	g_object_set (data.pipeline, "uri", uri ? uri : DEFAULT_URI, NULL);
+	spread_threads (&data);
+
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Wait until error or EOS */
+	bus = gst_element_get_bus (data.pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		GError *err;
+		gchar *debug_info;
+
+		gst_message_parse_error (msg, &err, &debug_info);
+		g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+		g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+		g_clear_error (&err);
+		g_free (debug_info);
+	}
+
+	gst_message_unref (msg);
+	gst_object_unref (bus);
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	gst_object_unref (data.pipeline);
+	return 0;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	int result;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- spread one thread count over every decoder and converter");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (threads <= 0)
+		threads = g_get_num_processors ();
+	if (seconds <= 0) {
+		g_printerr ("The time limit must be positive.\n");
+		return -1;
+	}
+
+	result = report ? run_report () : run_playback ();
+	g_free (uri);
+	return result;
+}
@@ -0,0 +1,292 @@
+/* Throughput benchmark : headless runs of the tutorial pipelines
+ *
+ * Goal
+ *
+ * The tutorials only prove that a pipeline works by showing a window or playing a sound.
+ * This program runs the same graphs headless so they can be timed on a render node:
+ *
+ *   - video : videotestsrc -> sink                                   (basic-tutorial-2.c)
+ *   - audio : audiotestsrc -> sink                                   (basic-tutorial-6.c)
+ *   - tee   : audiotestsrc -> tee -> queue -> audioconvert -> audioresample -> sink
+ *                                 -> queue -> wavescope -> videoconvert -> sink  (basic-tutorial-7.c)
+ *
+ * The display and audio sinks are replaced by fakesinks with sync=false, so the pipeline runs as fast
+ * as the CPU allows instead of at the clock rate. Every source produces a fixed number of buffers
+ * (num-buffers) and a capsfilter pins the caps, so two runs on the same machine are comparable.
+ *
+ * Buffers are counted with a pad probe on each sink pad (cheaper than the fakesink "handoff" signal).
+ * Each case runs in its own child process, because the peak RSS reported by getrusage() is a
+ * per-process high-water mark.
+ *
+ * Usage
+ *   throughput-benchmark [--buffers=N] [--case=video|audio|tee] [--output=results.csv]
+ *
+ * One CSV row is appended per sink:
+ *   case,sink,buffers,frames,wall_s,buffers_per_s,frames_per_s,cpu_user_s,cpu_sys_s,peak_rss_kb
+ * "frames" are video frames on video sinks and audio frames (samples per channel) on audio sinks.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+/* The graphs to measure. "%d" is replaced by the number of buffers to produce */
+typedef struct _BenchCase {
+	const gchar *name;
+	const gchar *description;
+	const gchar *sinks[3];          /* Names of the fakesinks to count on, NULL terminated */
+} BenchCase;
+
+static const BenchCase bench_cases[] = {
+	{ "video",
+		"videotestsrc name=source pattern=0 num-buffers=%d "
+		"! video/x-raw,format=I420,width=1280,height=720,framerate=30/1 "
+		"! fakesink name=video_sink sync=false",
+		{ "video_sink", NULL } },
+	{ "audio",
+		"audiotestsrc name=source num-buffers=%d "
+		"! audio/x-raw,format=S16LE,rate=44100,channels=2,layout=interleaved "
+		"! fakesink name=audio_sink sync=false",
+		{ "audio_sink", NULL } },
+	{ "tee",
+		"audiotestsrc name=source freq=215 num-buffers=%d "
+		"! audio/x-raw,format=S16LE,rate=44100,channels=2,layout=interleaved ! tee name=tee "
+		"tee. ! queue name=audio_queue ! audioconvert ! audioresample ! fakesink name=audio_sink sync=false "
+		"tee. ! queue name=video_queue ! wavescope shader=0 style=1 "
+		"! video/x-raw,width=640,height=480,framerate=30/1 ! videoconvert ! fakesink name=video_sink sync=false",
+		{ "audio_sink", "video_sink", NULL } },
+};
+
+/* Per-sink counters, updated from the streaming threads */
+typedef struct _SinkCounter {
+	const gchar *name;
+	gboolean is_video;
+	gint bpf;                       /* Bytes per audio frame, 0 until the caps are known */
+	guint64 buffers;
+	guint64 frames;
+} SinkCounter;
+
+static gint num_buffers = 2000;
+static gchar *case_name = NULL;
+static gchar *output_path = NULL;
+
+static GOptionEntry entries[] = {
+	{ "buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers, "Number of buffers each source produces (default 2000)", "N" },
+	{ "case", 'c', 0, G_OPTION_ARG_STRING, &case_name, "Run only this case: video, audio or tee (default: all)", "NAME" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path, "CSV file to append results to (default: benchmark.csv)", "FILE" },
+	{ NULL }
+};
+
+/* Counts buffers (and frames) as they reach a sink */
+static GstPadProbeReturn count_probe (GstPad *pad, GstPadProbeInfo *info, SinkCounter *counter) {
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+		/* Remember the caps so audio buffers can be converted to frames */
+		if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+			GstStructure *structure;
+
+			gst_event_parse_caps (event, &caps);
+			structure = gst_caps_get_structure (caps, 0);
+			counter->is_video = g_str_has_prefix (gst_structure_get_name (structure), "video/");
+			if (!counter->is_video) {
+				GstAudioInfo audio_info;
+				if (gst_audio_info_from_caps (&audio_info, caps))
+					counter->bpf = GST_AUDIO_INFO_BPF (&audio_info);
+			}
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+		counter->buffers++;
+		if (counter->is_video)
+			counter->frames++;
+		else if (counter->bpf > 0)
+			counter->frames += gst_buffer_get_size (buffer) / counter->bpf;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static gdouble timeval_to_seconds (const struct timeval *tv) {
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Runs one case in this process and appends its rows to the CSV file */
+static int run_case (const BenchCase *bench) {
+	GstElement *pipeline;
+	GstBus *bus;
+	GstMessage *msg;
+	GError *error = NULL;
+	gchar *description;
+	SinkCounter counters[G_N_ELEMENTS (bench->sinks)];
+	struct rusage usage_start, usage_end;
+	gint64 wall_start, wall_end;
+	gdouble wall, cpu_user, cpu_sys;
+	gboolean failed = FALSE;
+	FILE *csv;
+	guint i, n_sinks = 0;
+
+	/* Build the pipeline */
+	description = g_strdup_printf (bench->description, num_buffers);
+	pipeline = gst_parse_launch (description, &error);
+	g_free (description);
+	if (!pipeline) {
+		g_printerr ("Could not build pipeline for case '%s': %s\n", bench->name, error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+
+	/* Attach a counter to every sink of this case */
+	memset (counters, 0, sizeof (counters));
+	for (i = 0; bench->sinks[i] != NULL; i++) {
+		GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), bench->sinks[i]);
+		GstPad *pad = gst_element_get_static_pad (sink, "sink");
+
+		counters[i].name = bench->sinks[i];
+		gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+				(GstPadProbeCallback) count_probe, &counters[i], NULL);
+		gst_object_unref (pad);
+		gst_object_unref (sink);
+		n_sinks++;
+	}
+
+	/* Run until EOS, measuring wall clock and CPU time around it */
+	getrusage (RUSAGE_SELF, &usage_start);
+	wall_start = g_get_monotonic_time ();
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (pipeline);
+		return -1;
+	}
+
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	wall_end = g_get_monotonic_time ();
+	getrusage (RUSAGE_SELF, &usage_end);
+
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		gchar *debug_info;
+
+		gst_message_parse_error (msg, &error, &debug_info);
+		g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), error->message);
+		g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+		g_clear_error (&error);
+		g_free (debug_info);
+		failed = TRUE;
+	}
+	gst_message_unref (msg);
+	gst_object_unref (bus);
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+
+	if (failed)
+		return -1;
+
+	wall = (wall_end - wall_start) / 1e6;
+	cpu_user = timeval_to_seconds (&usage_end.ru_utime) - timeval_to_seconds (&usage_start.ru_utime);
+	cpu_sys = timeval_to_seconds (&usage_end.ru_stime) - timeval_to_seconds (&usage_start.ru_stime);
+
+	/* Append the results, writing the header if the file is new */
+	csv = fopen (output_path, "a");
+	if (!csv) {
+		g_printerr ("Could not open '%s' for writing.\n", output_path);
+		return -1;
+	}
+	fseek (csv, 0, SEEK_END);
+	if (ftell (csv) == 0)
+		fprintf (csv, "case,sink,buffers,frames,wall_s,buffers_per_s,frames_per_s,cpu_user_s,cpu_sys_s,peak_rss_kb\n");
+
+	for (i = 0; i < n_sinks; i++) {
+		fprintf (csv, "%s,%s,%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%.6f,%.1f,%.1f,%.6f,%.6f,%ld\n",
+				bench->name, counters[i].name, counters[i].buffers, counters[i].frames, wall,
+				counters[i].buffers / wall, counters[i].frames / wall, cpu_user, cpu_sys, usage_end.ru_maxrss);
+		g_print ("%-6s %-11s %8" G_GUINT64_FORMAT " buffers in %.3f s: %10.1f buffers/s, %12.1f frames/s\n",
+				bench->name, counters[i].name, counters[i].buffers, wall,
+				counters[i].buffers / wall, counters[i].frames / wall);
+	}
+	fclose (csv);
+	return 0;
+}
+
+/* Runs every case in a fresh child process, so each one gets its own peak RSS */
+static int run_all_cases (const gchar *self) {
+	gchar *buffers_arg = g_strdup_printf ("--buffers=%d", num_buffers);
+	gchar *output_arg = g_strdup_printf ("--output=%s", output_path);
+	int result = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (bench_cases); i++) {
+		gchar *case_arg = g_strdup_printf ("--case=%s", bench_cases[i].name);
+		gchar *child_argv[] = { (gchar *) self, case_arg, buffers_arg, output_arg, NULL };
+		GError *error = NULL;
+		gint status;
+
+		if (!g_spawn_sync (NULL, child_argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_CHILD_INHERITS_STDIN,
+					NULL, NULL, NULL, NULL, &status, &error)) {
+			g_printerr ("Could not start case '%s': %s\n", bench_cases[i].name, error->message);
+			g_clear_error (&error);
+			result = -1;
+		} else if (!g_spawn_check_wait_status (status, &error)) {
+			g_printerr ("Case '%s' failed: %s\n", bench_cases[i].name, error->message);
+			g_clear_error (&error);
+			result = -1;
+		}
+		g_free (case_arg);
+	}
+
+	g_free (buffers_arg);
+	g_free (output_arg);
+	return result;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *self = g_strdup (argv[0]);
+	int result = -1;
+	guint i;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- headless throughput benchmark of the tutorial pipelines");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (num_buffers <= 0) {
+		g_printerr ("The number of buffers must be positive.\n");
+		return -1;
+	}
+	if (!output_path)
+		output_path = g_strdup ("benchmark.csv");
+
+	if (!case_name) {
+		result = run_all_cases (self);
+	} else {
+		for (i = 0; i < G_N_ELEMENTS (bench_cases); i++) {
+			if (g_strcmp0 (case_name, bench_cases[i].name) == 0)
+				break;
+		}
+		if (i < G_N_ELEMENTS (bench_cases))
+			result = run_case (&bench_cases[i]);
+		else
+			g_printerr ("Unknown case '%s'.\n", case_name);
+	}
+
+	g_free (self);
+	g_free (case_name);
+	g_free (output_path);
+	return result;
+}
@@ -0,0 +1,402 @@
+/* Video tap batch : decoded frames grouped into batches for analytics
+ *
+ * Goal
+ *
+ * The pad_added_handler of basic-tutorial-3.c only links audio/x-raw pads and ignores the video. This program keeps
+ * that audio branch and taps the decoded video into an appsink for our inference workers:
+ *
+ *   uridecodebin -> audioconvert -> audioresample -> autoaudiosink
+ *                -> videoscale -> videoconvert -> capsfilter (WIDTHxHEIGHT, RGB or planar RGBP) -> appsink
+ *
+ * The appsink callback does not copy anything: it only queues a reference to the sample. A batching thread takes
+ * the samples, and as soon as it has --batch-size frames, or the first frame of the batch has waited --max-wait ms,
+ * it maps the frames and copies each one, once, into one contiguous batch buffer (N x H x W x 3, or N x 3 x H x W
+ * for planar RGB). The batch goes to a worker thread that stands in for the inference (--infer-ms per batch).
+ *
+ * A larger batch keeps the GPU busier, a shorter wait keeps the latency down. To show the trade-off, it prints every
+ * second:
+ *   - frames tapped, batches, average batch fill and the average wait of a frame in its batch;
+ *   - frames dropped because the batching thread fell behind (more than --max-pending frames queued);
+ *   - frames dropped because the worker was still busy with the previous batches.
+ *
+ * Usage
+ *   video-tap-batch [--uri=URI] [--batch-size=N] [--max-wait=MS] [--width=W] [--height=H] [--planar] [--infer-ms=MS]
+ *
+ * It also needs the app and video libraries: add gstreamer-app-1.0 and gstreamer-video-1.0 to the pkg-config line.
+ * The planar RGBP format needs GStreamer 1.20 or newer.
+ *
+ */
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#define DEFAULT_URI "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm"
+#define MAX_PENDING_BATCHES 2
+
+/* One batch of frames, in one contiguous buffer */
+typedef struct _Batch {
+	GstBuffer *buffer;
+	guint frames;
+	GstClockTime first_arrival;     /* When the oldest frame of the batch was tapped */
+} Batch;
+
+/* A tapped frame waiting for its batch */
+typedef struct _TappedFrame {
+	GstSample *sample;
+	GstClockTime arrival;
+} TappedFrame;
+
+/* Structure to contain all our information, so we can pass it to callbacks */
+typedef struct _CustomData {
+	GstElement *pipeline;
+	GstElement *source;
+	GstElement *audio_convert;
+	GstElement *video_scale;
+	GMainLoop *loop;
+
+	GAsyncQueue *frames;            /* TappedFrame, from the appsink to the batching thread */
+	GAsyncQueue *batches;           /* Batch, from the batching thread to the worker */
+	GThread *batcher;
+	GThread *worker;
+	gint stop;                      /* Atomic, tells the threads to finish */
+
+	/* Counters */
+	GMutex stats_lock;
+	guint64 tapped;
+	guint64 batched;                /* Frames that made it into a batch */
+	guint64 batch_count;
+	GstClockTime batch_wait;        /* Sum over batches of the wait of their first frame */
+	guint64 dropped_pending;
+	guint64 dropped_busy;
+} CustomData;
+
+static gchar *uri = NULL;
+static gint batch_size = 8;
+static gint max_wait = 100;
+static gint width = 224;
+static gint height = 224;
+static gboolean planar = FALSE;
+static gint infer_ms = 20;
+static gint max_pending = 32;
+
+static GOptionEntry entries[] = {
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play (default: sintel trailer)", "URI" },
+	{ "batch-size", 'b', 0, G_OPTION_ARG_INT, &batch_size, "Frames per batch (default: 8)", "N" },
+	{ "max-wait", 'w', 0, G_OPTION_ARG_INT, &max_wait, "Longest a frame waits for its batch to fill (default: 100)", "MS" },
+	{ "width", 'W', 0, G_OPTION_ARG_INT, &width, "Width of the batched frames (default: 224)", "W" },
+	{ "height", 'H', 0, G_OPTION_ARG_INT, &height, "Height of the batched frames (default: 224)", "H" },
+	{ "planar", 'p', 0, G_OPTION_ARG_NONE, &planar, "Planar RGB (N x 3 x H x W) instead of packed RGB", NULL },
+	{ "infer-ms", 'i', 0, G_OPTION_ARG_INT, &infer_ms, "Simulated inference time per batch (default: 20)", "MS" },
+	{ "max-pending", 'm', 0, G_OPTION_ARG_INT, &max_pending, "Frames queued for batching before new ones are dropped (default: 32)", "N" },
+	{ NULL }
+};
+
+static void tapped_frame_free (TappedFrame *frame) {
+	gst_sample_unref (frame->sample);
+	g_free (frame);
+}
+
+static void batch_free (Batch *batch) {
+	gst_buffer_unref (batch->buffer);
+	g_free (batch);
+}
+
+/* Called from the streaming thread: keep a reference, never copy or wait here */
+static GstFlowReturn new_sample_cb (GstAppSink *sink, CustomData *data) {
+	GstSample *sample = gst_app_sink_pull_sample (sink);
+	gboolean dropped = FALSE;
+
+	if (!sample)
+		return GST_FLOW_EOS;
+
+	if (g_async_queue_length (data->frames) >= max_pending) {
+		gst_sample_unref (sample);
+		dropped = TRUE;
+	} else {
+		TappedFrame *frame = g_new (TappedFrame, 1);
+
+		frame->sample = sample;
+		frame->arrival = gst_util_get_timestamp ();
+		g_async_queue_push (data->frames, frame);
+	}
+
+	g_mutex_lock (&data->stats_lock);
+	data->tapped++;
+	if (dropped)
+		data->dropped_pending++;
+	g_mutex_unlock (&data->stats_lock);
+	return GST_FLOW_OK;
+}
+
+/* Copies one frame into slot "index" of the batch, row by row because the frame rows may be padded */
+static void copy_frame (GstSample *sample, guint8 *batch, guint index) {
+	GstVideoInfo info;
+	GstVideoFrame frame;
+	gsize plane_size = (gsize) width * height;
+	guint plane, row;
+
+	if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) ||
+			!gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample), GST_MAP_READ))
+		return;
+
+	if (planar) {
+		guint8 *dst = batch + index * 3 * plane_size;
+
+		for (plane = 0; plane < 3; plane++)
+			for (row = 0; row < (guint) height; row++)
+				memcpy (dst + plane * plane_size + row * width,
+						(guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame, plane) + row * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, plane), width);
+	} else {
+		guint8 *dst = batch + index * 3 * plane_size;
+
+		for (row = 0; row < (guint) height; row++)
+			memcpy (dst + row * width * 3, (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame, 0) + row * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0),
+					width * 3);
+	}
+	gst_video_frame_unmap (&frame);
+}
+
+/* Sends a batch of frames to the worker, or drops it if the worker is still busy */
+static void emit_batch (CustomData *data, GPtrArray *pending) {
+	Batch *batch;
+	GstMapInfo map;
+	GstClockTime now = gst_util_get_timestamp ();
+	guint i;
+
+	if (pending->len == 0)
+		return;
+
+	if (g_async_queue_length (data->batches) >= MAX_PENDING_BATCHES) {
+		g_mutex_lock (&data->stats_lock);
+		data->dropped_busy += pending->len;
+		g_mutex_unlock (&data->stats_lock);
+		g_ptr_array_set_size (pending, 0);
+		return;
+	}
+
+	batch = g_new (Batch, 1);
+	batch->frames = pending->len;
+	batch->first_arrival = ((TappedFrame *) g_ptr_array_index (pending, 0))->arrival;
+	batch->buffer = gst_buffer_new_allocate (NULL, (gsize) batch_size * 3 * width * height, NULL);
+	gst_buffer_map (batch->buffer, &map, GST_MAP_WRITE);
+	for (i = 0; i < pending->len; i++)
+		copy_frame (((TappedFrame *) g_ptr_array_index (pending, i))->sample, map.data, i);
+	gst_buffer_unmap (batch->buffer, &map);
+	gst_buffer_set_size (batch->buffer, (gsize) batch->frames * 3 * width * height);
+
+	g_mutex_lock (&data->stats_lock);
+	data->batched += batch->frames;
+	data->batch_count++;
+	data->batch_wait += now - batch->first_arrival;
+	g_mutex_unlock (&data->stats_lock);
+
+	g_async_queue_push (data->batches, batch);
+	g_ptr_array_set_size (pending, 0);
+}
+
+/* Collects frames until the batch is full or its first frame has waited long enough */
+static gpointer batcher_thread (CustomData *data) {
+	GPtrArray *pending = g_ptr_array_new_with_free_func ((GDestroyNotify) tapped_frame_free);
+	GstClockTime max_wait_time = max_wait * GST_MSECOND;
+
+	while (!g_atomic_int_get (&data->stop)) {
+		GstClockTime timeout = 100 * GST_MSECOND;
+		TappedFrame *frame;
+
+		if (pending->len > 0) {
+			GstClockTime waited = gst_util_get_timestamp () - ((TappedFrame *) g_ptr_array_index (pending, 0))->arrival;
+
+			if (waited >= max_wait_time) {
+				emit_batch (data, pending);
+				continue;
+			}
+			timeout = max_wait_time - waited;
+		}
+
+		frame = g_async_queue_timeout_pop (data->frames, timeout / GST_USECOND);
+		if (frame) {
+			g_ptr_array_add (pending, frame);
+			if (pending->len >= (guint) batch_size)
+				emit_batch (data, pending);
+		}
+	}
+
+	emit_batch (data, pending);
+	g_ptr_array_unref (pending);
+	return NULL;
+}
+
+/* Stands in for the inference workers */
+static gpointer worker_thread (CustomData *data) {
+	while (!g_atomic_int_get (&data->stop) || g_async_queue_length (data->batches) > 0) {
+		Batch *batch = g_async_queue_timeout_pop (data->batches, 100 * G_TIME_SPAN_MILLISECOND);
+
+		if (!batch)
+			continue;
+		g_usleep (infer_ms * G_TIME_SPAN_MILLISECOND);
+		batch_free (batch);
+	}
+	return NULL;
+}
+
+/* Handler for the pad-added signal: audio as in basic-tutorial-3.c, and the video tap */
+static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
+	GstCaps *new_pad_caps = gst_pad_get_current_caps (new_pad);
+	const gchar *new_pad_type = gst_structure_get_name (gst_caps_get_structure (new_pad_caps, 0));
+	GstElement *branch = NULL;
+	GstPad *sink_pad;
+
+	if (g_str_has_prefix (new_pad_type, "audio/x-raw"))
+		branch = data->audio_convert;
+	else if (g_str_has_prefix (new_pad_type, "video/x-raw"))
+		branch = data->video_scale;
+	gst_caps_unref (new_pad_caps);
+	if (!branch)
+		return;
+
+	sink_pad = gst_element_get_static_pad (branch, "sink");
+	if (!gst_pad_is_linked (sink_pad) && GST_PAD_LINK_FAILED (gst_pad_link (new_pad, sink_pad)))
+		g_print ("Type is '%s' but link failed.\n", new_pad_type);
+	gst_object_unref (sink_pad);
+}
+
+static gboolean print_stats (CustomData *data) {
+	g_mutex_lock (&data->stats_lock);
+	g_print ("tapped %" G_GUINT64_FORMAT ", batches %" G_GUINT64_FORMAT " (avg fill %.1f/%d, avg wait %.1f ms), dropped %"
+			G_GUINT64_FORMAT " pending + %" G_GUINT64_FORMAT " busy\n", data->tapped, data->batch_count,
+			data->batch_count ? (gdouble) data->batched / data->batch_count : 0.0, batch_size,
+			data->batch_count ? data->batch_wait / 1e6 / data->batch_count : 0.0, data->dropped_pending, data->dropped_busy);
+	g_mutex_unlock (&data->stats_lock);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (msg, &err, &debug_info);
+			g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+			g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+			g_clear_error (&err);
+			g_free (debug_info);
+			g_main_loop_quit (data->loop);
+			break;
+		case GST_MESSAGE_EOS:
+			g_print ("End-Of-Stream reached.\n");
+			g_main_loop_quit (data->loop);
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+int main (int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	CustomData data;
+	GstElement *audio_resample, *audio_sink, *video_convert, *video_filter, *video_sink;
+	GstAppSinkCallbacks callbacks = { NULL, };
+	GstCaps *caps;
+	GstBus *bus;
+
+	/* Parse our options together with the GStreamer ones. This also initializes GStreamer */
+	context = g_option_context_new ("- batched video tap for analytics");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse options: %s\n", error->message);
+		g_clear_error (&error);
+		return -1;
+	}
+	g_option_context_free (context);
+
+	if (batch_size <= 0 || max_wait < 0 || width <= 0 || height <= 0 || infer_ms < 0 || max_pending <= 0) {
+		g_printerr ("Invalid batch, size or time option.\n");
+		return -1;
+	}
+
+	memset (&data, 0, sizeof (data));
+	g_mutex_init (&data.stats_lock);
+	data.frames = g_async_queue_new_full ((GDestroyNotify) tapped_frame_free);
+	data.batches = g_async_queue_new_full ((GDestroyNotify) batch_free);
+
+	/* Create the elements */
+	data.source = gst_element_factory_make ("uridecodebin", "source");
+	data.audio_convert = gst_element_factory_make ("audioconvert", "convert");
+	audio_resample = gst_element_factory_make ("audioresample", "resample");
+	audio_sink = gst_element_factory_make ("autoaudiosink", "sink");
+	data.video_scale = gst_element_factory_make ("videoscale", "video_scale");
+	video_convert = gst_element_factory_make ("videoconvert", "video_convert");
+	video_filter = gst_element_factory_make ("capsfilter", "video_filter");
+	video_sink = gst_element_factory_make ("appsink", "video_tap");
+	data.pipeline = gst_pipeline_new ("test-pipeline");
+
+	if (!data.pipeline || !data.source || !data.audio_convert || !audio_resample || !audio_sink || !data.video_scale ||
+			!video_convert || !video_filter || !video_sink) {
+		g_printerr ("Not all elements could be created.\n");
+		return -1;
+	}
+
+	/* Build the pipeline. The source is linked in pad_added_handler */
+	gst_bin_add_many (GST_BIN (data.pipeline), data.source, data.audio_convert, audio_resample, audio_sink,
+			data.video_scale, video_convert, video_filter, video_sink, NULL);
+	if (!gst_element_link_many (data.audio_convert, audio_resample, audio_sink, NULL) ||
+			!gst_element_link_many (data.video_scale, video_convert, video_filter, video_sink, NULL)) {
+		g_printerr ("Elements could not be linked.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+
+	/* Scale and convert to what the model takes */
+	caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, planar ? "RGBP" : "RGB",
+			"width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+	g_object_set (video_filter, "caps", caps, NULL);
+	gst_caps_unref (caps);
+
+	/* The appsink hands every sample to new_sample_cb and follows the clock like a display would */
+	callbacks.new_sample = (GstFlowReturn (*) (GstAppSink *, gpointer)) new_sample_cb;
+	gst_app_sink_set_callbacks (GST_APP_SINK (video_sink), &callbacks, &data, NULL);
+	g_object_set (video_sink, "max-buffers", 1, "drop", FALSE, "sync", TRUE, NULL);
+
+	g_object_set (data.source, "uri", uri ? uri : DEFAULT_URI, NULL);
+	g_signal_connect (data.source, "pad-added", G_CALLBACK (pad_added_handler), &data);
+
+	data.batcher = g_thread_new ("batcher", (GThreadFunc) batcher_thread, &data);
+	data.worker = g_thread_new ("inference", (GThreadFunc) worker_thread, &data);
+	data.loop = g_main_loop_new (NULL, FALSE);
+	bus = gst_element_get_bus (data.pipeline);
+	gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &data);
+	g_timeout_add_seconds (1, (GSourceFunc) print_stats, &data);
+
+	/* Start playing */
+	if (gst_element_set_state (data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+		g_printerr ("Unable to set the pipeline to the playing state.\n");
+		gst_object_unref (data.pipeline);
+		return -1;
+	}
+	g_main_loop_run (data.loop);
+
+	/* Stop the pipeline first, so no new frame is tapped, then the threads */
+	gst_element_set_state (data.pipeline, GST_STATE_NULL);
+	g_atomic_int_set (&data.stop, 1);
+	g_thread_join (data.batcher);
+	g_thread_join (data.worker);
+	print_stats (&data);
+
+	/* Free resources */
+	gst_bus_remove_watch (bus);
+	gst_object_unref (bus);
+	gst_object_unref (data.pipeline);
+	g_async_queue_unref (data.frames);
+	g_async_queue_unref (data.batches);
+	g_main_loop_unref (data.loop);
+	g_mutex_clear (&data.stats_lock);
+	g_free (uri);
+	return 0;
+}